@@ -0,0 +1,206 @@
+#include "AutoEjectHashRing.hh"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <string>
+#include <vector>
+
+#include "NutcrackerConsistentHashRing.hh"
+
+using namespace std;
+
+
+
+AutoEjectHashRing::Policy::Policy() : failure_limit(2), latency_limit_usecs(0),
+    retry_interval_usecs(30000000) { }
+
+AutoEjectHashRing::HostHealth::HostHealth() : consecutive_failures(0),
+    ejected_until(0), num_ejections(0) { }
+
+
+
+AutoEjectHashRing::AutoEjectHashRing(const vector<Host>& hosts,
+    RingFactory factory, const Policy& policy) : ConsistentHashRing(hosts),
+    factory(factory), policy(policy), state(NULL),
+    host_health(new HostHealth[hosts.size()]) {
+  if (this->hosts.empty()) {
+    throw invalid_argument("no hosts in continuum");
+  }
+  if (this->policy.failure_limit == 0) {
+    throw invalid_argument("failure limit must be at least 1");
+  }
+
+  lock_guard<mutex> g(this->rebuild_lock);
+  this->rebuild_locked();
+}
+
+uint64_t AutoEjectHashRing::host_id_for_key(const void* key,
+    int64_t size) const {
+  const State* s = this->state.load(memory_order_acquire);
+  return s->live_host_id_to_host_id[s->ring->host_id_for_key(key, size)];
+}
+
+vector<uint64_t> AutoEjectHashRing::host_ids_for_key(const void* key,
+    int64_t size, size_t count) const {
+  const State* s = this->state.load(memory_order_acquire);
+
+  vector<uint64_t> ret;
+  auto* nutcracker_ring = dynamic_cast<const NutcrackerConsistentHashRing*>(
+      s->ring.get());
+  if (nutcracker_ring) {
+    ret = nutcracker_ring->host_ids_for_key(key, size, count);
+  } else {
+    size_t num_live_hosts = s->live_host_id_to_host_id.size();
+    if (count > num_live_hosts) {
+      count = num_live_hosts;
+    }
+    uint64_t live_host_id = s->ring->host_id_for_key(key, size);
+    for (size_t x = 0; x < count; x++) {
+      ret.emplace_back((live_host_id + x) % num_live_hosts);
+    }
+  }
+
+  for (auto& host_id : ret) {
+    host_id = s->live_host_id_to_host_id[host_id];
+  }
+  return ret;
+}
+
+const AutoEjectHashRing::Policy& AutoEjectHashRing::get_policy() const {
+  return this->policy;
+}
+
+void AutoEjectHashRing::report_success(size_t host_id, uint64_t latency_usecs) {
+  if (this->policy.latency_limit_usecs &&
+      (latency_usecs > this->policy.latency_limit_usecs)) {
+    this->report_failure(host_id);
+    return;
+  }
+
+  // avoid writing to the shared cache line if nothing changes
+  auto& health = this->host_health[host_id];
+  if (health.consecutive_failures.load(memory_order_relaxed)) {
+    health.consecutive_failures.store(0, memory_order_relaxed);
+  }
+}
+
+void AutoEjectHashRing::report_failure(size_t host_id) {
+  auto& health = this->host_health[host_id];
+  size_t failures = ++health.consecutive_failures;
+  if ((failures < this->policy.failure_limit) ||
+      health.ejected_until.load(memory_order_relaxed)) {
+    return;
+  }
+
+  lock_guard<mutex> g(this->rebuild_lock);
+
+  // another thread may have ejected it while we were waiting for the lock
+  if (health.ejected_until.load(memory_order_relaxed)) {
+    return;
+  }
+
+  // never eject the last live host - there would be nowhere to send the keys
+  if (this->state.load(memory_order_relaxed)->num_ejected_hosts >=
+      this->hosts.size() - 1) {
+    return;
+  }
+
+  health.ejected_until = now() + this->policy.retry_interval_usecs;
+  health.num_ejections++;
+  this->rebuild_locked();
+
+  const auto& host = this->hosts[host_id];
+  log(WARNING, "ejected backend %s:%d@%s after %zu consecutive failures",
+      host.host.c_str(), host.port, host.name.c_str(), failures);
+}
+
+size_t AutoEjectHashRing::reinstate_expired_hosts() {
+  // this is called periodically from every proxy thread, so check without the
+  // lock first
+  uint64_t t = now();
+  bool any_expired = false;
+  for (size_t x = 0; x < this->hosts.size(); x++) {
+    uint64_t ejected_until = this->host_health[x].ejected_until.load(
+        memory_order_relaxed);
+    if (ejected_until && (ejected_until <= t)) {
+      any_expired = true;
+      break;
+    }
+  }
+  if (!any_expired) {
+    return 0;
+  }
+
+  lock_guard<mutex> g(this->rebuild_lock);
+
+  size_t num_reinstated = 0;
+  for (size_t x = 0; x < this->hosts.size(); x++) {
+    auto& health = this->host_health[x];
+    uint64_t ejected_until = health.ejected_until.load(memory_order_relaxed);
+    if (!ejected_until || (ejected_until > t)) {
+      continue;
+    }
+
+    // the host is on probation until it succeeds again
+    health.consecutive_failures = this->policy.failure_limit - 1;
+    health.ejected_until = 0;
+    num_reinstated++;
+
+    const auto& host = this->hosts[x];
+    log(INFO, "reinstated backend %s:%d@%s", host.host.c_str(), host.port,
+        host.name.c_str());
+  }
+
+  if (num_reinstated) {
+    this->rebuild_locked();
+  }
+  return num_reinstated;
+}
+
+bool AutoEjectHashRing::is_ejected(size_t host_id) const {
+  return this->host_health[host_id].ejected_until.load(memory_order_relaxed);
+}
+
+size_t AutoEjectHashRing::num_ejected_hosts() const {
+  return this->state.load(memory_order_acquire)->num_ejected_hosts;
+}
+
+size_t AutoEjectHashRing::num_ejections(size_t host_id) const {
+  return this->host_health[host_id].num_ejections.load(memory_order_relaxed);
+}
+
+size_t AutoEjectHashRing::consecutive_failures(size_t host_id) const {
+  return this->host_health[host_id].consecutive_failures.load(
+      memory_order_relaxed);
+}
+
+void AutoEjectHashRing::rebuild_locked() {
+  string ejected_set(this->hosts.size(), '0');
+  for (size_t x = 0; x < this->hosts.size(); x++) {
+    if (this->host_health[x].ejected_until.load(memory_order_relaxed)) {
+      ejected_set[x] = '1';
+    }
+  }
+
+  auto state_it = this->ejected_set_to_state.find(ejected_set);
+  if (state_it == this->ejected_set_to_state.end()) {
+    unique_ptr<State> new_state(new State());
+    vector<Host> live_hosts;
+    for (size_t x = 0; x < this->hosts.size(); x++) {
+      if (ejected_set[x] == '0') {
+        live_hosts.emplace_back(this->hosts[x]);
+        new_state->live_host_id_to_host_id.emplace_back(x);
+      }
+    }
+    new_state->num_ejected_hosts = this->hosts.size() - live_hosts.size();
+    new_state->ring = this->factory(live_hosts);
+
+    state_it = this->ejected_set_to_state.emplace(ejected_set,
+        move(new_state)).first;
+  }
+
+  this->state.store(state_it->second.get(), memory_order_release);
+}
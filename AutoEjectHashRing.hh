@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <phosg/ConsistentHashRing.hh>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// this ring wraps another ConsistentHashRing implementation and allows hosts to
+// be temporarily removed from it, like twemproxy's auto_eject_hosts option.
+// when a host is ejected, the underlying ring is rebuilt without it (so its keys
+// are distributed over the remaining hosts exactly as the underlying ring would
+// distribute them) and the new ring replaces the old one atomically for all
+// threads. host IDs returned by this ring always refer to the original host
+// list, so callers don't need to know which hosts are currently ejected.
+//
+// host health is reported by the proxy threads. a host is ejected after
+// failure_limit consecutive failures; a response that takes longer than
+// latency_limit_usecs counts as a failure. ejected hosts are reinstated after
+// retry_interval_usecs, but only on probation - a single failure after that
+// will eject the host again.
+
+class AutoEjectHashRing : public ConsistentHashRing {
+public:
+  typedef std::function<std::shared_ptr<ConsistentHashRing>(
+      const std::vector<Host>&)> RingFactory;
+
+  struct Policy {
+    size_t failure_limit;
+    uint64_t latency_limit_usecs; // 0 = no limit
+    uint64_t retry_interval_usecs;
+
+    Policy();
+  };
+
+  AutoEjectHashRing() = delete;
+  AutoEjectHashRing(const std::vector<Host>& hosts, RingFactory factory,
+      const Policy& policy);
+  AutoEjectHashRing(const AutoEjectHashRing&) = delete;
+  AutoEjectHashRing(AutoEjectHashRing&&) = delete;
+  AutoEjectHashRing& operator=(const AutoEjectHashRing&) = delete;
+  AutoEjectHashRing& operator=(AutoEjectHashRing&&) = delete;
+  virtual ~AutoEjectHashRing() = default;
+
+  virtual uint64_t host_id_for_key(const void* key, int64_t size) const;
+
+  // returns the host for the key followed by its successors among the hosts
+  // that aren't ejected, up to count hosts in total. successors are taken
+  // from the underlying ring if it's a NutcrackerConsistentHashRing, or are
+  // the next hosts in order otherwise
+  std::vector<uint64_t> host_ids_for_key(const void* key, int64_t size,
+      size_t count) const;
+
+  const Policy& get_policy() const;
+
+  void report_success(size_t host_id, uint64_t latency_usecs);
+  void report_failure(size_t host_id);
+  size_t reinstate_expired_hosts();
+
+  bool is_ejected(size_t host_id) const;
+  size_t num_ejected_hosts() const;
+  size_t num_ejections(size_t host_id) const;
+  size_t consecutive_failures(size_t host_id) const;
+
+protected:
+  // a State is an immutable snapshot of the ring for one set of ejected hosts.
+  // States are never deleted while the ring exists, so readers can use them
+  // without holding any locks. there's at most one State for each distinct
+  // ejected set, so this doesn't grow without bound when a host flaps.
+  struct State {
+    std::shared_ptr<ConsistentHashRing> ring;
+    std::vector<uint64_t> live_host_id_to_host_id;
+    size_t num_ejected_hosts;
+  };
+
+  struct HostHealth {
+    std::atomic<size_t> consecutive_failures;
+    std::atomic<uint64_t> ejected_until; // 0 = not ejected
+    std::atomic<size_t> num_ejections;
+
+    HostHealth();
+  };
+
+  RingFactory factory;
+  Policy policy;
+
+  std::atomic<const State*> state;
+  std::unique_ptr<HostHealth[]> host_health;
+
+  std::mutex rebuild_lock;
+  std::unordered_map<std::string, std::unique_ptr<State>> ejected_set_to_state;
+
+  void rebuild_locked();
+};
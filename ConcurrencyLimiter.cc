@@ -0,0 +1,76 @@
+#include "ConcurrencyLimiter.hh"
+
+using namespace std;
+
+
+
+ConcurrencyLimiter::ConcurrencyLimiter(size_t initial_limit, size_t min_limit,
+    size_t max_limit, double tolerance, double backoff_ratio) :
+    current_limit(initial_limit), min_limit(min_limit ? min_limit : 1),
+    max_limit(max_limit), tolerance(tolerance), backoff_ratio(backoff_ratio),
+    current_min_rtt(0), window_min_rtt(0), window_samples(0),
+    samples_since_decrease(0) {
+  if (this->max_limit < this->min_limit) {
+    this->max_limit = this->min_limit;
+  }
+  if (this->current_limit < this->min_limit) {
+    this->current_limit = this->min_limit;
+  } else if (this->current_limit > this->max_limit) {
+    this->current_limit = this->max_limit;
+  }
+}
+
+size_t ConcurrencyLimiter::limit() const {
+  return this->current_limit;
+}
+
+uint64_t ConcurrencyLimiter::min_rtt() const {
+  return this->current_min_rtt;
+}
+
+void ConcurrencyLimiter::on_response(uint64_t rtt_usecs, size_t in_flight) {
+  // an RTT of 0 would make every later response look slow
+  if (!rtt_usecs) {
+    rtt_usecs = 1;
+  }
+
+  if (!this->current_min_rtt || (rtt_usecs < this->current_min_rtt)) {
+    this->current_min_rtt = rtt_usecs;
+  }
+  if (!this->window_min_rtt || (rtt_usecs < this->window_min_rtt)) {
+    this->window_min_rtt = rtt_usecs;
+  }
+  if (++this->window_samples >= RTT_WINDOW_SAMPLES) {
+    this->current_min_rtt = this->window_min_rtt;
+    this->window_min_rtt = 0;
+    this->window_samples = 0;
+  }
+  this->samples_since_decrease++;
+
+  if (rtt_usecs > this->current_min_rtt * this->tolerance) {
+    this->decrease();
+
+  // don't grow the limit if it isn't being used; otherwise it would grow
+  // without bound while the load is light, and be useless when it gets heavy
+  } else if (in_flight * 2 >= this->current_limit) {
+    this->current_limit += 1.0 / this->current_limit;
+    if (this->current_limit > this->max_limit) {
+      this->current_limit = this->max_limit;
+    }
+  }
+}
+
+void ConcurrencyLimiter::on_drop() {
+  this->decrease();
+}
+
+void ConcurrencyLimiter::decrease() {
+  if (this->samples_since_decrease < this->current_limit) {
+    return;
+  }
+  this->samples_since_decrease = 0;
+  this->current_limit *= this->backoff_ratio;
+  if (this->current_limit < this->min_limit) {
+    this->current_limit = this->min_limit;
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// an adaptive concurrency limit, learned from round-trip times with an AIMD
+// (additive increase, multiplicative decrease) rule. the limiter tracks the
+// minimum RTT it has seen recently, which approximates the RTT of an idle
+// server. when a response takes more than tolerance times that long (or a
+// command times out), the server is assumed to be queueing requests and the
+// limit is multiplied by backoff_ratio. otherwise, the limit grows by about 1
+// per limit's worth of responses (so about 1 per RTT), but only while the
+// limit is actually being used.
+//
+// decreases happen at most once per limit's worth of responses, so a burst of
+// slow responses that were all sent before the last decrease doesn't collapse
+// the limit. the minimum RTT is reset every RTT_WINDOW_SAMPLES responses to
+// the minimum of the last window, so it can follow a server that becomes
+// permanently slower (e.g. because its dataset grew).
+
+class ConcurrencyLimiter {
+public:
+  ConcurrencyLimiter(size_t initial_limit, size_t min_limit, size_t max_limit,
+      double tolerance = 2.0, double backoff_ratio = 0.9);
+  ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+  ConcurrencyLimiter(ConcurrencyLimiter&&) = delete;
+  ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+  ConcurrencyLimiter& operator=(ConcurrencyLimiter&&) = delete;
+  ~ConcurrencyLimiter() = default;
+
+  // returns the current limit (always between min_limit and max_limit)
+  size_t limit() const;
+
+  // returns the minimum RTT in the current window (0 if there are no samples)
+  uint64_t min_rtt() const;
+
+  // records a response that took rtt_usecs. in_flight is the number of
+  // commands that were outstanding when it was received, including itself
+  void on_response(uint64_t rtt_usecs, size_t in_flight);
+
+  // records a command that timed out or was otherwise lost
+  void on_drop();
+
+private:
+  static const size_t RTT_WINDOW_SAMPLES = 1000;
+
+  void decrease();
+
+  double current_limit;
+  size_t min_limit;
+  size_t max_limit;
+  double tolerance;
+  double backoff_ratio;
+
+  uint64_t current_min_rtt;
+  uint64_t window_min_rtt;
+  size_t window_samples;
+  size_t samples_since_decrease;
+};
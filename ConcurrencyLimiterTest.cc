@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/UnitTest.hh>
+
+#include "ConcurrencyLimiter.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- the limit grows by about 1 per limit's worth of fast responses\n");
+
+    ConcurrencyLimiter l(10, 1, 100);
+    expect_eq(l.limit(), 10);
+    for (size_t x = 0; x < 10; x++) {
+      l.on_response(1000, 10);
+    }
+    expect_eq(l.limit(), 10);
+    expect_eq(l.min_rtt(), 1000);
+    for (size_t x = 0; x < 11; x++) {
+      l.on_response(1000, 10);
+    }
+    expect_eq(l.limit(), 11);
+
+    // it doesn't grow when the limit isn't being used
+    for (size_t x = 0; x < 100; x++) {
+      l.on_response(1000, 2);
+    }
+    expect_eq(l.limit(), 11);
+
+    // and it doesn't grow beyond the maximum
+    for (size_t x = 0; x < 100000; x++) {
+      l.on_response(1000, 100);
+    }
+    expect_eq(l.limit(), 100);
+  }
+
+  {
+    printf("-- slow responses and drops shrink the limit, but not too often\n");
+
+    ConcurrencyLimiter l(100, 10, 200);
+    for (size_t x = 0; x < 100; x++) {
+      l.on_response(1000, 1);
+    }
+    expect_eq(l.limit(), 100);
+
+    // the first slow response decreases the limit; the rest of the limit's
+    // worth of responses don't
+    l.on_response(3000, 100);
+    expect_eq(l.limit(), 90);
+    for (size_t x = 0; x < 50; x++) {
+      l.on_response(3000, 100);
+    }
+    expect_eq(l.limit(), 90);
+    for (size_t x = 0; x < 40; x++) {
+      l.on_response(3000, 100);
+    }
+    expect_eq(l.limit(), 81);
+
+    for (size_t x = 0; x < 100; x++) {
+      l.on_drop();
+    }
+    expect_eq(l.limit(), 81);
+    for (size_t x = 0; x < 1000; x++) {
+      l.on_response(1000, 1);
+      l.on_drop();
+    }
+    expect_eq(l.limit(), 10);
+  }
+
+  {
+    printf("-- the minimum RTT follows a server that gets slower\n");
+
+    ConcurrencyLimiter l(10, 1, 100);
+    l.on_response(100, 1);
+    expect_eq(l.min_rtt(), 100);
+    for (size_t x = 0; x < 2000; x++) {
+      l.on_response(1000, 1);
+    }
+    expect_eq(l.min_rtt(), 1000);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <phosg/Filesystem.hh>
 #include <phosg/Network.hh>
@@ -81,19 +82,74 @@ shared_ptr<Response> test_expect_response(const char* host, int port,
   return expected_response ? NULL : r;
 }
 
+// for tests that need to keep a connection open between commands
+void send_command(int fd, const vector<string>& args) {
+  DataCommand cmd;
+  cmd.args = args;
+  unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+      evbuffer_free);
+  cmd.write(buf.get());
+  evbuffer_write(buf.get(), fd);
+}
+
+// sends all of the commands in one write, so the proxy receives them together
+void send_commands(int fd, const vector<vector<string>>& commands) {
+  unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+      evbuffer_free);
+  for (const auto& args : commands) {
+    DataCommand cmd;
+    cmd.args = args;
+    cmd.write(buf.get());
+  }
+  evbuffer_write(buf.get(), fd);
+}
+
+shared_ptr<Response> read_next_response(int fd, struct evbuffer* buf,
+    ResponseParser& parser) {
+  shared_ptr<Response> r;
+  while (!(r = parser.resume(buf))) {
+    expect_gt(evbuffer_read(buf, fd, 1024 * 128), 0);
+  }
+  return r;
+}
+
+void expect_next_response(int fd, struct evbuffer* buf, ResponseParser& parser,
+    const char* expected_response) {
+  shared_ptr<Response> r = read_next_response(fd, buf, parser);
+
+  shared_ptr<Response> expected_r = parse_response(expected_response);
+  expect(expected_r.get()); // if this fails, the test itself is broken
+  if (*r != *expected_r) {
+    fprintf(stderr, "expected = ");
+    expected_r->print(stderr);
+    fprintf(stderr, "\nactual   = ");
+    r->print(stderr);
+    fprintf(stderr, "\n");
+    expect(false);
+  }
+}
+
+// returns a numeric field from a proxy's INFO response
+int64_t info_field(int port, const char* name) {
+  auto r = test_expect_response("localhost", port, NULL, "INFO", NULL);
+  expect_eq(r->type, Response::Type::Data);
+  string prefix = string("\n") + name + ":";
+  size_t offset = r->data.find(prefix);
+  expect_ne(offset, string::npos);
+  return strtoll(r->data.c_str() + offset + prefix.size(), NULL, 10);
+}
+
 int main(int argc, char* argv[]) {
 
   printf("functional tests\n");
   printf("we expect redis-shatter to be running with all backends connected\n");
+  printf("optional features are tested through the proxy on port 6380\n");
 
   {
     printf("-- unimplemented commands return PROXYERROR\n");
 
     const vector<string> unimplemented_commands = {
-      "AUTH", "BLPOP", "BRPOP", "BRPOPLPUSH", "DISCARD", "EXEC", "MONITOR",
-      "MOVE", "MULTI", "PSUBSCRIBE", "PUBSUB", "PUBLISH", "PUNSUBSCRIBE",
-      "SELECT", "SLAVEOF", "SUBSCRIBE", "SYNC", "UNSUBSCRIBE", "UNWATCH",
-      "WATCH"};
+      "AUTH", "MONITOR", "MOVE", "SELECT", "SLAVEOF", "SYNC"};
 
     for (const auto& cmd : unimplemented_commands) {
       test_expect_response("localhost", 6379,
@@ -180,6 +236,459 @@ int main(int argc, char* argv[]) {
     test_expect_response("localhost", 6379, "+OK\r\n", "RENAME", "y{abd}", "zxcvbnm{abd}", NULL);
   }
 
+  {
+    printf("-- SUBSCRIBE, PSUBSCRIBE, PUBLISH, UNSUBSCRIBE, PUNSUBSCRIBE\n");
+    scoped_fd fd = connect("localhost", 6379, false); // not nonblocking
+    expect_ge(fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser;
+
+    send_command(fd, {"SUBSCRIBE", "ch1", "ch2"});
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$9\r\nsubscribe\r\n$3\r\nch1\r\n:1\r\n");
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$9\r\nsubscribe\r\n$3\r\nch2\r\n:2\r\n");
+    send_command(fd, {"PSUBSCRIBE", "ch*"});
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$10\r\npsubscribe\r\n$3\r\nch*\r\n:3\r\n");
+
+    // only subscription commands, PING and QUIT work in subscribe mode
+    send_command(fd, {"GET", "x"});
+    expect_next_response(fd, buf.get(), parser, "-ERR only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING / QUIT allowed in this context\r\n");
+    send_command(fd, {"PING"});
+    expect_next_response(fd, buf.get(), parser, "*2\r\n$4\r\npong\r\n$0\r\n\r\n");
+
+    // the proxy subscribes on the backends asynchronously, so give it a moment.
+    // the channel's backend has both the channel and pattern subscriptions
+    usleep(100000);
+    test_expect_response("localhost", 6379, ":2\r\n", "PUBLISH", "ch1", "hello", NULL);
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$7\r\nmessage\r\n$3\r\nch1\r\n$5\r\nhello\r\n");
+    expect_next_response(fd, buf.get(), parser, "*4\r\n$8\r\npmessage\r\n$3\r\nch*\r\n$3\r\nch1\r\n$5\r\nhello\r\n");
+
+    send_command(fd, {"UNSUBSCRIBE", "ch1"});
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$11\r\nunsubscribe\r\n$3\r\nch1\r\n:2\r\n");
+    send_command(fd, {"UNSUBSCRIBE"});
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$11\r\nunsubscribe\r\n$3\r\nch2\r\n:1\r\n");
+    send_command(fd, {"PUNSUBSCRIBE"});
+    expect_next_response(fd, buf.get(), parser, "*3\r\n$12\r\npunsubscribe\r\n$3\r\nch*\r\n:0\r\n");
+
+    // the client isn't in subscribe mode anymore
+    send_command(fd, {"PING"});
+    expect_next_response(fd, buf.get(), parser, "+PONG\r\n");
+  }
+
+  {
+    printf("-- BLPOP, BRPOP, BRPOPLPUSH\n");
+    test_expect_response("localhost", 6379, ":2\r\n", "RPUSH", "bl{abc}", "a", "b", NULL);
+    test_expect_response("localhost", 6379, "*2\r\n$7\r\nbl{abc}\r\n$1\r\na\r\n", "BLPOP", "bl{bbc}", "bl{abc}", "1", NULL);
+    test_expect_response("localhost", 6379, "$1\r\nb\r\n", "BRPOPLPUSH", "bl{abc}", "bl2{abc}", "1", NULL);
+    test_expect_response("localhost", 6379, "-PROXYERROR keys are on different backends\r\n", "BRPOPLPUSH", "bl{abc}", "bl{bbc}", "1", NULL);
+    test_expect_response("localhost", 6379, "*-1\r\n", "BRPOP", "bl{abc}", "bl{bbc}", "1", NULL);
+
+    // a blocked client is woken up by a push on another connection, and other
+    // clients' commands aren't held up in the meantime
+    scoped_fd fd = connect("localhost", 6379, false); // not nonblocking
+    expect_ge(fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser;
+    send_command(fd, {"BRPOP", "bl{abc}", "bl{bbc}", "5"});
+    usleep(100000);
+    test_expect_response("localhost", 6379, "+PONG\r\n", "PING", NULL);
+    test_expect_response("localhost", 6379, ":1\r\n", "LPUSH", "bl{bbc}", "c", NULL);
+    expect_next_response(fd, buf.get(), parser, "*2\r\n$7\r\nbl{bbc}\r\n$1\r\nc\r\n");
+    test_expect_response("localhost", 6379, ":1\r\n", "DEL", "bl2{abc}", NULL);
+  }
+
+  {
+    printf("-- MULTI, EXEC, DISCARD, WATCH, UNWATCH\n");
+    scoped_fd fd = connect("localhost", 6379, false); // not nonblocking
+    expect_ge(fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser;
+
+    send_command(fd, {"EXEC"});
+    expect_next_response(fd, buf.get(), parser, "-ERR EXEC without MULTI\r\n");
+
+    send_command(fd, {"MULTI"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"SET", "tx{abc}", "1"});
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    send_command(fd, {"INCR", "tx{abc}"});
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    send_command(fd, {"EXEC"});
+    expect_next_response(fd, buf.get(), parser, "*2\r\n+OK\r\n:2\r\n");
+
+    // UNWATCH is accepted in a transaction, but does nothing
+    send_command(fd, {"MULTI"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"UNWATCH"});
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    send_command(fd, {"EXEC"});
+    expect_next_response(fd, buf.get(), parser, "*0\r\n");
+
+    // keys on another backend make the transaction fail
+    send_command(fd, {"MULTI"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"INCR", "tx{abc}"});
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    send_command(fd, {"INCR", "tx{bbc}"});
+    expect_next_response(fd, buf.get(), parser, "-PROXYERROR keys in a transaction must all be on the same backend\r\n");
+    send_command(fd, {"EXEC"});
+    expect_next_response(fd, buf.get(), parser, "-EXECABORT Transaction discarded because of previous errors.\r\n");
+
+    send_command(fd, {"MULTI"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"INCR", "tx{abc}"});
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    send_command(fd, {"DISCARD"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    test_expect_response("localhost", 6379, "$1\r\n2\r\n", "GET", "tx{abc}", NULL);
+
+    // a watched key that changes before EXEC makes it return null
+    send_command(fd, {"WATCH", "tx{abc}"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    test_expect_response("localhost", 6379, ":3\r\n", "INCR", "tx{abc}", NULL);
+    send_command(fd, {"MULTI"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"INCR", "tx{abc}"});
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    send_command(fd, {"EXEC"});
+    expect_next_response(fd, buf.get(), parser, "*-1\r\n");
+
+    send_command(fd, {"WATCH", "tx{abc}"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"UNWATCH"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    test_expect_response("localhost", 6379, ":1\r\n", "DEL", "tx{abc}", NULL);
+  }
+
+  {
+    printf("-- CLIENT REPLY\n");
+    scoped_fd fd = connect("localhost", 6379, false); // not nonblocking
+    expect_ge(fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser;
+
+    // only the responses to the last INCR and the ON are sent
+    send_command(fd, {"CLIENT", "REPLY", "SKIP"});
+    send_command(fd, {"INCR", "reply{abc}"});
+    send_command(fd, {"INCR", "reply{abc}"});
+    expect_next_response(fd, buf.get(), parser, ":2\r\n");
+    send_command(fd, {"CLIENT", "REPLY", "OFF"});
+    send_command(fd, {"INCR", "reply{abc}"});
+    send_command(fd, {"GET", "reply{abc}"});
+    send_command(fd, {"CLIENT", "REPLY", "ON"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    send_command(fd, {"GET", "reply{abc}"});
+    expect_next_response(fd, buf.get(), parser, "$1\r\n3\r\n");
+
+    // a read sent just before OFF still gets its response
+    send_command(fd, {"GET", "reply{abc}"});
+    send_command(fd, {"CLIENT", "REPLY", "OFF"});
+    send_command(fd, {"INCR", "reply{abc}"});
+    send_command(fd, {"CLIENT", "REPLY", "ON"});
+    expect_next_response(fd, buf.get(), parser, "$1\r\n3\r\n");
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    test_expect_response("localhost", 6379, ":1\r\n", "DEL", "reply{abc}", NULL);
+  }
+
+  {
+    printf("-- EVALSHA after EVAL on a different backend\n");
+
+    // after SCRIPT FLUSH, EVAL only loads the script on one backend. EVALSHA
+    // works on the others anyway, since the proxy loads it there first
+    test_expect_response("localhost", 6379, "+OK\r\n", "SCRIPT", "FLUSH", NULL);
+    test_expect_response("localhost", 6379, "$3\r\nabc\r\n", "EVAL",
+        "return KEYS[1]", "1", "abc", NULL);
+    const char* keys[] = {"abc", "def", "ghi", "jkl", "mno", "pqr", "stu", NULL};
+    for (size_t x = 0; keys[x]; x++) {
+      string expected = string_printf("$3\r\n%s\r\n", keys[x]);
+      test_expect_response("localhost", 6379, expected.c_str(), "EVALSHA",
+          "4a2267357833227dd98abdedb8cf24b15a986445", "1", keys[x], NULL);
+    }
+  }
+
+  {
+    printf("-- reads see earlier writes through the read cache\n");
+    test_expect_response("localhost", 6380, "+OK\r\n", "SET", "hot:cached", "1", NULL);
+    test_expect_response("localhost", 6380, "$1\r\n1\r\n", "GET", "hot:cached", NULL);
+
+    // the second read is answered from the cache
+    int64_t num_hits = info_field(6380, "num_read_cache_hits");
+    test_expect_response("localhost", 6380, "$1\r\n1\r\n", "GET", "hot:cached", NULL);
+    expect_eq(info_field(6380, "num_read_cache_hits"), num_hits + 1);
+
+    test_expect_response("localhost", 6380, ":2\r\n", "INCR", "hot:cached", NULL);
+    test_expect_response("localhost", 6380, "$1\r\n2\r\n", "GET", "hot:cached", NULL);
+    test_expect_response("localhost", 6380, ":1\r\n", "DEL", "hot:cached", NULL);
+    test_expect_response("localhost", 6380, "$-1\r\n", "GET", "hot:cached", NULL);
+
+    // STORE destinations are invalidated too
+    test_expect_response("localhost", 6380, ":3\r\n", "RPUSH", "hot:src{s}", "3", "1", "2", NULL);
+    test_expect_response("localhost", 6380, "*0\r\n", "LRANGE", "hot:dest{s}", "0", "-1", NULL);
+    test_expect_response("localhost", 6380, ":3\r\n", "SORT", "hot:src{s}", "STORE", "hot:dest{s}", NULL);
+    test_expect_response("localhost", 6380, "*3\r\n$1\r\n1\r\n$1\r\n2\r\n$1\r\n3\r\n", "LRANGE", "hot:dest{s}", "0", "-1", NULL);
+    test_expect_response("localhost", 6380, ":2\r\n", "DEL", "hot:src{s}", "hot:dest{s}", NULL);
+  }
+
+  {
+    printf("-- identical pipelined reads are coalesced\n");
+    test_expect_response("localhost", 6380, "+OK\r\n", "SET", "coalesce:k", "1", NULL);
+
+    scoped_fd fd = connect("localhost", 6380, false); // not nonblocking
+    expect_ge(fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser;
+
+    // the second GET is sent while the first is still in flight, so it gets
+    // the first one's response instead of being sent to the backend
+    int64_t num_coalesced = info_field(6380, "num_coalesced_commands");
+    send_commands(fd, {{"GET", "coalesce:k"}, {"GET", "coalesce:k"}});
+    expect_next_response(fd, buf.get(), parser, "$1\r\n1\r\n");
+    expect_next_response(fd, buf.get(), parser, "$1\r\n1\r\n");
+    expect_eq(info_field(6380, "num_coalesced_commands"), num_coalesced + 1);
+
+    // a write ends coalescing, so the GET after it can't join the GET before
+    // it and sees the write
+    num_coalesced = info_field(6380, "num_coalesced_commands");
+    send_commands(fd, {{"GET", "coalesce:k"}, {"SET", "coalesce:k", "2"},
+        {"GET", "coalesce:k"}});
+    expect_next_response(fd, buf.get(), parser, "$1\r\n1\r\n");
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    expect_next_response(fd, buf.get(), parser, "$1\r\n2\r\n");
+    expect_eq(info_field(6380, "num_coalesced_commands"), num_coalesced);
+
+    test_expect_response("localhost", 6380, ":1\r\n", "DEL", "coalesce:k", NULL);
+  }
+
+  {
+    printf("-- pipelined GETs from several clients (GET batching)\n");
+    test_expect_response("localhost", 6380, "+OK\r\n", "MSET", "batch:a", "1", "batch:b", "2", "batch:c", "3", NULL);
+
+    scoped_fd fd1 = connect("localhost", 6380, false); // not nonblocking
+    scoped_fd fd2 = connect("localhost", 6380, false); // not nonblocking
+    expect_ge(fd1, 0);
+    expect_ge(fd2, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf1(evbuffer_new(),
+        evbuffer_free);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf2(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser1, parser2;
+
+    int64_t num_batched_gets = info_field(6380, "num_batched_gets");
+    send_commands(fd1, {{"GET", "batch:a"}, {"GET", "batch:b"}, {"GET", "batch:c"}});
+    send_commands(fd2, {{"GET", "batch:b"}, {"GET", "batch:a"}, {"GET", "batch:missing"}});
+    expect_next_response(fd1, buf1.get(), parser1, "$1\r\n1\r\n");
+    expect_next_response(fd1, buf1.get(), parser1, "$1\r\n2\r\n");
+    expect_next_response(fd1, buf1.get(), parser1, "$1\r\n3\r\n");
+    expect_next_response(fd2, buf2.get(), parser2, "$1\r\n2\r\n");
+    expect_next_response(fd2, buf2.get(), parser2, "$1\r\n1\r\n");
+    expect_next_response(fd2, buf2.get(), parser2, "$-1\r\n");
+    expect_gt(info_field(6380, "num_batched_gets"), num_batched_gets);
+
+    // a write after a GET can't reach the backend before it
+    send_commands(fd1, {{"GET", "batch:a"}, {"SET", "batch:a", "4"},
+        {"GET", "batch:a"}});
+    expect_next_response(fd1, buf1.get(), parser1, "$1\r\n1\r\n");
+    expect_next_response(fd1, buf1.get(), parser1, "+OK\r\n");
+    expect_next_response(fd1, buf1.get(), parser1, "$1\r\n4\r\n");
+
+    test_expect_response("localhost", 6380, ":3\r\n", "DEL", "batch:a", "batch:b", "batch:c", NULL);
+  }
+
+  {
+    printf("-- batched GETs time out with their MGET\n");
+
+    // this script keeps the backend busy for a second. it's sent through the
+    // default proxy, which has no timeouts, while the GETs are sent through
+    // the features proxy, which has a 500ms read timeout
+    static const char* busy_script = "\
+local function usecs()\n\
+  local t = redis.call('TIME')\n\
+  return tonumber(t[1]) * 1000000 + tonumber(t[2])\n\
+end\n\
+local end_time = usecs() + 1000000\n\
+while usecs() < end_time do end\n\
+return 1\n";
+
+    auto r = test_expect_response("localhost", 6380, NULL, "BACKENDNUM", "batch:{t}x", NULL);
+    expect_eq(r->type, Response::Type::Integer);
+    string backend_str = string_printf("%" PRId64, r->int_value);
+
+    scoped_fd script_fd = connect("localhost", 6379, false); // not nonblocking
+    scoped_fd fd1 = connect("localhost", 6380, false); // not nonblocking
+    scoped_fd fd2 = connect("localhost", 6380, false); // not nonblocking
+    expect_ge(script_fd, 0);
+    expect_ge(fd1, 0);
+    expect_ge(fd2, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> script_buf(
+        evbuffer_new(), evbuffer_free);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf1(evbuffer_new(),
+        evbuffer_free);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf2(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser script_parser, parser1, parser2;
+
+    send_command(script_fd, {"FORWARD", backend_str, "EVAL", busy_script, "0"});
+    usleep(100000); // let the script start before the GETs are sent
+    send_command(fd1, {"GET", "batch:{t}x"});
+    send_command(fd2, {"GET", "batch:{t}y"});
+    r = read_next_response(fd1, buf1.get(), parser1);
+    expect_eq(r->type, Response::Type::Error);
+    expect(starts_with(r->data, "CHANNELERROR backend did not respond"));
+    r = read_next_response(fd2, buf2.get(), parser2);
+    expect_eq(r->type, Response::Type::Error);
+    expect(starts_with(r->data, "CHANNELERROR backend did not respond"));
+    expect_next_response(script_fd, script_buf.get(), script_parser, ":1\r\n");
+
+    // the timed-out connection was closed, and the next GET uses a new one
+    test_expect_response("localhost", 6380, "$-1\r\n", "GET", "batch:{t}x", NULL);
+  }
+
+  {
+    printf("-- WATCH gives its connection back after watch_timeout\n");
+
+    scoped_fd fd = connect("localhost", 6380, false); // not nonblocking
+    expect_ge(fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+        evbuffer_free);
+    ResponseParser parser;
+
+    int64_t num_watch_timeouts = info_field(6380, "num_watch_timeouts");
+    send_command(fd, {"WATCH", "watch:k"});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+
+    // the features proxy's watch_timeout is 1 second, and clients are checked
+    // once per second
+    usleep(2500000);
+    expect_eq(info_field(6380, "num_watch_timeouts"), num_watch_timeouts + 1);
+
+    // the key isn't watched anymore, so the transaction fails
+    send_commands(fd, {{"MULTI"}, {"SET", "watch:k", "1"}, {"EXEC"}});
+    expect_next_response(fd, buf.get(), parser, "+OK\r\n");
+    expect_next_response(fd, buf.get(), parser, "+QUEUED\r\n");
+    expect_next_response(fd, buf.get(), parser, "*-1\r\n");
+    test_expect_response("localhost", 6380, "$-1\r\n", "GET", "watch:k", NULL);
+  }
+
+  {
+    printf("-- INFO HOTKEYS validates its arguments\n");
+    test_expect_response("localhost", 6379, "-ERR value is not an integer\r\n", "INFO", "HOTKEYS", "x", NULL);
+  }
+
+  {
+    printf("-- CLIENT TRACKING validates its arguments\n");
+    test_expect_response("localhost", 6379, "-ERR syntax error\r\n", "CLIENT", "TRACKING", "MAYBE", NULL);
+    test_expect_response("localhost", 6379, "+OK\r\n", "CLIENT", "TRACKING", "OFF", NULL);
+  }
+
+  {
+    printf("-- CLIENT TRACKING sends invalidations for written keys\n");
+
+    // all the keys are on the same backend, and this opens its connection if
+    // needed (which would flush all tracked keys)
+    test_expect_response("localhost", 6380, "+OK\r\n", "MSET", "track:{t}a", "1", "track:{t}b", "2", NULL);
+
+    scoped_fd sub_fd = connect("localhost", 6380, false); // not nonblocking
+    scoped_fd track_fd = connect("localhost", 6380, false); // not nonblocking
+    expect_ge(sub_fd, 0);
+    expect_ge(track_fd, 0);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> sub_buf(
+        evbuffer_new(), evbuffer_free);
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> track_buf(
+        evbuffer_new(), evbuffer_free);
+    ResponseParser sub_parser, track_parser;
+
+    send_command(sub_fd, {"CLIENT", "ID"});
+    auto r = read_next_response(sub_fd, sub_buf.get(), sub_parser);
+    expect_eq(r->type, Response::Type::Integer);
+    string sub_id_str = string_printf("%" PRId64, r->int_value);
+    send_command(sub_fd, {"SUBSCRIBE", "__redis__:invalidate"});
+    expect_next_response(sub_fd, sub_buf.get(), sub_parser, "*3\r\n$9\r\nsubscribe\r\n$20\r\n__redis__:invalidate\r\n:1\r\n");
+
+    send_command(track_fd, {"CLIENT", "TRACKING", "ON", "REDIRECT", sub_id_str});
+    expect_next_response(track_fd, track_buf.get(), track_parser, "+OK\r\n");
+    send_command(track_fd, {"GET", "track:{t}a"});
+    expect_next_response(track_fd, track_buf.get(), track_parser, "$1\r\n1\r\n");
+
+    // a write from another client invalidates the key
+    int64_t num_invalidations = info_field(6380, "num_tracking_invalidations");
+    test_expect_response("localhost", 6380, "+OK\r\n", "SET", "track:{t}a", "3", NULL);
+    expect_next_response(sub_fd, sub_buf.get(), sub_parser, "*3\r\n$7\r\nmessage\r\n$20\r\n__redis__:invalidate\r\n*1\r\n$10\r\ntrack:{t}a\r\n");
+
+    // the backend reports the write too; wait for that so it doesn't arrive
+    // after the key is read again below
+    for (size_t x = 0; (x < 100) &&
+        (info_field(6380, "num_tracking_invalidations") == num_invalidations);
+        x++) {
+      usleep(10000);
+    }
+    expect_gt(info_field(6380, "num_tracking_invalidations"), num_invalidations);
+
+    // the features proxy tracks at most 4 keys, so reading a fifth one
+    // invalidates one of the others
+    int64_t num_evictions = info_field(6380, "num_tracking_evictions");
+    send_commands(track_fd, {{"GET", "track:{t}a"}, {"GET", "track:{t}b"},
+        {"GET", "track:{t}c"}, {"GET", "track:{t}d"}, {"GET", "track:{t}e"}});
+    expect_next_response(track_fd, track_buf.get(), track_parser, "$1\r\n3\r\n");
+    expect_next_response(track_fd, track_buf.get(), track_parser, "$1\r\n2\r\n");
+    expect_next_response(track_fd, track_buf.get(), track_parser, "$-1\r\n");
+    expect_next_response(track_fd, track_buf.get(), track_parser, "$-1\r\n");
+    expect_next_response(track_fd, track_buf.get(), track_parser, "$-1\r\n");
+    r = read_next_response(sub_fd, sub_buf.get(), sub_parser);
+    expect_eq(r->type, Response::Type::Multi);
+    expect_eq(r->fields.size(), 3);
+    expect_eq(r->fields[2]->type, Response::Type::Multi);
+    expect_eq(r->fields[2]->fields.size(), 1);
+    expect(starts_with(r->fields[2]->fields[0]->data, "track:{t}"));
+    expect_eq(info_field(6380, "num_tracking_evictions"), num_evictions + 1);
+
+    test_expect_response("localhost", 6380, ":2\r\n", "DEL", "track:{t}a", "track:{t}b", NULL);
+  }
+
+  {
+    printf("-- ROUTE validates its arguments\n");
+    test_expect_response("localhost", 6379, "-ERR backend does not exist\r\n", "ROUTE", "SET", "x", "nonexistent-backend", NULL);
+    test_expect_response("localhost", 6379, ":0\r\n", "ROUTE", "DEL", "x", NULL);
+    test_expect_response("localhost", 6379, "-ERR unrecognized subcommand\r\n", "ROUTE", "MOVE", "x", NULL);
+  }
+
+  {
+    printf("-- ROUTE overrides the ring for a key\n");
+    auto r = test_expect_response("localhost", 6379, NULL, "BACKENDS", NULL);
+    size_t num_backends = r->fields.size();
+    r = test_expect_response("localhost", 6379, NULL, "BACKENDNUM", "route:k", NULL);
+    int64_t ring_backend = r->int_value;
+    int64_t override_backend = (ring_backend + 1) % num_backends;
+    string ring_backend_str = string_printf("%" PRId64, ring_backend);
+    string override_backend_str = string_printf("%" PRId64, override_backend);
+    string override_backend_resp = string_printf(":%" PRId64 "\r\n", override_backend);
+    string ring_backend_resp = string_printf(":%" PRId64 "\r\n", ring_backend);
+
+    test_expect_response("localhost", 6379, "+OK\r\n", "ROUTE", "SET", "route:k", override_backend_str.c_str(), NULL);
+    test_expect_response("localhost", 6379, override_backend_resp.c_str(), "BACKENDNUM", "route:k", NULL);
+    r = test_expect_response("localhost", 6379, NULL, "ROUTE", "LIST", NULL);
+    expect_eq(r->type, Response::Type::Multi);
+    expect_eq(r->fields.size(), 2);
+    expect_eq(r->fields[0]->data, "route:k");
+
+    // the key is written to and read from the override backend
+    test_expect_response("localhost", 6379, "+OK\r\n", "SET", "route:k", "1", NULL);
+    test_expect_response("localhost", 6379, "$1\r\n1\r\n", "GET", "route:k", NULL);
+    test_expect_response("localhost", 6379, "$1\r\n1\r\n", "FORWARD", override_backend_str.c_str(), "GET", "route:k", NULL);
+    if (num_backends > 1) {
+      test_expect_response("localhost", 6379, ":0\r\n", "FORWARD", ring_backend_str.c_str(), "EXISTS", "route:k", NULL);
+    }
+
+    // after the override is removed, the ring decides again
+    test_expect_response("localhost", 6379, ":1\r\n", "ROUTE", "DEL", "route:k", NULL);
+    test_expect_response("localhost", 6379, ring_backend_resp.c_str(), "BACKENDNUM", "route:k", NULL);
+    test_expect_response("localhost", 6379, "*0\r\n", "ROUTE", "LIST", NULL);
+    test_expect_response("localhost", 6379, ":1\r\n", "FORWARD", override_backend_str.c_str(), "DEL", "route:k", NULL);
+  }
+
   printf("all tests passed\n");
   return 0;
 }
@@ -0,0 +1,89 @@
+#include "HotKeySketch.hh"
+
+using namespace std;
+
+
+
+HotKeySketch::HotKeySketch(size_t capacity) : max_keys(capacity), total(0),
+    counters(), order() { }
+
+void HotKeySketch::add(const string& key, uint64_t count) {
+  this->add_counter(key, count, 0);
+}
+
+void HotKeySketch::add_counter(const string& key, uint64_t count,
+    uint64_t error) {
+  if (!this->max_keys) {
+    return;
+  }
+  this->total += count;
+
+  auto counter_it = this->counters.find(key);
+  if (counter_it == this->counters.end()) {
+    // if the sketch is full, the new key takes over the counter with the
+    // lowest count. the key could have occurred up to that many times before
+    // (while it wasn't being counted), so that's its error
+    uint64_t min_count = 0;
+    if (this->counters.size() >= this->max_keys) {
+      auto min_it = this->order.begin();
+      min_count = min_it->first;
+      string min_key = *min_it->second;
+      this->order.erase(min_it);
+      this->counters.erase(min_key);
+    }
+    counter_it = this->counters.emplace(key, Counter()).first;
+    counter_it->second.count = min_count;
+    counter_it->second.error = min_count;
+  } else {
+    this->order.erase(counter_it->second.order_it);
+  }
+
+  Counter& counter = counter_it->second;
+  counter.count += count;
+  counter.error += error;
+  counter.order_it = this->order.emplace(counter.count,
+      &counter_it->first).first;
+}
+
+void HotKeySketch::merge(const HotKeySketch& other) {
+  for (const auto& it : other.counters) {
+    this->add_counter(it.first, it.second.count, it.second.error);
+  }
+
+  // other's total also includes keys that it evicted
+  uint64_t other_counted = 0;
+  for (const auto& it : other.counters) {
+    other_counted += it.second.count;
+  }
+  if (other.total > other_counted) {
+    this->total += other.total - other_counted;
+  }
+}
+
+vector<HotKeySketch::Key> HotKeySketch::top(size_t n) const {
+  vector<Key> ret;
+  for (auto it = this->order.rbegin();
+       (it != this->order.rend()) && (ret.size() < n); it++) {
+    const Counter& counter = this->counters.at(*it->second);
+    ret.emplace_back(Key({*it->second, counter.count, counter.error}));
+  }
+  return ret;
+}
+
+size_t HotKeySketch::capacity() const {
+  return this->max_keys;
+}
+
+size_t HotKeySketch::size() const {
+  return this->counters.size();
+}
+
+uint64_t HotKeySketch::total_count() const {
+  return this->total;
+}
+
+void HotKeySketch::clear() {
+  this->order.clear();
+  this->counters.clear();
+  this->total = 0;
+}
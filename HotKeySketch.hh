@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// an approximate count of the most frequent keys in a stream, in bounded
+// memory (Space-Saving). at most capacity keys are counted; when a new key
+// arrives and the sketch is full, it replaces the key with the lowest count
+// and inherits that count (which is remembered as the new key's error). every
+// key that occurred more than (total count / capacity) times is guaranteed to
+// be in the sketch, and each key's count is an upper bound on its true count,
+// off by at most its error.
+//
+// the sketch isn't thread-safe. each proxy thread has its own, and merges it
+// into a shared one periodically.
+
+class HotKeySketch {
+public:
+  struct Key {
+    std::string key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  explicit HotKeySketch(size_t capacity);
+  HotKeySketch(const HotKeySketch&) = delete;
+  HotKeySketch(HotKeySketch&&) = delete;
+  HotKeySketch& operator=(const HotKeySketch&) = delete;
+  HotKeySketch& operator=(HotKeySketch&&) = delete;
+  ~HotKeySketch() = default;
+
+  void add(const std::string& key, uint64_t count = 1);
+
+  // adds all of other's counts to this sketch. errors are carried over, so
+  // the counts are still upper bounds
+  void merge(const HotKeySketch& other);
+
+  // returns up to n keys, highest count first
+  std::vector<Key> top(size_t n) const;
+
+  size_t capacity() const;
+  size_t size() const;
+
+  // returns the sum of all the counts added, including those of keys that
+  // aren't in the sketch anymore
+  uint64_t total_count() const;
+
+  void clear();
+
+private:
+  struct Counter {
+    uint64_t count;
+    uint64_t error;
+    std::set<std::pair<uint64_t, const std::string*>>::iterator order_it;
+  };
+
+  size_t max_keys;
+  uint64_t total;
+  std::unordered_map<std::string, Counter> counters;
+  // (count, key) for every counter, lowest count first
+  std::set<std::pair<uint64_t, const std::string*>> order;
+
+  void add_counter(const std::string& key, uint64_t count, uint64_t error);
+};
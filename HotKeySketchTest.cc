@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/Strings.hh>
+#include <phosg/UnitTest.hh>
+#include <string>
+
+#include "HotKeySketch.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- counts are exact while the sketch isn\'t full\n");
+
+    HotKeySketch sketch(10);
+    expect_eq(sketch.top(5).size(), 0);
+    sketch.add("a", 3);
+    sketch.add("b");
+    sketch.add("c", 2);
+    sketch.add("b");
+    sketch.add("b");
+    sketch.add("b");
+    expect_eq(sketch.size(), 3);
+    expect_eq(sketch.total_count(), 9);
+
+    auto top = sketch.top(2);
+    expect_eq(top.size(), 2);
+    expect_eq(top[0].key, "b");
+    expect_eq(top[0].count, 4);
+    expect_eq(top[0].error, 0);
+    expect_eq(top[1].key, "a");
+    expect_eq(top[1].count, 3);
+  }
+
+  {
+    printf("-- frequent keys survive a stream of infrequent ones\n");
+
+    HotKeySketch sketch(8);
+    for (size_t x = 0; x < 1000; x++) {
+      sketch.add("hot");
+      if (x % 2 == 0) {
+        sketch.add("warm");
+      }
+      sketch.add(string_printf("cold%zu", x));
+    }
+    expect_eq(sketch.size(), 8);
+    expect_eq(sketch.total_count(), 2500);
+
+    auto top = sketch.top(2);
+    expect_eq(top[0].key, "hot");
+    expect_ge(top[0].count, 1000);
+    expect_le(top[0].count - top[0].error, 1000);
+    expect_eq(top[1].key, "warm");
+    expect_ge(top[1].count, 500);
+
+    sketch.clear();
+    expect_eq(sketch.size(), 0);
+    expect_eq(sketch.total_count(), 0);
+  }
+
+  {
+    printf("-- merged sketches keep the counts of both\n");
+
+    HotKeySketch a(4), b(4), merged(4);
+    a.add("x", 10);
+    a.add("y", 2);
+    b.add("x", 5);
+    b.add("z", 7);
+    merged.merge(a);
+    merged.merge(b);
+    expect_eq(merged.total_count(), 24);
+
+    auto top = merged.top(3);
+    expect_eq(top.size(), 3);
+    expect_eq(top[0].key, "x");
+    expect_eq(top[0].count, 15);
+    expect_eq(top[1].key, "z");
+    expect_eq(top[1].count, 7);
+    expect_eq(top[2].key, "y");
+    expect_eq(top[2].count, 2);
+
+    // a sketch with no capacity counts nothing
+    HotKeySketch empty(0);
+    empty.add("x");
+    expect_eq(empty.size(), 0);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include "LatencyHistogram.hh"
+
+#include <math.h>
+
+using namespace std;
+
+
+
+LatencyHistogram::LatencyHistogram() : total_count(0) {
+  for (size_t x = 0; x < NUM_BUCKETS; x++) {
+    this->bucket_counts[x] = 0;
+  }
+}
+
+size_t LatencyHistogram::bucket_for_value(uint64_t value) {
+  // small values get one bucket each. for larger values, the bucket is
+  // determined by the position of the highest set bit and the next
+  // SUB_BUCKET_BITS bits after it
+  if (value < SUB_BUCKETS) {
+    return value;
+  }
+  uint8_t high_bit = 63 - __builtin_clzll(value);
+  uint8_t shift = high_bit - SUB_BUCKET_BITS;
+  return (high_bit - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+      ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::max_value_for_bucket(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  uint8_t shift = (bucket / SUB_BUCKETS) - 1;
+  uint64_t min_value = (SUB_BUCKETS + (bucket % SUB_BUCKETS)) << shift;
+  return min_value + ((1ULL << shift) - 1);
+}
+
+void LatencyHistogram::add(uint64_t value) {
+  this->bucket_counts[this->bucket_for_value(value)]++;
+  this->total_count++;
+}
+
+uint64_t LatencyHistogram::count() const {
+  return this->total_count;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  uint64_t total = this->total_count;
+  if (!total) {
+    return 0;
+  }
+
+  uint64_t target = ceil(total * p / 100);
+  if (target < 1) {
+    target = 1;
+  }
+  uint64_t cumulative = 0;
+  for (size_t x = 0; x < NUM_BUCKETS; x++) {
+    cumulative += this->bucket_counts[x];
+    if (cumulative >= target) {
+      return this->max_value_for_bucket(x);
+    }
+  }
+
+  // this can happen if another thread is in the middle of add(); the total was
+  // incremented after we read the buckets
+  return this->max_value_for_bucket(NUM_BUCKETS - 1);
+}
+
+void LatencyHistogram::decay() {
+  uint64_t total = 0;
+  for (size_t x = 0; x < NUM_BUCKETS; x++) {
+    uint64_t count = this->bucket_counts[x] / 2;
+    this->bucket_counts[x] = count;
+    total += count;
+  }
+  this->total_count = total;
+}
+
+void LatencyHistogram::clear() {
+  for (size_t x = 0; x < NUM_BUCKETS; x++) {
+    this->bucket_counts[x] = 0;
+  }
+  this->total_count = 0;
+}
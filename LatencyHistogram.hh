@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+
+// a histogram of latencies (or any other nonnegative integers) with
+// logarithmic buckets. each power of two is split into 16 linear buckets, so
+// values are recorded with at most about 6% error. recording a value is
+// constant-time and doesn't allocate memory. the counts are atomic, so a
+// histogram can be shared between threads (though decay() and clear() aren't
+// atomic as a whole).
+
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram(LatencyHistogram&&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(LatencyHistogram&&) = delete;
+  ~LatencyHistogram() = default;
+
+  void add(uint64_t value);
+
+  // returns the number of values recorded
+  uint64_t count() const;
+
+  // returns an upper bound for the given percentile (0-100) of the recorded
+  // values, or 0 if there are no values
+  uint64_t percentile(double p) const;
+
+  // halves all the counts, so older values gradually have less influence
+  void decay();
+  void clear();
+
+private:
+  static const uint8_t SUB_BUCKET_BITS = 4;
+  static const size_t SUB_BUCKETS = (1 << SUB_BUCKET_BITS);
+  static const size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  static size_t bucket_for_value(uint64_t value);
+  static uint64_t max_value_for_bucket(size_t bucket);
+
+  std::atomic<uint64_t> total_count;
+  std::atomic<uint64_t> bucket_counts[NUM_BUCKETS];
+};
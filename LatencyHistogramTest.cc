@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/UnitTest.hh>
+#include <vector>
+
+#include "LatencyHistogram.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- percentiles of small values are exact\n");
+
+    LatencyHistogram h;
+    expect_eq(h.percentile(50), 0);
+    for (uint64_t x = 1; x <= 10; x++) {
+      h.add(x);
+    }
+    expect_eq(h.count(), 10);
+    expect_eq(h.percentile(0), 1);
+    expect_eq(h.percentile(50), 5);
+    expect_eq(h.percentile(90), 9);
+    expect_eq(h.percentile(100), 10);
+  }
+
+  {
+    printf("-- percentiles of large values are within the bucket error\n");
+
+    LatencyHistogram h;
+    for (uint64_t x = 1; x <= 100000; x++) {
+      h.add(x);
+    }
+    vector<double> percentiles = {50.0, 99.0, 99.9};
+    for (double p : percentiles) {
+      uint64_t expected = p * 1000;
+      uint64_t value = h.percentile(p);
+      expect_ge(value, expected);
+      expect_le(value, expected + expected / 16);
+    }
+
+    // values that are too large for any other bucket go in the last one
+    h.add(UINT64_MAX);
+    expect_eq(h.percentile(100), UINT64_MAX);
+  }
+
+  {
+    printf("-- decay halves the counts\n");
+
+    LatencyHistogram h;
+    for (size_t x = 0; x < 9; x++) {
+      h.add(1000);
+    }
+    h.add(5);
+    h.decay();
+    expect_eq(h.count(), 4);
+    expect_ge(h.percentile(0), 1000);
+    h.clear();
+    expect_eq(h.count(), 0);
+    expect_eq(h.percentile(99), 0);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
@@ -27,8 +27,11 @@
 #include <unordered_set>
 #include <vector>
 
+#include "AutoEjectHashRing.hh"
 #include "NutcrackerConsistentHashRing.hh"
 #include "Proxy.hh"
+#include "RoutingOverrides.hh"
+#include "ScriptCache.hh"
 
 using namespace std;
 
@@ -73,9 +76,113 @@ struct Options {
     int hash_begin_delimiter;
     int hash_end_delimiter;
 
+    bool auto_eject_hosts;
+    AutoEjectHashRing::Policy auto_eject_policy;
+
+    bool preconnect_backends;
+    double startup_ready_fraction;
+    uint64_t startup_ready_timeout_usecs;
+
+    uint64_t read_timeout_usecs;
+    uint64_t write_timeout_usecs;
+    uint64_t fanout_timeout_usecs;
+    bool retry_reads;
+
+    string spill_directory;
+    size_t spill_max_size;
+    bool spill_ack_immediately;
+    size_t spill_replay_rate;
+
+    unordered_map<string, vector<string>> backend_name_to_replica_netlocs;
+    Proxy::ReplicaReadPolicy replica_read_policy;
+    uint64_t read_your_writes_usecs;
+    double hedge_percentile;
+    double hedge_budget_percent;
+
+    size_t replication_factor;
+    unordered_map<string, size_t> key_prefix_to_replication_factor;
+    Proxy::WriteAckPolicy write_ack_policy;
+
+    size_t backend_output_high_watermark;
+    size_t backend_output_low_watermark;
+    size_t backend_pending_high_watermark;
+    size_t backend_pending_low_watermark;
+
+    bool adaptive_concurrency_limits;
+    size_t concurrency_limit_initial;
+    size_t concurrency_limit_min;
+    size_t concurrency_limit_max;
+    double concurrency_limit_latency_tolerance;
+    size_t concurrency_limit_max_queued_commands;
+
+    size_t blocking_pool_size;
+    uint64_t watch_timeout_usecs;
+    size_t script_cache_size;
+
+    size_t read_cache_max_bytes;
+    uint64_t read_cache_ttl_usecs;
+    vector<string> read_cache_key_prefixes;
+    bool backend_tracking;
+    size_t tracking_table_max_keys;
+    vector<string> coalesced_commands;
+    size_t get_batch_max_keys;
+    uint64_t get_batch_window_usecs;
+
+    size_t hot_key_sample_rate;
+    uint64_t hot_key_interval_usecs;
+    double hot_key_alarm_rate;
+    unordered_map<string, double> backend_name_to_hot_key_alarm_rate;
+    unordered_map<string, string> key_to_backend_override;
+
+    int64_t client_max_multibulk_length;
+    int64_t client_max_bulk_length;
+    size_t client_output_hard_limit;
+    size_t client_output_soft_limit;
+    uint64_t client_output_soft_limit_usecs;
+
+    size_t fair_queue_quantum;
+    size_t client_max_inflight_commands;
+
+    uint64_t client_idle_mode_usecs;
+    uint64_t client_idle_timeout_usecs;
+    size_t max_clients;
+
     ProxyOptions() : num_threads(1), affinity_cpus(0), listen_addr(""),
         port(6379), listen_fd(-1), backend_netlocs(), commands_to_disable(),
-        hash_precision(17), hash_begin_delimiter(-1), hash_end_delimiter(-1) { }
+        hash_precision(17), hash_begin_delimiter(-1), hash_end_delimiter(-1),
+        auto_eject_hosts(false), auto_eject_policy(),
+        preconnect_backends(true), startup_ready_fraction(0),
+        startup_ready_timeout_usecs(5000000), read_timeout_usecs(0),
+        write_timeout_usecs(0), fanout_timeout_usecs(0), retry_reads(false),
+        spill_directory(), spill_max_size(64 * 1024 * 1024),
+        spill_ack_immediately(false), spill_replay_rate(1000),
+        backend_name_to_replica_netlocs(),
+        replica_read_policy(Proxy::ReplicaReadPolicy::LeastOutstanding),
+        read_your_writes_usecs(0), hedge_percentile(0),
+        hedge_budget_percent(5), replication_factor(1),
+        key_prefix_to_replication_factor(),
+        write_ack_policy(Proxy::WriteAckPolicy::Majority),
+        backend_output_high_watermark(0), backend_output_low_watermark(0),
+        backend_pending_high_watermark(0), backend_pending_low_watermark(0),
+        adaptive_concurrency_limits(false), concurrency_limit_initial(20),
+        concurrency_limit_min(1), concurrency_limit_max(1000),
+        concurrency_limit_latency_tolerance(2.0),
+        concurrency_limit_max_queued_commands(10000), blocking_pool_size(16),
+        watch_timeout_usecs(60000000), script_cache_size(1024),
+        read_cache_max_bytes(0),
+        read_cache_ttl_usecs(1000000), read_cache_key_prefixes(),
+        backend_tracking(false), tracking_table_max_keys(1000000),
+        coalesced_commands(), get_batch_max_keys(0),
+        get_batch_window_usecs(0), hot_key_sample_rate(0),
+        hot_key_interval_usecs(10000000), hot_key_alarm_rate(0),
+        backend_name_to_hot_key_alarm_rate(),
+        key_to_backend_override(),
+        client_max_multibulk_length(CommandParser().max_multibulk_length),
+        client_max_bulk_length(CommandParser().max_bulk_length),
+        client_output_hard_limit(0), client_output_soft_limit(0),
+        client_output_soft_limit_usecs(0), fair_queue_quantum(0),
+        client_max_inflight_commands(0), client_idle_mode_usecs(0),
+        client_idle_timeout_usecs(0), max_clients(0) { }
 
     void print(FILE* stream, const char* name) const {
       fprintf(stream, "[%s] %zu worker thread(s)\n", name, this->num_threads);
@@ -100,6 +207,45 @@ struct Options {
         fprintf(stream, "[%s] register backend %s\n", name,
             backend_netloc.c_str());
       }
+      for (const auto& it : this->backend_name_to_replica_netlocs) {
+        for (const auto& replica_netloc : it.second) {
+          fprintf(stream, "[%s] register replica %s for backend %s\n", name,
+              replica_netloc.c_str(), it.first.c_str());
+        }
+      }
+      if (!this->backend_name_to_replica_netlocs.empty()) {
+        fprintf(stream, "[%s] send reads to the replica with the %s\n", name,
+            (this->replica_read_policy == Proxy::ReplicaReadPolicy::RoundRobin) ?
+              "next turn (round-robin)" : "fewest outstanding requests");
+        if (this->read_your_writes_usecs) {
+          fprintf(stream, "[%s] read from masters for %" PRIu64 "ms after a client writes to them\n",
+              name, this->read_your_writes_usecs / 1000);
+        }
+        if (this->hedge_percentile > 0) {
+          fprintf(stream, "[%s] hedge reads slower than the %gth percentile to another replica, up to %g%% of reads\n",
+              name, this->hedge_percentile, this->hedge_budget_percent);
+        }
+      }
+
+      if (this->replication_factor > 1) {
+        fprintf(stream, "[%s] store each key on %zu backends\n", name,
+            this->replication_factor);
+      }
+      for (const auto& it : this->key_prefix_to_replication_factor) {
+        fprintf(stream, "[%s] store keys beginning with \"%s\" on %zu backends\n",
+            name, it.first.c_str(), it.second);
+      }
+      if ((this->replication_factor > 1) ||
+          !this->key_prefix_to_replication_factor.empty()) {
+        const char* policy_str = "a majority of";
+        if (this->write_ack_policy == Proxy::WriteAckPolicy::First) {
+          policy_str = "the first of";
+        } else if (this->write_ack_policy == Proxy::WriteAckPolicy::All) {
+          policy_str = "all of";
+        }
+        fprintf(stream, "[%s] acknowledge replicated writes when %s the backends succeed\n",
+            name, policy_str);
+      }
 
       for (const auto& command : this->commands_to_disable) {
         fprintf(stream, "[%s] disable command %s\n", name, command.c_str());
@@ -113,12 +259,255 @@ struct Options {
         fprintf(stream, "[%s] hash end delimiter is 0x%02X\n", name,
             this->hash_end_delimiter);
       }
+
+      if (this->auto_eject_hosts) {
+        fprintf(stream, "[%s] eject backends after %zu consecutive failures; retry after %" PRIu64 "ms\n",
+            name, this->auto_eject_policy.failure_limit,
+            this->auto_eject_policy.retry_interval_usecs / 1000);
+        if (this->auto_eject_policy.latency_limit_usecs) {
+          fprintf(stream, "[%s] responses slower than %" PRIu64 "ms count as failures\n",
+              name, this->auto_eject_policy.latency_limit_usecs / 1000);
+        }
+      }
+
+      if (!this->preconnect_backends) {
+        fprintf(stream, "[%s] connect to backends on demand\n", name);
+      } else if (this->startup_ready_fraction > 0) {
+        fprintf(stream, "[%s] preconnect to backends; wait up to %" PRIu64 "ms for %g%% of them before accepting clients\n",
+            name, this->startup_ready_timeout_usecs / 1000,
+            this->startup_ready_fraction * 100);
+      } else {
+        fprintf(stream, "[%s] preconnect to backends\n", name);
+      }
+
+      if (this->read_timeout_usecs) {
+        fprintf(stream, "[%s] read commands time out after %" PRIu64 "ms\n",
+            name, this->read_timeout_usecs / 1000);
+      }
+      if (this->write_timeout_usecs) {
+        fprintf(stream, "[%s] write commands time out after %" PRIu64 "ms\n",
+            name, this->write_timeout_usecs / 1000);
+      }
+      if (this->fanout_timeout_usecs) {
+        fprintf(stream, "[%s] multi-backend commands time out after %" PRIu64 "ms\n",
+            name, this->fanout_timeout_usecs / 1000);
+      }
+      if (this->retry_reads) {
+        fprintf(stream, "[%s] retry read commands once if a backend disconnects\n",
+            name);
+      }
+      if (!this->spill_directory.empty()) {
+        fprintf(stream, "[%s] spill writes for down backends to %s (up to %zu bytes per backend per thread); %s; replay at %zu commands/sec\n",
+            name, this->spill_directory.c_str(), this->spill_max_size,
+            this->spill_ack_immediately ? "acknowledge +OK commands immediately" :
+              "hold responses until replayed",
+            this->spill_replay_rate);
+      }
+
+      if (this->backend_output_high_watermark) {
+        fprintf(stream, "[%s] pause clients when a backend has more than %zu bytes unsent; resume at %zu bytes\n",
+            name, this->backend_output_high_watermark,
+            this->backend_output_low_watermark);
+      }
+      if (this->backend_pending_high_watermark) {
+        fprintf(stream, "[%s] pause clients when a backend has more than %zu pending commands; resume at %zu commands\n",
+            name, this->backend_pending_high_watermark,
+            this->backend_pending_low_watermark);
+      }
+      if (this->adaptive_concurrency_limits) {
+        fprintf(stream, "[%s] limit pending commands per backend adaptively (initially %zu, between %zu and %zu); queue up to %zu more\n",
+            name, this->concurrency_limit_initial, this->concurrency_limit_min,
+            this->concurrency_limit_max,
+            this->concurrency_limit_max_queued_commands);
+        fprintf(stream, "[%s] decrease concurrency limits when responses take more than %g times the minimum latency\n",
+            name, this->concurrency_limit_latency_tolerance);
+      }
+      if (this->blocking_pool_size) {
+        fprintf(stream, "[%s] run blocking commands on up to %zu dedicated connections per backend\n",
+            name, this->blocking_pool_size);
+      } else {
+        fprintf(stream, "[%s] blocking commands are disabled\n", name);
+      }
+      if (this->blocking_pool_size && this->watch_timeout_usecs) {
+        fprintf(stream, "[%s] release connections pinned by WATCH after %" PRIu64 "ms\n",
+            name, this->watch_timeout_usecs / 1000);
+      }
+      if (this->script_cache_size) {
+        fprintf(stream, "[%s] cache up to %zu scripts for EVALSHA\n",
+            name, this->script_cache_size);
+      } else {
+        fprintf(stream, "[%s] scripts are not cached\n", name);
+      }
+      if (this->read_cache_max_bytes) {
+        fprintf(stream, "[%s] cache read responses for %" PRIu64 "ms in up to %zu bytes\n",
+            name, this->read_cache_ttl_usecs / 1000, this->read_cache_max_bytes);
+        for (const auto& prefix : this->read_cache_key_prefixes) {
+          fprintf(stream, "[%s] cache reads of keys beginning with \"%s\"\n",
+              name, prefix.c_str());
+        }
+      }
+      if (this->backend_tracking) {
+        fprintf(stream, "[%s] track keys on backends for invalidations\n", name);
+        if (this->tracking_table_max_keys) {
+          fprintf(stream, "[%s] track up to %zu keys for clients\n", name,
+              this->tracking_table_max_keys);
+        }
+      }
+      for (const auto& command : this->coalesced_commands) {
+        fprintf(stream, "[%s] coalesce identical in-flight %s commands\n",
+            name, command.c_str());
+      }
+      if (this->get_batch_max_keys) {
+        fprintf(stream, "[%s] batch up to %zu GETs per backend for %" PRIu64 "usecs\n",
+            name, this->get_batch_max_keys, this->get_batch_window_usecs);
+      }
+      if (this->hot_key_sample_rate) {
+        fprintf(stream, "[%s] count the keys of 1 in %zu commands to find hot keys every %" PRIu64 "ms\n",
+            name, this->hot_key_sample_rate,
+            this->hot_key_interval_usecs / 1000);
+        if (this->hot_key_alarm_rate > 0) {
+          fprintf(stream, "[%s] log keys with more than %g commands/sec\n",
+              name, this->hot_key_alarm_rate);
+        }
+        for (const auto& it : this->backend_name_to_hot_key_alarm_rate) {
+          fprintf(stream, "[%s] log keys on backend %s with more than %g commands/sec\n",
+              name, it.first.c_str(), it.second);
+        }
+      } else {
+        fprintf(stream, "[%s] hot key detection is disabled\n", name);
+      }
+      for (const auto& it : this->key_to_backend_override) {
+        fprintf(stream, "[%s] route key %s to backend %s\n", name,
+            it.first.c_str(), it.second.c_str());
+      }
+
+      fprintf(stream, "[%s] accept commands with up to %" PRId64 " arguments of up to %" PRId64 " bytes each\n",
+          name, this->client_max_multibulk_length,
+          this->client_max_bulk_length);
+      if (this->client_output_hard_limit) {
+        fprintf(stream, "[%s] disconnect clients with more than %zu bytes of unsent responses\n",
+            name, this->client_output_hard_limit);
+      }
+      if (this->client_output_soft_limit) {
+        fprintf(stream, "[%s] disconnect clients with more than %zu bytes of unsent responses for %" PRIu64 "ms\n",
+            name, this->client_output_soft_limit,
+            this->client_output_soft_limit_usecs / 1000);
+      }
+
+      if (this->fair_queue_quantum) {
+        fprintf(stream, "[%s] schedule client commands fairly with quantum %zu\n",
+            name, this->fair_queue_quantum);
+        if (this->client_max_inflight_commands) {
+          fprintf(stream, "[%s] allow at most %zu in-flight commands per client\n",
+              name, this->client_max_inflight_commands);
+        }
+      }
+
+      if (this->client_idle_mode_usecs) {
+        fprintf(stream, "[%s] release buffers for clients idle for %" PRIu64 "ms\n",
+            name, this->client_idle_mode_usecs / 1000);
+      }
+      if (this->client_idle_timeout_usecs) {
+        fprintf(stream, "[%s] disconnect clients idle for %" PRIu64 "ms\n",
+            name, this->client_idle_timeout_usecs / 1000);
+      }
+      if (this->max_clients) {
+        fprintf(stream, "[%s] allow at most %zu clients\n", name,
+            this->max_clients);
+      }
     }
 
     void validate() const {
       if (this->backend_netlocs.empty()) {
         throw invalid_argument("no backends specified");
       }
+      if ((this->startup_ready_fraction < 0) ||
+          (this->startup_ready_fraction > 1)) {
+        throw invalid_argument("startup_ready_fraction must be between 0 and 1");
+      }
+      if (this->backend_output_low_watermark >
+          this->backend_output_high_watermark) {
+        throw invalid_argument("backend_output_low_watermark must not be greater than backend_output_high_watermark");
+      }
+      if (this->backend_pending_low_watermark >
+          this->backend_pending_high_watermark) {
+        throw invalid_argument("backend_pending_low_watermark must not be greater than backend_pending_high_watermark");
+      }
+      if ((this->client_max_multibulk_length <= 0) ||
+          (this->client_max_bulk_length <= 0)) {
+        throw invalid_argument("client command limits must be positive");
+      }
+      if (!this->spill_directory.empty() && !this->spill_max_size) {
+        throw invalid_argument("spill_max_size must be positive");
+      }
+      for (const auto& it : this->backend_name_to_replica_netlocs) {
+        string suffix = "@" + it.first;
+        bool found = false;
+        for (const auto& backend_netloc : this->backend_netlocs) {
+          if (ends_with(backend_netloc, suffix)) {
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          throw invalid_argument("replicas given for nonexistent backend " +
+              it.first);
+        }
+      }
+      for (const auto& it : this->backend_name_to_hot_key_alarm_rate) {
+        string suffix = "@" + it.first;
+        bool found = false;
+        for (const auto& backend_netloc : this->backend_netlocs) {
+          if ((backend_netloc == it.first) ||
+              ends_with(backend_netloc, suffix)) {
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          throw invalid_argument("hot key alarm rate given for nonexistent backend " +
+              it.first);
+        }
+      }
+      for (const auto& it : this->key_to_backend_override) {
+        string suffix = "@" + it.second;
+        bool found = false;
+        for (const auto& backend_netloc : this->backend_netlocs) {
+          if ((backend_netloc == it.second) ||
+              ends_with(backend_netloc, suffix)) {
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          throw invalid_argument("key " + it.first +
+              " routed to nonexistent backend " + it.second);
+        }
+      }
+      if (this->adaptive_concurrency_limits &&
+          (!this->concurrency_limit_min ||
+           (this->concurrency_limit_min > this->concurrency_limit_max))) {
+        throw invalid_argument("concurrency_limit_min must be positive and no greater than concurrency_limit_max");
+      }
+      if (this->adaptive_concurrency_limits &&
+          (this->concurrency_limit_latency_tolerance <= 1)) {
+        throw invalid_argument("concurrency_limit_latency_tolerance must be greater than 1");
+      }
+      if (this->replication_factor < 1) {
+        throw invalid_argument("replication_factor must be at least 1");
+      }
+      for (const auto& it : this->key_prefix_to_replication_factor) {
+        if (it.second < 1) {
+          throw invalid_argument("replication factors must be at least 1");
+        }
+      }
+      if ((this->hedge_percentile < 0) || (this->hedge_percentile >= 100)) {
+        throw invalid_argument("hedge_percentile must be in [0, 100)");
+      }
+      if ((this->hedge_budget_percent < 0) ||
+          (this->hedge_budget_percent > 100)) {
+        throw invalid_argument("hedge_budget must be in [0, 100]");
+      }
     }
   };
 
@@ -189,12 +578,315 @@ struct Options {
         options.hash_end_delimiter = s[0];
       } catch (const out_of_range& e) { }
 
+      try {
+        options.auto_eject_hosts = proxy_config.at("auto_eject_hosts")->as_bool();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.auto_eject_policy.failure_limit =
+            proxy_config.at("server_failure_limit")->as_int();
+        if (options.auto_eject_policy.failure_limit == 0) {
+          throw invalid_argument("server_failure_limit must be at least 1");
+        }
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.auto_eject_policy.retry_interval_usecs =
+            proxy_config.at("server_retry_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.auto_eject_policy.latency_limit_usecs =
+            proxy_config.at("server_latency_limit")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.preconnect_backends =
+            proxy_config.at("preconnect_backends")->as_bool();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.startup_ready_fraction =
+            proxy_config.at("startup_ready_fraction")->as_float();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.startup_ready_timeout_usecs =
+            proxy_config.at("startup_ready_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.read_timeout_usecs =
+            proxy_config.at("read_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.write_timeout_usecs =
+            proxy_config.at("write_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.fanout_timeout_usecs =
+            proxy_config.at("fanout_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.retry_reads = proxy_config.at("retry_reads")->as_bool();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.spill_directory =
+            proxy_config.at("spill_directory")->as_string();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.spill_max_size = proxy_config.at("spill_max_size")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.spill_ack_immediately =
+            proxy_config.at("spill_ack_immediately")->as_bool();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.spill_replay_rate =
+            proxy_config.at("spill_replay_rate")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.backend_output_high_watermark =
+            proxy_config.at("backend_output_high_watermark")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.backend_output_low_watermark =
+            proxy_config.at("backend_output_low_watermark")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.backend_pending_high_watermark =
+            proxy_config.at("backend_pending_high_watermark")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.backend_pending_low_watermark =
+            proxy_config.at("backend_pending_low_watermark")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.adaptive_concurrency_limits =
+            proxy_config.at("adaptive_concurrency_limits")->as_bool();
+      } catch (const out_of_range& e) { }
+      try {
+        options.concurrency_limit_initial =
+            proxy_config.at("concurrency_limit_initial")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.concurrency_limit_min =
+            proxy_config.at("concurrency_limit_min")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.concurrency_limit_max =
+            proxy_config.at("concurrency_limit_max")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.concurrency_limit_latency_tolerance =
+            proxy_config.at("concurrency_limit_latency_tolerance")->as_float();
+      } catch (const out_of_range& e) { }
+      try {
+        options.concurrency_limit_max_queued_commands =
+            proxy_config.at("concurrency_limit_max_queued_commands")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.blocking_pool_size =
+            proxy_config.at("blocking_pool_size")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.watch_timeout_usecs =
+            proxy_config.at("watch_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+      try {
+        options.script_cache_size =
+            proxy_config.at("script_cache_size")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.read_cache_max_bytes =
+            proxy_config.at("read_cache_max_bytes")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.read_cache_ttl_usecs =
+            proxy_config.at("read_cache_ttl")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+      try {
+        for (const auto& prefix : proxy_config.at("read_cache_key_prefixes")->as_list()) {
+          options.read_cache_key_prefixes.emplace_back(prefix->as_string());
+        }
+      } catch (const out_of_range& e) { }
+      try {
+        options.backend_tracking =
+            proxy_config.at("backend_tracking")->as_bool();
+      } catch (const out_of_range& e) { }
+      try {
+        options.tracking_table_max_keys =
+            proxy_config.at("tracking_table_max_keys")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        for (const auto& command : proxy_config.at("coalesced_commands")->as_list()) {
+          options.coalesced_commands.emplace_back(command->as_string());
+        }
+      } catch (const out_of_range& e) { }
+      try {
+        options.get_batch_max_keys =
+            proxy_config.at("get_batch_max_keys")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.get_batch_window_usecs =
+            proxy_config.at("get_batch_window_usecs")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.hot_key_sample_rate =
+            proxy_config.at("hot_key_sample_rate")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        options.hot_key_interval_usecs =
+            proxy_config.at("hot_key_interval")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+      try {
+        options.hot_key_alarm_rate =
+            proxy_config.at("hot_key_alarm_rate")->as_float();
+      } catch (const out_of_range& e) { }
+      try {
+        for (const auto& it : proxy_config.at("hot_key_backend_alarm_rates")->as_dict()) {
+          options.backend_name_to_hot_key_alarm_rate.emplace(it.first,
+              it.second->as_float());
+        }
+      } catch (const out_of_range& e) { }
+
+      try {
+        for (const auto& it : proxy_config.at("routing_overrides")->as_dict()) {
+          options.key_to_backend_override.emplace(it.first,
+              it.second->as_string());
+        }
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_max_multibulk_length =
+            proxy_config.at("client_max_multibulk_length")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_max_bulk_length =
+            proxy_config.at("client_max_bulk_length")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_output_hard_limit =
+            proxy_config.at("client_output_buffer_hard_limit")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_output_soft_limit =
+            proxy_config.at("client_output_buffer_soft_limit")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_output_soft_limit_usecs =
+            proxy_config.at("client_output_buffer_soft_limit_time")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.fair_queue_quantum =
+            proxy_config.at("fair_queue_quantum")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_max_inflight_commands =
+            proxy_config.at("client_max_inflight_commands")->as_int();
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_idle_mode_usecs =
+            proxy_config.at("client_idle_mode_time")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.client_idle_timeout_usecs =
+            proxy_config.at("client_idle_timeout")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.max_clients = proxy_config.at("maxclients")->as_int();
+      } catch (const out_of_range& e) { }
+
       try {
         for (const auto& command : proxy_config.at("disable_commands")->as_list()) {
           options.commands_to_disable.emplace(command->as_string());
         }
       } catch (const out_of_range& e) { }
 
+      try {
+        for (const auto& replicas_it : proxy_config.at("replicas")->as_dict()) {
+          const auto& backend_name = replicas_it.first;
+          auto& netlocs = options.backend_name_to_replica_netlocs[backend_name];
+          for (const auto& replica : replicas_it.second->as_list()) {
+            netlocs.emplace_back(string_printf("%s@%s/replica%zu",
+                replica->as_string().c_str(), backend_name.c_str(),
+                netlocs.size()));
+          }
+        }
+      } catch (const out_of_range& e) { }
+
+      try {
+        const auto& policy = proxy_config.at("replica_read_policy")->as_string();
+        if (policy == "least_outstanding") {
+          options.replica_read_policy = Proxy::ReplicaReadPolicy::LeastOutstanding;
+        } else if (policy == "round_robin") {
+          options.replica_read_policy = Proxy::ReplicaReadPolicy::RoundRobin;
+        } else {
+          throw invalid_argument(
+              "replica_read_policy must be least_outstanding or round_robin");
+        }
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.read_your_writes_usecs =
+            proxy_config.at("read_your_writes_time")->as_int() * 1000;
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.replication_factor =
+            proxy_config.at("replication_factor")->as_int();
+      } catch (const out_of_range& e) { }
+      try {
+        for (const auto& it : proxy_config.at("replicated_key_prefixes")->as_dict()) {
+          options.key_prefix_to_replication_factor[it.first] =
+              it.second->as_int();
+        }
+      } catch (const out_of_range& e) { }
+      try {
+        const auto& policy = proxy_config.at("replicated_write_ack")->as_string();
+        if (policy == "first") {
+          options.write_ack_policy = Proxy::WriteAckPolicy::First;
+        } else if (policy == "majority") {
+          options.write_ack_policy = Proxy::WriteAckPolicy::Majority;
+        } else if (policy == "all") {
+          options.write_ack_policy = Proxy::WriteAckPolicy::All;
+        } else {
+          throw invalid_argument(
+              "replicated_write_ack must be first, majority, or all");
+        }
+      } catch (const out_of_range& e) { }
+
+      try {
+        options.hedge_percentile = proxy_config.at("hedge_percentile")->as_float();
+      } catch (const out_of_range& e) { }
+      try {
+        options.hedge_budget_percent = proxy_config.at("hedge_budget")->as_float();
+      } catch (const out_of_range& e) { }
+
       try {
         for (const auto& backend_it : proxy_config.at("backends")->as_dict()) {
           const auto& backend_name = backend_it.first;
@@ -274,14 +966,33 @@ int main(int argc, char** argv) {
     fprintf(stderr, "[%s] setting up configuration\n", proxy_name);
     auto hosts = ConsistentHashRing::Host::parse_netloc_list(
         proxy_options.backend_netlocs, 6379);
+    uint8_t hash_precision = proxy_options.hash_precision;
+    auto make_ring = [hash_precision](const vector<ConsistentHashRing::Host>& hosts)
+        -> shared_ptr<ConsistentHashRing> {
+      if (hash_precision) {
+        return shared_ptr<ConsistentHashRing>(
+            new ConstantTimeConsistentHashRing(hosts, hash_precision));
+      } else {
+        return shared_ptr<ConsistentHashRing>(
+            new NutcrackerConsistentHashRing(hosts));
+      }
+    };
     shared_ptr<ConsistentHashRing> ring;
-    if (proxy_options.hash_precision) {
-      ring.reset(new ConstantTimeConsistentHashRing(
-          hosts, proxy_options.hash_precision));
+    shared_ptr<AutoEjectHashRing> auto_eject_ring;
+    if (proxy_options.auto_eject_hosts) {
+      auto_eject_ring.reset(new AutoEjectHashRing(hosts, make_ring,
+          proxy_options.auto_eject_policy));
+      ring = auto_eject_ring;
     } else {
-      ring.reset(new NutcrackerConsistentHashRing(hosts));
+      ring = make_ring(hosts);
     }
     shared_ptr<Proxy::Stats> stats(new Proxy::Stats());
+    shared_ptr<RoutingOverrides> routing_overrides(new RoutingOverrides());
+    for (const auto& it : proxy_options.key_to_backend_override) {
+      routing_overrides->set(it.first, it.second);
+    }
+    shared_ptr<ScriptCache> script_cache(new ScriptCache(
+        proxy_options.script_cache_size));
 
     fprintf(stderr, "[%s] starting %zu proxy instances\n", proxy_name,
         proxy_options.num_threads);
@@ -292,6 +1003,84 @@ int main(int argc, char** argv) {
       for (const auto& command : proxy_options.commands_to_disable) {
         proxies.back()->disable_command(command);
       }
+      if (auto_eject_ring.get()) {
+        proxies.back()->set_auto_eject_ring(auto_eject_ring);
+      }
+      proxies.back()->set_routing_overrides(routing_overrides);
+      proxies.back()->set_preconnect_backends(
+          proxy_options.preconnect_backends,
+          proxy_options.startup_ready_fraction,
+          proxy_options.startup_ready_timeout_usecs);
+      proxies.back()->set_timeouts(proxy_options.read_timeout_usecs,
+          proxy_options.write_timeout_usecs,
+          proxy_options.fanout_timeout_usecs);
+      proxies.back()->set_retry_reads(proxy_options.retry_reads);
+      if (!proxy_options.spill_directory.empty()) {
+        proxies.back()->set_spill_queues(
+            proxy_options.spill_directory + "/" + proxy_name,
+            proxy_options.spill_max_size, proxy_options.spill_ack_immediately,
+            proxy_options.spill_replay_rate);
+      }
+      if (!proxy_options.backend_name_to_replica_netlocs.empty()) {
+        unordered_map<string, vector<ConsistentHashRing::Host>>
+            backend_name_to_replicas;
+        for (const auto& it : proxy_options.backend_name_to_replica_netlocs) {
+          backend_name_to_replicas.emplace(it.first,
+              ConsistentHashRing::Host::parse_netloc_list(it.second, 6379));
+        }
+        proxies.back()->set_replicas(backend_name_to_replicas,
+            proxy_options.replica_read_policy,
+            proxy_options.read_your_writes_usecs);
+        proxies.back()->set_hedging(proxy_options.hedge_percentile,
+            proxy_options.hedge_budget_percent);
+      }
+      if ((proxy_options.replication_factor > 1) ||
+          !proxy_options.key_prefix_to_replication_factor.empty()) {
+        proxies.back()->set_replicated_keyspace(
+            proxy_options.replication_factor,
+            proxy_options.key_prefix_to_replication_factor,
+            proxy_options.write_ack_policy);
+      }
+      if (proxy_options.adaptive_concurrency_limits) {
+        proxies.back()->set_concurrency_limits(
+            proxy_options.concurrency_limit_initial,
+            proxy_options.concurrency_limit_min,
+            proxy_options.concurrency_limit_max,
+            proxy_options.concurrency_limit_latency_tolerance,
+            proxy_options.concurrency_limit_max_queued_commands);
+      }
+      proxies.back()->set_blocking_pool_size(proxy_options.blocking_pool_size,
+          proxy_options.watch_timeout_usecs);
+      proxies.back()->set_script_cache(script_cache);
+      if (proxy_options.read_cache_max_bytes) {
+        proxies.back()->set_read_cache(proxy_options.read_cache_max_bytes,
+            proxy_options.read_cache_ttl_usecs,
+            proxy_options.read_cache_key_prefixes);
+      }
+      proxies.back()->set_backend_tracking(proxy_options.backend_tracking,
+          proxy_options.tracking_table_max_keys);
+      proxies.back()->set_coalesced_commands(proxy_options.coalesced_commands);
+      proxies.back()->set_get_batching(proxy_options.get_batch_max_keys,
+          proxy_options.get_batch_window_usecs);
+      proxies.back()->set_hot_key_sampling(proxy_options.hot_key_sample_rate,
+          proxy_options.hot_key_interval_usecs,
+          proxy_options.hot_key_alarm_rate,
+          proxy_options.backend_name_to_hot_key_alarm_rate);
+      proxies.back()->set_backpressure_watermarks(
+          proxy_options.backend_output_high_watermark,
+          proxy_options.backend_output_low_watermark,
+          proxy_options.backend_pending_high_watermark,
+          proxy_options.backend_pending_low_watermark);
+      proxies.back()->set_client_limits(
+          proxy_options.client_max_multibulk_length,
+          proxy_options.client_max_bulk_length,
+          proxy_options.client_output_hard_limit,
+          proxy_options.client_output_soft_limit,
+          proxy_options.client_output_soft_limit_usecs);
+      proxies.back()->set_fair_queuing(proxy_options.fair_queue_quantum,
+          proxy_options.client_max_inflight_commands);
+      proxies.back()->set_idle_clients(proxy_options.client_idle_mode_usecs,
+          proxy_options.client_idle_timeout_usecs, proxy_options.max_clients);
 
       // run the thread on the least-loaded cpu
       int64_t min_load_cpu = -1;
@@ -70,6 +70,33 @@ NutcrackerConsistentHashRing::NutcrackerConsistentHashRing(
 
 uint64_t NutcrackerConsistentHashRing::host_id_for_key(const void* key,
     int64_t size) const {
+  return this->points[this->point_index_for_key(key, size)].index;
+}
+
+vector<uint64_t> NutcrackerConsistentHashRing::host_ids_for_key(
+    const void* key, int64_t size, size_t count) const {
+  if (count > this->hosts.size()) {
+    count = this->hosts.size();
+  }
+
+  // walk clockwise from the key's point, skipping points for hosts that are
+  // already in the list
+  vector<uint64_t> ret;
+  vector<bool> host_used(this->hosts.size(), false);
+  size_t point_index = this->point_index_for_key(key, size);
+  for (size_t x = 0; (x < this->points.size()) && (ret.size() < count); x++) {
+    uint32_t host_index = this->points[point_index].index;
+    if (!host_used[host_index]) {
+      host_used[host_index] = true;
+      ret.emplace_back(host_index);
+    }
+    point_index = (point_index + 1) % this->points.size();
+  }
+  return ret;
+}
+
+size_t NutcrackerConsistentHashRing::point_index_for_key(const void* key,
+    int64_t size) const {
   // TODO: use std::lower_bound here instead of manual binary search
 
   uint32_t hash32 = fnv1a64(key, size);
@@ -87,7 +114,7 @@ uint64_t NutcrackerConsistentHashRing::host_id_for_key(const void* key,
   }
 
   if (right == this->points.data() + this->points.size()) {
-    return this->points[0].index;
+    return 0;
   }
-  return right->index;
+  return right - this->points.data();
 }
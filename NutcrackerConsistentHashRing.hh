@@ -20,6 +20,11 @@ public:
 
   virtual uint64_t host_id_for_key(const void* key, int64_t size) const;
 
+  // returns the host for the key followed by the next distinct hosts after it
+  // on the ring, up to count hosts in total
+  std::vector<uint64_t> host_ids_for_key(const void* key, int64_t size,
+      size_t count) const;
+
 protected:
   struct Point {
     uint32_t index;
@@ -29,4 +34,6 @@ protected:
   };
 
   std::vector<Point> points;
+
+  size_t point_index_for_key(const void* key, int64_t size) const;
 };
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/Strings.hh>
+#include <phosg/UnitTest.hh>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "NutcrackerConsistentHashRing.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+  vector<ConsistentHashRing::Host> hosts;
+  for (size_t x = 0; x < 8; x++) {
+    hosts.emplace_back(string_printf("shard%zu", x), "localhost", 6379 + x);
+  }
+  NutcrackerConsistentHashRing ring(hosts);
+
+  {
+    printf("-- successors start with the key's host and are distinct\n");
+
+    for (size_t x = 0; x < 1000; x++) {
+      string key = string_printf("key%zu", x);
+      uint64_t host_id = ring.host_id_for_key(key.data(), key.size());
+
+      auto host_ids = ring.host_ids_for_key(key.data(), key.size(), 3);
+      expect_eq(host_ids.size(), 3);
+      expect_eq(host_ids[0], host_id);
+      unordered_set<uint64_t> distinct_host_ids(host_ids.begin(),
+          host_ids.end());
+      expect_eq(distinct_host_ids.size(), 3);
+
+      // asking for fewer successors gives a prefix of the same list
+      auto fewer_host_ids = ring.host_ids_for_key(key.data(), key.size(), 2);
+      expect_eq(fewer_host_ids.size(), 2);
+      expect_eq(fewer_host_ids[0], host_ids[0]);
+      expect_eq(fewer_host_ids[1], host_ids[1]);
+    }
+  }
+
+  {
+    printf("-- the number of successors is limited by the number of hosts\n");
+
+    auto host_ids = ring.host_ids_for_key("key", 3, 20);
+    expect_eq(host_ids.size(), 8);
+    unordered_set<uint64_t> distinct_host_ids(host_ids.begin(), host_ids.end());
+    expect_eq(distinct_host_ids.size(), 8);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
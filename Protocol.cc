@@ -10,6 +10,7 @@
 #include <string.h>
 #include <errno.h>
 
+#include <algorithm>
 #include <phosg/Strings.hh>
 
 using namespace std;
@@ -449,7 +450,11 @@ void Response::write_int(struct evbuffer* buf, int64_t value,
 
 
 
-CommandParser::CommandParser() : state(State::Initial), error_str(NULL) { }
+CommandLimitError::CommandLimitError(Limit limit, const string& what) :
+    runtime_error(what), limit(limit) { }
+
+CommandParser::CommandParser() : state(State::Initial), error_str(NULL),
+    max_multibulk_length(1024 * 1024), max_bulk_length(512 * 1024 * 1024) { }
 
 const char* CommandParser::error() const {
   return this->error_str;
@@ -498,7 +503,14 @@ shared_ptr<DataCommand> CommandParser::resume(struct evbuffer* buf) {
         if (this->arguments_remaining <= 0) {
           throw runtime_error("command with zero or fewer arguments");
         }
-        this->command_in_progress.reset(new DataCommand(this->arguments_remaining));
+        if (this->arguments_remaining > this->max_multibulk_length) {
+          throw CommandLimitError(CommandLimitError::Limit::MultibulkLength,
+              "command has too many arguments");
+        }
+        // don't preallocate space for more arguments than we've received,
+        // within reason - the client may never send them
+        this->command_in_progress.reset(new DataCommand(
+            min<int64_t>(this->arguments_remaining, 1024)));
         this->state = State::ReadingArgumentSize;
         break;
       }
@@ -518,10 +530,18 @@ shared_ptr<DataCommand> CommandParser::resume(struct evbuffer* buf) {
         if (input_line[0] != '$') {
           throw runtime_error("didn\'t get command arg size where expected");
         } else {
-          this->data_bytes_remaining = strtoull(&input_line[1], NULL, 10);
+          this->data_bytes_remaining = strtoll(&input_line[1], NULL, 10);
+          if (this->data_bytes_remaining < 0) {
+            throw runtime_error("command arg size is negative");
+          }
+          if (this->data_bytes_remaining > this->max_bulk_length) {
+            throw CommandLimitError(CommandLimitError::Limit::BulkLength,
+                "command arg is too large");
+          }
+          // same as above: preallocate at most 1MB until the data arrives
           this->command_in_progress->args.emplace_back();
           this->command_in_progress->args.back().reserve(
-              this->data_bytes_remaining);
+              min<int64_t>(this->data_bytes_remaining, 1024 * 1024));
           this->state = State::ReadingArgumentData;
         }
         break;
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -83,6 +84,18 @@ struct Response {
 };
 
 
+// thrown by CommandParser::resume when a command exceeds one of the parser's
+// limits. this happens before any memory is allocated for the command.
+struct CommandLimitError : std::runtime_error {
+  enum class Limit {
+    MultibulkLength = 0,
+    BulkLength,
+  };
+  Limit limit;
+
+  CommandLimitError(Limit limit, const std::string& what);
+};
+
 struct CommandParser {
   enum State {
     Initial = 0,
@@ -98,6 +111,11 @@ struct CommandParser {
   int64_t arguments_remaining;
   int64_t data_bytes_remaining;
 
+  // maximum number of arguments in a command and maximum size of a single
+  // argument. the defaults are the same as redis-server's
+  int64_t max_multibulk_length;
+  int64_t max_bulk_length;
+
   CommandParser();
   ~CommandParser() = default;
 
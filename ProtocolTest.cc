@@ -83,6 +83,54 @@ int main(int argc, char* argv[]) {
     check_serialization(cmd, expected_serialization);
   }
 
+  {
+    printf("-- command parser enforces argument count and size limits\n");
+
+    auto expect_limit = [](const char* command_string,
+        CommandLimitError::Limit expected_limit) {
+      unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> in_buf(
+          evbuffer_new(), evbuffer_free);
+      evbuffer_add(in_buf.get(), command_string, strlen(command_string));
+      CommandParser parser;
+      parser.max_multibulk_length = 3;
+      parser.max_bulk_length = 4;
+      try {
+        parser.resume(in_buf.get());
+        expect(false);
+      } catch (const CommandLimitError& e) {
+        expect_eq(static_cast<int>(e.limit), static_cast<int>(expected_limit));
+      }
+    };
+
+    expect_limit("*2147483647\r\n", CommandLimitError::Limit::MultibulkLength);
+    expect_limit("*4\r\n$3\r\nDEL\r\n", CommandLimitError::Limit::MultibulkLength);
+    expect_limit("*2\r\n$3\r\nGET\r\n$9999999999\r\n",
+        CommandLimitError::Limit::BulkLength);
+    expect_limit("*2\r\n$3\r\nGET\r\n$5\r\n", CommandLimitError::Limit::BulkLength);
+
+    // commands within the limits are parsed normally
+    const char* command_string = "*3\r\n$3\r\nSET\r\n$1\r\nx\r\n$4\r\nabcd\r\n";
+    unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> in_buf(
+        evbuffer_new(), evbuffer_free);
+    evbuffer_add(in_buf.get(), command_string, strlen(command_string));
+    CommandParser parser;
+    parser.max_multibulk_length = 3;
+    parser.max_bulk_length = 4;
+    auto cmd = parser.resume(in_buf.get());
+    expect_eq(cmd->args.size(), 3);
+    expect_eq(cmd->args[2], "abcd");
+
+    // negative argument sizes are rejected instead of allocating memory
+    const char* negative_string = "*2\r\n$3\r\nGET\r\n$-1\r\n";
+    evbuffer_add(in_buf.get(), negative_string, strlen(negative_string));
+    try {
+      CommandParser().resume(in_buf.get());
+      expect(false);
+    } catch (const CommandLimitError& e) {
+      expect(false);
+    } catch (const runtime_error& e) { }
+  }
+
   {
     printf("-- parse a response & serialize it again\n");
 
@@ -2,18 +2,22 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <event2/bufferevent.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
 #include <phosg/Network.hh>
 #include <phosg/Process.hh>
 #include <phosg/Strings.hh>
 #include <phosg/Time.hh>
 
+#include "NutcrackerConsistentHashRing.hh"
 #include "Protocol.hh"
 #include "Proxy.hh"
 
@@ -21,15 +25,35 @@ using namespace std;
 using CollectionType = ResponseLink::CollectionType;
 
 
+// the channel that redis-server sends invalidations on when CLIENT TRACKING
+// redirects them to another connection
+static const string tracking_invalidation_channel("__redis__:invalidate");
+
+// client ids have the index of the client's proxy thread in their low bits,
+// so invalidations can be forwarded to the thread a redirect target is on
+static const int64_t CLIENT_ID_PROXY_INDEX_BITS = 16;
+
+static string tracking_forward_channel_for_proxy_index(size_t proxy_index) {
+  // the name has to be unique across all the proxies that share the backends
+  static const uint64_t process_token =
+      (static_cast<uint64_t>(random_device()()) << 32) | random_device()();
+  return string_printf("__redis-shatter__:tracking:%016" PRIx64 ":%zu",
+      process_token, proxy_index);
+}
+
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // BackendConnection implementation
 
 BackendConnection::BackendConnection(Backend* backend, int64_t index,
     std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>&& new_bev)
-    : backend(backend), index(index), bev(move(new_bev)), parser(),
+    : backend(backend), index(index), bev(move(new_bev)), connected(false),
+    draining(false), parser(),
     local_addr(), remote_addr(), num_commands_sent(0),
-    num_responses_received(0), head_link(NULL), tail_link(NULL) {
+    num_responses_received(0), head_link(NULL), tail_link(NULL),
+    paused_clients(), queued_output(NULL, evbuffer_free),
+    queued_command_sizes(), queued_bytes(0), send_times(), tracking(false) {
   get_socket_addresses(bufferevent_getfd(this->bev.get()), &this->local_addr,
       &this->remote_addr);
 }
@@ -60,6 +84,37 @@ void BackendConnection::print(FILE* stream, int indent_level) const {
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// SubscriberConnection implementation
+
+SubscriberConnection::SubscriberConnection(Backend* backend,
+    std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>&& new_bev)
+    : backend(backend), bev(move(new_bev)), connected(false), parser(),
+    channels(), patterns(), num_messages_received(0), client_id(-1),
+    awaiting_client_id(false) { }
+
+void SubscriberConnection::send_command(const char* command,
+    const string& name) {
+  ReferenceCommand cmd(2);
+  cmd.args.emplace_back(command, strlen(command));
+  cmd.args.emplace_back(name);
+  cmd.write(bufferevent_get_output(this->bev.get()));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// BlockingConnection implementation
+
+BlockingConnection::BlockingConnection(Backend* backend, int64_t index,
+    std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>&& new_bev)
+    : backend(backend), index(index), bev(move(new_bev)), connected(false),
+    parser(), client_id(-1), awaiting_client_id(false), leased(false),
+    link(NULL), command_name(), cancel_time(0), pinned_client(NULL),
+    pinned_links() { }
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Backend implementation
 
@@ -67,7 +122,38 @@ Backend::Backend(size_t index, const string& host, int port, const string& name)
     : index(index), host(host), port(port), name(name),
     debug_name(string_printf("%s:%d@%s", this->host.c_str(), this->port,
       this->name.c_str())), index_to_connection(), next_connection_index(0),
-    num_responses_received(0), num_commands_sent(0) { }
+    num_responses_received(0), num_commands_sent(0), num_timeouts(0),
+    num_retries(0), is_down(false), spill_queue(), spilled_links(),
+    master(NULL), replicas(), next_replica_index(0), read_latency(),
+    concurrency_limiter(), num_concurrency_limit_rejects(0),
+    num_keyless_selections(0), subscriber_conn(),
+    index_to_blocking_connection(), next_blocking_connection_index(0),
+    idle_blocking_conns(), num_blocking_leases(0),
+    num_blocking_pool_exhausted(0), loaded_script_shas() { }
+
+BackendConnection* Backend::get_active_connection() {
+  // draining connections can't be used for new commands
+  for (auto& conn_it : this->index_to_connection) {
+    if (!conn_it.second.draining) {
+      return &conn_it.second;
+    }
+  }
+  return NULL;
+}
+
+BackendConnection* Backend::get_connected_connection() {
+  BackendConnection* conn = this->get_active_connection();
+  return (conn && conn->connected) ? conn : NULL;
+}
+
+size_t Backend::num_pending_commands() const {
+  size_t ret = 0;
+  for (const auto& conn_it : this->index_to_connection) {
+    ret += conn_it.second.num_commands_sent -
+        conn_it.second.num_responses_received;
+  }
+  return ret;
+}
 
 void Backend::print(FILE* stream, int indent_level) const {
   fprintf(stream, "Backend[index=%zu, debug_name=%s, io_counts=[%zu, %zu], next_connection_index=%" PRId64 ", connections=[",
@@ -81,6 +167,20 @@ void Backend::print(FILE* stream, int indent_level) const {
     fputc(',', stream);
   }
   fputc(']', stream);
+  if (this->spill_queue.get()) {
+    fprintf(stream, ", spill_queue=[%zu commands, %zu bytes]",
+        this->spill_queue->size(), this->spill_queue->bytes());
+  }
+  if (!this->replicas.empty()) {
+    fprintf(stream, ", replicas=[");
+    for (const Backend* replica : this->replicas) {
+      fputc('\n', stream);
+      print_indent(stream, indent_level + 1);
+      replica->print(stream, indent_level + 1);
+      fputc(',', stream);
+    }
+    fputc(']', stream);
+  }
 }
 
 
@@ -89,13 +189,24 @@ void Backend::print(FILE* stream, int indent_level) const {
 // Client implementation
 
 Client::Client(unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev)
-    : name(), debug_name(), should_disconnect(false), bev(move(bev)), parser(),
+    : name(), debug_name(), should_disconnect(false),
+    fd(bufferevent_getfd(bev.get())), bev(move(bev)),
+    idle_event(NULL, event_free), last_active_time(now()), parser(),
     local_addr(), remote_addr(), num_commands_received(0),
-    num_responses_sent(0), head_link(NULL), tail_link(NULL) {
-  get_socket_addresses(bufferevent_getfd(this->bev.get()), &this->local_addr,
-      &this->remote_addr);
+    num_responses_sent(0), head_link(NULL), tail_link(NULL),
+    paused_by_backend_conns(), pause_start_time(0),
+    output_soft_limit_start_time(0), queued_commands(), deficit(0),
+    scheduled(false), scheduled_it(), num_pending_responses(0),
+    backend_index_to_last_write_time(), subscribed_channels(),
+    subscribed_patterns(), in_transaction(false), transaction_aborted(false),
+    transaction_watch_failed(false), transaction_backend_index(-1),
+    transaction_commands(), pinned_conn(NULL), pin_start_time(0),
+    reply_off(false), reply_skip(false), replies_suppressed(false), id(0),
+    tracking(false), tracking_noloop(false), tracking_redirect_id(-1),
+    tracked_keys() {
+  get_socket_addresses(this->fd, &this->local_addr, &this->remote_addr);
   this->debug_name = render_sockaddr_storage(this->remote_addr) +
-      string_printf("@%d", bufferevent_getfd(this->bev.get()));
+      string_printf("@%d", this->fd);
 }
 
 Client::~Client() {
@@ -114,16 +225,59 @@ Client::~Client() {
 
     l = next_l;
   }
+
+  // if the client is idle, there's no bufferevent to close the socket for us
+  if (!this->bev.get()) {
+    evutil_closesocket(this->fd);
+  }
 }
 
 struct evbuffer* Client::get_output_buffer() {
   return bufferevent_get_output(this->bev.get());
 }
 
+bool Client::is_idle() const {
+  return !this->bev.get();
+}
+
+bool Client::in_subscribe_mode() const {
+  return !this->subscribed_channels.empty() ||
+      !this->subscribed_patterns.empty();
+}
+
+size_t Client::memory_usage() const {
+  // libevent doesn't expose the sizes of its structures, so this is an
+  // estimate. a socket bufferevent contains two events and two evbuffers and
+  // is about 800 bytes with libevent 2.1 on 64-bit systems
+  static const size_t bufferevent_size = 800;
+
+  size_t ret = sizeof(*this) + this->name.capacity() +
+      this->debug_name.capacity();
+  if (this->bev.get()) {
+    ret += bufferevent_size +
+        evbuffer_get_length(bufferevent_get_input(this->bev.get())) +
+        evbuffer_get_length(bufferevent_get_output(this->bev.get()));
+  } else {
+    ret += event_get_struct_event_size();
+  }
+  if (this->parser.command_in_progress.get()) {
+    for (const auto& arg : this->parser.command_in_progress->args) {
+      ret += sizeof(arg) + arg.capacity();
+    }
+  }
+  for (const auto& cmd : this->queued_commands) {
+    for (const auto& arg : cmd->args) {
+      ret += sizeof(arg) + arg.capacity();
+    }
+  }
+  return ret;
+}
+
 void Client::print(FILE* stream, int indent_level) const {
-  fprintf(stream, "Client[name=%s, debug_name=%s, should_disconnect=%s, io_counts=[%zu, %zu], chain=[",
+  fprintf(stream, "Client[name=%s, debug_name=%s, should_disconnect=%s, idle=%s, io_counts=[%zu, %zu], chain=[",
       this->name.c_str(), this->debug_name.c_str(), this->should_disconnect ? "true" : "false",
-      this->num_commands_received, this->num_responses_sent);
+      this->is_idle() ? "true" : "false", this->num_commands_received,
+      this->num_responses_sent);
 
   for (ResponseLink* l = this->head_link; l; l = l->next_client) {
     fputc('\n', stream);
@@ -162,23 +316,42 @@ const char* ResponseLink::name_for_collection_type(CollectionType type) {
       return "ModifyScriptExistsResponse";
     case CollectionType::ModifyMigrateResponse:
       return "ModifyMigrateResponse";
+    case CollectionType::CollectQuorumResponses:
+      return "CollectQuorumResponses";
     default:
       return "UnknownCollectionType";
   }
 }
 
 ResponseLink::ResponseLink(CollectionType type, Client* client) : type(type),
-    client(client), next_client(NULL), backend_conn_to_next_link(),
+    client(client), next_client(NULL), start_time(now()), deadline_timer(),
+    backend_conn_to_next_link(), backend_conn_to_retry_command(),
+    retried(false), spilled(false), replies_suppressed(false), hedge_timer(),
+    hedge_command(),
+    hedge_conn(NULL), script_command(), script_reloaded(false),
+    read_cache_command(), read_cache_generation(0), coalesced_command(),
+    coalesced_links(), coalescing_leader(NULL), batched_links(),
+    batch_link(NULL),
     error_response(), response_to_forward(), response_integer_sum(0),
     expected_response_type(Response::Type::Status), responses(),
-    recombination_queue(), backend_index_to_response(), scan_backend_index(0) {
-  // link this object from the Client
+    recombination_queue(), backend_index_to_response(), scan_backend_index(0),
+    quorum_size(0), blocking_conns() {
+  this->deadline_timer.ctx = this;
+  this->hedge_timer.ctx = this;
+
+  // link this object from the Client. if there's no client, the caller is
+  // responsible for linking it
+  if (!this->client) {
+    return;
+  }
   if (this->client->tail_link) {
     this->client->tail_link->next_client = this;
   } else {
     this->client->head_link = this;
   }
   this->client->tail_link = this;
+  this->client->num_pending_responses++;
+  this->replies_suppressed = this->client->replies_suppressed;
 }
 
 ResponseLink::~ResponseLink() {
@@ -189,7 +362,9 @@ ResponseLink::~ResponseLink() {
 }
 
 bool ResponseLink::is_ready() const {
-  return this->backend_conn_to_next_link.empty();
+  return this->backend_conn_to_next_link.empty() &&
+      this->blocking_conns.empty() && !this->spilled &&
+      !this->coalescing_leader && !this->batch_link;
 }
 
 void ResponseLink::print(FILE* stream, int indent_level) const {
@@ -249,6 +424,15 @@ void ResponseLink::print(FILE* stream, int indent_level) const {
           this->backend_index_to_response.size(),
           this->recombination_queue.size());
       break;
+
+    case CollectionType::CollectQuorumResponses:
+      data += string_printf(", quorum_size=%zu, responses=[", this->quorum_size);
+      for (const auto& r : this->responses) {
+        data += r->format();
+        data += ',';
+      }
+      data += ']';
+      break;
   }
   data += ']';
 
@@ -262,7 +446,33 @@ void ResponseLink::print(FILE* stream, int indent_level) const {
 
 Proxy::Stats::Stats() : num_commands_received(0), num_commands_sent(0),
     num_responses_received(0), num_responses_sent(0),
-    num_connections_received(0), num_clients(0), start_time(now()) { }
+    num_connections_received(0), num_clients(0), num_timeouts(0),
+    num_retries(0), num_retry_failures(0), num_spilled_commands(0),
+    num_replayed_commands(0), num_spill_queue_full_errors(0),
+    num_replica_reads(0), num_hedges_sent(0), num_hedge_wins(0),
+    num_hedges_over_budget(0), num_concurrency_limit_rejects(0),
+    num_replicated_reads(0), num_replicated_writes(0), num_pubsub_channels(0),
+    num_pubsub_patterns(0), num_pubsub_messages_received(0),
+    num_pubsub_messages_sent(0), num_blocking_commands(0),
+    num_blocking_leases(0), num_blocking_conns_leased(0),
+    num_blocking_pool_exhausted(0), num_blocking_cancels(0),
+    num_blocking_requeues(0), num_transactions(0),
+    num_transactions_aborted(0), num_transactions_discarded(0),
+    num_transaction_pins(0), transaction_pin_usecs(0), num_watch_timeouts(0),
+    num_suppressed_replies(0), num_script_loads(0), num_noscript_retries(0),
+    num_read_cache_hits(0), num_read_cache_misses(0), num_coalesced_commands(0),
+    num_batched_gets(0), num_get_batches(0),
+    num_tracking_invalidations(0), num_tracking_flushes(0),
+    num_tracking_messages_sent(0), num_tracking_evictions(0),
+    num_paused_clients(0), num_client_pauses(0),
+    client_pause_usecs(0),
+    num_disconnects_multibulk_length(0), num_disconnects_bulk_length(0),
+    num_disconnects_output_hard_limit(0), num_disconnects_output_soft_limit(0),
+    num_disconnects_idle_timeout(0), num_rejected_connections(0),
+    num_idle_clients(0), response_latency(),
+    tracking_invalidation_lag(), start_time(now()), hot_keys_lock(),
+    hot_keys(HOT_KEY_SKETCH_CAPACITY), last_hot_keys(HOT_KEY_SKETCH_CAPACITY),
+    hot_keys_start_time(now()), last_hot_keys_usecs(0) { }
 
 Proxy::Proxy(int listen_fd, shared_ptr<const ConsistentHashRing> ring,
     int hash_begin_delimiter, int hash_end_delimiter, shared_ptr<Stats> stats,
@@ -271,10 +481,55 @@ Proxy::Proxy(int listen_fd, shared_ptr<const ConsistentHashRing> ring,
     listener(evconnlistener_new(this->base.get(),
         Proxy::dispatch_on_client_accept, this, LEV_OPT_REUSEABLE, 0,
         this->listen_fd), evconnlistener_free),
-    should_exit(false), ring(ring), backends(), name_to_backend(),
-    bev_to_backend_conn(), bev_to_client(), proxy_index(proxy_index),
+    should_exit(false), accepting_clients(true), preconnect_backends(false),
+    ready_fraction(0), ready_timeout_usecs(0), serve_start_time(0),
+    all_backends_connected(false), read_timeout_usecs(0),
+    write_timeout_usecs(0), fanout_timeout_usecs(0), deadlines(1000, now()),
+    deadline_event(event_new(this->base.get(), -1, EV_PERSIST,
+        &Proxy::dispatch_check_deadlines, this), event_free),
+    retry_reads(false), spill_ack_immediately(false), spill_replay_rate(0),
+    spill_replay_event(event_new(this->base.get(), -1, EV_PERSIST,
+        &Proxy::dispatch_replay_spilled_commands, this), event_free),
+    replica_read_policy(ReplicaReadPolicy::LeastOutstanding),
+    read_your_writes_usecs(0), replication_factor(1),
+    key_prefix_to_replication_factor(),
+    write_ack_policy(WriteAckPolicy::Majority), hedge_percentile(0), hedge_budget(0),
+    hedge_tokens(0), read_latency_decay_time(now()),
+    concurrency_limit_max_queued_commands(0), blocking_pool_size(16),
+    watch_timeout_usecs(0),
+    script_cache(new ScriptCache(1024)), read_cache(),
+    read_cache_ttl_usecs(0), read_cache_key_prefixes(), backend_tracking(false),
+    tracking_table_max_keys(0), tracking_forward_channel(
+      tracking_forward_channel_for_proxy_index(proxy_index)),
+    next_client_id(1), id_to_client(), tracked_key_to_clients(),
+    local_write_times(), coalesced_commands(), inflight_reads(),
+    get_batch_max_keys(0), get_batch_window_usecs(0),
+    backend_index_to_get_batch(), get_batch_flush_pending(false),
+    get_batch_event(event_new(this->base.get(), -1, 0,
+        &Proxy::dispatch_send_get_batches, this), event_free),
+    hot_key_sample_rate(0), hot_key_sample_countdown(0),
+    hot_key_interval_usecs(10000000), backend_index_to_hot_key_alarm_rate(),
+    hot_keys(Stats::HOT_KEY_SKETCH_CAPACITY),
+    backend_output_high_watermark(0), backend_output_low_watermark(0),
+    backend_pending_high_watermark(0), backend_pending_low_watermark(0),
+    client_max_multibulk_length(CommandParser().max_multibulk_length),
+    client_max_bulk_length(CommandParser().max_bulk_length),
+    client_output_hard_limit(0), client_output_soft_limit(0),
+    client_output_soft_limit_usecs(0), fair_queue_quantum(0),
+    client_max_inflight_commands(0), scheduled_clients(),
+    fair_queue_run_pending(false),
+    fair_queue_event(event_new(this->base.get(), -1, 0,
+        &Proxy::dispatch_run_fair_queue, this), event_free),
+    client_idle_mode_usecs(0), client_idle_timeout_usecs(0), max_clients(0),
+    accepts_throttled(false), ring(ring),
+    routing_overrides(new RoutingOverrides()), key_to_backend_override(),
+    routing_overrides_version(0), backends(), name_to_backend(),
+    bev_to_backend_conn(), fd_to_client(), channel_to_clients(),
+    pattern_to_clients(), bev_to_subscriber_conn(), bev_to_blocking_conn(),
+    proxy_index(proxy_index),
     stats(stats), hash_begin_delimiter(hash_begin_delimiter),
-    hash_end_delimiter(hash_end_delimiter), handlers(this->default_handlers) {
+    hash_end_delimiter(hash_end_delimiter), rng(random_device()()),
+    handlers(this->default_handlers) {
 
   if (!this->stats.get()) {
     this->stats.reset(new Stats());
@@ -289,12 +544,202 @@ Proxy::Proxy(int listen_fd, shared_ptr<const ConsistentHashRing> ring,
     this->backends.emplace_back(b);
     this->name_to_backend.emplace(b->name, b);
   }
+  this->backend_index_to_hot_key_alarm_rate.resize(this->backends.size(), 0);
 }
 
 bool Proxy::disable_command(const string& command_name) {
   return this->handlers.erase(command_name);
 }
 
+void Proxy::set_auto_eject_ring(shared_ptr<AutoEjectHashRing> ring) {
+  this->auto_eject_ring = ring;
+}
+
+void Proxy::set_routing_overrides(shared_ptr<RoutingOverrides> overrides) {
+  this->routing_overrides = overrides;
+  this->key_to_backend_override.clear();
+  this->routing_overrides_version = 0;
+}
+
+void Proxy::set_preconnect_backends(bool enabled, double ready_fraction,
+    uint64_t ready_timeout_usecs) {
+  this->preconnect_backends = enabled;
+  this->ready_fraction = enabled ? ready_fraction : 0;
+  this->ready_timeout_usecs = ready_timeout_usecs;
+}
+
+void Proxy::set_timeouts(uint64_t read_timeout_usecs,
+    uint64_t write_timeout_usecs, uint64_t fanout_timeout_usecs) {
+  this->read_timeout_usecs = read_timeout_usecs;
+  this->write_timeout_usecs = write_timeout_usecs;
+  this->fanout_timeout_usecs = fanout_timeout_usecs;
+}
+
+void Proxy::set_retry_reads(bool enabled) {
+  this->retry_reads = enabled;
+}
+
+void Proxy::set_spill_queues(const string& filename_prefix, size_t max_size,
+    bool ack_immediately, size_t replay_rate) {
+  this->spill_ack_immediately = ack_immediately;
+  this->spill_replay_rate = replay_rate;
+
+  for (Backend* b : this->backends) {
+    b->spill_queue.reset(new SpillQueue(string_printf("%s-%zu-%s.spill",
+        filename_prefix.c_str(), this->proxy_index, b->name.c_str()),
+        max_size));
+
+    // commands left over from a previous run have no clients waiting for
+    // them, but they still have to be replayed
+    b->spilled_links.assign(b->spill_queue->size(), NULL);
+    if (!b->spill_queue->empty()) {
+      log(INFO, "[thread %zu] recovered %zu spilled commands for backend %s",
+          this->proxy_index, b->spill_queue->size(), b->debug_name.c_str());
+      struct timeval tv = {0, 10000}; // 10ms
+      event_add(this->spill_replay_event.get(), &tv);
+    }
+  }
+}
+
+void Proxy::set_replicas(const unordered_map<string,
+      vector<ConsistentHashRing::Host>>& backend_name_to_replicas,
+    ReplicaReadPolicy policy, uint64_t read_your_writes_usecs) {
+  this->replica_read_policy = policy;
+  this->read_your_writes_usecs = read_your_writes_usecs;
+
+  for (const auto& it : backend_name_to_replicas) {
+    Backend* master = this->name_to_backend.at(it.first);
+    for (const auto& host : it.second) {
+      Backend* replica = new Backend(master->index, host.host, host.port,
+          host.name);
+      replica->master = master;
+      master->replicas.emplace_back(replica);
+    }
+  }
+}
+
+void Proxy::set_hedging(double percentile, double budget_percent) {
+  this->hedge_percentile = percentile;
+  this->hedge_budget = (percentile > 0) ? (budget_percent / 100) : 0;
+}
+
+void Proxy::set_replicated_keyspace(size_t replication_factor,
+    const unordered_map<string, size_t>& key_prefix_to_replication_factor,
+    WriteAckPolicy write_ack_policy) {
+  this->replication_factor = replication_factor ? replication_factor : 1;
+  this->write_ack_policy = write_ack_policy;
+
+  // longer prefixes are checked first, so the most specific one wins
+  this->key_prefix_to_replication_factor.assign(
+      key_prefix_to_replication_factor.begin(),
+      key_prefix_to_replication_factor.end());
+  sort(this->key_prefix_to_replication_factor.begin(),
+      this->key_prefix_to_replication_factor.end(),
+      [](const pair<string, size_t>& a, const pair<string, size_t>& b) {
+    return a.first.size() > b.first.size();
+  });
+}
+
+void Proxy::set_concurrency_limits(size_t initial_limit, size_t min_limit,
+    size_t max_limit, double latency_tolerance, size_t max_queued_commands) {
+  this->concurrency_limit_max_queued_commands = max_queued_commands;
+
+  // replicas have their own limits, since they can be slower or faster than
+  // their masters
+  auto create_limiter = [&](Backend* b) {
+    b->concurrency_limiter.reset(new ConcurrencyLimiter(initial_limit,
+        min_limit, max_limit, latency_tolerance));
+  };
+  for (Backend* b : this->backends) {
+    create_limiter(b);
+    for (Backend* replica : b->replicas) {
+      create_limiter(replica);
+    }
+  }
+}
+
+void Proxy::set_blocking_pool_size(size_t max_connections_per_backend,
+    uint64_t watch_timeout_usecs) {
+  this->blocking_pool_size = max_connections_per_backend;
+  this->watch_timeout_usecs = watch_timeout_usecs;
+}
+
+void Proxy::set_script_cache(shared_ptr<ScriptCache> script_cache) {
+  this->script_cache = script_cache;
+}
+
+void Proxy::set_read_cache(size_t max_bytes, uint64_t ttl_usecs,
+    const vector<string>& key_prefixes) {
+  this->read_cache.set_max_bytes(max_bytes);
+  this->read_cache_ttl_usecs = ttl_usecs;
+  this->read_cache_key_prefixes = key_prefixes;
+}
+
+void Proxy::set_backend_tracking(bool enabled, size_t table_max_keys) {
+  this->backend_tracking = enabled;
+  this->tracking_table_max_keys = table_max_keys;
+}
+
+void Proxy::set_coalesced_commands(const vector<string>& commands) {
+  this->coalesced_commands.clear();
+  for (string command : commands) {
+    for (char& ch : command) {
+      ch = toupper(ch);
+    }
+    this->coalesced_commands.emplace(command);
+  }
+}
+
+void Proxy::set_get_batching(size_t max_keys, uint64_t window_usecs) {
+  this->get_batch_max_keys = max_keys;
+  this->get_batch_window_usecs = window_usecs;
+}
+
+void Proxy::set_hot_key_sampling(size_t sample_rate, uint64_t interval_usecs,
+    double alarm_rate,
+    const unordered_map<string, double>& backend_name_to_alarm_rate) {
+  this->hot_key_sample_rate = sample_rate;
+  this->hot_key_sample_countdown = sample_rate;
+  this->hot_key_interval_usecs = interval_usecs;
+  this->backend_index_to_hot_key_alarm_rate.clear();
+  this->backend_index_to_hot_key_alarm_rate.resize(this->backends.size(),
+      alarm_rate);
+  for (const auto& it : backend_name_to_alarm_rate) {
+    this->backend_index_to_hot_key_alarm_rate[
+        this->name_to_backend.at(it.first)->index] = it.second;
+  }
+}
+
+void Proxy::set_backpressure_watermarks(size_t output_high, size_t output_low,
+    size_t pending_high, size_t pending_low) {
+  this->backend_output_high_watermark = output_high;
+  this->backend_output_low_watermark = output_low;
+  this->backend_pending_high_watermark = pending_high;
+  this->backend_pending_low_watermark = pending_low;
+}
+
+void Proxy::set_client_limits(int64_t max_multibulk_length,
+    int64_t max_bulk_length, size_t output_hard_limit,
+    size_t output_soft_limit, uint64_t output_soft_limit_usecs) {
+  this->client_max_multibulk_length = max_multibulk_length;
+  this->client_max_bulk_length = max_bulk_length;
+  this->client_output_hard_limit = output_hard_limit;
+  this->client_output_soft_limit = output_soft_limit;
+  this->client_output_soft_limit_usecs = output_soft_limit_usecs;
+}
+
+void Proxy::set_fair_queuing(size_t quantum, size_t max_inflight_commands) {
+  this->fair_queue_quantum = quantum;
+  this->client_max_inflight_commands = max_inflight_commands;
+}
+
+void Proxy::set_idle_clients(uint64_t idle_mode_usecs,
+    uint64_t idle_timeout_usecs, size_t max_clients) {
+  this->client_idle_mode_usecs = idle_mode_usecs;
+  this->client_idle_timeout_usecs = idle_timeout_usecs;
+  this->max_clients = max_clients;
+}
+
 void Proxy::serve() {
   struct timeval tv = {1, 0}; // 1 second
 
@@ -302,9 +747,33 @@ void Proxy::serve() {
       &Proxy::dispatch_check_for_thread_exit, this);
   event_add(ev, &tv);
 
+  struct event* backends_ev = event_new(this->base.get(), -1, EV_PERSIST,
+      &Proxy::dispatch_check_backends, this);
+  event_add(backends_ev, &tv);
+
+  struct event* clients_ev = event_new(this->base.get(), -1, EV_PERSIST,
+      &Proxy::dispatch_check_clients, this);
+  event_add(clients_ev, &tv);
+
+  // if preconnecting, don't accept any clients until enough of the backends
+  // are connected (if a ready fraction is given)
+  this->serve_start_time = now();
+  if (this->preconnect_backends) {
+    if (this->ready_fraction > 0) {
+      evconnlistener_disable(this->listener.get());
+      this->accepting_clients = false;
+    }
+    this->connect_all_backends();
+  }
+
   event_base_dispatch(this->base.get());
 
   event_del(ev);
+  event_del(backends_ev);
+  event_del(clients_ev);
+  event_del(this->deadline_event.get());
+  event_del(this->spill_replay_event.get());
+  event_del(this->get_batch_event.get());
 }
 
 void Proxy::stop() {
@@ -319,13 +788,13 @@ void Proxy::print(FILE* stream, int indent_level) const {
   }
 
   fprintf(stream, "Proxy[listen_fd=%d, num_clients=%zu, io_counts=[%zu, %zu, %zu, %zu], clients=[\n",
-      this->listen_fd, this->bev_to_client.size(),
+      this->listen_fd, this->fd_to_client.size(),
       this->stats->num_commands_received.load(),
       this->stats->num_commands_sent.load(),
       this->stats->num_responses_received.load(),
       this->stats->num_responses_sent.load());
 
-  for (const auto& bev_client : this->bev_to_client) {
+  for (const auto& bev_client : this->fd_to_client) {
     print_indent(stream, indent_level + 1);
     bev_client.second.print(stream, indent_level + 1);
     fprintf(stream, ",\n");
@@ -347,7 +816,7 @@ void Proxy::print(FILE* stream, int indent_level) const {
 ////////////////////////////////////////////////////////////////////////////////
 // backend lookups
 
-int64_t Proxy::backend_index_for_key(const string& s) const {
+const char* Proxy::hashed_part_of_key(const string& s, size_t* size) const {
   size_t hash_begin_pos = (this->hash_begin_delimiter >= 0) ?
       s.find(this->hash_begin_delimiter) : 0;
   size_t hash_end_pos = (this->hash_end_delimiter >= 0) ?
@@ -367,8 +836,106 @@ int64_t Proxy::backend_index_for_key(const string& s) const {
     hash_begin_pos = 0;
   }
 
-  return this->ring->host_id_for_key(s.data() + hash_begin_pos,
-      hash_end_pos - hash_begin_pos);
+  *size = hash_end_pos - hash_begin_pos;
+  return s.data() + hash_begin_pos;
+}
+
+int64_t Proxy::backend_override_for_key(const string& s, const char* data,
+    size_t size) const {
+  // this is on the path of every keyed command, so when there are no
+  // overrides it should cost only an atomic load and an emptiness check
+  uint64_t version = this->routing_overrides->version();
+  if (version != this->routing_overrides_version) {
+    this->key_to_backend_override.clear();
+    for (const auto& it : this->routing_overrides->get_all(&version)) {
+      try {
+        this->key_to_backend_override.emplace(it.first,
+            this->name_to_backend.at(it.second)->index);
+      } catch (const out_of_range& e) { }
+    }
+    this->routing_overrides_version = version;
+  }
+  if (this->key_to_backend_override.empty()) {
+    return -1;
+  }
+
+  // an override can name the whole key or its hashed part (hash tag)
+  auto it = this->key_to_backend_override.find(s);
+  if (it != this->key_to_backend_override.end()) {
+    return it->second;
+  }
+  if (size != s.size()) {
+    it = this->key_to_backend_override.find(string(data, size));
+    if (it != this->key_to_backend_override.end()) {
+      return it->second;
+    }
+  }
+  return -1;
+}
+
+int64_t Proxy::backend_index_for_key(const string& s) const {
+  size_t size;
+  const char* data = this->hashed_part_of_key(s, &size);
+  int64_t override_index = this->backend_override_for_key(s, data, size);
+  if (override_index >= 0) {
+    return override_index;
+  }
+  return this->ring->host_id_for_key(data, size);
+}
+
+vector<uint64_t> Proxy::backend_indexes_for_key(const string& s,
+    size_t count) const {
+  size_t size;
+  const char* data = this->hashed_part_of_key(s, &size);
+
+  // overridden keys go to their pinned backend and the ones after it,
+  // skipping any that are ejected (unless they all are)
+  int64_t override_index = this->backend_override_for_key(s, data, size);
+  if (override_index >= 0) {
+    vector<uint64_t> ret;
+    for (size_t x = 0; (x < this->backends.size()) && (ret.size() < count);
+         x++) {
+      uint64_t backend_index = (override_index + x) % this->backends.size();
+      if (!this->auto_eject_ring.get() ||
+          !this->auto_eject_ring->is_ejected(backend_index)) {
+        ret.emplace_back(backend_index);
+      }
+    }
+    if (ret.empty()) {
+      ret.emplace_back(override_index);
+    }
+    return ret;
+  }
+
+  if (this->auto_eject_ring.get()) {
+    return this->auto_eject_ring->host_ids_for_key(data, size, count);
+  }
+  auto* nutcracker_ring = dynamic_cast<const NutcrackerConsistentHashRing*>(
+      this->ring.get());
+  if (nutcracker_ring) {
+    return nutcracker_ring->host_ids_for_key(data, size, count);
+  }
+
+  // other rings don't expose their points, so the successors are just the
+  // next backends in order
+  if (count > this->backends.size()) {
+    count = this->backends.size();
+  }
+  vector<uint64_t> ret;
+  uint64_t backend_index = this->ring->host_id_for_key(data, size);
+  for (size_t x = 0; x < count; x++) {
+    ret.emplace_back((backend_index + x) % this->backends.size());
+  }
+  return ret;
+}
+
+size_t Proxy::replication_factor_for_key(const string& s) const {
+  for (const auto& it : this->key_prefix_to_replication_factor) {
+    if (starts_with(s, it.first)) {
+      return it.second;
+    }
+  }
+  return this->replication_factor;
 }
 
 int64_t Proxy::backend_index_for_argument(const string& arg) const {
@@ -386,6 +953,30 @@ int64_t Proxy::backend_index_for_argument(const string& arg) const {
   }
 }
 
+size_t Proxy::backend_index_for_keyless_command() {
+  // power of two choices: pick two different backends at random and use the
+  // one with fewer pending commands (preferring one that isn't down). this
+  // avoids busy backends almost as well as checking all of them would, without
+  // making every command scan the entire backend list
+  size_t num_backends = this->backends.size();
+  size_t index1 = this->rng() % num_backends;
+  size_t index2 = index1;
+  if (num_backends > 1) {
+    index2 = (index1 + 1 + (this->rng() % (num_backends - 1))) % num_backends;
+  }
+
+  Backend* b1 = this->backends[index1];
+  Backend* b2 = this->backends[index2];
+  Backend* b;
+  if (b1->is_down != b2->is_down) {
+    b = b1->is_down ? b2 : b1;
+  } else {
+    b = (b2->num_pending_commands() < b1->num_pending_commands()) ? b2 : b1;
+  }
+  b->num_keyless_selections++;
+  return b->index;
+}
+
 Backend& Proxy::backend_for_index(size_t index) {
   return *this->backends[index];
 }
@@ -396,17 +987,35 @@ Backend& Proxy::backend_for_key(const string& s) {
 
 BackendConnection& Proxy::backend_conn_for_index(size_t index) {
   Backend& b = this->backend_for_index(index);
-  auto conn_it = b.index_to_connection.begin();
-  if (conn_it != b.index_to_connection.end()) {
-    return conn_it->second;
+  BackendConnection* conn = b.get_active_connection();
+  if (conn) {
+    return *conn;
   }
 
   // there's no open connection for this backend; make a new one
+  return this->connect_backend(b);
+}
+
+BackendConnection& Proxy::backend_conn_for_key(const string& s) {
+  return this->backend_conn_for_index(this->backend_index_for_key(s));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// connection management
+
+BackendConnection& Proxy::connect_backend(Backend& b) {
   unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev(
       bufferevent_socket_new(this->base.get(), -1, BEV_OPT_CLOSE_ON_FREE),
       bufferevent_free);
-  bufferevent_setcb(bev.get(), Proxy::dispatch_on_backend_input, NULL,
-      Proxy::dispatch_on_backend_error, this);
+  bufferevent_setcb(bev.get(), Proxy::dispatch_on_backend_input,
+      Proxy::dispatch_on_backend_output, Proxy::dispatch_on_backend_error,
+      this);
+  // the output callback is called when the output buffer drains to the low
+  // watermark, so paused clients can be resumed
+  bufferevent_setwatermark(bev.get(), EV_WRITE,
+      this->backend_output_low_watermark, 0);
   evbuffer_defer_callbacks(bufferevent_get_output(bev.get()), this->base.get());
 
   // connect to the backend (nonblocking)
@@ -414,6 +1023,10 @@ BackendConnection& Proxy::backend_conn_for_index(size_t index) {
   if (bufferevent_socket_connect(bev.get(), (struct sockaddr*)&s.first,
       s.second) < 0) {
     string error = string_for_error(errno);
+    if (this->auto_eject_ring.get() && !b.master) {
+      this->auto_eject_ring->report_failure(b.index);
+    }
+    b.is_down = true;
     throw runtime_error(string_printf(
         "error: can\'t connect to backend %s:%d (errno=%d) (%s)\n",
         b.host.c_str(), b.port, errno, error.c_str()));
@@ -432,33 +1045,225 @@ BackendConnection& Proxy::backend_conn_for_index(size_t index) {
   return conn;
 }
 
-BackendConnection& Proxy::backend_conn_for_key(const string& s) {
-  return this->backend_conn_for_index(this->backend_index_for_key(s));
+void Proxy::connect_all_backends() {
+  // connections are nonblocking, so this starts all of them in parallel. the
+  // connections are usable as soon as they're created (commands are buffered
+  // until the connect completes), but we track when each one actually connects
+  // so we know when the thread is ready
+  auto connect = [&](Backend* b) {
+    if (b->get_active_connection()) {
+      return;
+    }
+    try {
+      this->connect_backend(*b);
+    } catch (const exception& e) {
+      log(WARNING, "failed to preconnect to backend %s: %s",
+          b->debug_name.c_str(), e.what());
+    }
+  };
+  for (Backend* b : this->backends) {
+    connect(b);
+    for (Backend* replica : b->replicas) {
+      connect(replica);
+    }
+  }
+}
+
+size_t Proxy::num_connected_backends() const {
+  size_t ret = 0;
+  for (const Backend* b : this->backends) {
+    for (const auto& conn_it : b->index_to_connection) {
+      if (conn_it.second.connected) {
+        ret++;
+        break;
+      }
+    }
+  }
+  return ret;
 }
 
+void Proxy::check_ready_to_accept(bool timed_out) {
+  if (this->accepting_clients) {
+    return;
+  }
 
+  size_t num_connected = this->num_connected_backends();
+  size_t num_required = ceil(this->ready_fraction * this->backends.size());
+  if (!timed_out && (num_connected < num_required)) {
+    return;
+  }
 
-////////////////////////////////////////////////////////////////////////////////
-// connection management
+  uint64_t time_to_ready = now() - this->serve_start_time;
+  if (timed_out) {
+    log(WARNING, "[thread %zu] accepting clients with only %zu/%zu backends connected after %" PRIu64 "ms",
+        this->proxy_index, num_connected, this->backends.size(),
+        time_to_ready / 1000);
+  } else {
+    log(INFO, "[thread %zu] ready with %zu/%zu backends connected after %" PRIu64 "ms",
+        this->proxy_index, num_connected, this->backends.size(),
+        time_to_ready / 1000);
+  }
+
+  evconnlistener_enable(this->listener.get());
+  this->accepting_clients = true;
+}
+
+unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>
+Proxy::create_client_bev(int fd) {
+  unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev(
+      bufferevent_socket_new(this->base.get(), fd, BEV_OPT_CLOSE_ON_FREE),
+      bufferevent_free);
+  evbuffer_defer_callbacks(bufferevent_get_output(bev.get()), this->base.get());
+  bufferevent_setcb(bev.get(), Proxy::dispatch_on_client_input, NULL,
+      Proxy::dispatch_on_client_error, this);
+  return bev;
+}
 
 void Proxy::disconnect_client(Client* c) {
-  auto bev_it = this->bev_to_client.find(c->bev.get());
-  assert((bev_it != this->bev_to_client.end()) && (&bev_it->second == c));
-  this->bev_to_client.erase(bev_it);
+  auto client_it = this->fd_to_client.find(c->fd);
+  assert((client_it != this->fd_to_client.end()) && (&client_it->second == c));
+
+  if (c->is_idle()) {
+    this->stats->num_idle_clients--;
+  }
+
+  // if the client is paused, take it out of the backends' paused lists
+  for (BackendConnection* conn : c->paused_by_backend_conns) {
+    conn->paused_clients.erase(c);
+  }
+  c->paused_by_backend_conns.clear();
+  this->unpause_client(c);
+
+  if (c->scheduled) {
+    this->scheduled_clients.erase(c->scheduled_it);
+    c->scheduled = false;
+  }
+
+  // blocking commands can't be answered anymore. their connections are
+  // unblocked and go back to the pool, as does a connection pinned for a
+  // transaction (links waiting on a pinned connection aren't cancelled; their
+  // responses are discarded when they arrive)
+  for (ResponseLink* l = c->head_link; l; l = l->next_client) {
+    if (!l->blocking_conns.empty() &&
+        ((*l->blocking_conns.begin())->link == l)) {
+      this->cancel_blocking_link(l);
+    }
+  }
+  this->unpin_transaction_conn(c, true);
+
+  // the client's subscriptions are dropped upstream if it was the last local
+  // subscriber
+  while (!c->subscribed_channels.empty()) {
+    string channel = *c->subscribed_channels.begin();
+    this->unsubscribe_client(c, channel, false);
+  }
+  while (!c->subscribed_patterns.empty()) {
+    string pattern = *c->subscribed_patterns.begin();
+    this->unsubscribe_client(c, pattern, true);
+  }
+  this->stop_client_tracking(c);
+  this->id_to_client.erase(c->id);
+
+  this->fd_to_client.erase(client_it);
   this->stats->num_clients--;
+  this->update_accept_throttling();
   // the Client destructor will close the connection and unlink any ResponseLink
   // objects appropriately
 }
 
+void Proxy::disconnect_client_later(Client* c) {
+  // this is for when we can't delete the Client right now because the caller
+  // may still be using it. stop reading commands from it and disconnect it
+  // from the event loop
+  if (!c->should_disconnect) {
+    c->should_disconnect = true;
+    bufferevent_disable(c->bev.get(), EV_READ);
+    bufferevent_trigger_event(c->bev.get(), BEV_EVENT_EOF,
+        BEV_TRIG_DEFER_CALLBACKS);
+  }
+}
+
+void Proxy::check_client_output_limits(Client* c) {
+  if (c->should_disconnect ||
+      (!this->client_output_hard_limit && !this->client_output_soft_limit)) {
+    return;
+  }
+
+  size_t size = evbuffer_get_length(c->get_output_buffer());
+  if (this->client_output_hard_limit &&
+      (size > this->client_output_hard_limit)) {
+    log(WARNING, "disconnecting client %s: output buffer size %zu is over the hard limit",
+        c->debug_name.c_str(), size);
+    this->stats->num_disconnects_output_hard_limit++;
+    this->disconnect_client_later(c);
+    return;
+  }
+
+  if (!this->client_output_soft_limit ||
+      (size <= this->client_output_soft_limit)) {
+    c->output_soft_limit_start_time = 0;
+    return;
+  }
+
+  uint64_t t = now();
+  if (!c->output_soft_limit_start_time) {
+    c->output_soft_limit_start_time = t;
+  }
+  if (t - c->output_soft_limit_start_time >=
+      this->client_output_soft_limit_usecs) {
+    log(WARNING, "disconnecting client %s: output buffer size %zu has been over the soft limit for %" PRIu64 "ms",
+        c->debug_name.c_str(), size,
+        (t - c->output_soft_limit_start_time) / 1000);
+    this->stats->num_disconnects_output_soft_limit++;
+    this->disconnect_client_later(c);
+  }
+}
+
 void Proxy::disconnect_backend(BackendConnection* conn) {
   // issue a fake error response to all waiting clients
   static shared_ptr<Response> error_response(new Response(
       Response::Type::Error,
       "CHANNELERROR backend disconnected before sending the response"));
+
+  // resend what we can on another connection first. this must happen before
+  // any error responses are handled below, since that can send ready
+  // responses to clients, and a link that was removed from this connection
+  // but not yet linked to another one would look ready
+  conn->draining = true;
+
+  // hedged reads that are also waiting on another connection will get their
+  // response from there
+  ResponseLink* prev_l = NULL;
+  for (ResponseLink* l = conn->head_link; l;) {
+    ResponseLink* next_l = l->backend_conn_to_next_link.at(conn);
+    if (l->hedge_conn && (l->backend_conn_to_next_link.size() > 1)) {
+      this->unlink_backend_conn(conn, prev_l, l);
+      l->hedge_conn = NULL;
+    } else {
+      prev_l = l;
+    }
+    l = next_l;
+  }
+
+  if (this->retry_reads) {
+    this->retry_read_only_links(conn);
+  }
+
   while (conn->head_link) {
+    if (conn->head_link->retried) {
+      this->stats->num_retry_failures++;
+    }
     this->handle_backend_response(conn, error_response);
   }
 
+  // there's no point in waiting for this connection to drain anymore
+  this->resume_paused_clients(conn);
+
+  // keys that were read on this connection won't be invalidated anymore
+  if (conn->tracking) {
+    this->flush_tracking();
+  }
+
   // remove the bev -> BackendConnection reference before deleting the
   // connection itself
   this->bev_to_backend_conn.erase(conn->bev.get());
@@ -469,41 +1274,1756 @@ void Proxy::disconnect_backend(BackendConnection* conn) {
   conn->backend->index_to_connection.erase(conn->index);
 }
 
+void Proxy::count_backend_response(BackendConnection* conn,
+    const ResponseLink* l) {
+  conn->num_responses_received++;
+  conn->backend->num_responses_received++;
+  this->stats->num_responses_received++;
 
+  if (this->auto_eject_ring.get() && l && !conn->backend->master) {
+    this->auto_eject_ring->report_success(conn->backend->index,
+        now() - l->start_time);
+  }
 
-////////////////////////////////////////////////////////////////////////////////
-// response linking
+  // hedgeable reads determine the hedge delay for their backend. (the losers
+  // of hedges don't count, since their responses go to placeholder links)
+  if (l && l->hedge_command) {
+    Backend* master = conn->backend->master ? conn->backend->master :
+        conn->backend;
+    master->read_latency.add(now() - l->start_time);
+  }
 
-ResponseLink* Proxy::create_link(CollectionType type, Client* c) {
-  return new ResponseLink(type, c);
+  // responses arrive in the same order the commands were sent, so this is the
+  // response to the oldest command in send_times
+  if (!conn->send_times.empty()) {
+    conn->backend->concurrency_limiter->on_response(
+        now() - conn->send_times.front(),
+        this->backend_conn_in_flight(conn) + 1);
+    conn->send_times.pop_front();
+  }
 }
 
-ResponseLink* Proxy::create_error_link(Client* c, shared_ptr<Response> r) {
-  ResponseLink* l = new ResponseLink(CollectionType::ForwardResponse, c);
-  l->error_response = r;
-  return l;
+bool Proxy::backend_conn_above_high_watermark(BackendConnection* conn) {
+  if (this->backend_output_high_watermark &&
+      (evbuffer_get_length(conn->get_output_buffer()) >
+        this->backend_output_high_watermark)) {
+    return true;
+  }
+  return this->backend_pending_high_watermark &&
+      (conn->num_commands_sent - conn->num_responses_received >
+        this->backend_pending_high_watermark);
 }
 
-struct evbuffer* Proxy::can_send_command(BackendConnection* conn,
-    ResponseLink* l) {
-  assert(!l->backend_conn_to_next_link.count(conn));
-
-  if (l->error_response.get()) {
-    return NULL;
+bool Proxy::backend_conn_below_low_watermark(BackendConnection* conn) {
+  if (this->backend_output_high_watermark &&
+      (evbuffer_get_length(conn->get_output_buffer()) >
+        this->backend_output_low_watermark)) {
+    return false;
   }
+  return !this->backend_pending_high_watermark ||
+      (conn->num_commands_sent - conn->num_responses_received <=
+        this->backend_pending_low_watermark);
+}
 
-  if (!conn) {
-    static shared_ptr<Response> r(new Response(Response::Type::Error,
-        "CHANNELERROR backend is missing"));
-    l->error_response = r;
-    return NULL;
+void Proxy::pause_client(Client* c, BackendConnection* conn) {
+  if (c->paused_by_backend_conns.empty()) {
+    bufferevent_disable(c->bev.get(), EV_READ);
+    c->pause_start_time = now();
+    this->stats->num_paused_clients++;
+    this->stats->num_client_pauses++;
   }
+  c->paused_by_backend_conns.emplace(conn);
+  conn->paused_clients.emplace(c);
+}
 
-  struct evbuffer* out = conn->get_output_buffer();
-  if (!out) {
-    static shared_ptr<Response> r(new Response(Response::Type::Error,
-        "CHANNELERROR backend is not connected"));
-    l->error_response = r;
+void Proxy::resume_paused_clients(BackendConnection* conn) {
+  unordered_set<Client*> clients;
+  clients.swap(conn->paused_clients);
+  for (Client* c : clients) {
+    c->paused_by_backend_conns.erase(conn);
+    if (c->paused_by_backend_conns.empty()) {
+      this->unpause_client(c);
+      this->resume_reading(c);
+    }
+  }
+}
+
+void Proxy::unpause_client(Client* c) {
+  if (c->pause_start_time) {
+    this->stats->num_paused_clients--;
+    this->stats->client_pause_usecs += now() - c->pause_start_time;
+    c->pause_start_time = 0;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// concurrency limits
+
+size_t Proxy::backend_conn_in_flight(const BackendConnection* conn) const {
+  return conn->num_commands_sent - conn->num_responses_received -
+      conn->queued_command_sizes.size();
+}
+
+struct evbuffer* Proxy::backend_conn_command_buffer(BackendConnection* conn) {
+  // commands over the backend's concurrency limit are written to the queued
+  // output buffer instead of the bufferevent. once any command is queued, all
+  // later commands have to be queued too so they're sent in order
+  ConcurrencyLimiter* limiter = conn->backend->concurrency_limiter.get();
+  if (!limiter || (conn->queued_command_sizes.empty() &&
+      (this->backend_conn_in_flight(conn) < limiter->limit()))) {
+    return conn->get_output_buffer();
+  }
+  if (!conn->queued_output.get()) {
+    conn->queued_output.reset(evbuffer_new());
+  }
+  return conn->queued_output.get();
+}
+
+void Proxy::send_queued_commands(BackendConnection* conn) {
+  // this is called after responses are received, which make room under the
+  // limit. it's also fine to call on draining connections; their queued
+  // commands still have to be sent so their links get responses
+  if (conn->queued_command_sizes.empty()) {
+    return;
+  }
+  ConcurrencyLimiter* limiter = conn->backend->concurrency_limiter.get();
+  struct evbuffer* out = conn->get_output_buffer();
+  uint64_t t = now();
+  while (!conn->queued_command_sizes.empty() &&
+         (this->backend_conn_in_flight(conn) < limiter->limit())) {
+    size_t size = conn->queued_command_sizes.front();
+    evbuffer_remove_buffer(conn->queued_output.get(), out, size);
+    conn->queued_command_sizes.pop_front();
+    conn->queued_bytes -= size;
+    conn->send_times.emplace_back(t);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// pub/sub
+
+SubscriberConnection* Proxy::subscriber_conn_for_backend(Backend& b) {
+  if (b.subscriber_conn.get()) {
+    return b.subscriber_conn.get();
+  }
+
+  unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev(
+      bufferevent_socket_new(this->base.get(), -1, BEV_OPT_CLOSE_ON_FREE),
+      bufferevent_free);
+  bufferevent_setcb(bev.get(), Proxy::dispatch_on_subscriber_input, NULL,
+      Proxy::dispatch_on_subscriber_error, this);
+
+  // if this fails, sync_subscriptions will try again later
+  auto s = make_sockaddr_storage(b.host, b.port);
+  if (bufferevent_socket_connect(bev.get(), (struct sockaddr*)&s.first,
+      s.second) < 0) {
+    string error = string_for_error(errno);
+    log(WARNING, "can\'t open subscriber connection to backend %s (%s)",
+        b.debug_name.c_str(), error.c_str());
+    return NULL;
+  }
+  bufferevent_enable(bev.get(), EV_READ | EV_WRITE);
+
+  b.subscriber_conn.reset(new SubscriberConnection(&b, move(bev)));
+  this->bev_to_subscriber_conn[b.subscriber_conn->bev.get()] =
+      b.subscriber_conn.get();
+
+  // with backend tracking, this connection receives the invalidations for all
+  // of the backend's other connections. its id has to be requested before it
+  // enters subscribe mode
+  if (this->backend_tracking) {
+    b.subscriber_conn->awaiting_client_id = true;
+    b.subscriber_conn->send_command("CLIENT", "ID");
+    this->subscribe_upstream(b, tracking_invalidation_channel, false);
+  }
+  return b.subscriber_conn.get();
+}
+
+void Proxy::disconnect_subscriber(SubscriberConnection* conn) {
+  // the subscriptions are still in channel_to_clients and pattern_to_clients,
+  // so sync_subscriptions will make them again on a new connection. messages
+  // published in the meantime are lost
+  this->bev_to_subscriber_conn.erase(conn->bev.get());
+
+  // the backend's connections can't deliver invalidations anymore, so nothing
+  // that was read on them can be trusted. they're redirected to the new
+  // subscriber connection when it gets its id
+  bool was_tracking = (conn->client_id >= 0);
+  Backend* b = conn->backend;
+  b->subscriber_conn.reset();
+  if (this->backend_tracking && was_tracking) {
+    for (auto& it : b->index_to_connection) {
+      it.second.tracking = false;
+    }
+    this->flush_tracking();
+  }
+}
+
+void Proxy::subscribe_upstream(Backend& b, const string& name, bool pattern) {
+  SubscriberConnection* conn = this->subscriber_conn_for_backend(b);
+  if (!conn) {
+    return;
+  }
+  auto& names = pattern ? conn->patterns : conn->channels;
+  if (names.emplace(name).second) {
+    conn->send_command(pattern ? "PSUBSCRIBE" : "SUBSCRIBE", name);
+  }
+}
+
+void Proxy::unsubscribe_upstream(Backend& b, const string& name,
+    bool pattern) {
+  SubscriberConnection* conn = b.subscriber_conn.get();
+  if (!conn) {
+    return;
+  }
+  auto& names = pattern ? conn->patterns : conn->channels;
+  if (names.erase(name)) {
+    conn->send_command(pattern ? "PUNSUBSCRIBE" : "UNSUBSCRIBE", name);
+  }
+}
+
+bool Proxy::subscribe_client(Client* c, const string& name, bool pattern) {
+  auto& client_names = pattern ? c->subscribed_patterns : c->subscribed_channels;
+  if (!client_names.emplace(name).second) {
+    return false;
+  }
+
+  // only the first local subscriber causes a subscription on the backend(s).
+  // with backend tracking, the proxy generates the invalidation messages for
+  // its clients, so the invalidation channel isn't subscribed to for them
+  auto& name_to_clients = pattern ? this->pattern_to_clients :
+      this->channel_to_clients;
+  auto& clients = name_to_clients[name];
+  clients.emplace(c);
+  if ((clients.size() == 1) && (pattern || !this->backend_tracking ||
+      (name != tracking_invalidation_channel))) {
+    if (pattern) {
+      this->stats->num_pubsub_patterns++;
+      for (Backend* b : this->backends) {
+        this->subscribe_upstream(*b, name, true);
+      }
+    } else {
+      this->stats->num_pubsub_channels++;
+      this->subscribe_upstream(this->backend_for_key(name), name, false);
+    }
+  }
+  return true;
+}
+
+bool Proxy::unsubscribe_client(Client* c, const string& name, bool pattern) {
+  auto& client_names = pattern ? c->subscribed_patterns : c->subscribed_channels;
+  if (!client_names.erase(name)) {
+    return false;
+  }
+
+  auto& name_to_clients = pattern ? this->pattern_to_clients :
+      this->channel_to_clients;
+  auto clients_it = name_to_clients.find(name);
+  clients_it->second.erase(c);
+  if (!clients_it->second.empty()) {
+    return true;
+  }
+  name_to_clients.erase(clients_it);
+
+  // that was the last local subscriber. a channel may have moved between
+  // backends since it was subscribed to, so check all of them
+  if (pattern) {
+    this->stats->num_pubsub_patterns--;
+  } else if (this->backend_tracking &&
+      (name == tracking_invalidation_channel)) {
+    return true;
+  } else {
+    this->stats->num_pubsub_channels--;
+  }
+  for (Backend* b : this->backends) {
+    this->unsubscribe_upstream(*b, name, pattern);
+  }
+  return true;
+}
+
+void Proxy::sync_subscriptions() {
+  // resubscribe on connections that were lost, and move channels that the ring
+  // now maps to a different backend (e.g. if a backend was ejected), so they
+  // follow PUBLISH
+  for (const auto& it : this->channel_to_clients) {
+    if (!this->backend_tracking || (it.first != tracking_invalidation_channel)) {
+      this->sync_channel_subscription(it.first);
+    }
+  }
+  for (const auto& it : this->pattern_to_clients) {
+    for (Backend* b : this->backends) {
+      this->subscribe_upstream(*b, it.first, true);
+    }
+  }
+
+  // with backend tracking, every backend (including replicas) needs a
+  // subscriber connection to receive invalidations, and invalidations for
+  // clients on this thread can be forwarded from other threads
+  if (this->backend_tracking) {
+    for (Backend* b : this->backends) {
+      this->subscriber_conn_for_backend(*b);
+      for (Backend* replica : b->replicas) {
+        this->subscriber_conn_for_backend(*replica);
+      }
+    }
+    this->sync_channel_subscription(this->tracking_forward_channel);
+  }
+}
+
+void Proxy::sync_channel_subscription(const string& channel) {
+  Backend& b = this->backend_for_key(channel);
+  if (b.subscriber_conn.get() && b.subscriber_conn->channels.count(channel)) {
+    return;
+  }
+  for (Backend* other_b : this->backends) {
+    if (other_b != &b) {
+      this->unsubscribe_upstream(*other_b, channel, false);
+    }
+  }
+  this->subscribe_upstream(b, channel, false);
+}
+
+void Proxy::send_client_push(Client* c, shared_ptr<Response> r) {
+  // if the client is still waiting for earlier responses, this has to wait
+  // behind them
+  if (c->tail_link) {
+    ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+    l->response_to_forward = r;
+  } else {
+    this->send_client_response(c, r);
+    this->check_client_output_limits(c);
+  }
+}
+
+void Proxy::handle_subscriber_message(SubscriberConnection* conn,
+    shared_ptr<Response> r) {
+  // the first response on a tracking subscriber connection is its id. the
+  // backend's other connections can redirect their invalidations here now
+  if (conn->awaiting_client_id) {
+    conn->awaiting_client_id = false;
+    if (r->type != Response::Type::Integer) {
+      log(WARNING, "can\'t get id of subscriber connection to backend %s; invalidations are disabled",
+          conn->backend->debug_name.c_str());
+      return;
+    }
+    conn->client_id = r->int_value;
+    for (auto& it : conn->backend->index_to_connection) {
+      this->enable_backend_tracking(&it.second);
+    }
+    return;
+  }
+
+  if (r->type == Response::Type::Error) {
+    log(WARNING, "subscriber connection to backend %s returned an error: %s",
+        conn->backend->debug_name.c_str(), r->data.c_str());
+    return;
+  }
+
+  // messages are ["message", channel, data] or
+  // ["pmessage", pattern, channel, data]. anything else is a confirmation of
+  // one of our own commands, and is ignored
+  if ((r->type != Response::Type::Multi) || (r->fields.size() < 3) ||
+      (r->fields[0]->type != Response::Type::Data)) {
+    return;
+  }
+  const string& kind = r->fields[0]->data;
+  const unordered_map<string, unordered_set<Client*>>* name_to_clients;
+  if ((kind == "message") && (r->fields.size() == 3)) {
+    name_to_clients = &this->channel_to_clients;
+  } else if ((kind == "pmessage") && (r->fields.size() == 4)) {
+    name_to_clients = &this->pattern_to_clients;
+  } else {
+    return;
+  }
+  conn->num_messages_received++;
+  this->stats->num_pubsub_messages_received++;
+
+  if (this->backend_tracking && (kind == "message")) {
+    if (r->fields[1]->data == tracking_invalidation_channel) {
+      this->handle_tracking_invalidation(r->fields[2]);
+      return;
+    }
+    if (r->fields[1]->data == this->tracking_forward_channel) {
+      this->handle_forwarded_invalidation(r->fields[2]->data);
+      return;
+    }
+  }
+
+  auto clients_it = name_to_clients->find(r->fields[1]->data);
+  if (clients_it == name_to_clients->end()) {
+    return; // we unsubscribed after the message was sent
+  }
+  for (Client* c : clients_it->second) {
+    this->send_client_push(c, r);
+    this->stats->num_pubsub_messages_sent++;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// blocking commands
+
+BlockingConnection* Proxy::lease_blocking_conn(Backend& b) {
+  BlockingConnection* conn;
+  if (!b.idle_blocking_conns.empty()) {
+    conn = b.idle_blocking_conns.back();
+    b.idle_blocking_conns.pop_back();
+
+  } else if (b.index_to_blocking_connection.size() < this->blocking_pool_size) {
+    unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev(
+        bufferevent_socket_new(this->base.get(), -1, BEV_OPT_CLOSE_ON_FREE),
+        bufferevent_free);
+    bufferevent_setcb(bev.get(), Proxy::dispatch_on_blocking_input, NULL,
+        Proxy::dispatch_on_blocking_error, this);
+
+    auto s = make_sockaddr_storage(b.host, b.port);
+    if (bufferevent_socket_connect(bev.get(), (struct sockaddr*)&s.first,
+        s.second) < 0) {
+      string error = string_for_error(errno);
+      throw runtime_error(string_printf(
+          "can\'t connect to backend %s:%d (errno=%d) (%s)", b.host.c_str(),
+          b.port, errno, error.c_str()));
+    }
+    bufferevent_enable(bev.get(), EV_READ | EV_WRITE);
+
+    conn = &b.index_to_blocking_connection.emplace(piecewise_construct,
+        forward_as_tuple(b.next_blocking_connection_index),
+        forward_as_tuple(&b, b.next_blocking_connection_index, move(bev))).first->second;
+    b.next_blocking_connection_index++;
+    this->bev_to_blocking_conn[conn->bev.get()] = conn;
+
+    // get the connection's id first, so its command can be cancelled later
+    static const string client_str("CLIENT");
+    static const string id_str("ID");
+    ReferenceCommand cmd(2);
+    cmd.args.emplace_back(client_str);
+    cmd.args.emplace_back(id_str);
+    cmd.write(bufferevent_get_output(conn->bev.get()));
+    conn->awaiting_client_id = true;
+
+  } else {
+    b.num_blocking_pool_exhausted++;
+    this->stats->num_blocking_pool_exhausted++;
+    return NULL;
+  }
+
+  conn->leased = true;
+  b.num_blocking_leases++;
+  this->stats->num_blocking_leases++;
+  this->stats->num_blocking_conns_leased++;
+  return conn;
+}
+
+void Proxy::release_blocking_conn(BlockingConnection* conn) {
+  conn->leased = false;
+  conn->link = NULL;
+  conn->command_name.clear();
+  conn->cancel_time = 0;
+  conn->backend->idle_blocking_conns.emplace_back(conn);
+  this->stats->num_blocking_conns_leased--;
+}
+
+void Proxy::disconnect_blocking_conn(BlockingConnection* conn) {
+  Backend* b = conn->backend;
+  vector<ResponseLink*> links;
+  if (conn->link) {
+    links.emplace_back(conn->link);
+  }
+  for (ResponseLink* l : conn->pinned_links) {
+    if (l) {
+      links.emplace_back(l);
+    }
+  }
+
+  // if the connection was pinned for a transaction, the keys the client was
+  // watching are no longer watched, so its transaction has to fail
+  if (conn->pinned_client) {
+    Client* c = conn->pinned_client;
+    c->pinned_conn = NULL;
+    c->transaction_watch_failed = true;
+    this->stats->transaction_pin_usecs += now() - c->pin_start_time;
+  }
+
+  if (conn->leased) {
+    this->stats->num_blocking_conns_leased--;
+  } else {
+    auto it = find(b->idle_blocking_conns.begin(), b->idle_blocking_conns.end(),
+        conn);
+    if (it != b->idle_blocking_conns.end()) {
+      b->idle_blocking_conns.erase(it);
+    }
+  }
+
+  this->bev_to_blocking_conn.erase(conn->bev.get());
+  b->index_to_blocking_connection.erase(conn->index);
+
+  // if this was the last connection a command was waiting on, it failed
+  static shared_ptr<Response> error_response(new Response(
+      Response::Type::Error,
+      "CHANNELERROR backend disconnected before sending the response"));
+  for (ResponseLink* l : links) {
+    l->blocking_conns.erase(conn);
+    if (!l->blocking_conns.empty()) {
+      continue;
+    }
+    l->error_response = error_response;
+    if (l->client) {
+      this->send_all_ready_responses(l->client);
+    } else if (l->is_ready()) {
+      delete l;
+    }
+  }
+}
+
+void Proxy::send_blocking_commands(Client* c,
+    unordered_map<size_t, ReferenceCommand>& backend_index_to_command) {
+  static shared_ptr<Response> pool_exhausted_response(new Response(
+      Response::Type::Error,
+      "PROXYERROR too many blocking commands are waiting on the backend"));
+
+  // lease a connection on every backend before sending anything, so the
+  // command goes to all of them or none of them
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+  vector<pair<BlockingConnection*, const ReferenceCommand*>> leases;
+  try {
+    for (const auto& it : backend_index_to_command) {
+      BlockingConnection* conn = this->lease_blocking_conn(
+          this->backend_for_index(it.first));
+      if (!conn) {
+        l->error_response = pool_exhausted_response;
+        break;
+      }
+      leases.emplace_back(conn, &it.second);
+    }
+  } catch (const exception& e) {
+    for (const auto& lease : leases) {
+      this->release_blocking_conn(lease.first);
+    }
+    throw;
+  }
+  if (l->error_response) {
+    for (const auto& lease : leases) {
+      this->release_blocking_conn(lease.first);
+    }
+    return;
+  }
+
+  for (const auto& lease : leases) {
+    BlockingConnection* conn = lease.first;
+    const ReferenceCommand* cmd = lease.second;
+    cmd->write(bufferevent_get_output(conn->bev.get()));
+    conn->link = l;
+    conn->command_name.assign(
+        reinterpret_cast<const char*>(cmd->args[0].data), cmd->args[0].size);
+    l->blocking_conns.emplace(conn);
+  }
+  this->stats->num_blocking_commands++;
+}
+
+void Proxy::cancel_blocking_conn(BlockingConnection* conn) {
+  conn->link = NULL;
+  if (!conn->cancel_time) {
+    conn->cancel_time = now();
+    this->stats->num_blocking_cancels++;
+  }
+
+  // the connection is blocked, so CLIENT UNBLOCK has to go on another one. if
+  // the id isn't known yet, this is called again when it arrives. if it's
+  // never known, check_backends closes the connection instead
+  if (conn->client_id >= 0) {
+    static const string client_str("CLIENT");
+    static const string unblock_str("UNBLOCK");
+    string id_str = string_printf("%" PRId64, conn->client_id);
+    ReferenceCommand cmd(3);
+    cmd.args.emplace_back(client_str);
+    cmd.args.emplace_back(unblock_str);
+    cmd.args.emplace_back(id_str);
+    this->send_background_command(*conn->backend, &cmd);
+  }
+}
+
+void Proxy::cancel_blocking_link(ResponseLink* l) {
+  for (BlockingConnection* conn : l->blocking_conns) {
+    this->cancel_blocking_conn(conn);
+  }
+  l->blocking_conns.clear();
+}
+
+void Proxy::requeue_blocking_response(Backend* b, const string& command_name,
+    shared_ptr<Response> r) {
+  // a cancelled pop can still return an element if it was pushed before the
+  // cancellation arrived. put it back where it came from so it isn't lost.
+  // (BRPOPLPUSH has already moved its element, XREAD doesn't remove anything,
+  // and XREADGROUP's entries stay in the group's pending list)
+  if ((r->type != Response::Type::Multi) || (r->int_value < 0)) {
+    return;
+  }
+  for (const auto& field : r->fields) {
+    if (field->type != Response::Type::Data) {
+      return;
+    }
+  }
+
+  static const string lpush_str("LPUSH");
+  static const string rpush_str("RPUSH");
+  static const string zadd_str("ZADD");
+  ReferenceCommand cmd(3);
+  if (((command_name == "BLPOP") || (command_name == "BRPOP")) &&
+      (r->fields.size() == 2)) {
+    cmd.args.emplace_back((command_name == "BLPOP") ? lpush_str : rpush_str);
+    cmd.args.emplace_back(r->fields[0]->data);
+    cmd.args.emplace_back(r->fields[1]->data);
+  } else if (((command_name == "BZPOPMIN") || (command_name == "BZPOPMAX")) &&
+      (r->fields.size() == 3)) {
+    cmd.args.emplace_back(zadd_str);
+    cmd.args.emplace_back(r->fields[0]->data);
+    cmd.args.emplace_back(r->fields[2]->data);
+    cmd.args.emplace_back(r->fields[1]->data);
+  } else {
+    return;
+  }
+  this->send_background_command(*b, &cmd);
+  this->stats->num_blocking_requeues++;
+}
+
+void Proxy::send_background_command(Backend& b, const ReferenceCommand* cmd) {
+  try {
+    this->send_background_command(&this->backend_conn_for_index(b.index), cmd);
+  } catch (const exception& e) {
+    log(WARNING, "can\'t send command to backend %s: %s", b.debug_name.c_str(),
+        e.what());
+  }
+}
+
+void Proxy::send_background_command(BackendConnection* conn,
+    const ReferenceCommand* cmd) {
+  // the link has no client, so the response is discarded
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, NULL);
+  this->send_command_and_link(conn, l, cmd);
+  if (l->is_ready()) {
+    delete l;
+  }
+}
+
+void Proxy::handle_blocking_response(BlockingConnection* conn,
+    shared_ptr<Response> r) {
+  if (!conn->leased) {
+    log(WARNING, "discarded response from backend %s on an idle blocking connection",
+        conn->backend->debug_name.c_str());
+    return;
+  }
+
+  if (!conn->pinned_links.empty()) {
+    this->handle_pinned_response(conn, r);
+    return;
+  }
+
+  // the connection can be reused as soon as it has responded
+  ResponseLink* l = conn->link;
+  Backend* b = conn->backend;
+  string command_name = move(conn->command_name);
+  this->release_blocking_conn(conn);
+
+  if (!l) {
+    this->requeue_blocking_response(b, command_name, r);
+    return;
+  }
+
+  // a null response means the command timed out on this backend. the client
+  // gets the first response that isn't null, or the last one if they all are
+  l->blocking_conns.erase(conn);
+  bool is_null = ((r->type == Response::Type::Data) ||
+      (r->type == Response::Type::Multi)) && (r->int_value < 0);
+  if (is_null && !l->blocking_conns.empty()) {
+    return;
+  }
+  l->response_to_forward = r;
+  this->cancel_blocking_link(l);
+  if (l->client) {
+    this->send_all_ready_responses(l->client);
+  } else {
+    delete l;
+  }
+}
+
+
+
+void Proxy::handle_pinned_response(BlockingConnection* conn,
+    shared_ptr<Response> r) {
+  ResponseLink* l = conn->pinned_links.front();
+  conn->pinned_links.pop_front();
+
+  if (l) {
+    l->blocking_conns.erase(conn);
+    l->response_to_forward = r;
+
+    // EXEC returns null if a watched key changed, or EXECABORT if one of the
+    // queued commands was rejected by the backend
+    if (((r->type == Response::Type::Multi) && (r->int_value < 0)) ||
+        ((r->type == Response::Type::Error) &&
+         starts_with(r->data, "EXECABORT"))) {
+      this->stats->num_transactions_aborted++;
+    }
+
+    if (l->client) {
+      this->send_all_ready_responses(l->client);
+    } else if (l->is_ready()) {
+      delete l;
+    }
+  }
+
+  if (!conn->pinned_client && conn->pinned_links.empty()) {
+    this->release_blocking_conn(conn);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// script cache
+
+static string script_sha_for_arg(const string& arg) {
+  // redis-server accepts SHAs in either case, but always names them in
+  // lowercase
+  string sha = arg;
+  for (char& ch : sha) {
+    ch = tolower(ch);
+  }
+  return sha;
+}
+
+void Proxy::load_script(BackendConnection* conn, const string& sha,
+    const string& body) {
+  static const string script_str("SCRIPT");
+  static const string load_str("LOAD");
+  ReferenceCommand cmd(3);
+  cmd.args.emplace_back(script_str);
+  cmd.args.emplace_back(load_str);
+  cmd.args.emplace_back(body);
+  this->send_background_command(conn, &cmd);
+  conn->backend->loaded_script_shas.emplace(sha);
+  this->stats->num_script_loads++;
+}
+
+void Proxy::preload_scripts(BackendConnection* conn) {
+  // the backend may have restarted since it was last connected, so don't
+  // assume it still has anything
+  conn->backend->loaded_script_shas.clear();
+  for (const auto& it : this->script_cache->get_all()) {
+    this->load_script(conn, it.first, it.second);
+  }
+}
+
+bool Proxy::retry_script_command(BackendConnection* conn, ResponseLink* l,
+    const shared_ptr<Response>& r) {
+  if (l->script_reloaded || conn->draining ||
+      (r->type != Response::Type::Error) || !starts_with(r->data, "NOSCRIPT")) {
+    return false;
+  }
+  string sha = script_sha_for_arg(l->script_command->args[1]);
+  string body;
+  if (!this->script_cache->get(sha, &body)) {
+    return false;
+  }
+
+  // the load and the retry go on the same connection, so the backend runs
+  // them in order
+  l->script_reloaded = true;
+  this->load_script(conn, sha, body);
+  this->send_command_and_link(conn, l, l->script_command);
+  this->stats->num_noscript_retries++;
+  return true;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// hot keys
+
+// keys can contain any bytes, so when they're logged or shown in INFO fields,
+// bytes that aren't printable or that separate the fields (and backslashes, so
+// the escapes are unambiguous) are written as \xHH
+static string escape_key(const string& s) {
+  string ret;
+  for (char ch : s) {
+    if (isprint(static_cast<unsigned char>(ch)) && (ch != '\\') &&
+        (ch != ',') && (ch != '=')) {
+      ret.push_back(ch);
+    } else {
+      ret += string_printf("\\x%02hhX", static_cast<uint8_t>(ch));
+    }
+  }
+  return ret;
+}
+
+void Proxy::sample_hot_keys(const DataCommand* cmd) {
+  // keys are counted by the part that's hashed, so keys with the same hash tag
+  // (which all go to the same backend) count as one. but a key with a routing
+  // override of its own is routed by the whole key, so it's counted by the
+  // whole key too (and INFO HOTKEYS shows the backend it actually goes to)
+  for (size_t index : this->key_arg_indexes(cmd)) {
+    const string& key = cmd->args[index];
+    size_t size;
+    const char* data = this->hashed_part_of_key(key, &size);
+    if ((size != key.size()) &&
+        (this->backend_override_for_key(key, key.data(), key.size()) >= 0)) {
+      this->hot_keys.add(key);
+    } else {
+      this->hot_keys.add(string(data, size));
+    }
+  }
+}
+
+double Proxy::hot_key_rate(uint64_t count, uint64_t interval_usecs) const {
+  if (!interval_usecs) {
+    return 0;
+  }
+  return static_cast<double>(count) * this->hot_key_sample_rate * 1000000 /
+      interval_usecs;
+}
+
+void Proxy::merge_hot_keys() {
+  vector<HotKeySketch::Key> alarm_keys;
+  uint64_t interval_usecs = 0;
+  {
+    lock_guard<mutex> g(this->stats->hot_keys_lock);
+    this->stats->hot_keys.merge(this->hot_keys);
+
+    // whichever thread sees that the interval is over rotates the sketches
+    uint64_t t = now();
+    if (t - this->stats->hot_keys_start_time >= this->hot_key_interval_usecs) {
+      interval_usecs = t - this->stats->hot_keys_start_time;
+      this->stats->last_hot_keys.clear();
+      this->stats->last_hot_keys.merge(this->stats->hot_keys);
+      this->stats->last_hot_keys_usecs = interval_usecs;
+      this->stats->hot_keys.clear();
+      this->stats->hot_keys_start_time = t;
+
+      for (const auto& key : this->stats->last_hot_keys.top(
+          Stats::HOT_KEY_SKETCH_CAPACITY)) {
+        double alarm_rate = this->backend_index_to_hot_key_alarm_rate.at(
+            this->backend_index_for_key(key.key));
+        if ((alarm_rate > 0) &&
+            (this->hot_key_rate(key.count, interval_usecs) >= alarm_rate)) {
+          alarm_keys.emplace_back(key);
+        }
+      }
+    }
+  }
+  this->hot_keys.clear();
+
+  for (const auto& key : alarm_keys) {
+    log(WARNING, "hot key on backend %s: %s (about %.0f commands/sec)",
+        this->backend_for_key(key.key).debug_name.c_str(),
+        escape_key(key.key).c_str(),
+        this->hot_key_rate(key.count, interval_usecs));
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// read cache
+
+static string read_cache_variant(const DataCommand* cmd) {
+  // the command and all its arguments except the key, which is the cache key.
+  // the arguments are length-prefixed so different commands can't collide
+  string ret = cmd->args[0];
+  for (size_t x = 2; x < cmd->args.size(); x++) {
+    ret += string_printf(" %zu:", cmd->args[x].size());
+    ret += cmd->args[x];
+  }
+  return ret;
+}
+
+static size_t response_memory_size(const Response* r) {
+  size_t ret = sizeof(Response) + r->data.size();
+  for (const auto& field : r->fields) {
+    ret += response_memory_size(field.get());
+  }
+  return ret;
+}
+
+bool Proxy::is_read_cacheable(const DataCommand* cmd) const {
+  if ((cmd->args.size() < 2) || !this->read_cache_commands.count(cmd->args[0])) {
+    return false;
+  }
+  if (this->read_cache_key_prefixes.empty()) {
+    return true;
+  }
+  for (const auto& prefix : this->read_cache_key_prefixes) {
+    if (starts_with(cmd->args[1], prefix)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Proxy::send_cached_response(Client* c, const DataCommand* cmd) {
+  auto r = this->read_cache.get(cmd->args[1], read_cache_variant(cmd), now());
+  if (!r) {
+    this->stats->num_read_cache_misses++;
+    return false;
+  }
+  this->stats->num_read_cache_hits++;
+  this->send_client_push(c, r);
+  return true;
+}
+
+void Proxy::invalidate_read_cache(Client* c, const DataCommand* cmd) {
+  if (this->read_cache_clearing_commands.count(cmd->args[0])) {
+    this->inflight_reads.clear();
+    if (this->backend_tracking) {
+      this->flush_tracking();
+    } else {
+      this->read_cache.clear();
+    }
+    return;
+  }
+
+  for (size_t index : this->key_arg_indexes(cmd)) {
+    this->invalidate_key(c, cmd->args[index]);
+  }
+
+  // queued commands invalidated their keys when they were queued, but they
+  // haven't been run yet, so reads since then may have cached the old values
+  if ((cmd->args[0] == "EXEC") && c->in_transaction) {
+    for (const auto& queued_cmd : c->transaction_commands) {
+      this->invalidate_read_cache(c, queued_cmd.get());
+    }
+  }
+}
+
+void Proxy::fill_read_cache(ResponseLink* l, const shared_ptr<Response>& r) {
+  const DataCommand* cmd = l->read_cache_command.get();
+  this->read_cache.put(cmd->args[1], read_cache_variant(cmd), r,
+      response_memory_size(r.get()), now() + this->read_cache_ttl_usecs,
+      l->read_cache_generation);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// request coalescing
+
+bool Proxy::is_coalescable(const DataCommand* cmd) const {
+  return (cmd->args.size() >= 2) &&
+      this->coalesced_commands.count(cmd->args[0]) &&
+      this->read_only_commands.count(cmd->args[0]);
+}
+
+bool Proxy::join_inflight_read(Client* c, const DataCommand* cmd) {
+  auto key_it = this->inflight_reads.find(cmd->args[1]);
+  if (key_it == this->inflight_reads.end()) {
+    return false;
+  }
+  auto variant_it = key_it->second.find(read_cache_variant(cmd));
+  if (variant_it == key_it->second.end()) {
+    return false;
+  }
+
+  // the new link isn't ready until the leader's response arrives. it has its
+  // own deadline, in case the leader's backend doesn't respond
+  ResponseLink* leader_l = variant_it->second;
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+  l->coalescing_leader = leader_l;
+  leader_l->coalesced_links.emplace_back(l);
+  this->start_deadline(l, cmd);
+  this->stats->num_coalesced_commands++;
+  return true;
+}
+
+void Proxy::start_coalescing(ResponseLink* l,
+    shared_ptr<const DataCommand> cmd) {
+  auto& variant_to_link = this->inflight_reads[cmd->args[1]];
+  if (variant_to_link.emplace(read_cache_variant(cmd.get()), l).second) {
+    l->coalesced_command = cmd;
+  }
+}
+
+void Proxy::end_coalescing(ResponseLink* l) {
+  // the entry may have been removed (or replaced by a later read) already if
+  // the key was written while this read was in flight
+  const DataCommand* cmd = l->coalesced_command.get();
+  auto key_it = this->inflight_reads.find(cmd->args[1]);
+  if (key_it != this->inflight_reads.end()) {
+    auto variant_it = key_it->second.find(read_cache_variant(cmd));
+    if ((variant_it != key_it->second.end()) && (variant_it->second == l)) {
+      key_it->second.erase(variant_it);
+      if (key_it->second.empty()) {
+        this->inflight_reads.erase(key_it);
+      }
+    }
+  }
+}
+
+void Proxy::send_coalesced_responses(ResponseLink* l,
+    const shared_ptr<Response>& r) {
+  const shared_ptr<Response>& response = l->error_response ?
+      l->error_response : r;
+
+  vector<ResponseLink*> coalesced_links;
+  coalesced_links.swap(l->coalesced_links);
+  for (ResponseLink* coalesced_l : coalesced_links) {
+    coalesced_l->coalescing_leader = NULL;
+    coalesced_l->response_to_forward = response;
+
+    // if the client disconnected (or the link timed out), nothing else refers
+    // to the link anymore
+    if (coalesced_l->client) {
+      this->send_all_ready_responses(coalesced_l->client);
+    } else {
+      delete coalesced_l;
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GET batching
+
+bool Proxy::batch_get(Client* c, const DataCommand* cmd) {
+  // GETs for replicated keys go to more than one backend, and GETs that have
+  // to read the client's own writes can't go to a replica with the others
+  const string& key = cmd->args[1];
+  if (this->replication_factor_for_key(key) > 1) {
+    return false;
+  }
+  int64_t backend_index = this->backend_index_for_key(key);
+  if (this->should_read_from_master(c, backend_index)) {
+    return false;
+  }
+
+  auto emplace_ret = this->backend_index_to_get_batch.emplace(backend_index,
+      GetBatch());
+  GetBatch& batch = emplace_ret.first->second;
+  if (emplace_ret.second) {
+    batch.link = this->create_link(CollectionType::ForwardResponse, NULL);
+    batch.cmd.reset(new DataCommand());
+    batch.cmd->args.emplace_back("MGET");
+  }
+  batch.cmd->args.emplace_back(key);
+
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+  l->batch_link = batch.link;
+  batch.link->batched_links.emplace_back(l);
+  this->stats->num_batched_gets++;
+
+  if (batch.link->batched_links.size() >= this->get_batch_max_keys) {
+    this->send_get_batch(backend_index);
+
+  } else if (!this->get_batch_flush_pending) {
+    this->get_batch_flush_pending = true;
+    if (this->get_batch_window_usecs) {
+      struct timeval tv = {
+          static_cast<time_t>(this->get_batch_window_usecs / 1000000),
+          static_cast<suseconds_t>(this->get_batch_window_usecs % 1000000)};
+      event_add(this->get_batch_event.get(), &tv);
+    } else {
+      event_active(this->get_batch_event.get(), EV_TIMEOUT, 0);
+    }
+  }
+  return true;
+}
+
+void Proxy::send_get_batch(int64_t backend_index) {
+  auto batch_it = this->backend_index_to_get_batch.find(backend_index);
+  GetBatch batch = batch_it->second;
+  this->backend_index_to_get_batch.erase(batch_it);
+
+  try {
+    BackendConnection& conn = this->backend_conn_for_index(backend_index);
+    this->send_command_and_link(&conn, batch.link, batch.cmd);
+
+    // the MGET has its own deadline (which is no later than the GETs'), so a
+    // backend that doesn't respond to it is handled as if the GETs had been
+    // sent on their own
+    this->start_deadline(batch.link, batch.cmd.get());
+
+    // the GETs' links aren't linked to the connection, so run_client_command
+    // can't see if it's backed up. the clients that sent them are paused here
+    // instead
+    if (this->backend_conn_above_high_watermark(&conn)) {
+      for (ResponseLink* l : batch.link->batched_links) {
+        if (l->client) {
+          this->pause_client(l->client, &conn);
+        }
+      }
+    }
+  } catch (const exception& e) {
+    batch.link->error_response.reset(new Response(Response::Type::Error,
+        string_printf("PROXYERROR can\'t send batched command: %s", e.what())));
+  }
+  this->stats->num_get_batches++;
+
+  // if the command couldn't be sent, the link already has an error response
+  if (batch.link->is_ready()) {
+    this->send_batched_responses(batch.link, NULL);
+    delete batch.link;
+  }
+}
+
+void Proxy::send_get_batches() {
+  this->get_batch_flush_pending = false;
+  event_del(this->get_batch_event.get());
+  while (!this->backend_index_to_get_batch.empty()) {
+    this->send_get_batch(this->backend_index_to_get_batch.begin()->first);
+  }
+}
+
+void Proxy::dispatch_send_get_batches(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->send_get_batches();
+}
+
+void Proxy::send_batched_responses(ResponseLink* l,
+    const shared_ptr<Response>& r) {
+  vector<ResponseLink*> batched_links;
+  batched_links.swap(l->batched_links);
+
+  // the MGET's response has one field for each GET. if it's anything else,
+  // all of the GETs get the error
+  static shared_ptr<Response> unexpected_response(new Response(
+      Response::Type::Error,
+      "CHANNELERROR backend returned an unexpected response to batched GETs"));
+  shared_ptr<Response> error_response = l->error_response;
+  if (!error_response) {
+    if (r && (r->type == Response::Type::Error)) {
+      error_response = r;
+    } else if (!r || (r->type != Response::Type::Multi) ||
+        (r->fields.size() != batched_links.size())) {
+      error_response = unexpected_response;
+    }
+  }
+
+  for (size_t x = 0; x < batched_links.size(); x++) {
+    ResponseLink* batched_l = batched_links[x];
+    batched_l->batch_link = NULL;
+    const shared_ptr<Response>& field = error_response ? error_response :
+        r->fields[x];
+    batched_l->response_to_forward = field;
+
+    // the GETs' links may have joined the read cache or been joined by other
+    // reads, as if they'd been sent on their own
+    if (batched_l->read_cache_command && !error_response) {
+      this->fill_read_cache(batched_l, field);
+    }
+    if (batched_l->coalesced_command) {
+      this->end_coalescing(batched_l);
+    }
+    if (!batched_l->coalesced_links.empty()) {
+      this->send_coalesced_responses(batched_l, field);
+    }
+
+    if (batched_l->client) {
+      this->send_all_ready_responses(batched_l->client);
+    } else {
+      delete batched_l;
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// backend tracking and CLIENT TRACKING
+
+void Proxy::enable_backend_tracking(BackendConnection* conn) {
+  if (conn->tracking) {
+    return;
+  }
+  SubscriberConnection* subscriber_conn =
+      this->subscriber_conn_for_backend(*conn->backend);
+  if (!subscriber_conn || (subscriber_conn->client_id < 0)) {
+    return; // this is called again when the subscriber connection has its id
+  }
+
+  static const string client_str("CLIENT");
+  static const string tracking_str("TRACKING");
+  static const string on_str("ON");
+  static const string redirect_str("REDIRECT");
+  string id_str = string_printf("%" PRId64, subscriber_conn->client_id);
+  ReferenceCommand cmd(5);
+  cmd.args.emplace_back(client_str);
+  cmd.args.emplace_back(tracking_str);
+  cmd.args.emplace_back(on_str);
+  cmd.args.emplace_back(redirect_str);
+  cmd.args.emplace_back(id_str);
+  try {
+    this->send_background_command(conn, &cmd);
+  } catch (const exception& e) {
+    log(WARNING, "can\'t enable tracking on backend %s: %s",
+        conn->backend->debug_name.c_str(), e.what());
+    return;
+  }
+  conn->tracking = true;
+
+  // reads that were sent on this connection before tracking was enabled won't
+  // cause invalidations, so forget everything that came from them
+  this->flush_tracking();
+}
+
+void Proxy::handle_tracking_invalidation(const shared_ptr<Response>& keys) {
+  // a null array means the backend was flushed
+  if ((keys->type != Response::Type::Multi) || (keys->int_value < 0)) {
+    this->stats->num_tracking_flushes++;
+    this->flush_tracking();
+    return;
+  }
+
+  uint64_t t = now();
+  for (const auto& key : keys->fields) {
+    this->stats->num_tracking_invalidations++;
+    auto write_it = this->local_write_times.find(key->data);
+    if (write_it != this->local_write_times.end()) {
+      this->stats->tracking_invalidation_lag.add(t - write_it->second);
+      this->local_write_times.erase(write_it);
+    }
+    this->read_cache.invalidate(key->data);
+    this->invalidate_tracked_key(NULL, key->data);
+  }
+}
+
+void Proxy::handle_forwarded_invalidation(const string& data) {
+  // the message is "<target_id>:<key>", or just "<target_id>" for a flush
+  char* endptr;
+  int64_t target_id = strtoll(data.c_str(), &endptr, 10);
+  size_t offset = endptr - data.c_str();
+  if (offset >= data.size()) {
+    this->deliver_tracking_invalidation(target_id, NULL);
+  } else if (data[offset] == ':') {
+    string key = data.substr(offset + 1);
+    this->deliver_tracking_invalidation(target_id, &key);
+  }
+}
+
+void Proxy::invalidate_key(Client* writer, const string& key) {
+  this->inflight_reads.erase(key);
+  bool was_cached = this->read_cache.invalidate(key);
+  if (!this->backend_tracking) {
+    return;
+  }
+
+  // the backend will send an invalidation for this key, since it was read on
+  // a tracking connection; the time it takes to arrive is the lag that other
+  // proxies see for this write. the map is bounded in case invalidations are
+  // lost
+  if (was_cached && (this->local_write_times.size() < 1024)) {
+    this->local_write_times[key] = now();
+  }
+  this->invalidate_tracked_key(writer, key);
+}
+
+void Proxy::invalidate_tracked_key(Client* writer, const string& key) {
+  // like redis-server, each read causes at most one invalidation; the client
+  // has to read the key again to track it again
+  auto clients_it = this->tracked_key_to_clients.find(key);
+  if (clients_it == this->tracked_key_to_clients.end()) {
+    return;
+  }
+  for (Client* c : clients_it->second) {
+    c->tracked_keys.erase(key);
+    if (!c->tracking_noloop || (c != writer)) {
+      this->send_tracking_invalidation(c, &key);
+    }
+  }
+  this->tracked_key_to_clients.erase(clients_it);
+}
+
+void Proxy::flush_tracking() {
+  this->read_cache.clear();
+  this->local_write_times.clear();
+  for (auto& it : this->fd_to_client) {
+    Client* c = &it.second;
+    if (c->tracking) {
+      c->tracked_keys.clear();
+      this->send_tracking_invalidation(c, NULL);
+    }
+  }
+  this->tracked_key_to_clients.clear();
+}
+
+void Proxy::track_client_keys(Client* c, const DataCommand* cmd) {
+  for (size_t index : this->key_arg_indexes(cmd)) {
+    const string& key = cmd->args[index];
+    if (c->tracked_keys.emplace(key).second) {
+      this->tracked_key_to_clients[key].emplace(c);
+    }
+  }
+
+  // if the table is full, evict arbitrary keys by invalidating them. their
+  // clients will stop caching them, so this is always safe, but the clients
+  // will have to read them again
+  while (this->tracking_table_max_keys &&
+      (this->tracked_key_to_clients.size() > this->tracking_table_max_keys)) {
+    string key = this->tracked_key_to_clients.begin()->first;
+    this->invalidate_tracked_key(NULL, key);
+    this->stats->num_tracking_evictions++;
+  }
+}
+
+void Proxy::stop_client_tracking(Client* c) {
+  for (const string& key : c->tracked_keys) {
+    auto clients_it = this->tracked_key_to_clients.find(key);
+    clients_it->second.erase(c);
+    if (clients_it->second.empty()) {
+      this->tracked_key_to_clients.erase(clients_it);
+    }
+  }
+  c->tracked_keys.clear();
+  c->tracking = false;
+  c->tracking_noloop = false;
+  c->tracking_redirect_id = -1;
+}
+
+void Proxy::send_tracking_invalidation(Client* c, const string* key) {
+  size_t target_proxy_index = c->tracking_redirect_id &
+      ((1 << CLIENT_ID_PROXY_INDEX_BITS) - 1);
+  if (target_proxy_index == this->proxy_index) {
+    this->deliver_tracking_invalidation(c->tracking_redirect_id, key);
+    return;
+  }
+
+  // the target is on another thread; it gets the invalidation through the
+  // backend, like any other pub/sub message
+  static const string publish_str("PUBLISH");
+  string channel = tracking_forward_channel_for_proxy_index(target_proxy_index);
+  string data = string_printf("%" PRId64, c->tracking_redirect_id);
+  if (key) {
+    data += ':';
+    data += *key;
+  }
+  ReferenceCommand cmd(3);
+  cmd.args.emplace_back(publish_str);
+  cmd.args.emplace_back(channel);
+  cmd.args.emplace_back(data);
+  this->send_background_command(this->backend_for_key(channel), &cmd);
+}
+
+void Proxy::deliver_tracking_invalidation(int64_t target_id,
+    const string* key) {
+  auto client_it = this->id_to_client.find(target_id);
+  if ((client_it == this->id_to_client.end()) ||
+      !client_it->second->subscribed_channels.count(
+        tracking_invalidation_channel)) {
+    return;
+  }
+
+  shared_ptr<Response> keys;
+  if (key) {
+    keys.reset(new Response(Response::Type::Multi, 1));
+    keys->fields.emplace_back(new Response(Response::Type::Data, *key));
+  } else {
+    keys.reset(new Response(Response::Type::Multi, -1));
+  }
+  shared_ptr<Response> r(new Response(Response::Type::Multi, 3));
+  r->fields.emplace_back(new Response(Response::Type::Data, "message"));
+  r->fields.emplace_back(new Response(Response::Type::Data,
+      tracking_invalidation_channel));
+  r->fields.emplace_back(keys);
+  this->send_client_push(client_it->second, r);
+  this->stats->num_tracking_messages_sent++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// transactions
+
+static size_t store_clause_key_index(const DataCommand* cmd) {
+  // SORT key [BY pattern] [LIMIT offset count] [GET pattern ...] ...
+  //     [STORE destination]
+  // GEORADIUS key longitude latitude radius unit ... [STORE[DIST] destination]
+  // GEORADIUSBYMEMBER key member radius unit ... [STORE[DIST] destination]
+  // returns the index of the destination, or 0 if there isn't one
+  const string& command_name = cmd->args[0];
+  size_t x;
+  if (command_name == "SORT") {
+    x = 2;
+  } else if (command_name == "GEORADIUS") {
+    x = 6;
+  } else if (command_name == "GEORADIUSBYMEMBER") {
+    x = 5;
+  } else {
+    return 0;
+  }
+
+  while (x + 1 < cmd->args.size()) {
+    const char* arg = cmd->args[x].c_str();
+    if (!strcasecmp(arg, "STORE") || !strcasecmp(arg, "STOREDIST")) {
+      return x + 1;
+    } else if (!strcasecmp(arg, "LIMIT")) {
+      x += 3;
+    } else if (!strcasecmp(arg, "BY") || !strcasecmp(arg, "GET") ||
+               !strcasecmp(arg, "COUNT")) {
+      x += 2;
+    } else {
+      x++;
+    }
+  }
+  return 0;
+}
+
+vector<size_t> Proxy::key_arg_indexes(const DataCommand* cmd) const {
+  // this only knows where the keys are for commands whose handlers find them
+  // in fixed positions, and the destinations of STORE clauses. for any other
+  // command, it returns no keys
+  vector<size_t> ret;
+  command_handler handler;
+  try {
+    handler = this->handlers.at(cmd->args[0]);
+  } catch (const out_of_range& e) {
+    return ret;
+  }
+
+  size_t num_args = cmd->args.size();
+  size_t start_index = 1, end_index = 1, step = 1;
+  if ((handler == &Proxy::command_forward_by_key_1) ||
+      (handler == &Proxy::command_GEORADIUS) ||
+      (handler == &Proxy::command_PUBLISH)) {
+    end_index = 2;
+  } else if ((handler == &Proxy::command_forward_by_keys_1_2) ||
+             (handler == &Proxy::command_BRPOPLPUSH)) {
+    end_index = 3;
+  } else if ((handler == &Proxy::command_forward_by_keys_1_all) ||
+             (handler == &Proxy::command_partition_by_keys_1_integer) ||
+             (handler == &Proxy::command_partition_by_keys_1_multi)) {
+    end_index = num_args;
+  } else if (handler == &Proxy::command_forward_by_keys_2_all) {
+    start_index = 2;
+    end_index = num_args;
+  } else if ((handler == &Proxy::command_partition_by_keys_2_status) ||
+             (handler == &Proxy::command_MSETNX)) {
+    end_index = num_args;
+    step = 2;
+  } else if (handler == &Proxy::command_blocking_pop) {
+    end_index = num_args - 1;
+  } else if ((handler == &Proxy::command_ZACTIONSTORE) ||
+             (handler == &Proxy::command_EVAL)) {
+    // the key count is arg 2 and the keys follow it. ZINTERSTORE and
+    // ZUNIONSTORE also have the destination key before it
+    if (num_args <= 3) {
+      return ret;
+    }
+    char* endptr;
+    int64_t num_keys = strtoll(cmd->args[2].c_str(), &endptr, 0);
+    if ((endptr == cmd->args[2].c_str()) || (num_keys < 0) ||
+        (num_keys > static_cast<int64_t>(num_args - 3))) {
+      return ret;
+    }
+    if (handler == &Proxy::command_ZACTIONSTORE) {
+      ret.emplace_back(1);
+    }
+    start_index = 3;
+    end_index = 3 + num_keys;
+  }
+
+  for (size_t x = start_index; (x < end_index) && (x < num_args); x += step) {
+    ret.emplace_back(x);
+  }
+
+  // SORT and GEORADIUS can also write to a destination key
+  size_t store_index = store_clause_key_index(cmd);
+  if (store_index) {
+    ret.emplace_back(store_index);
+  }
+  return ret;
+}
+
+BlockingConnection* Proxy::pin_transaction_conn(Client* c,
+    int64_t backend_index) {
+  if (c->pinned_conn) {
+    return c->pinned_conn;
+  }
+
+  BlockingConnection* conn = this->lease_blocking_conn(
+      this->backend_for_index(backend_index));
+  if (!conn) {
+    return NULL;
+  }
+  conn->pinned_client = c;
+  c->pinned_conn = conn;
+  c->pin_start_time = now();
+  this->stats->num_transaction_pins++;
+  return conn;
+}
+
+void Proxy::unpin_transaction_conn(Client* c, bool unwatch) {
+  BlockingConnection* conn = c->pinned_conn;
+  if (!conn) {
+    return;
+  }
+  c->pinned_conn = NULL;
+  conn->pinned_client = NULL;
+  this->stats->transaction_pin_usecs += now() - c->pin_start_time;
+
+  // EXEC and DISCARD unwatch the keys on the backend, but otherwise the
+  // connection has to be cleaned up before another client can use it
+  if (unwatch) {
+    DataCommand unwatch_cmd(1);
+    unwatch_cmd.args.emplace_back("UNWATCH");
+    this->send_pinned_command(conn, NULL, &unwatch_cmd);
+  }
+
+  // if there are still responses to come, the connection goes back to the pool
+  // when they arrive
+  if (conn->pinned_links.empty()) {
+    this->release_blocking_conn(conn);
+  }
+}
+
+void Proxy::send_pinned_command(BlockingConnection* conn, ResponseLink* l,
+    const DataCommand* cmd) {
+  cmd->write(bufferevent_get_output(conn->bev.get()));
+  conn->pinned_links.emplace_back(l);
+  if (l) {
+    l->blocking_conns.emplace(conn);
+  }
+}
+
+void Proxy::queue_transaction_command(Client* c,
+    shared_ptr<DataCommand> cmd) {
+  static shared_ptr<Response> queued_response(new Response(
+      Response::Type::Status, "QUEUED"));
+  static shared_ptr<Response> no_keys_response(new Response(
+      Response::Type::Error,
+      "PROXYERROR only commands on keys can be used in transactions"));
+  static shared_ptr<Response> replicated_response(new Response(
+      Response::Type::Error,
+      "PROXYERROR transactions on replicated keys are not supported"));
+  static shared_ptr<Response> different_backends_response(new Response(
+      Response::Type::Error,
+      "PROXYERROR keys in a transaction must all be on the same backend"));
+
+  // UNWATCH is a no-op in a transaction, so it isn't sent to the backend
+  if (cmd->args[0] == "UNWATCH") {
+    this->send_client_push(c, queued_response);
+    return;
+  }
+
+  // like redis-server, a command that can't be queued makes EXEC fail
+  vector<size_t> key_indexes = this->key_arg_indexes(cmd.get());
+  shared_ptr<Response> error_response;
+  int64_t backend_index = c->transaction_backend_index;
+  if (key_indexes.empty()) {
+    error_response = no_keys_response;
+  }
+  for (size_t key_index : key_indexes) {
+    const string& key = cmd->args[key_index];
+    if (this->replication_factor_for_key(key) > 1) {
+      error_response = replicated_response;
+      break;
+    }
+    int64_t key_backend_index = this->backend_index_for_key(key);
+    if (backend_index < 0) {
+      backend_index = key_backend_index;
+    } else if (key_backend_index != backend_index) {
+      error_response = different_backends_response;
+      break;
+    }
+  }
+  if (error_response) {
+    c->transaction_aborted = true;
+    this->send_client_push(c, error_response);
+    return;
+  }
+
+  c->transaction_backend_index = backend_index;
+  c->transaction_commands.emplace_back(cmd);
+  this->send_client_push(c, queued_response);
+}
+
+void Proxy::reset_transaction(Client* c) {
+  c->in_transaction = false;
+  c->transaction_aborted = false;
+  c->transaction_watch_failed = false;
+  c->transaction_backend_index = -1;
+  c->transaction_commands.clear();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// fair queuing
+
+size_t Proxy::client_max_queued_commands() const {
+  return this->client_max_inflight_commands ?
+      this->client_max_inflight_commands : 1024;
+}
+
+bool Proxy::can_read_commands(const Client* c) const {
+  return !c->should_disconnect && c->paused_by_backend_conns.empty() &&
+      (c->queued_commands.size() < this->client_max_queued_commands());
+}
+
+void Proxy::resume_reading(Client* c) {
+  if (!this->can_read_commands(c)) {
+    return;
+  }
+
+  // the client may have sent more commands that are already in its input
+  // buffer; libevent won't call the read callback for them until more data
+  // arrives, so trigger it manually
+  bufferevent_enable(c->bev.get(), EV_READ);
+  bufferevent_trigger(c->bev.get(), EV_READ,
+      BEV_TRIG_IGNORE_WATERMARKS | BEV_TRIG_DEFER_CALLBACKS);
+}
+
+void Proxy::enqueue_client_command(Client* c, shared_ptr<DataCommand> cmd) {
+  if (!this->fair_queue_quantum) {
+    this->handle_client_command(c, cmd);
+    return;
+  }
+
+  // priority commands skip the queue, but only if there's nothing ahead of
+  // them, since the responses have to be in the same order as the commands
+  if (c->queued_commands.empty() && !cmd->args.empty()) {
+    char* arg0_str = const_cast<char*>(cmd->args[0].c_str());
+    for (size_t x = 0; x < cmd->args[0].size(); x++) {
+      arg0_str[x] = toupper(arg0_str[x]);
+    }
+    if (this->priority_commands.count(cmd->args[0])) {
+      this->handle_client_command(c, cmd);
+      return;
+    }
+  }
+
+  c->queued_commands.emplace_back(move(cmd));
+  this->schedule_client(c);
+}
+
+void Proxy::schedule_client(Client* c) {
+  if (c->scheduled || c->should_disconnect || c->queued_commands.empty() ||
+      (this->client_max_inflight_commands &&
+       (c->num_pending_responses >= this->client_max_inflight_commands))) {
+    return;
+  }
+
+  this->scheduled_clients.emplace_back(c);
+  c->scheduled_it = prev(this->scheduled_clients.end());
+  c->scheduled = true;
+
+  // commands are dispatched after all the pending events in this event loop
+  // iteration are processed, so all clients that have sent commands get a
+  // turn before any backend queues are filled
+  if (!this->fair_queue_run_pending) {
+    this->fair_queue_run_pending = true;
+    event_active(this->fair_queue_event.get(), EV_TIMEOUT, 0);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// idle clients
+
+bool Proxy::can_enter_idle_mode(const Client* c) const {
+  // the client must not be waiting for anything, and its bufferevent must not
+  // contain any data
+  // subscribed clients can't be idle, since messages can arrive for them at
+  // any time
+  return !c->is_idle() && !c->should_disconnect && !c->head_link &&
+      !c->in_subscribe_mode() && c->queued_commands.empty() && !c->scheduled &&
+      c->paused_by_backend_conns.empty() &&
+      (c->parser.state == CommandParser::State::Initial) &&
+      !evbuffer_get_length(bufferevent_get_input(c->bev.get())) &&
+      !evbuffer_get_length(bufferevent_get_output(c->bev.get()));
+}
+
+void Proxy::enter_idle_mode(Client* c) {
+  // free the bufferevent without closing the socket, and wait for the socket
+  // to be readable with a plain event instead
+  bufferevent_setfd(c->bev.get(), -1);
+  c->bev.reset();
+  c->idle_event.reset(event_new(this->base.get(), c->fd, EV_READ,
+      &Proxy::dispatch_on_idle_client_input, this));
+  event_add(c->idle_event.get(), NULL);
+  c->parser.command_in_progress.reset();
+  c->output_soft_limit_start_time = 0;
+  this->stats->num_idle_clients++;
+}
+
+void Proxy::leave_idle_mode(Client* c) {
+  c->idle_event.reset();
+  c->bev = this->create_client_bev(c->fd);
+  bufferevent_enable(c->bev.get(), EV_READ | EV_WRITE);
+  c->last_active_time = now();
+  this->stats->num_idle_clients--;
+}
+
+void Proxy::update_accept_throttling() {
+  if (!this->max_clients) {
+    return;
+  }
+
+  // stop accepting connections when the limit is reached; they'll wait in the
+  // listen backlog until some clients disconnect
+  bool should_throttle = (this->stats->num_clients >= this->max_clients);
+  if (should_throttle && !this->accepts_throttled) {
+    evconnlistener_disable(this->listener.get());
+    this->accepts_throttled = true;
+  } else if (!should_throttle && this->accepts_throttled) {
+    if (this->accepting_clients) {
+      evconnlistener_enable(this->listener.get());
+    }
+    this->accepts_throttled = false;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// response linking
+
+ResponseLink* Proxy::create_link(CollectionType type, Client* c) {
+  return new ResponseLink(type, c);
+}
+
+ResponseLink* Proxy::create_error_link(Client* c, shared_ptr<Response> r) {
+  ResponseLink* l = new ResponseLink(CollectionType::ForwardResponse, c);
+  l->error_response = r;
+  return l;
+}
+
+struct evbuffer* Proxy::can_send_command(BackendConnection* conn,
+    ResponseLink* l) {
+  assert(!l->backend_conn_to_next_link.count(conn));
+
+  if (l->error_response.get()) {
+    return NULL;
+  }
+
+  if (!conn) {
+    static shared_ptr<Response> r(new Response(Response::Type::Error,
+        "CHANNELERROR backend is missing"));
+    l->error_response = r;
+    return NULL;
+  }
+
+  struct evbuffer* out = conn->get_output_buffer();
+  if (!out) {
+    static shared_ptr<Response> r(new Response(Response::Type::Error,
+        "CHANNELERROR backend is not connected"));
+    l->error_response = r;
+    return out;
+  }
+
+  out = this->backend_conn_command_buffer(conn);
+  if ((out == conn->queued_output.get()) &&
+      (conn->queued_command_sizes.size() >=
+        this->concurrency_limit_max_queued_commands)) {
+    static shared_ptr<Response> r(new Response(Response::Type::Error,
+        "PROXYERROR backend is over its concurrency limit"));
+    l->error_response = r;
+    conn->backend->num_concurrency_limit_rejects++;
+    this->stats->num_concurrency_limit_rejects++;
+    return NULL;
   }
   return out;
 }
@@ -521,30 +3041,621 @@ void Proxy::link_connection(BackendConnection* conn, ResponseLink* l) {
   conn->num_commands_sent++;
   conn->backend->num_commands_sent++;
   this->stats->num_commands_sent++;
+
+  // if the command went to the queued output buffer, remember its size so it
+  // can be sent by itself later. if not, remember when it was sent
+  if (conn->backend->concurrency_limiter.get()) {
+    size_t queued_bytes = conn->queued_output.get() ?
+        evbuffer_get_length(conn->queued_output.get()) : 0;
+    if (queued_bytes > conn->queued_bytes) {
+      conn->queued_command_sizes.emplace_back(queued_bytes - conn->queued_bytes);
+      conn->queued_bytes = queued_bytes;
+    } else {
+      conn->send_times.emplace_back(now());
+    }
+  }
+}
+
+void Proxy::save_retry_command(BackendConnection* conn, ResponseLink* l,
+    struct evbuffer* out, size_t start_offset) {
+  // copy the command back out of the output buffer. nothing can have been
+  // sent since it was written, since writes only happen in the event loop
+  size_t size = evbuffer_get_length(out) - start_offset;
+  struct evbuffer_ptr pos;
+  evbuffer_ptr_set(out, &pos, start_offset, EVBUFFER_PTR_SET);
+
+  string& data = l->backend_conn_to_retry_command[conn];
+  data.resize(size);
+  evbuffer_copyout_from(out, &pos, const_cast<char*>(data.data()), size);
+}
+
+void Proxy::unlink_backend_conn(BackendConnection* conn, ResponseLink* prev_l,
+    ResponseLink* l) {
+  // removes l from anywhere in conn's chain. prev_l is the link before it (or
+  // NULL if l is the head)
+  ResponseLink* next_l = l->backend_conn_to_next_link.at(conn);
+  if (prev_l) {
+    prev_l->backend_conn_to_next_link[conn] = next_l;
+  } else {
+    conn->head_link = next_l;
+  }
+  if (conn->tail_link == l) {
+    conn->tail_link = prev_l;
+  }
+  l->backend_conn_to_next_link.erase(conn);
+}
+
+void Proxy::replace_backend_conn_link(BackendConnection* conn,
+    ResponseLink* l, ResponseLink* new_l) {
+  // puts new_l in l's place in conn's chain, so it gets the response that l
+  // would have gotten
+  ResponseLink* next_l = l->backend_conn_to_next_link.at(conn);
+  l->backend_conn_to_next_link.erase(conn);
+  new_l->backend_conn_to_next_link.emplace(conn, next_l);
+
+  if (conn->head_link == l) {
+    conn->head_link = new_l;
+  } else {
+    ResponseLink* prev_l = conn->head_link;
+    while (prev_l->backend_conn_to_next_link.at(conn) != l) {
+      prev_l = prev_l->backend_conn_to_next_link.at(conn);
+    }
+    prev_l->backend_conn_to_next_link[conn] = new_l;
+  }
+  if (conn->tail_link == l) {
+    conn->tail_link = new_l;
+  }
+}
+
+bool Proxy::is_retryable_link(BackendConnection* conn,
+    const ResponseLink* l) const {
+  // links are only retried if their clients are still waiting for them and
+  // their deadlines haven't passed (expired links are orphaned, so checking
+  // the client covers both). batched GETs' links have no client, but are
+  // retried for the GETs'
+  return (l->client || !l->batched_links.empty()) &&
+      l->backend_conn_to_retry_command.count(conn);
+}
+
+void Proxy::retry_read_only_links(BackendConnection* conn) {
+  // if the connection never connected or the backend is known to be down, a
+  // new connection would fail the same way (and retrying from its error would
+  // reconnect in a loop), so the links just fail
+  if (!conn->connected || conn->backend->is_down) {
+    return;
+  }
+
+  // don't reconnect unless there's something to retry
+  ResponseLink* l = conn->head_link;
+  while (l && !this->is_retryable_link(conn, l)) {
+    l = l->backend_conn_to_next_link.at(conn);
+  }
+  if (!l) {
+    return;
+  }
+
+  // conn is draining, so this gets (or makes) a different connection
+  BackendConnection* new_conn;
+  try {
+    new_conn = &this->backend_conn_for_index(conn->backend->index);
+  } catch (const exception& e) {
+    log(WARNING, "can\'t reconnect to backend %s to retry commands: %s",
+        conn->backend->debug_name.c_str(), e.what());
+    return;
+  }
+  struct evbuffer* out = this->backend_conn_command_buffer(new_conn);
+
+  // the retried links stay in the same order on the new connection, since
+  // their responses are matched up by position
+  ResponseLink* prev_l = NULL;
+  for (l = conn->head_link; l;) {
+    ResponseLink* next_l = l->backend_conn_to_next_link.at(conn);
+    if (!this->is_retryable_link(conn, l)) {
+      prev_l = l;
+      l = next_l;
+      continue;
+    }
+
+    this->unlink_backend_conn(conn, prev_l, l);
+    auto retry_it = l->backend_conn_to_retry_command.find(conn);
+
+    // resend the command. it isn't saved for the new connection, so it won't
+    // be retried again
+    evbuffer_add(out, retry_it->second.data(), retry_it->second.size());
+    l->backend_conn_to_retry_command.erase(retry_it);
+    l->retried = true;
+    this->link_connection(new_conn, l);
+
+    conn->backend->num_retries++;
+    this->stats->num_retries++;
+
+    l = next_l;
+  }
+}
+
+bool Proxy::should_spill_command(Backend* b, ResponseLink* l,
+    const DataCommand* cmd) {
+  // only writes that get forwarded verbatim from a single backend are
+  // spilled, since the proxy can't combine a held or faked response with other
+  // backends' responses. while a backend's spill queue isn't empty, all of its
+  // writes have to go through the queue so they stay in order
+  if (!b->spill_queue.get() || (!b->is_down && b->spill_queue->empty())) {
+    return false;
+  }
+  if ((l->type != CollectionType::ForwardResponse) || l->error_response ||
+      !l->backend_conn_to_next_link.empty() || l->spilled) {
+    return false;
+  }
+  const string& command_name = cmd->args[0];
+  return !this->read_only_commands.count(command_name) &&
+      !this->unspillable_commands.count(command_name);
+}
+
+void Proxy::spill_command(Backend* b, ResponseLink* l,
+    const DataCommand* cmd) {
+  unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(evbuffer_new(),
+      evbuffer_free);
+  cmd->write(buf.get());
+  size_t size = evbuffer_get_length(buf.get());
+  if (!b->spill_queue->push(evbuffer_pullup(buf.get(), size), size)) {
+    static shared_ptr<Response> r(new Response(Response::Type::Error,
+        "CHANNELERROR backend is down and its spill queue is full"));
+    l->error_response = r;
+    this->stats->num_spill_queue_full_errors++;
+    return;
+  }
+  this->stats->num_spilled_commands++;
+
+  // commands that would get some other response (e.g. INCR) are held until
+  // they're replayed, since clients wouldn't expect +OK from them
+  if (this->spill_ack_immediately && this->can_ack_spilled_command(cmd)) {
+    static shared_ptr<Response> ok_response(new Response(
+        Response::Type::Status, "OK"));
+    l->response_to_forward = ok_response;
+    b->spilled_links.emplace_back(nullptr);
+  } else {
+    l->spilled = true;
+    b->spilled_links.emplace_back(l);
+  }
+
+  if (!event_pending(this->spill_replay_event.get(), EV_TIMEOUT, NULL)) {
+    struct timeval tv = {0, 10000}; // 10ms
+    event_add(this->spill_replay_event.get(), &tv);
+  }
+}
+
+bool Proxy::can_ack_spilled_command(const DataCommand* cmd) const {
+  if (!this->status_response_commands.count(cmd->args[0])) {
+    return false;
+  }
+  // SET with NX, XX or GET can respond with null or the old value instead
+  if (cmd->args[0] == "SET") {
+    for (size_t x = 3; x < cmd->args.size(); x++) {
+      const char* arg = cmd->args[x].c_str();
+      if (!strcasecmp(arg, "NX") || !strcasecmp(arg, "XX") ||
+          !strcasecmp(arg, "GET")) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Proxy::should_read_from_master(Client* c, size_t backend_index) {
+  // if the client wrote to this backend recently, the replicas may not have
+  // the write yet
+  if (!this->read_your_writes_usecs) {
+    return false;
+  }
+  auto write_it = c->backend_index_to_last_write_time.find(backend_index);
+  if (write_it == c->backend_index_to_last_write_time.end()) {
+    return false;
+  }
+  if (now() - write_it->second < this->read_your_writes_usecs) {
+    return true;
+  }
+  c->backend_index_to_last_write_time.erase(write_it);
+  return false;
+}
+
+BackendConnection* Proxy::route_command(BackendConnection* conn,
+    ResponseLink* l, bool read_only) {
+  Backend* b = conn->backend;
+  Client* c = l->client;
+  if (!read_only) {
+    if (c && this->read_your_writes_usecs) {
+      c->backend_index_to_last_write_time[b->index] = now();
+    }
+    return conn;
+  }
+
+  if (c && this->should_read_from_master(c, b->index)) {
+    return conn;
+  }
+
+  // pick a replica that has connected. the search starts at a different
+  // replica each time, which is the whole policy for round-robin and breaks
+  // ties for least-outstanding
+  size_t num_replicas = b->replicas.size();
+  size_t start_index = b->next_replica_index;
+  b->next_replica_index = (b->next_replica_index + 1) % num_replicas;
+
+  Backend* replica = NULL;
+  size_t replica_pending_commands = 0;
+  for (size_t x = 0; x < num_replicas; x++) {
+    Backend* candidate = b->replicas[(start_index + x) % num_replicas];
+    if (!candidate->get_connected_connection()) {
+      // reads only go to a replica once it has connected, so a replica that
+      // isn't reachable never gets any. start connecting to it here if it
+      // isn't known to be down; check_backends reconnects the ones that are
+      if (!candidate->is_down && !candidate->get_active_connection()) {
+        try {
+          this->connect_backend(*candidate);
+        } catch (const exception& e) {
+          log(WARNING, "can\'t connect to replica %s: %s",
+              candidate->debug_name.c_str(), e.what());
+        }
+      }
+      continue;
+    }
+    if (this->replica_read_policy == ReplicaReadPolicy::RoundRobin) {
+      replica = candidate;
+      break;
+    }
+    size_t pending_commands = candidate->num_pending_commands();
+    if (!replica || (pending_commands < replica_pending_commands)) {
+      replica = candidate;
+      replica_pending_commands = pending_commands;
+    }
+  }
+
+  // if none of the replicas are connected, the master can serve the read
+  if (!replica) {
+    return conn;
+  }
+  this->stats->num_replica_reads++;
+  return replica->get_connected_connection();
 }
 
 void Proxy::send_command_and_link(BackendConnection* conn, ResponseLink* l,
     const DataCommand* cmd) {
 
+  if (conn && !conn->backend->replicas.empty()) {
+    conn = this->route_command(conn, l,
+        this->read_only_commands.count(cmd->args[0]));
+  }
+  if (conn && this->should_spill_command(conn->backend, l, cmd)) {
+    this->spill_command(conn->backend, l, cmd);
+    return;
+  }
+
+  struct evbuffer* out = this->can_send_command(conn, l);
+  if (out) {
+    size_t start_offset = evbuffer_get_length(out);
+    cmd->write(out);
+    if (this->retry_reads && this->read_only_commands.count(cmd->args[0])) {
+      this->save_retry_command(conn, l, out, start_offset);
+    }
+    this->link_connection(conn, l);
+  }
+}
+
+void Proxy::send_command_and_link(BackendConnection* conn, ResponseLink* l,
+    const shared_ptr<const DataCommand>& cmd) {
+  this->send_command_and_link(conn, l, cmd.get());
+}
+
+void Proxy::send_command_and_link(BackendConnection* conn, ResponseLink* l,
+    const ReferenceCommand* cmd) {
+
+  if (conn && !conn->backend->replicas.empty()) {
+    conn = this->route_command(conn, l,
+        this->read_only_commands.count(string(
+          reinterpret_cast<const char*>(cmd->args[0].data), cmd->args[0].size)));
+  }
+
   struct evbuffer* out = this->can_send_command(conn, l);
   if (out) {
+    size_t start_offset = evbuffer_get_length(out);
     cmd->write(out);
+    if (this->retry_reads && this->read_only_commands.count(string(
+        reinterpret_cast<const char*>(cmd->args[0].data), cmd->args[0].size))) {
+      this->save_retry_command(conn, l, out, start_offset);
+    }
     this->link_connection(conn, l);
   }
 }
 
-void Proxy::send_command_and_link(BackendConnection* conn, ResponseLink* l,
-    const shared_ptr<const DataCommand>& cmd) {
-  this->send_command_and_link(conn, l, cmd.get());
-}
+void Proxy::start_deadline(ResponseLink* l, const DataCommand* cmd) {
+  // blocking commands are expected to take a long time, so they never time out
+  if (this->is_blocking_command(cmd)) {
+    return;
+  }
+  const string& command_name = cmd->args[0];
+
+  uint64_t timeout_usecs;
+  if (l->backend_conn_to_next_link.size() > 1) {
+    timeout_usecs = this->fanout_timeout_usecs;
+  } else if (this->read_only_commands.count(command_name)) {
+    timeout_usecs = this->read_timeout_usecs;
+  } else {
+    timeout_usecs = this->write_timeout_usecs;
+  }
+  if (!timeout_usecs) {
+    return;
+  }
+
+  this->deadlines.schedule(&l->deadline_timer, l->start_time + timeout_usecs);
+
+  // the deadline event only runs while there are deadlines pending
+  if (!event_pending(this->deadline_event.get(), EV_TIMEOUT, NULL)) {
+    struct timeval tv = {0, static_cast<suseconds_t>(
+        this->deadlines.get_tick_usecs())};
+    event_add(this->deadline_event.get(), &tv);
+  }
+}
+
+void Proxy::start_hedge_timer(ResponseLink* l,
+    const shared_ptr<DataCommand>& cmd) {
+  // only reads that went to a single backend with replicas can be hedged
+  if ((l->type != CollectionType::ForwardResponse) ||
+      (l->backend_conn_to_next_link.size() != 1)) {
+    return;
+  }
+  BackendConnection* conn = l->backend_conn_to_next_link.begin()->first;
+  Backend* master = conn->backend->master ? conn->backend->master : conn->backend;
+  if (master->replicas.empty() ||
+      !this->read_only_commands.count(cmd->args[0]) ||
+      this->is_blocking_command(cmd.get()) ||
+      (l->client && this->should_read_from_master(l->client, master->index))) {
+    return;
+  }
+
+  // this read's latency will count toward the hedge delay even if it doesn't
+  // end up being hedged
+  l->hedge_command = cmd;
+  this->hedge_tokens = min<double>(this->hedge_tokens + this->hedge_budget, 10);
+
+  // don't hedge until there are enough samples for the percentile to mean
+  // something
+  if (master->read_latency.count() < 100) {
+    return;
+  }
+  this->deadlines.schedule(&l->hedge_timer, l->start_time +
+      master->read_latency.percentile(this->hedge_percentile));
+  if (!event_pending(this->deadline_event.get(), EV_TIMEOUT, NULL)) {
+    struct timeval tv = {0, static_cast<suseconds_t>(
+        this->deadlines.get_tick_usecs())};
+    event_add(this->deadline_event.get(), &tv);
+  }
+}
+
+void Proxy::send_hedge(ResponseLink* l) {
+  if (!l->client || l->error_response || l->is_ready() ||
+      (l->backend_conn_to_next_link.size() != 1)) {
+    return;
+  }
+  if (this->hedge_tokens < 1) {
+    this->stats->num_hedges_over_budget++;
+    return;
+  }
+
+  // send the command to the least-loaded node (other than the one that already
+  // has it) that isn't down. replicas are only used once they've connected
+  BackendConnection* conn = l->backend_conn_to_next_link.begin()->first;
+  Backend* master = conn->backend->master ? conn->backend->master : conn->backend;
+  Backend* target = NULL;
+  size_t target_pending_commands = 0;
+  auto consider = [&](Backend* b) {
+    if ((b == conn->backend) || b->is_down ||
+        (b->master && !b->get_connected_connection())) {
+      return;
+    }
+    size_t pending_commands = b->num_pending_commands();
+    if (!target || (pending_commands < target_pending_commands)) {
+      target = b;
+      target_pending_commands = pending_commands;
+    }
+  };
+  consider(master);
+  for (Backend* replica : master->replicas) {
+    consider(replica);
+  }
+  if (!target) {
+    return;
+  }
+
+  BackendConnection* hedge_conn = target->get_active_connection();
+  if (!hedge_conn) {
+    try {
+      hedge_conn = &this->connect_backend(*target);
+    } catch (const exception& e) {
+      log(WARNING, "can\'t connect to backend %s to hedge a read: %s",
+          target->debug_name.c_str(), e.what());
+      return;
+    }
+  }
+
+  this->hedge_tokens -= 1;
+  l->hedge_command->write(this->backend_conn_command_buffer(hedge_conn));
+  this->link_connection(hedge_conn, l);
+  l->hedge_conn = hedge_conn;
+  this->stats->num_hedges_sent++;
+}
+
+void Proxy::finish_hedged_link(ResponseLink* l, BackendConnection* conn) {
+  // the first response wins. the other connection's response will go to a
+  // link with no client, which discards it
+  if (conn == l->hedge_conn) {
+    this->stats->num_hedge_wins++;
+  }
+  l->hedge_conn = NULL;
+  this->abandon_backend_conns(l);
+}
+
+void Proxy::abandon_backend_conns(ResponseLink* l) {
+  // l doesn't need any more responses. it's replaced in the chains of the
+  // connections it's still waiting on by links with no client, which discard
+  // the responses when they arrive
+  vector<BackendConnection*> conns;
+  for (const auto& it : l->backend_conn_to_next_link) {
+    conns.emplace_back(it.first);
+  }
+  for (BackendConnection* conn : conns) {
+    this->replace_backend_conn_link(conn, l,
+        new ResponseLink(CollectionType::ForwardResponse, NULL));
+  }
+}
+
+void Proxy::send_replicated_command(Client* c, shared_ptr<DataCommand> cmd,
+    const vector<uint64_t>& backend_indexes) {
+  // reads go to the least-loaded backend with a copy of the key that isn't
+  // down (or the first one, if they're all down)
+  if (this->read_only_commands.count(cmd->args[0])) {
+    Backend* target = NULL;
+    for (uint64_t backend_index : backend_indexes) {
+      Backend* b = this->backends[backend_index];
+      if (!b->is_down && (!target ||
+          (b->num_pending_commands() < target->num_pending_commands()))) {
+        target = b;
+      }
+    }
+    if (!target) {
+      target = this->backends[backend_indexes[0]];
+    }
+
+    BackendConnection& conn = this->backend_conn_for_index(target->index);
+    ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+    this->send_command_and_link(&conn, l, cmd);
+    this->stats->num_replicated_reads++;
+    return;
+  }
+
+  // writes go to all of them. a backend that can't be reached counts as a
+  // failed response rather than failing the entire command
+  ResponseLink* l = this->create_link(CollectionType::CollectQuorumResponses, c);
+  if (this->write_ack_policy == WriteAckPolicy::First) {
+    l->quorum_size = 1;
+  } else if (this->write_ack_policy == WriteAckPolicy::Majority) {
+    l->quorum_size = backend_indexes.size() / 2 + 1;
+  } else {
+    l->quorum_size = backend_indexes.size();
+  }
+  for (uint64_t backend_index : backend_indexes) {
+    BackendConnection* conn;
+    try {
+      conn = &this->backend_conn_for_index(backend_index);
+    } catch (const exception& e) {
+      l->responses.emplace_back(new Response(Response::Type::Error,
+          string_printf("CHANNELERROR can't connect to backend %s: %s",
+            this->backends[backend_index]->name.c_str(), e.what())));
+      continue;
+    }
+    this->send_command_and_link(conn, l, cmd);
+    if (l->error_response.get()) {
+      l->responses.emplace_back(move(l->error_response));
+      l->error_response.reset();
+    }
+  }
+  this->stats->num_replicated_writes++;
+  this->check_quorum(l);
+}
+
+void Proxy::check_quorum(ResponseLink* l) {
+  // once enough backends have succeeded, or too many have failed for that to
+  // happen, the remaining responses don't matter
+  size_t num_successes = 0;
+  for (const auto& r : l->responses) {
+    if (r->type != Response::Type::Error) {
+      num_successes++;
+    }
+  }
+  size_t num_remaining = l->backend_conn_to_next_link.size();
+  if (num_remaining && ((num_successes >= l->quorum_size) ||
+      (num_successes + num_remaining < l->quorum_size))) {
+    this->abandon_backend_conns(l);
+  }
+}
+
+void Proxy::expire_link(ResponseLink* l) {
+  if (l->is_ready()) {
+    return; // it's just waiting for an earlier response to the same client
+  }
+
+  this->stats->num_timeouts++;
+  vector<BackendConnection*> conns;
+  static shared_ptr<Response> timeout_response(new Response(
+      Response::Type::Error,
+      "CHANNELERROR backend did not respond before the deadline"));
+
+  // later reads shouldn't wait for a backend that isn't responding. reads that
+  // already joined this one keep waiting until their own deadlines
+  if (l->coalesced_command) {
+    this->end_coalescing(l);
+  }
+
+  // if this is a batched MGET, all of its GETs time out with it
+  if (!l->batched_links.empty()) {
+    l->error_response = timeout_response;
+    this->send_batched_responses(l, NULL);
+  }
+  for (const auto& it : l->backend_conn_to_next_link) {
+    it.first->draining = true;
+    it.first->backend->num_timeouts++;
+    if (it.first->backend->concurrency_limiter.get()) {
+      it.first->backend->concurrency_limiter->on_drop();
+    }
+    conns.emplace_back(it.first);
+  }
+
+  // replace the link in the client's chain with a timeout error. the original
+  // link becomes orphaned, so the late responses will be discarded
+  Client* c = l->client;
+  if (c) {
+    ResponseLink* error_l = new ResponseLink(CollectionType::ForwardResponse,
+        NULL);
+    error_l->error_response = timeout_response;
+    error_l->client = c;
+    error_l->next_client = l->next_client;
+    error_l->replies_suppressed = l->replies_suppressed;
+
+    if (c->head_link == l) {
+      c->head_link = error_l;
+    } else {
+      ResponseLink* prev_l = c->head_link;
+      while (prev_l->next_client != l) {
+        prev_l = prev_l->next_client;
+      }
+      prev_l->next_client = error_l;
+    }
+    if (c->tail_link == l) {
+      c->tail_link = error_l;
+    }
+
+    l->client = NULL;
+    l->next_client = NULL;
+  }
 
-void Proxy::send_command_and_link(BackendConnection* conn, ResponseLink* l,
-    const ReferenceCommand* cmd) {
+  // if the draining connections have nothing useful left to receive, close
+  // them now instead of waiting for the late responses. this may delete l
+  for (BackendConnection* conn : conns) {
+    bool has_waiting_client = false;
+    for (ResponseLink* conn_l = conn->head_link; conn_l;
+         conn_l = conn_l->backend_conn_to_next_link.at(conn)) {
+      if (conn_l->client || !conn_l->batched_links.empty()) {
+        has_waiting_client = true;
+        break;
+      }
+    }
+    if (!has_waiting_client) {
+      log(WARNING, "closing backend connection %s:%" PRId64 " after a response timeout",
+          conn->backend->debug_name.c_str(), conn->index);
+      this->disconnect_backend(conn);
+    }
+  }
 
-  struct evbuffer* out = this->can_send_command(conn, l);
-  if (out) {
-    cmd->write(out);
-    this->link_connection(conn, l);
+  if (c) {
+    this->send_all_ready_responses(c);
   }
 }
 
@@ -555,6 +3666,10 @@ void Proxy::send_command_and_link(BackendConnection* conn, ResponseLink* l,
 
 void Proxy::send_client_response(Client* c, const Response* r) {
 
+  if (c->replies_suppressed) {
+    return;
+  }
+
   struct evbuffer* out = c->get_output_buffer();
   if (!out) {
     log(WARNING, "tried to send response to client %s with no output buffer",
@@ -574,6 +3689,10 @@ void Proxy::send_client_response(Client* c, const shared_ptr<const Response>& r)
 void Proxy::send_client_string_response(Client* c, const char* s,
     Response::Type type) {
 
+  if (c->replies_suppressed) {
+    return;
+  }
+
   struct evbuffer* out = c->get_output_buffer();
   if (!out) {
     log(WARNING, "tried to send response to client %s with no output buffer",
@@ -589,6 +3708,10 @@ void Proxy::send_client_string_response(Client* c, const char* s,
 void Proxy::send_client_string_response(Client* c, const string& s,
     Response::Type type) {
 
+  if (c->replies_suppressed) {
+    return;
+  }
+
   struct evbuffer* out = c->get_output_buffer();
   if (!out) {
     log(WARNING, "tried to send response to client %s with no output buffer",
@@ -604,6 +3727,10 @@ void Proxy::send_client_string_response(Client* c, const string& s,
 void Proxy::send_client_string_response(Client* c, const void* data,
     size_t size, Response::Type type) {
 
+  if (c->replies_suppressed) {
+    return;
+  }
+
   struct evbuffer* out = c->get_output_buffer();
   if (!out) {
     log(WARNING, "tried to send response to client %s with no output buffer",
@@ -619,6 +3746,10 @@ void Proxy::send_client_string_response(Client* c, const void* data,
 void Proxy::send_client_int_response(Client* c, int64_t int_value,
     Response::Type type) {
 
+  if (c->replies_suppressed) {
+    return;
+  }
+
   struct evbuffer* out = c->get_output_buffer();
   if (!out) {
     log(WARNING, "tried to send response to client %s with no output buffer",
@@ -774,6 +3905,33 @@ void Proxy::send_ready_response(ResponseLink* l) {
       break;
     }
 
+    case CollectionType::CollectQuorumResponses: {
+      // send the first successful response if there were enough of them, or
+      // the first error if not
+      shared_ptr<Response> success_r, error_r;
+      size_t num_successes = 0;
+      for (const auto& backend_r : l->responses) {
+        if (backend_r->type == Response::Type::Error) {
+          if (!error_r.get()) {
+            error_r = backend_r;
+          }
+        } else {
+          if (!success_r.get()) {
+            success_r = backend_r;
+          }
+          num_successes++;
+        }
+      }
+      if (num_successes >= l->quorum_size) {
+        this->send_client_response(l->client, success_r);
+      } else if (error_r.get()) {
+        this->send_client_response(l->client, error_r);
+      } else {
+        this->send_client_response(l->client, bad_upstream_error_response);
+      }
+      break;
+    }
+
     case CollectionType::CollectIdenticalResponses: {
       for (size_t x = 1; x < l->responses.size(); x++) {
         if (*l->responses[x] != *l->responses[0]) {
@@ -922,8 +4080,13 @@ void Proxy::send_ready_response(ResponseLink* l) {
 }
 
 void Proxy::send_all_ready_responses(Client* c) {
+  // this can be called while a command with CLIENT REPLY OFF or SKIP is being
+  // handled, but only the links that command created are suppressed
+  bool replies_suppressed = c->replies_suppressed;
   while (c->head_link && c->head_link->is_ready()) {
+    c->replies_suppressed = c->head_link->replies_suppressed;
     this->send_ready_response(c->head_link);
+    this->stats->response_latency.add(now() - c->head_link->start_time);
 
     // delete the link object. we don't need to mess with BackendConnection
     // chains because the link object is ready - this means it's not linked to
@@ -935,7 +4098,15 @@ void Proxy::send_all_ready_responses(Client* c) {
     if (!c->head_link) {
       c->tail_link = NULL;
     }
+    c->num_pending_responses--;
   }
+  c->replies_suppressed = replies_suppressed;
+
+  this->check_client_output_limits(c);
+
+  // the client may have been waiting for responses before sending more
+  // queued commands
+  this->schedule_client(c);
 }
 
 void Proxy::handle_backend_response(BackendConnection* conn,
@@ -961,6 +4132,30 @@ void Proxy::handle_backend_response(BackendConnection* conn,
     conn->tail_link = NULL;
   }
   l->backend_conn_to_next_link.erase(next_link_it);
+  if (l->hedge_conn) {
+    this->finish_hedged_link(l, conn);
+  }
+
+  // an EVALSHA that failed because the backend doesn't have the script (for
+  // example, after a restart or SCRIPT FLUSH) is sent again after loading it
+  if (l->script_command && l->client && !l->error_response &&
+      this->retry_script_command(conn, l, r)) {
+    return;
+  }
+
+  // a replica's response may be older than writes that the proxy has already
+  // sent to the master (and that have already invalidated the cache), so the
+  // cache is only filled from masters' responses
+  if (conn->backend->master) {
+    l->read_cache_command.reset();
+    for (ResponseLink* batched_l : l->batched_links) {
+      batched_l->read_cache_command.reset();
+    }
+  }
+  if (l->read_cache_command && !l->error_response &&
+      (r->type != Response::Type::Error)) {
+    this->fill_read_cache(l, r);
+  }
 
   // if an error response isn't present, update the link object based on the new
   // response
@@ -1010,11 +4205,29 @@ void Proxy::handle_backend_response(BackendConnection* conn,
         break;
       }
 
+      case CollectionType::CollectQuorumResponses:
+        l->responses.emplace_back(r);
+        this->check_quorum(l);
+        break;
+
       default:
         l->error_response = unknown_collection_type_error_response;
     }
   }
 
+  // GETs that were batched into this MGET get their part of the response
+  if (!l->batched_links.empty()) {
+    this->send_batched_responses(l, r);
+  }
+
+  // identical reads that joined this one get the same response
+  if (l->coalesced_command) {
+    this->end_coalescing(l);
+  }
+  if (!l->coalesced_links.empty()) {
+    this->send_coalesced_responses(l, r);
+  }
+
   // if this link doesn't have a client (it disconnected before the response was
   // ready), then delete the response if it's ready - it's not linked from any
   // client object and therefore will be leaked if we don't deal with it now
@@ -1036,6 +4249,53 @@ void Proxy::handle_backend_response(BackendConnection* conn,
 }
 
 void Proxy::handle_client_command(Client* c, shared_ptr<DataCommand> cmd) {
+  if (!c->reply_off && !c->reply_skip) {
+    this->run_client_command(c, cmd);
+    return;
+  }
+
+  // with CLIENT REPLY OFF or SKIP, the command runs normally but nothing is
+  // sent back. the links it created are taken out of the client's chain, so
+  // their responses are discarded by the backend parser without being built
+  // into Response objects, and they don't hold up the client's later responses
+  c->reply_skip = false;
+  ResponseLink* orig_tail_link = c->tail_link;
+  c->replies_suppressed = true;
+  this->run_client_command(c, cmd);
+  c->replies_suppressed = false;
+  this->stats->num_suppressed_replies++;
+
+  // if the original tail link was sent during the command, everything in the
+  // chain is new
+  ResponseLink* l = c->head_link;
+  while (l && (l != orig_tail_link)) {
+    l = l->next_client;
+  }
+  this->detach_client_links(c, l);
+}
+
+void Proxy::detach_client_links(Client* c, ResponseLink* after_l) {
+  ResponseLink* l = after_l ? after_l->next_client : c->head_link;
+  if (after_l) {
+    after_l->next_client = NULL;
+  } else {
+    c->head_link = NULL;
+  }
+  c->tail_link = after_l;
+
+  while (l) {
+    ResponseLink* next_l = l->next_client;
+    l->client = NULL;
+    l->next_client = NULL;
+    c->num_pending_responses--;
+    if (l->is_ready()) {
+      delete l;
+    }
+    l = next_l;
+  }
+}
+
+void Proxy::run_client_command(Client* c, shared_ptr<DataCommand> cmd) {
 
   if (cmd->args.size() <= 0) {
     static shared_ptr<Response> invalid_command_response(new Response(
@@ -1058,6 +4318,76 @@ void Proxy::handle_client_command(Client* c, shared_ptr<DataCommand> cmd) {
     arg0_str[x] = toupper(arg0_str[x]);
   }
 
+  // clients in subscribe mode can only change their subscriptions
+  if (c->in_subscribe_mode() && !this->subscribe_mode_commands.count(arg0_str)) {
+    static shared_ptr<Response> subscribe_mode_response(new Response(
+        Response::Type::Error,
+        "ERR only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING / QUIT allowed in this context"));
+    if (c->tail_link) {
+      this->create_error_link(c, subscribe_mode_response);
+    } else {
+      this->send_client_response(c, subscribe_mode_response);
+    }
+    return;
+  }
+
+  // writes invalidate the read cache as soon as they're seen, so reads sent
+  // after them (which the backend will run after them too) don't get old
+  // responses from the cache
+  bool read_cache_miss = false;
+  if (this->read_cache.max_bytes() || this->backend_tracking ||
+      !this->inflight_reads.empty()) {
+    if (!this->read_only_commands.count(arg0_str)) {
+      this->invalidate_read_cache(c, cmd.get());
+    } else {
+      if (c->tracking) {
+        this->track_client_keys(c, cmd.get());
+      }
+      if (this->read_cache.max_bytes() && !c->in_transaction &&
+          this->is_read_cacheable(cmd.get())) {
+        if (this->send_cached_response(c, cmd.get())) {
+          return;
+        }
+        read_cache_miss = true;
+      }
+    }
+  }
+
+  // between MULTI and EXEC, most commands are queued instead of being run
+  if (c->in_transaction &&
+      !this->transaction_control_commands.count(arg0_str)) {
+    this->queue_transaction_command(c, cmd);
+    return;
+  }
+
+  // the keys of a sample of commands are counted to find hot keys. reads
+  // answered from the read cache don't count, since they don't go to a backend
+  if (this->hot_key_sample_rate && !--this->hot_key_sample_countdown) {
+    this->hot_key_sample_countdown = this->hot_key_sample_rate;
+    this->sample_hot_keys(cmd.get());
+  }
+
+  // batched GETs have to reach the backends before any write that was sent
+  // after them
+  if (!this->backend_index_to_get_batch.empty() &&
+      !this->read_only_commands.count(arg0_str)) {
+    this->send_get_batches();
+  }
+
+  // identical reads that are already in flight are answered with the same
+  // response. CLIENT REPLY OFF/SKIP commands aren't coalesced, since their
+  // links are detached from the client after the command runs. neither are
+  // reads that must go to the master because the client wrote to it recently,
+  // since the read in flight may have gone to a replica that doesn't have the
+  // client's write yet
+  bool coalescable = !this->coalesced_commands.empty() &&
+      !c->replies_suppressed && this->is_coalescable(cmd.get()) &&
+      (!this->read_your_writes_usecs || !this->should_read_from_master(c,
+        this->backend_index_for_key(cmd->args[1])));
+  if (coalescable && this->join_inflight_read(c, cmd.get())) {
+    return;
+  }
+
   // find the appropriate handler
   command_handler handler;
   try {
@@ -1095,6 +4425,36 @@ void Proxy::handle_client_command(Client* c, shared_ptr<DataCommand> cmd) {
     }
   }
 
+  // if the handler sent the command to any backends, start the deadline for
+  // its response
+  if ((c->tail_link != orig_tail_link) && !c->tail_link->is_ready()) {
+    bool single_response = (c->tail_link->type ==
+          CollectionType::ForwardResponse) &&
+        ((c->tail_link->backend_conn_to_next_link.size() == 1) ||
+         c->tail_link->batch_link);
+    if (read_cache_miss && single_response) {
+      c->tail_link->read_cache_command = cmd;
+      c->tail_link->read_cache_generation = this->read_cache.generation(
+          cmd->args[1]);
+    }
+    if (coalescable && single_response && !c->tail_link->script_command) {
+      this->start_coalescing(c->tail_link, cmd);
+    }
+
+    this->start_deadline(c->tail_link, cmd.get());
+    if (this->hedge_budget > 0) {
+      this->start_hedge_timer(c->tail_link, cmd);
+    }
+
+    // if any of the backends this command went to are backed up, stop reading
+    // from this client until they drain
+    for (const auto& it : c->tail_link->backend_conn_to_next_link) {
+      if (this->backend_conn_above_high_watermark(it.first)) {
+        this->pause_client(c, it.first);
+      }
+    }
+  }
+
   // check for complete responses. the command handler probably produces a
   // ResponseLink object, and this object can contain an error already (and if
   // so, it's likely to be ready)
@@ -1111,15 +4471,24 @@ void Proxy::dispatch_on_client_input(struct bufferevent *bev, void* ctx) {
 }
 
 void Proxy::on_client_input(struct bufferevent *bev) {
-  auto& c = this->bev_to_client.at(bev);
+  auto& c = this->fd_to_client.at(bufferevent_getfd(bev));
   struct evbuffer* in_buffer = bufferevent_get_input(bev);
+  c.last_active_time = now();
 
   shared_ptr<DataCommand> cmd;
   try {
-    while (!c.should_disconnect && (cmd = c.parser.resume(in_buffer))) {
+    while (this->can_read_commands(&c) &&
+        (cmd = c.parser.resume(in_buffer))) {
       c.num_commands_received++;
       this->stats->num_commands_received++;
-      this->handle_client_command(&c, cmd);
+      this->enqueue_client_command(&c, cmd);
+    }
+
+    // if the client's queue is full, stop reading until the queue is drained
+    // (the pause logic does the same thing if a backend is backed up)
+    if (!c.should_disconnect &&
+        (c.queued_commands.size() >= this->client_max_queued_commands())) {
+      bufferevent_disable(c.bev.get(), EV_READ);
     }
     if (c.parser.error()) {
       log(WARNING, "parse error in client %s input stream",
@@ -1127,6 +4496,16 @@ void Proxy::on_client_input(struct bufferevent *bev) {
       c.should_disconnect = true;
     }
 
+  } catch (const CommandLimitError& e) {
+    log(WARNING, "error in client %s input stream: %s", c.debug_name.c_str(),
+        e.what());
+    if (e.limit == CommandLimitError::Limit::MultibulkLength) {
+      this->stats->num_disconnects_multibulk_length++;
+    } else {
+      this->stats->num_disconnects_bulk_length++;
+    }
+    c.should_disconnect = true;
+
   } catch (const exception& e) {
     log(WARNING, "error in client %s input stream: %s", c.debug_name.c_str(),
         e.what());
@@ -1145,7 +4524,13 @@ void Proxy::dispatch_on_client_error(struct bufferevent *bev, short events,
 }
 
 void Proxy::on_client_error(struct bufferevent *bev, short events) {
-  auto& c = this->bev_to_client.at(bev);
+  auto& c = this->fd_to_client.at(bufferevent_getfd(bev));
+
+  // disconnect_client_later triggers an EOF event without an actual error
+  if (c.should_disconnect) {
+    this->disconnect_client(&c);
+    return;
+  }
 
   if (events & BEV_EVENT_ERROR) {
     int err = EVUTIL_SOCKET_ERROR();
@@ -1167,15 +4552,46 @@ void Proxy::on_backend_input(struct bufferevent *bev) {
   struct evbuffer* in_buffer = bufferevent_get_input(bev);
 
   for (;;) {
-    // if there's no client on the queue or if the head of the queue is a
-    // forwarding client, then use the forwarding parser (don't allocate a
-    // response object). in the first case, the response will be discarded
-    // (probably the client disconnected early); in the second case, the
-    // response will be forwarded verbatim to the client.
+    // if this connection is draining and nothing is waiting for a response on
+    // it anymore, close it
     auto* l = conn->head_link;
-    if (!l || (l->type == CollectionType::ForwardResponse)) {
+    if (!l && conn->draining) {
+      this->disconnect_backend(conn);
+      return;
+    }
+
+    // if there's no client on the queue, or if the head of the queue is a
+    // forwarding link that's also at the head of its client's queue (or has no
+    // client), then use the forwarding parser (don't allocate a response
+    // object). in the first case, the response will be discarded (this
+    // shouldn't happen); in the second case, the response will be forwarded
+    // verbatim to the client, or discarded if the client disconnected early or
+    // the link timed out. forwarding links that aren't at the head of their
+    // client's queue have to wait for earlier responses, so they're parsed
+    // normally below, as are EVALSHA responses that may have to be retried
+    // and responses that go into the read cache, may be shared by coalesced
+    // reads, or are split between batched GETs.
+    if (!l) {
+      try {
+        if (!conn->parser.forward(in_buffer, NULL)) {
+          break;
+        }
+      } catch (const exception& e) {
+        log(WARNING, "parse error in backend stream %s (%s)",
+            conn->backend->debug_name.c_str(), e.what());
+        this->disconnect_backend(conn);
+        return;
+      }
+      this->count_backend_response(conn, NULL);
+      log(WARNING, "discarded response from backend %s with no response link",
+          conn->backend->debug_name.c_str());
+
+    } else if ((l->type == CollectionType::ForwardResponse) &&
+        !l->script_command && !l->read_cache_command &&
+        !l->coalesced_command && l->batched_links.empty() &&
+        (!l->client || (l->client->head_link == l))) {
       struct evbuffer* out_buffer = NULL;
-      if (l && l->client) {
+      if (l->client) {
         out_buffer = l->client->get_output_buffer();
       }
 
@@ -1187,14 +4603,13 @@ void Proxy::on_backend_input(struct bufferevent *bev) {
         log(WARNING, "parse error in backend stream %s (%s)",
             conn->backend->debug_name.c_str(), e.what());
         this->disconnect_backend(conn);
-        break;
+        return;
       }
 
-      conn->num_responses_received++;
-      conn->backend->num_responses_received++;
-      this->stats->num_responses_received++;
+      this->count_backend_response(conn, l);
       if (l->client) {
         l->client->num_responses_sent++;
+        this->stats->response_latency.add(now() - l->start_time);
       }
       this->stats->num_responses_sent++;
 
@@ -1210,74 +4625,283 @@ void Proxy::on_backend_input(struct bufferevent *bev) {
         conn->tail_link = NULL;
       }
       l->backend_conn_to_next_link.erase(next_link_it);
+      if (l->hedge_conn) {
+        this->finish_hedged_link(l, conn);
+      }
+
+      Client* c = l->client;
+      if (c) {
+        c->head_link = l->next_client;
+        if (!c->head_link) {
+          c->tail_link = NULL;
+        }
+        l->next_client = NULL;
+        c->num_pending_responses--;
+      }
+
+      assert(l->is_ready());
+      delete l;
+
+      // later responses for this client may have been waiting for this one
+      if (c) {
+        this->send_all_ready_responses(c);
+      }
+
+    } else {
+      shared_ptr<Response> rsp;
+      try {
+        rsp = conn->parser.resume(in_buffer);
+      } catch (const exception& e) {
+        log(WARNING, "parse error in backend stream %s (%s)",
+            conn->backend->debug_name.c_str(), e.what());
+        this->disconnect_backend(conn);
+        return;
+      }
+      if (!rsp.get()) {
+        if (conn->parser.error()) {
+          log(WARNING, "parse error in backend stream %s",
+              conn->backend->debug_name.c_str());
+          this->disconnect_backend(conn);
+          return;
+        }
+        break;
+      }
+
+      this->count_backend_response(conn, conn->head_link);
+      this->handle_backend_response(conn, rsp);
+    }
+  }
+
+  if (conn->parser.error()) {
+    log(WARNING, "parse error in backend stream %s (%s)",
+        conn->backend->debug_name.c_str(), conn->parser.error());
+    this->disconnect_backend(conn);
+    return;
+  }
+
+  this->send_queued_commands(conn);
+
+  if (!conn->paused_clients.empty() &&
+      this->backend_conn_below_low_watermark(conn)) {
+    this->resume_paused_clients(conn);
+  }
+}
+
+
+void Proxy::dispatch_on_backend_output(struct bufferevent *bev, void* ctx) {
+  ((Proxy*)ctx)->on_backend_output(bev);
+}
+
+void Proxy::on_backend_output(struct bufferevent *bev) {
+  BackendConnection* conn = this->bev_to_backend_conn.at(bev);
+  if (!conn->paused_clients.empty() &&
+      this->backend_conn_below_low_watermark(conn)) {
+    this->resume_paused_clients(conn);
+  }
+}
+
+
+void Proxy::dispatch_on_backend_error(struct bufferevent *bev, short events,
+    void* ctx) {
+  ((Proxy*)ctx)->on_backend_error(bev, events);
+}
+
+void Proxy::on_backend_error(struct bufferevent *bev, short events) {
+  BackendConnection* conn = this->bev_to_backend_conn.at(bev);
+
+  if (events & BEV_EVENT_CONNECTED) {
+    conn->connected = true;
+    conn->backend->is_down = false;
+    get_socket_addresses(bufferevent_getfd(bev), &conn->local_addr,
+        &conn->remote_addr);
+
+    if (!this->accepting_clients) {
+      this->check_ready_to_accept(false);
+    }
+    if (this->backend_tracking) {
+      this->enable_backend_tracking(conn);
+    }
+    if (this->script_cache->max_size()) {
+      this->preload_scripts(conn);
+    }
+    if (this->preconnect_backends && !this->all_backends_connected &&
+        (this->num_connected_backends() == this->backends.size())) {
+      this->all_backends_connected = true;
+      log(INFO, "[thread %zu] all backends connected after %" PRIu64 "ms",
+          this->proxy_index, (now() - this->serve_start_time) / 1000);
+    }
+  }
+
+  if (events & BEV_EVENT_ERROR) {
+    int err = EVUTIL_SOCKET_ERROR();
+    log(WARNING, "backend %s gave %d (%s)", conn->backend->debug_name.c_str(), err,
+        evutil_socket_error_to_string(err));
+  }
+  if (events & BEV_EVENT_EOF) {
+    log(WARNING, "backend %s has disconnected",
+        conn->backend->debug_name.c_str());
+  }
+  if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+    if (this->auto_eject_ring.get() && !conn->backend->master) {
+      this->auto_eject_ring->report_failure(conn->backend->index);
+    }
+    // a connection that never connected means the backend is down. one that
+    // was dropped may only have lost that connection, so its reads are retried
+    // on a new one before the backend is considered down
+    Backend* b = conn->backend;
+    if (!conn->connected) {
+      b->is_down = true;
+    }
+    this->disconnect_backend(conn);
+  }
+}
+
+
+void Proxy::dispatch_on_subscriber_input(struct bufferevent *bev, void* ctx) {
+  ((Proxy*)ctx)->on_subscriber_input(bev);
+}
+
+void Proxy::on_subscriber_input(struct bufferevent *bev) {
+  SubscriberConnection* conn = this->bev_to_subscriber_conn.at(bev);
+  struct evbuffer* in_buffer = bufferevent_get_input(bev);
+
+  for (;;) {
+    shared_ptr<Response> r;
+    try {
+      r = conn->parser.resume(in_buffer);
+    } catch (const exception& e) {
+      log(WARNING, "parse error in subscriber stream %s (%s)",
+          conn->backend->debug_name.c_str(), e.what());
+      this->disconnect_subscriber(conn);
+      return;
+    }
+    if (!r.get()) {
+      if (conn->parser.error()) {
+        log(WARNING, "parse error in subscriber stream %s (%s)",
+            conn->backend->debug_name.c_str(), conn->parser.error());
+        this->disconnect_subscriber(conn);
+        return;
+      }
+      break;
+    }
+    this->handle_subscriber_message(conn, r);
+  }
+}
+
+
+void Proxy::dispatch_on_subscriber_error(struct bufferevent *bev,
+    short events, void* ctx) {
+  ((Proxy*)ctx)->on_subscriber_error(bev, events);
+}
+
+void Proxy::on_subscriber_error(struct bufferevent *bev, short events) {
+  SubscriberConnection* conn = this->bev_to_subscriber_conn.at(bev);
+
+  if (events & BEV_EVENT_CONNECTED) {
+    conn->connected = true;
+  }
+  if (events & BEV_EVENT_ERROR) {
+    int err = EVUTIL_SOCKET_ERROR();
+    log(WARNING, "subscriber connection to backend %s gave %d (%s)",
+        conn->backend->debug_name.c_str(), err,
+        evutil_socket_error_to_string(err));
+  }
+  if (events & BEV_EVENT_EOF) {
+    log(WARNING, "subscriber connection to backend %s has disconnected",
+        conn->backend->debug_name.c_str());
+  }
+  if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+    this->disconnect_subscriber(conn);
+  }
+}
 
-      if (l->client) {
-        l->client->head_link = l->next_client;
-        if (!l->client->head_link) {
-          l->client->tail_link = NULL;
-        }
-      }
 
-      assert(l->is_ready());
-      delete l;
+void Proxy::dispatch_on_blocking_input(struct bufferevent *bev, void* ctx) {
+  ((Proxy*)ctx)->on_blocking_input(bev);
+}
 
-    } else {
-      shared_ptr<Response> rsp;
-      try {
-        rsp = conn->parser.resume(in_buffer);
-      } catch (const exception& e) {
-        log(WARNING, "parse error in backend stream %s (%s)",
-            conn->backend->debug_name.c_str(), e.what());
-        this->disconnect_backend(conn);
-        break;
-      }
-      if (!rsp.get()) {
-        if (conn->parser.error()) {
-          log(WARNING, "parse error in backend stream %s",
-              conn->backend->debug_name.c_str());
-          this->disconnect_backend(conn);
-        }
-        break;
+void Proxy::on_blocking_input(struct bufferevent *bev) {
+  BlockingConnection* conn = this->bev_to_blocking_conn.at(bev);
+  struct evbuffer* in_buffer = bufferevent_get_input(bev);
+
+  for (;;) {
+    shared_ptr<Response> r;
+    try {
+      r = conn->parser.resume(in_buffer);
+    } catch (const exception& e) {
+      log(WARNING, "parse error in blocking stream %s (%s)",
+          conn->backend->debug_name.c_str(), e.what());
+      this->disconnect_blocking_conn(conn);
+      return;
+    }
+    if (!r.get()) {
+      if (conn->parser.error()) {
+        log(WARNING, "parse error in blocking stream %s (%s)",
+            conn->backend->debug_name.c_str(), conn->parser.error());
+        this->disconnect_blocking_conn(conn);
+        return;
       }
+      break;
+    }
 
-      conn->num_responses_received++;
-      conn->backend->num_responses_received++;
-      this->stats->num_responses_received++;
-      this->handle_backend_response(conn, rsp);
+    // the first response on a new connection is its id
+    if (conn->awaiting_client_id) {
+      conn->awaiting_client_id = false;
+      if (r->type == Response::Type::Integer) {
+        conn->client_id = r->int_value;
+      } else {
+        log(WARNING, "backend %s did not return a client id; blocking commands on it can only be cancelled by disconnecting",
+            conn->backend->debug_name.c_str());
+      }
+      if (conn->leased && !conn->link && conn->cancel_time) {
+        this->cancel_blocking_conn(conn);
+      }
+      continue;
     }
-  }
 
-  if (conn->parser.error()) {
-    log(WARNING, "parse error in backend stream %s (%s)",
-        conn->backend->debug_name.c_str(), conn->parser.error());
-    this->disconnect_backend(conn);
+    this->handle_blocking_response(conn, r);
   }
 }
 
 
-void Proxy::dispatch_on_backend_error(struct bufferevent *bev, short events,
-    void* ctx) {
-  ((Proxy*)ctx)->on_backend_error(bev, events);
+void Proxy::dispatch_on_blocking_error(struct bufferevent *bev,
+    short events, void* ctx) {
+  ((Proxy*)ctx)->on_blocking_error(bev, events);
 }
 
-void Proxy::on_backend_error(struct bufferevent *bev, short events) {
-  BackendConnection* conn = this->bev_to_backend_conn.at(bev);
+void Proxy::on_blocking_error(struct bufferevent *bev, short events) {
+  BlockingConnection* conn = this->bev_to_blocking_conn.at(bev);
 
+  if (events & BEV_EVENT_CONNECTED) {
+    conn->connected = true;
+  }
   if (events & BEV_EVENT_ERROR) {
     int err = EVUTIL_SOCKET_ERROR();
-    log(WARNING, "backend %s gave %d (%s)", conn->backend->debug_name.c_str(), err,
+    log(WARNING, "blocking connection to backend %s gave %d (%s)",
+        conn->backend->debug_name.c_str(), err,
         evutil_socket_error_to_string(err));
   }
   if (events & BEV_EVENT_EOF) {
-    log(WARNING, "backend %s has disconnected",
+    log(WARNING, "blocking connection to backend %s has disconnected",
         conn->backend->debug_name.c_str());
   }
   if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
-    this->disconnect_backend(conn);
+    this->disconnect_blocking_conn(conn);
   }
 }
 
 
+void Proxy::dispatch_on_idle_client_input(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->on_idle_client_input(fd, what);
+}
+
+void Proxy::on_idle_client_input(evutil_socket_t fd, short what) {
+  // the data (or EOF) will be read by the new bufferevent
+  this->leave_idle_mode(&this->fd_to_client.at(fd));
+}
+
+
 void Proxy::dispatch_on_listen_error(struct evconnlistener *listener,
     void* ctx) {
   ((Proxy*)ctx)->on_listen_error(listener);
@@ -1315,23 +4939,31 @@ void Proxy::on_client_accept(struct evconnlistener *listener,
         fd, error.c_str());
   }
 
-  // set up a bufferevent for the new connection
-  struct bufferevent* raw_bev = bufferevent_socket_new(this->base.get(), fd,
-      BEV_OPT_CLOSE_ON_FREE);
-  unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev(
-      raw_bev, bufferevent_free);
-  evbuffer_defer_callbacks(bufferevent_get_output(bev.get()), this->base.get());
-
-  // create a Client for this connection
-  this->bev_to_client.emplace(piecewise_construct,
-      forward_as_tuple(raw_bev), forward_as_tuple(move(bev)));
+  // if there are too many clients already, reject the connection. this can
+  // happen if other threads accepted connections at the same time
   this->stats->num_connections_received++;
+  if (this->max_clients && (this->stats->num_clients >= this->max_clients)) {
+    static const char* error_str = "-ERR max number of clients reached\r\n";
+    send(fd, error_str, strlen(error_str), 0); // the socket is nonblocking
+    evutil_closesocket(fd);
+    this->stats->num_rejected_connections++;
+    this->update_accept_throttling();
+    return;
+  }
+
+  // create a Client for this connection and enable i/o
+  Client& c = this->fd_to_client.emplace(piecewise_construct,
+      forward_as_tuple(fd),
+      forward_as_tuple(this->create_client_bev(fd))).first->second;
+  c.parser.max_multibulk_length = this->client_max_multibulk_length;
+  c.parser.max_bulk_length = this->client_max_bulk_length;
+  c.id = (this->next_client_id++ << CLIENT_ID_PROXY_INDEX_BITS) |
+      this->proxy_index;
+  this->id_to_client.emplace(c.id, &c);
   this->stats->num_clients++;
+  bufferevent_enable(c.bev.get(), EV_READ | EV_WRITE);
 
-  // set read/error callbacks and enable i/o
-  bufferevent_setcb(raw_bev, Proxy::dispatch_on_client_input, NULL,
-      Proxy::dispatch_on_client_error, this);
-  bufferevent_enable(raw_bev, EV_READ | EV_WRITE);
+  this->update_accept_throttling();
 }
 
 
@@ -1351,6 +4983,260 @@ void Proxy::check_for_thread_exit(evutil_socket_t fd, short what) {
   }
 }
 
+void Proxy::dispatch_check_backends(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->check_backends(fd, what);
+}
+
+void Proxy::check_backends(evutil_socket_t fd, short what) {
+  // all threads call this, but only the first one to see an expired ejection
+  // actually rebuilds the ring
+  if (this->auto_eject_ring.get()) {
+    this->auto_eject_ring->reinstate_expired_hosts();
+  }
+
+  // reconnect to any backends that disconnected since the last check. this
+  // runs at most once per second, which also serves as a backoff for backends
+  // that are down
+  if (this->preconnect_backends) {
+    this->connect_all_backends();
+  }
+
+  if (this->hot_key_sample_rate) {
+    this->merge_hot_keys();
+  }
+
+  // the hedge delays follow the recent read latencies
+  uint64_t t = now();
+  if (t - this->read_latency_decay_time >= 10000000) {
+    for (Backend* b : this->backends) {
+      b->read_latency.decay();
+    }
+    this->read_latency_decay_time = t;
+  }
+
+  // backends with spilled commands are reconnected even if preconnecting is
+  // disabled, so the commands are eventually replayed. so are replicas that
+  // are down, since reads aren't sent to them until they're back up
+  auto reconnect = [&](Backend* b) {
+    try {
+      this->connect_backend(*b);
+    } catch (const exception& e) {
+      log(WARNING, "failed to reconnect to backend %s: %s",
+          b->debug_name.c_str(), e.what());
+    }
+  };
+  for (Backend* b : this->backends) {
+    if (b->spill_queue.get() && !b->spill_queue->empty() &&
+        !b->get_active_connection()) {
+      reconnect(b);
+    }
+    for (Backend* replica : b->replicas) {
+      if (replica->is_down && !replica->get_active_connection()) {
+        reconnect(replica);
+      }
+    }
+  }
+
+  this->sync_subscriptions();
+
+  // cancelled blocking commands that the backend hasn't unblocked (because it
+  // doesn't support CLIENT UNBLOCK, or the command wasn't blocking yet when
+  // the unblock arrived) are cancelled by closing their connections instead
+  for (Backend* b : this->backends) {
+    vector<BlockingConnection*> conns_to_close;
+    for (auto& it : b->index_to_blocking_connection) {
+      BlockingConnection& conn = it.second;
+      if (conn.leased && !conn.link && conn.cancel_time &&
+          (t - conn.cancel_time >= 1000000)) {
+        conns_to_close.emplace_back(&conn);
+      }
+    }
+    for (BlockingConnection* conn : conns_to_close) {
+      this->disconnect_blocking_conn(conn);
+    }
+  }
+
+  if (!this->accepting_clients && this->ready_timeout_usecs &&
+      (now() - this->serve_start_time >= this->ready_timeout_usecs)) {
+    this->check_ready_to_accept(true);
+  }
+}
+
+void Proxy::dispatch_check_deadlines(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->check_deadlines(fd, what);
+}
+
+void Proxy::dispatch_check_clients(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->check_clients(fd, what);
+}
+
+void Proxy::check_clients(evutil_socket_t fd, short what) {
+  // clients may have disconnected on other threads
+  this->update_accept_throttling();
+
+  if (!this->client_idle_mode_usecs && !this->client_idle_timeout_usecs &&
+      !this->watch_timeout_usecs) {
+    return;
+  }
+
+  uint64_t t = now();
+  vector<Client*> clients_to_disconnect;
+  for (auto& it : this->fd_to_client) {
+    Client* c = &it.second;
+
+    // a client that WATCHes and never sends EXEC, DISCARD or UNWATCH would
+    // keep its connection out of the pool forever. the keys aren't watched
+    // after the connection is released, so EXEC fails as if one had changed
+    if (this->watch_timeout_usecs && c->pinned_conn &&
+        (t - c->pin_start_time >= this->watch_timeout_usecs)) {
+      this->unpin_transaction_conn(c, true);
+      c->transaction_watch_failed = true;
+      this->stats->num_watch_timeouts++;
+    }
+
+    if (!this->client_idle_mode_usecs && !this->client_idle_timeout_usecs) {
+      continue;
+    }
+    if (c->head_link || !c->queued_commands.empty() ||
+        c->in_subscribe_mode()) {
+      continue; // the client is waiting for something; it's not idle
+    }
+
+    uint64_t idle_usecs = t - c->last_active_time;
+    if (this->client_idle_timeout_usecs &&
+        (idle_usecs >= this->client_idle_timeout_usecs)) {
+      clients_to_disconnect.emplace_back(c);
+    } else if (this->client_idle_mode_usecs &&
+        (idle_usecs >= this->client_idle_mode_usecs) &&
+        this->can_enter_idle_mode(c)) {
+      this->enter_idle_mode(c);
+    }
+  }
+
+  for (Client* c : clients_to_disconnect) {
+    this->stats->num_disconnects_idle_timeout++;
+    this->disconnect_client(c);
+  }
+}
+
+void Proxy::dispatch_run_fair_queue(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->run_fair_queue(fd, what);
+}
+
+void Proxy::run_fair_queue(evutil_socket_t fd, short what) {
+  this->fair_queue_run_pending = false;
+
+  // deficit round-robin: each time a client comes up, it gets quantum more
+  // credits and can dispatch commands until it runs out (each command costs
+  // its argument count). clients at their in-flight limit are taken out of
+  // the rotation until a response is sent to them
+  while (!this->scheduled_clients.empty()) {
+    Client* c = this->scheduled_clients.front();
+    this->scheduled_clients.pop_front();
+    c->scheduled = false;
+
+    bool queue_was_full =
+        (c->queued_commands.size() >= this->client_max_queued_commands());
+
+    c->deficit += this->fair_queue_quantum;
+    while (!c->should_disconnect && !c->queued_commands.empty() &&
+        (!this->client_max_inflight_commands ||
+         (c->num_pending_responses < this->client_max_inflight_commands))) {
+      int64_t cost = c->queued_commands.front()->args.size();
+      if (cost > c->deficit) {
+        break;
+      }
+      c->deficit -= cost;
+
+      shared_ptr<DataCommand> cmd = move(c->queued_commands.front());
+      c->queued_commands.pop_front();
+      this->handle_client_command(c, cmd);
+    }
+
+    if (c->should_disconnect) {
+      this->disconnect_client(c);
+      continue;
+    }
+    if (c->queued_commands.empty()) {
+      c->deficit = 0;
+    }
+    if (queue_was_full) {
+      this->resume_reading(c);
+    }
+    this->schedule_client(c);
+  }
+}
+
+void Proxy::dispatch_replay_spilled_commands(evutil_socket_t fd, short what,
+    void* ctx) {
+  ((Proxy*)ctx)->replay_spilled_commands(fd, what);
+}
+
+void Proxy::replay_spilled_commands(evutil_socket_t fd, short what) {
+  // this runs every 10ms while any spill queue isn't empty
+  size_t max_commands = this->spill_replay_rate ?
+      max<size_t>(this->spill_replay_rate / 100, 1) : 0;
+
+  bool any_spilled = false;
+  for (Backend* b : this->backends) {
+    if (!b->spill_queue.get() || b->spill_queue->empty()) {
+      continue;
+    }
+
+    // wait for the backend to come back up, and don't replay commands faster
+    // than it can take them (or faster than its concurrency limit allows)
+    BackendConnection* conn = b->get_active_connection();
+    if (!b->is_down && conn && conn->connected) {
+      for (size_t x = 0; (!max_commands || (x < max_commands)) &&
+           !b->spill_queue->empty() && conn->queued_command_sizes.empty() &&
+           !this->backend_conn_above_high_watermark(conn); x++) {
+        size_t size;
+        const void* data = b->spill_queue->front(&size);
+        evbuffer_add(this->backend_conn_command_buffer(conn), data, size);
+        b->spill_queue->pop();
+
+        // commands that were already acknowledged get a link with no client,
+        // so their responses are discarded
+        ResponseLink* l = b->spilled_links.front();
+        b->spilled_links.pop_front();
+        if (l) {
+          l->spilled = false;
+        } else {
+          l = new ResponseLink(CollectionType::ForwardResponse, NULL);
+        }
+        this->link_connection(conn, l);
+        this->stats->num_replayed_commands++;
+      }
+    }
+
+    if (!b->spill_queue->empty()) {
+      any_spilled = true;
+    }
+  }
+
+  if (!any_spilled) {
+    event_del(this->spill_replay_event.get());
+  }
+}
+
+void Proxy::check_deadlines(evutil_socket_t fd, short what) {
+  this->deadlines.advance(now(), [&](TimerWheel::Timer* t) {
+    ResponseLink* l = reinterpret_cast<ResponseLink*>(t->ctx);
+    if (t == &l->hedge_timer) {
+      this->send_hedge(l);
+    } else {
+      this->expire_link(l);
+    }
+  });
+  if (!this->deadlines.size()) {
+    event_del(this->deadline_event.get());
+  }
+}
+
 
 
 
@@ -1396,7 +5282,15 @@ void Proxy::command_forward_by_key_index(Client* c, shared_ptr<DataCommand> cmd,
     return;
   }
 
-  BackendConnection& conn = this->backend_conn_for_key(cmd->args[key_index]);
+  const string& key = cmd->args[key_index];
+  size_t replication_factor = this->replication_factor_for_key(key);
+  if (replication_factor > 1) {
+    this->send_replicated_command(c, cmd,
+        this->backend_indexes_for_key(key, replication_factor));
+    return;
+  }
+
+  BackendConnection& conn = this->backend_conn_for_key(key);
   ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
   this->send_command_and_link(&conn, l, cmd);
 }
@@ -1415,17 +5309,40 @@ void Proxy::command_forward_by_keys(Client* c, shared_ptr<DataCommand> cmd,
     end_key_index = num_args;
   }
 
-  // check that the keys all hash to the same server
+  // check that the keys all hash to the same server. replicated keys must be
+  // on the same set of servers
   int64_t backend_index = this->backend_index_for_key(cmd->args[start_key_index]);
+  size_t replication_factor = this->replication_factor_for_key(
+      cmd->args[start_key_index]);
+  vector<uint64_t> backend_indexes;
+  if (replication_factor > 1) {
+    backend_indexes = this->backend_indexes_for_key(cmd->args[start_key_index],
+        replication_factor);
+  }
   int x;
   for (x = start_key_index + 1; x < end_key_index; x++) {
-    if (this->backend_index_for_key(cmd->args[x]) != backend_index) {
+    bool same_backends;
+    if (replication_factor > 1) {
+      same_backends = (this->replication_factor_for_key(cmd->args[x]) ==
+            replication_factor) &&
+          (this->backend_indexes_for_key(cmd->args[x], replication_factor) ==
+            backend_indexes);
+    } else {
+      same_backends = (this->replication_factor_for_key(cmd->args[x]) == 1) &&
+          (this->backend_index_for_key(cmd->args[x]) == backend_index);
+    }
+    if (!same_backends) {
       this->send_client_string_response(c,
           "PROXYERROR keys are on different backends", Response::Type::Error);
       return;
     }
   }
 
+  if (replication_factor > 1) {
+    this->send_replicated_command(c, cmd, backend_indexes);
+    return;
+  }
+
   BackendConnection& conn = this->backend_conn_for_index(backend_index);
   ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
   this->send_command_and_link(&conn, l, cmd);
@@ -1448,7 +5365,7 @@ void Proxy::command_forward_by_keys_2_all(Client* c,
 
 void Proxy::command_forward_random(Client* c, shared_ptr<DataCommand> cmd) {
   BackendConnection& conn = this->backend_conn_for_index(
-      rand() % this->backends.size());
+      this->backend_index_for_keyless_command());
   ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
   this->send_command_and_link(&conn, l, cmd);
 }
@@ -1469,6 +5386,21 @@ void Proxy::command_partition_by_keys(Client* c, shared_ptr<DataCommand> cmd,
   }
   size_t num_keys = (cmd->args.size() - start_arg_index) / args_per_key;
 
+  // writes to replicated keys would have to be split up differently for each
+  // copy of the key, so they aren't supported. reads just go to the first copy
+  if (!this->read_only_commands.count(cmd->args[0])) {
+    for (size_t y = 0; y < num_keys; y++) {
+      size_t arg_index = start_arg_index +
+          (interleaved ? (y * args_per_key) : y);
+      if (this->replication_factor_for_key(cmd->args[arg_index]) > 1) {
+        this->send_client_string_response(c,
+            "PROXYERROR multi-key writes to replicated keys are not supported",
+            Response::Type::Error);
+        return;
+      }
+    }
+  }
+
   // set up the ResponseLink
   auto l = this->create_link(type, c);
   if (l->type == CollectionType::CollectMultiResponsesByKey) {
@@ -1714,7 +5646,7 @@ void Proxy::command_CLIENT(Client* c, shared_ptr<DataCommand> cmd) {
 
   if (cmd->args[1] == "LIST") {
     string response_data;
-    for (const auto& bev_client : this->bev_to_client) {
+    for (const auto& bev_client : this->fd_to_client) {
       auto& c = bev_client.second;
 
       size_t response_chain_length = 0;
@@ -1722,17 +5654,20 @@ void Proxy::command_CLIENT(Client* c, shared_ptr<DataCommand> cmd) {
         response_chain_length++;
       }
 
-      int fd = bufferevent_getfd(c.bev.get());
       string addr_str = render_sockaddr_storage(c.remote_addr);
 
       response_data += string_printf(
-          "addr=%s fd=%d name=%s debug_name=%s cmdrecv=%d rspsent=%d rspchain=%d\n",
-          addr_str.c_str(), fd, c.name.c_str(), c.debug_name.c_str(),
-          c.num_commands_received, c.num_responses_sent, response_chain_length);
+          "id=%" PRId64 " addr=%s fd=%d name=%s debug_name=%s idle=%d mem=%zu cmdrecv=%d rspsent=%d rspchain=%d\n",
+          c.id, addr_str.c_str(), c.fd, c.name.c_str(), c.debug_name.c_str(),
+          c.is_idle() ? 1 : 0, c.memory_usage(), c.num_commands_received,
+          c.num_responses_sent, response_chain_length);
     }
 
     this->send_client_string_response(c, response_data, Response::Type::Data);
 
+  } else if (cmd->args[1] == "ID") {
+    this->send_client_int_response(c, c->id, Response::Type::Integer);
+
   } else if (cmd->args[1] == "GETNAME") {
     if (c->name.empty()) {
       // Redis returns a null response if the client name is missing
@@ -1761,6 +5696,104 @@ void Proxy::command_CLIENT(Client* c, shared_ptr<DataCommand> cmd) {
     c->name = cmd->args[2];
     this->send_client_string_response(c, "OK", Response::Type::Status);
 
+  } else if (cmd->args[1] == "REPLY") {
+    if (cmd->args.size() != 3) {
+      this->send_client_string_response(c, "ERR incorrect argument count",
+          Response::Type::Error);
+      return;
+    }
+
+    // OFF and SKIP aren't acknowledged. SKIP applies to the next command, so
+    // it's set after handle_client_command has checked it for this one
+    if (!strcasecmp(cmd->args[2].c_str(), "ON")) {
+      c->reply_off = false;
+      c->reply_skip = false;
+      c->replies_suppressed = false;
+      this->send_client_string_response(c, "OK", Response::Type::Status);
+    } else if (!strcasecmp(cmd->args[2].c_str(), "OFF")) {
+      c->reply_off = true;
+    } else if (!strcasecmp(cmd->args[2].c_str(), "SKIP")) {
+      c->reply_skip = true;
+    } else {
+      this->send_client_string_response(c, "ERR syntax error",
+          Response::Type::Error);
+    }
+
+  } else if (cmd->args[1] == "TRACKING") {
+    if (cmd->args.size() < 3) {
+      this->send_client_string_response(c, "ERR incorrect argument count",
+          Response::Type::Error);
+      return;
+    }
+    if (!strcasecmp(cmd->args[2].c_str(), "OFF")) {
+      this->stop_client_tracking(c);
+      this->send_client_string_response(c, "OK", Response::Type::Status);
+      return;
+    }
+    if (strcasecmp(cmd->args[2].c_str(), "ON")) {
+      this->send_client_string_response(c, "ERR syntax error",
+          Response::Type::Error);
+      return;
+    }
+    if (!this->backend_tracking) {
+      this->send_client_string_response(c,
+          "PROXYERROR CLIENT TRACKING requires backend tracking",
+          Response::Type::Error);
+      return;
+    }
+
+    int64_t redirect_id = -1;
+    bool noloop = false;
+    for (size_t x = 3; x < cmd->args.size(); x++) {
+      const char* option = cmd->args[x].c_str();
+      if (!strcasecmp(option, "REDIRECT") && (x + 1 < cmd->args.size())) {
+        char* endptr;
+        redirect_id = strtoll(cmd->args[x + 1].c_str(), &endptr, 10);
+        if (*endptr || (endptr == cmd->args[x + 1].c_str())) {
+          this->send_client_string_response(c, "ERR invalid client ID",
+              Response::Type::Error);
+          return;
+        }
+        x++;
+      } else if (!strcasecmp(option, "NOLOOP")) {
+        noloop = true;
+      } else if (!strcasecmp(option, "BCAST") ||
+          !strcasecmp(option, "PREFIX") || !strcasecmp(option, "OPTIN") ||
+          !strcasecmp(option, "OPTOUT")) {
+        this->send_client_string_response(c,
+            "PROXYERROR only REDIRECT and NOLOOP are supported",
+            Response::Type::Error);
+        return;
+      } else {
+        this->send_client_string_response(c, "ERR syntax error",
+            Response::Type::Error);
+        return;
+      }
+    }
+
+    // the proxy only speaks RESP2, so invalidations have to go to another
+    // connection. targets on other threads can't be checked here
+    if (redirect_id < 0) {
+      this->send_client_string_response(c,
+          "PROXYERROR CLIENT TRACKING requires REDIRECT",
+          Response::Type::Error);
+      return;
+    }
+    size_t target_proxy_index = redirect_id &
+        ((1 << CLIENT_ID_PROXY_INDEX_BITS) - 1);
+    if ((target_proxy_index == this->proxy_index) &&
+        !this->id_to_client.count(redirect_id)) {
+      this->send_client_string_response(c,
+          "ERR The client ID you want redirect to does not exist",
+          Response::Type::Error);
+      return;
+    }
+
+    c->tracking = true;
+    c->tracking_noloop = noloop;
+    c->tracking_redirect_id = redirect_id;
+    this->send_client_string_response(c, "OK", Response::Type::Status);
+
   } else {
     this->send_client_string_response(c, "ERR unsupported subcommand",
         Response::Type::Error);
@@ -1785,6 +5818,20 @@ void Proxy::command_DEBUG(Client* c, shared_ptr<DataCommand> cmd) {
   }
 }
 
+void Proxy::command_DISCARD(Client* c, shared_ptr<DataCommand> cmd) {
+  if (!c->in_transaction) {
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error, "ERR DISCARD without MULTI")));
+    return;
+  }
+
+  this->unpin_transaction_conn(c, true);
+  this->reset_transaction(c);
+  this->stats->num_transactions_discarded++;
+  this->send_client_push(c, shared_ptr<Response>(new Response(
+      Response::Type::Status, "OK")));
+}
+
 void Proxy::command_ECHO(Client* c, shared_ptr<DataCommand> cmd) {
   if (cmd->args.size() != 2) {
     this->send_client_string_response(c, "ERR wrong number of arguments",
@@ -1813,9 +5860,17 @@ void Proxy::command_EVAL(Client* c, shared_ptr<DataCommand> cmd) {
     return;
   }
 
-  // check that the keys all hash to the same server
+  // check that the keys all hash to the same server. the proxy can't tell
+  // whether a script writes its keys, and a write to a replicated key would
+  // only reach one of its copies, so replicated keys aren't supported
   int64_t backend_index = -1;
   for (int64_t x = 3; x < num_keys + 3; x++) {
+    if (this->replication_factor_for_key(cmd->args[x]) > 1) {
+      this->send_client_string_response(c,
+          "PROXYERROR scripts on replicated keys are not supported",
+          Response::Type::Error);
+      return;
+    }
     int64_t this_key_backend_index = this->backend_index_for_key(cmd->args[x]);
 
     if (backend_index == -1) {
@@ -1828,13 +5883,91 @@ void Proxy::command_EVAL(Client* c, shared_ptr<DataCommand> cmd) {
     }
   }
 
-  if (backend_index == -1) {
-    backend_index = rand() % this->backends.size();
+  if (backend_index == -1) {
+    backend_index = this->backend_index_for_keyless_command();
+  }
+
+  BackendConnection& conn = this->backend_conn_for_index(backend_index);
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+
+  // EVAL leaves its script in the backend's script cache. before EVALSHA is
+  // sent to a backend that may not have its script, the proxy loads it there
+  if (this->script_cache->max_size()) {
+    if (cmd->args[0] == "EVAL") {
+      conn.backend->loaded_script_shas.emplace(
+          this->script_cache->add(cmd->args[1]));
+    } else {
+      string sha = script_sha_for_arg(cmd->args[1]);
+      string body;
+      if (this->script_cache->get(sha, &body)) {
+        if (!conn.backend->loaded_script_shas.count(sha)) {
+          this->load_script(&conn, sha, body);
+        }
+        l->script_command = cmd;
+      }
+    }
+  }
+
+  this->send_command_and_link(&conn, l, cmd);
+}
+
+void Proxy::command_EXEC(Client* c, shared_ptr<DataCommand> cmd) {
+  if (!c->in_transaction) {
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error, "ERR EXEC without MULTI")));
+    return;
+  }
+
+  // if a command couldn't be queued or the watched keys may have changed,
+  // nothing is sent to the backend
+  if (c->transaction_aborted || c->transaction_watch_failed) {
+    shared_ptr<Response> r = c->transaction_aborted ?
+        shared_ptr<Response>(new Response(Response::Type::Error,
+          "EXECABORT Transaction discarded because of previous errors.")) :
+        shared_ptr<Response>(new Response(Response::Type::Multi, -1));
+    this->unpin_transaction_conn(c, true);
+    this->reset_transaction(c);
+    this->stats->num_transactions_aborted++;
+    this->send_client_push(c, r);
+    return;
+  }
+
+  // an empty transaction with nothing watched doesn't need a backend at all
+  if (c->transaction_backend_index < 0) {
+    this->unpin_transaction_conn(c, true);
+    this->reset_transaction(c);
+    this->stats->num_transactions++;
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Multi)));
+    return;
+  }
+
+  BlockingConnection* conn = this->pin_transaction_conn(c,
+      c->transaction_backend_index);
+  if (!conn) {
+    this->reset_transaction(c);
+    this->stats->num_transactions_aborted++;
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error,
+        "PROXYERROR no connections are available for the transaction")));
+    return;
+  }
+
+  // the whole transaction is sent at once, so the backend's MULTI state never
+  // outlives this call. only EXEC's response goes to the client; the backend's
+  // responses to MULTI and the queued commands were already faked above
+  DataCommand multi_cmd(1);
+  multi_cmd.args.emplace_back("MULTI");
+  this->send_pinned_command(conn, NULL, &multi_cmd);
+  for (const auto& queued_cmd : c->transaction_commands) {
+    this->send_pinned_command(conn, NULL, queued_cmd.get());
   }
-
-  BackendConnection& conn = this->backend_conn_for_index(backend_index);
   ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
-  this->send_command_and_link(&conn, l, cmd);
+  this->send_pinned_command(conn, l, cmd.get());
+  this->stats->num_transactions++;
+
+  this->unpin_transaction_conn(c, false);
+  this->reset_transaction(c);
 }
 
 void Proxy::command_FORWARD(Client* c, shared_ptr<DataCommand> cmd) {
@@ -1877,6 +6010,13 @@ void Proxy::command_FORWARD(Client* c, shared_ptr<DataCommand> cmd) {
   }
 }
 
+void Proxy::command_GET(Client* c, shared_ptr<DataCommand> cmd) {
+  if (!this->get_batch_max_keys || (cmd->args.size() != 2) ||
+      !this->batch_get(c, cmd.get())) {
+    this->command_forward_by_key_1(c, cmd);
+  }
+}
+
 void Proxy::command_GEORADIUS(Client* c, shared_ptr<DataCommand> cmd) {
   // GEORADIUS[BYMEMBER] key long lat rad unit ...
 
@@ -1886,27 +6026,22 @@ void Proxy::command_GEORADIUS(Client* c, shared_ptr<DataCommand> cmd) {
     return;
   }
 
-  // check that all keys hash to the same server
+  // check that all keys hash to the same server. a stored result would only
+  // be written to one copy of a replicated key, so they aren't supported
   int64_t backend_index = this->backend_index_for_key(cmd->args[1]);
-
-  size_t arg_index = 6;
-  while (arg_index < cmd->args.size()) {
-    const string& arg = cmd->args[arg_index];
-    if (starts_with(arg, "WITH") || (arg == "ASC") || (arg == "DESC")) {
-      arg_index++;
-    } else if (arg == "COUNT") {
-      arg_index += 2;
-    } else if ((arg == "STORE") || (arg == "STOREDIST")) {
-      if (arg_index == cmd->args.size() - 1) {
-        this->send_client_string_response(c, "ERR store clause missing argument",
-            Response::Type::Error);
-        return;
-      }
-      if (this->backend_index_for_key(cmd->args[arg_index + 1]) != backend_index) {
-        this->send_client_string_response(c,
-            "PROXYERROR keys are on different backends", Response::Type::Error);
-        return;
-      }
+  size_t store_index = store_clause_key_index(cmd.get());
+  if (store_index) {
+    if ((this->replication_factor_for_key(cmd->args[1]) > 1) ||
+        (this->replication_factor_for_key(cmd->args[store_index]) > 1)) {
+      this->send_client_string_response(c,
+          "PROXYERROR multi-key writes to replicated keys are not supported",
+          Response::Type::Error);
+      return;
+    }
+    if (this->backend_index_for_key(cmd->args[store_index]) != backend_index) {
+      this->send_client_string_response(c,
+          "PROXYERROR keys are on different backends", Response::Type::Error);
+      return;
     }
   }
 
@@ -1934,6 +6069,19 @@ void Proxy::command_INFO(Client* c, shared_ptr<DataCommand> cmd) {
 
     uint64_t uptime = now() - this->stats->start_time;
 
+    size_t client_memory_bytes = 0;
+    for (const auto& it : this->fd_to_client) {
+      client_memory_bytes += it.second.memory_usage();
+    }
+
+    size_t spill_queue_commands = 0, spill_queue_bytes = 0;
+    for (const Backend* b : this->backends) {
+      if (b->spill_queue.get()) {
+        spill_queue_commands += b->spill_queue->size();
+        spill_queue_bytes += b->spill_queue->bytes();
+      }
+    }
+
     Response r(Response::Type::Data, "\
 # Server\n\
 redis_version:redis-shatter\n\
@@ -1952,14 +6100,193 @@ num_connections_received:%zu\n\
 num_clients:%zu\n\
 num_clients_this_instance:%zu\n\
 num_backends:%zu\n\
+num_ejected_backends:%zu\n\
+num_timeouts:%zu\n\
+num_retries:%zu\n\
+num_retry_failures:%zu\n\
+num_spilled_commands:%zu\n\
+num_replayed_commands:%zu\n\
+num_spill_queue_full_errors:%zu\n\
+spill_queue_commands_this_instance:%zu\n\
+spill_queue_bytes_this_instance:%zu\n\
+spill_replay_rate:%zu\n\
+num_replica_reads:%zu\n\
+num_hedges_sent:%zu\n\
+num_hedge_wins:%zu\n\
+num_hedges_over_budget:%zu\n\
+num_concurrency_limit_rejects:%zu\n\
+num_replicated_reads:%zu\n\
+num_replicated_writes:%zu\n\
+num_pubsub_channels:%zu\n\
+num_pubsub_patterns:%zu\n\
+num_pubsub_messages_received:%zu\n\
+num_pubsub_messages_sent:%zu\n\
+blocking_pool_size:%zu\n\
+num_blocking_commands:%zu\n\
+num_blocking_leases:%zu\n\
+num_blocking_conns_leased:%zu\n\
+num_blocking_pool_exhausted:%zu\n\
+num_blocking_cancels:%zu\n\
+num_blocking_requeues:%zu\n\
+num_transactions:%zu\n\
+num_transactions_aborted:%zu\n\
+num_transactions_discarded:%zu\n\
+num_transaction_pins:%zu\n\
+transaction_pin_usecs:%" PRIu64 "\n\
+num_watch_timeouts:%zu\n\
+num_suppressed_replies:%zu\n\
+script_cache_size:%zu\n\
+scripts_cached:%zu\n\
+num_script_loads:%zu\n\
+num_noscript_retries:%zu\n\
+read_cache_max_bytes:%zu\n\
+read_cache_bytes_this_instance:%zu\n\
+read_cache_keys_this_instance:%zu\n\
+read_cache_evictions_this_instance:%zu\n\
+read_cache_expirations_this_instance:%zu\n\
+read_cache_invalidations_this_instance:%zu\n\
+num_read_cache_hits:%zu\n\
+num_read_cache_misses:%zu\n\
+num_coalesced_commands:%zu\n\
+num_batched_gets:%zu\n\
+num_get_batches:%zu\n\
+backend_tracking:%d\n\
+num_tracking_invalidations:%zu\n\
+num_tracking_flushes:%zu\n\
+num_tracking_messages_sent:%zu\n\
+num_tracking_evictions:%zu\n\
+num_paused_clients:%zu\n\
+num_client_pauses:%zu\n\
+client_pause_usecs:%" PRIu64 "\n\
+num_disconnects_multibulk_length:%zu\n\
+num_disconnects_bulk_length:%zu\n\
+num_disconnects_output_hard_limit:%zu\n\
+num_disconnects_output_soft_limit:%zu\n\
+num_disconnects_idle_timeout:%zu\n\
+num_rejected_connections:%zu\n\
+num_idle_clients:%zu\n\
+client_memory_bytes_this_instance:%zu\n\
+avg_client_memory_bytes_this_instance:%zu\n\
 ", getpid_cached(), this->stats->start_time, uptime, hash_begin_delimiter_str,
         hash_end_delimiter_str, this->stats->num_commands_received.load(),
         this->stats->num_commands_sent.load(),
         this->stats->num_responses_received.load(),
         this->stats->num_responses_sent.load(),
         this->stats->num_connections_received.load(),
-        this->stats->num_clients.load(), this->bev_to_client.size(),
-        this->backends.size(), this->proxy_index);
+        this->stats->num_clients.load(), this->fd_to_client.size(),
+        this->backends.size(), this->auto_eject_ring.get() ?
+          this->auto_eject_ring->num_ejected_hosts() : 0,
+        this->stats->num_timeouts.load(),
+        this->stats->num_retries.load(),
+        this->stats->num_retry_failures.load(),
+        this->stats->num_spilled_commands.load(),
+        this->stats->num_replayed_commands.load(),
+        this->stats->num_spill_queue_full_errors.load(), spill_queue_commands,
+        spill_queue_bytes, this->spill_replay_rate,
+        this->stats->num_replica_reads.load(),
+        this->stats->num_hedges_sent.load(),
+        this->stats->num_hedge_wins.load(),
+        this->stats->num_hedges_over_budget.load(),
+        this->stats->num_concurrency_limit_rejects.load(),
+        this->stats->num_replicated_reads.load(),
+        this->stats->num_replicated_writes.load(),
+        this->stats->num_pubsub_channels.load(),
+        this->stats->num_pubsub_patterns.load(),
+        this->stats->num_pubsub_messages_received.load(),
+        this->stats->num_pubsub_messages_sent.load(),
+        this->blocking_pool_size,
+        this->stats->num_blocking_commands.load(),
+        this->stats->num_blocking_leases.load(),
+        this->stats->num_blocking_conns_leased.load(),
+        this->stats->num_blocking_pool_exhausted.load(),
+        this->stats->num_blocking_cancels.load(),
+        this->stats->num_blocking_requeues.load(),
+        this->stats->num_transactions.load(),
+        this->stats->num_transactions_aborted.load(),
+        this->stats->num_transactions_discarded.load(),
+        this->stats->num_transaction_pins.load(),
+        this->stats->transaction_pin_usecs.load(),
+        this->stats->num_watch_timeouts.load(),
+        this->stats->num_suppressed_replies.load(),
+        this->script_cache->max_size(), this->script_cache->size(),
+        this->stats->num_script_loads.load(),
+        this->stats->num_noscript_retries.load(),
+        this->read_cache.max_bytes(), this->read_cache.bytes(),
+        this->read_cache.size(), this->read_cache.num_evictions(),
+        this->read_cache.num_expirations(),
+        this->read_cache.num_invalidations(),
+        this->stats->num_read_cache_hits.load(),
+        this->stats->num_read_cache_misses.load(),
+        this->stats->num_coalesced_commands.load(),
+        this->stats->num_batched_gets.load(),
+        this->stats->num_get_batches.load(),
+        this->backend_tracking ? 1 : 0,
+        this->stats->num_tracking_invalidations.load(),
+        this->stats->num_tracking_flushes.load(),
+        this->stats->num_tracking_messages_sent.load(),
+        this->stats->num_tracking_evictions.load(),
+        this->stats->num_paused_clients.load(),
+        this->stats->num_client_pauses.load(),
+        this->stats->client_pause_usecs.load(),
+        this->stats->num_disconnects_multibulk_length.load(),
+        this->stats->num_disconnects_bulk_length.load(),
+        this->stats->num_disconnects_output_hard_limit.load(),
+        this->stats->num_disconnects_output_soft_limit.load(),
+        this->stats->num_disconnects_idle_timeout.load(),
+        this->stats->num_rejected_connections.load(),
+        this->stats->num_idle_clients.load(), client_memory_bytes,
+        this->fd_to_client.empty() ? 0 :
+          (client_memory_bytes / this->fd_to_client.size()),
+        this->proxy_index);
+    r.data += string_printf("\n# Latency\nresponse_latency_count:%" PRIu64 "\nresponse_latency_p50_usecs:%" PRIu64 "\nresponse_latency_p90_usecs:%" PRIu64 "\nresponse_latency_p99_usecs:%" PRIu64 "\nresponse_latency_p999_usecs:%" PRIu64 "\n",
+        this->stats->response_latency.count(),
+        this->stats->response_latency.percentile(50),
+        this->stats->response_latency.percentile(90),
+        this->stats->response_latency.percentile(99),
+        this->stats->response_latency.percentile(99.9));
+    r.data += string_printf("tracking_invalidation_lag_count:%" PRIu64 "\ntracking_invalidation_lag_p50_usecs:%" PRIu64 "\ntracking_invalidation_lag_p99_usecs:%" PRIu64 "\n",
+        this->stats->tracking_invalidation_lag.count(),
+        this->stats->tracking_invalidation_lag.percentile(50),
+        this->stats->tracking_invalidation_lag.percentile(99));
+    this->send_client_response(c, &r);
+    return;
+  }
+
+  // INFO HOTKEYS [n] - return the n (default 10) hottest keys in the last
+  // complete interval
+  if ((cmd->args.size() <= 3) && (cmd->args[1] == "HOTKEYS")) {
+    size_t n = 10;
+    if (cmd->args.size() == 3) {
+      char* endptr;
+      n = strtoull(cmd->args[2].c_str(), &endptr, 10);
+      if (*endptr || cmd->args[2].empty()) {
+        this->send_client_string_response(c, "ERR value is not an integer",
+            Response::Type::Error);
+        return;
+      }
+    }
+
+    vector<HotKeySketch::Key> keys;
+    uint64_t interval_usecs;
+    {
+      lock_guard<mutex> g(this->stats->hot_keys_lock);
+      keys = this->stats->last_hot_keys.top(n);
+      interval_usecs = this->stats->last_hot_keys_usecs;
+    }
+
+    Response r(Response::Type::Data, "\
+# HotKeys\n\
+hot_key_sample_rate:%zu\n\
+hot_key_interval_usecs:%" PRIu64 "\n\
+", this->hot_key_sample_rate, interval_usecs);
+    for (size_t x = 0; x < keys.size(); x++) {
+      const auto& key = keys[x];
+      r.data += string_printf("hotkey%zu:key=%s,backend=%s,rate=%.1f,min_rate=%.1f\n",
+          x, escape_key(key.key).c_str(),
+          this->backend_for_key(key.key).name.c_str(),
+          this->hot_key_rate(key.count, interval_usecs),
+          this->hot_key_rate(key.count - key.error, interval_usecs));
+    }
     this->send_client_response(c, &r);
     return;
   }
@@ -1981,8 +6308,49 @@ host:%s\n\
 port:%d\n\
 num_commands_sent:%d\n\
 num_responses_received:%d\n\
+num_timeouts:%zu\n\
+num_retries:%zu\n\
 ", b.name.c_str(), b.debug_name.c_str(), b.host.c_str(), b.port,
-        b.num_commands_sent, b.num_responses_received);
+        b.num_commands_sent, b.num_responses_received, b.num_timeouts,
+        b.num_retries);
+    if (this->auto_eject_ring.get()) {
+      r.data += string_printf("ejected:%d\nnum_ejections:%zu\nconsecutive_failures:%zu\n",
+          this->auto_eject_ring->is_ejected(b.index) ? 1 : 0,
+          this->auto_eject_ring->num_ejections(b.index),
+          this->auto_eject_ring->consecutive_failures(b.index));
+    }
+    r.data += string_printf("down:%d\n", b.is_down ? 1 : 0);
+    r.data += string_printf("num_keyless_selections:%zu\n",
+        b.num_keyless_selections);
+    r.data += string_printf("num_replicas:%zu\n", b.replicas.size());
+    r.data += string_printf("loaded_scripts:%zu\n", b.loaded_script_shas.size());
+    r.data += string_printf("read_latency_count:%" PRIu64 "\nread_latency_p50_usecs:%" PRIu64 "\nread_latency_p99_usecs:%" PRIu64 "\n",
+        b.read_latency.count(), b.read_latency.percentile(50),
+        b.read_latency.percentile(99));
+    if ((this->hedge_budget > 0) && !b.replicas.empty()) {
+      r.data += string_printf("hedge_delay_usecs:%" PRIu64 "\n",
+          (b.read_latency.count() < 100) ? 0 :
+            b.read_latency.percentile(this->hedge_percentile));
+    }
+    for (size_t x = 0; x < b.replicas.size(); x++) {
+      const Backend* replica = b.replicas[x];
+      r.data += string_printf("replica%zu:debug_name=%s,down=%d,num_commands_sent=%zu,num_responses_received=%zu,num_pending_commands=%zu,concurrency_limit=%zu\n",
+          x, replica->debug_name.c_str(), replica->is_down ? 1 : 0,
+          replica->num_commands_sent, replica->num_responses_received,
+          replica->num_pending_commands(),
+          replica->concurrency_limiter.get() ?
+            replica->concurrency_limiter->limit() : 0);
+    }
+    if (b.concurrency_limiter.get()) {
+      r.data += string_printf("concurrency_limit:%zu\nconcurrency_limit_min_rtt_usecs:%" PRIu64 "\nnum_concurrency_limit_rejects:%zu\n",
+          b.concurrency_limiter->limit(), b.concurrency_limiter->min_rtt(),
+          b.num_concurrency_limit_rejects);
+    }
+    if (b.spill_queue.get()) {
+      r.data += string_printf("spill_file:%s\nspill_queue_commands:%zu\nspill_queue_bytes:%zu\nspill_queue_max_bytes:%zu\n",
+          b.spill_queue->get_filename().c_str(), b.spill_queue->size(),
+          b.spill_queue->bytes(), b.spill_queue->max_bytes());
+    }
     for (auto& conn_it : b.index_to_connection) {
       auto& conn = conn_it.second;
 
@@ -1991,9 +6359,28 @@ num_responses_received:%d\n\
         response_chain_length++;
       }
 
-      r.data += string_printf("connection_%" PRId64 ":commands_sent=%zu,responses_received=%zu,chain_length=%zu\n",
-          conn.index, conn.num_commands_sent, conn.num_responses_received,
-          response_chain_length);
+      r.data += string_printf("connection_%" PRId64 ":connected=%d,draining=%d,commands_sent=%zu,responses_received=%zu,chain_length=%zu,output_bytes=%zu,paused_clients=%zu,in_flight=%zu,queued_commands=%zu\n",
+          conn.index, conn.connected ? 1 : 0, conn.draining ? 1 : 0,
+          conn.num_commands_sent,
+          conn.num_responses_received, response_chain_length,
+          evbuffer_get_length(conn.get_output_buffer()),
+          conn.paused_clients.size(), this->backend_conn_in_flight(&conn),
+          conn.queued_command_sizes.size());
+    }
+
+    if (b.subscriber_conn.get()) {
+      const SubscriberConnection* sub_conn = b.subscriber_conn.get();
+      r.data += string_printf("subscriber_connection:connected=%d,channels=%zu,patterns=%zu,messages_received=%zu,output_bytes=%zu\n",
+          sub_conn->connected ? 1 : 0, sub_conn->channels.size(),
+          sub_conn->patterns.size(), sub_conn->num_messages_received,
+          evbuffer_get_length(bufferevent_get_output(sub_conn->bev.get())));
+    }
+
+    if (!b.index_to_blocking_connection.empty() || b.num_blocking_leases) {
+      r.data += string_printf("blocking_connections:total=%zu,idle=%zu,leased=%zu\nnum_blocking_leases:%zu\nnum_blocking_pool_exhausted:%zu\n",
+          b.index_to_blocking_connection.size(), b.idle_blocking_conns.size(),
+          b.index_to_blocking_connection.size() - b.idle_blocking_conns.size(),
+          b.num_blocking_leases, b.num_blocking_pool_exhausted);
     }
 
     this->send_client_response(c, &r);
@@ -2143,10 +6530,17 @@ void Proxy::command_MSETNX(Client* c, shared_ptr<DataCommand> cmd) {
     return;
   }
 
-  // check that the keys all hash to the same server
+  // check that the keys all hash to the same server. a write to a replicated
+  // key would only reach one of its copies, so they aren't supported
   int64_t backend_index = this->backend_index_for_key(cmd->args[1]);
   int x;
-  for (x = 3; x < num_args; x += 2) {
+  for (x = 1; x < num_args; x += 2) {
+    if (this->replication_factor_for_key(cmd->args[x]) > 1) {
+      this->send_client_string_response(c,
+          "PROXYERROR multi-key writes to replicated keys are not supported",
+          Response::Type::Error);
+      return;
+    }
     if (this->backend_index_for_key(cmd->args[x]) != backend_index) {
       this->send_client_string_response(c,
           "PROXYERROR keys are on different backends", Response::Type::Error);
@@ -2159,6 +6553,24 @@ void Proxy::command_MSETNX(Client* c, shared_ptr<DataCommand> cmd) {
   this->send_command_and_link(&conn, l, cmd);
 }
 
+void Proxy::command_MULTI(Client* c, shared_ptr<DataCommand> cmd) {
+  if (!this->blocking_pool_size) {
+    this->command_unimplemented(c, cmd);
+    return;
+  }
+  if (c->in_transaction) {
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error, "ERR MULTI calls can not be nested")));
+    return;
+  }
+
+  // the transaction's backend isn't known until its first key is seen, so
+  // nothing is sent until EXEC
+  c->in_transaction = true;
+  this->send_client_push(c, shared_ptr<Response>(new Response(
+      Response::Type::Status, "OK")));
+}
+
 void Proxy::command_OBJECT(Client* c, shared_ptr<DataCommand> cmd) {
   if ((cmd->args.size() == 2) && (cmd->args[1] == "HELP")) {
     this->command_forward_random(c, cmd);
@@ -2180,6 +6592,15 @@ void Proxy::command_OBJECT(Client* c, shared_ptr<DataCommand> cmd) {
 }
 
 void Proxy::command_PING(Client* c, shared_ptr<DataCommand> cmd) {
+  // in subscribe mode, the response is formatted like a message
+  if (c->in_subscribe_mode()) {
+    shared_ptr<Response> r(new Response(Response::Type::Multi, 2));
+    r->fields.emplace_back(new Response(Response::Type::Data, "pong"));
+    r->fields.emplace_back(new Response(Response::Type::Data,
+        (cmd->args.size() > 1) ? cmd->args[1] : ""));
+    this->send_client_push(c, r);
+    return;
+  }
   this->send_client_string_response(c, "PONG", Response::Type::Status);
 }
 
@@ -2190,6 +6611,49 @@ void Proxy::command_PRINTSTATE(Client* c, shared_ptr<DataCommand> cmd) {
   this->send_client_string_response(c, "OK", Response::Type::Status);
 }
 
+void Proxy::command_PSUBSCRIBE(Client* c, shared_ptr<DataCommand> cmd) {
+  this->command_subscribe(c, cmd, true);
+}
+
+void Proxy::command_PUBLISH(Client* c, shared_ptr<DataCommand> cmd) {
+  if (cmd->args.size() != 3) {
+    this->send_client_string_response(c, "ERR incorrect argument count",
+        Response::Type::Error);
+    return;
+  }
+
+  // channels aren't keys, so they're never replicated. this is the backend
+  // that subscribers to the channel are connected to
+  BackendConnection& conn = this->backend_conn_for_key(cmd->args[1]);
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+  this->send_command_and_link(&conn, l, cmd);
+}
+
+void Proxy::command_PUBSUB(Client* c, shared_ptr<DataCommand> cmd) {
+  if (cmd->args.size() < 2) {
+    this->send_client_string_response(c, "ERR not enough arguments",
+        Response::Type::Error);
+    return;
+  }
+
+  // each channel is only subscribed to on one backend, so the lists from all
+  // the backends don't overlap. every backend has all the patterns, so any of
+  // them can count them. the backends' subscriber counts only include the
+  // proxy's connections, so NUMSUB would be misleading
+  if (!strcasecmp(cmd->args[1].c_str(), "CHANNELS")) {
+    this->command_forward_all(c, cmd, CollectionType::CombineMultiResponses);
+  } else if (!strcasecmp(cmd->args[1].c_str(), "NUMPAT")) {
+    this->command_forward_random(c, cmd);
+  } else {
+    this->send_client_string_response(c, "PROXYERROR unsupported subcommand",
+        Response::Type::Error);
+  }
+}
+
+void Proxy::command_PUNSUBSCRIBE(Client* c, shared_ptr<DataCommand> cmd) {
+  this->command_unsubscribe(c, cmd, true);
+}
+
 void Proxy::command_QUIT(Client* c, shared_ptr<DataCommand> cmd) {
   c->should_disconnect = 1;
 }
@@ -2212,6 +6676,57 @@ void Proxy::command_ROLE(Client* c, shared_ptr<DataCommand> cmd) {
   this->send_client_response(c, &r);
 }
 
+void Proxy::command_ROUTE(Client* c, shared_ptr<DataCommand> cmd) {
+  if (cmd->args.size() < 2) {
+    this->send_client_string_response(c, "ERR not enough arguments",
+        Response::Type::Error);
+    return;
+  }
+
+  // overrides only change where commands are sent; they don't move any data
+  // between backends
+  if (cmd->args[1] == "SET") {
+    if (cmd->args.size() != 4) {
+      this->send_client_string_response(c, "ERR incorrect argument count",
+          Response::Type::Error);
+      return;
+    }
+    int64_t backend_index = this->backend_index_for_argument(cmd->args[3]);
+    if (backend_index < 0) {
+      this->send_client_string_response(c, "ERR backend does not exist",
+          Response::Type::Error);
+      return;
+    }
+    this->routing_overrides->set(cmd->args[2],
+        this->backends[backend_index]->name);
+    log(INFO, "client %s routed key %s to backend %s", c->name.c_str(),
+        cmd->args[2].c_str(), this->backends[backend_index]->name.c_str());
+    this->send_client_string_response(c, "OK", Response::Type::Status);
+
+  } else if (cmd->args[1] == "DEL") {
+    if (cmd->args.size() != 3) {
+      this->send_client_string_response(c, "ERR incorrect argument count",
+          Response::Type::Error);
+      return;
+    }
+    bool erased = this->routing_overrides->erase(cmd->args[2]);
+    this->send_client_int_response(c, erased, Response::Type::Integer);
+
+  } else if (cmd->args[1] == "LIST") {
+    auto key_to_backend_name = this->routing_overrides->get_all();
+    Response r(Response::Type::Multi, 2 * key_to_backend_name.size());
+    for (const auto& it : key_to_backend_name) {
+      r.fields.emplace_back(new Response(Response::Type::Data, it.first));
+      r.fields.emplace_back(new Response(Response::Type::Data, it.second));
+    }
+    this->send_client_response(c, &r);
+
+  } else {
+    this->send_client_string_response(c, "ERR unrecognized subcommand",
+        Response::Type::Error);
+  }
+}
+
 void Proxy::command_SCAN(Client* c, shared_ptr<DataCommand> cmd) {
   if (cmd->args.size() < 2) {
     this->send_client_string_response(c, "ERR not enough arguments",
@@ -2286,8 +6801,21 @@ void Proxy::command_SCRIPT(Client* c, shared_ptr<DataCommand> cmd) {
   }
 
   if (cmd->args[1] == "FLUSH") {
+    this->script_cache->clear();
+    for (Backend* b : this->backends) {
+      b->loaded_script_shas.clear();
+      for (Backend* replica : b->replicas) {
+        replica->loaded_script_shas.clear();
+      }
+    }
     this->command_forward_all(c, cmd, CollectionType::CollectStatusResponses);
   } else if (cmd->args[1] == "LOAD") {
+    if (this->script_cache->max_size() && (cmd->args.size() == 3)) {
+      string sha = this->script_cache->add(cmd->args[2]);
+      for (Backend* b : this->backends) {
+        b->loaded_script_shas.emplace(sha);
+      }
+    }
     this->command_forward_all(c, cmd, CollectionType::CollectIdenticalResponses);
   } else if (cmd->args[1] == "EXISTS") {
     this->command_forward_all(c, cmd, CollectionType::ModifyScriptExistsResponse);
@@ -2298,6 +6826,73 @@ void Proxy::command_SCRIPT(Client* c, shared_ptr<DataCommand> cmd) {
   }
 }
 
+void Proxy::command_SUBSCRIBE(Client* c, shared_ptr<DataCommand> cmd) {
+  this->command_subscribe(c, cmd, false);
+}
+
+void Proxy::command_UNSUBSCRIBE(Client* c, shared_ptr<DataCommand> cmd) {
+  this->command_unsubscribe(c, cmd, false);
+}
+
+void Proxy::command_UNWATCH(Client* c, shared_ptr<DataCommand> cmd) {
+  // inside a transaction, UNWATCH does nothing (see queue_transaction_command)
+  this->unpin_transaction_conn(c, true);
+  c->transaction_watch_failed = false;
+  c->transaction_backend_index = -1;
+  this->send_client_push(c, shared_ptr<Response>(new Response(
+      Response::Type::Status, "OK")));
+}
+
+void Proxy::command_WATCH(Client* c, shared_ptr<DataCommand> cmd) {
+  if (cmd->args.size() < 2) {
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error, "ERR wrong number of arguments")));
+    return;
+  }
+  if (!this->blocking_pool_size) {
+    this->command_unimplemented(c, cmd);
+    return;
+  }
+  if (c->in_transaction) {
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error, "ERR WATCH inside MULTI is not allowed")));
+    return;
+  }
+
+  // the watched keys have to be on the same backend as the rest of the
+  // transaction, since the watch is on the pinned connection
+  int64_t backend_index = c->transaction_backend_index;
+  for (size_t x = 1; x < cmd->args.size(); x++) {
+    if (this->replication_factor_for_key(cmd->args[x]) > 1) {
+      this->send_client_push(c, shared_ptr<Response>(new Response(
+          Response::Type::Error,
+          "PROXYERROR transactions on replicated keys are not supported")));
+      return;
+    }
+    int64_t key_backend_index = this->backend_index_for_key(cmd->args[x]);
+    if (backend_index < 0) {
+      backend_index = key_backend_index;
+    } else if (key_backend_index != backend_index) {
+      this->send_client_push(c, shared_ptr<Response>(new Response(
+          Response::Type::Error,
+          "PROXYERROR keys in a transaction must all be on the same backend")));
+      return;
+    }
+  }
+
+  BlockingConnection* conn = this->pin_transaction_conn(c, backend_index);
+  if (!conn) {
+    this->send_client_push(c, shared_ptr<Response>(new Response(
+        Response::Type::Error,
+        "PROXYERROR no connections are available for the transaction")));
+    return;
+  }
+  c->transaction_backend_index = backend_index;
+
+  ResponseLink* l = this->create_link(CollectionType::ForwardResponse, c);
+  this->send_pinned_command(conn, l, cmd.get());
+}
+
 void Proxy::command_XGROUP(Client* c, shared_ptr<DataCommand> cmd) {
   int64_t num_args = cmd->args.size();
   if (num_args < 2) {
@@ -2375,9 +6970,19 @@ void Proxy::command_XREAD(Client* c, shared_ptr<DataCommand> cmd) {
     return;
   }
 
+  int64_t block_arg_index = -1;
   if (cmd->args[arg_index] == "BLOCK") {
-    this->send_client_string_response(c,
-        "PROXYERROR blocking reads are not supported", Response::Type::Error);
+    if (!this->blocking_pool_size) {
+      this->send_client_string_response(c,
+          "PROXYERROR blocking reads are not supported", Response::Type::Error);
+      return;
+    }
+    block_arg_index = arg_index;
+    arg_index += 2;
+  }
+  if (arg_index >= num_args) {
+    this->send_client_string_response(c, "ERR not enough arguments",
+        Response::Type::Error);
     return;
   }
 
@@ -2395,8 +7000,104 @@ void Proxy::command_XREAD(Client* c, shared_ptr<DataCommand> cmd) {
     return;
   }
 
-  this->command_partition_by_keys(c, cmd, arg_index, 2, false,
-      CollectionType::CollectMultiResponsesByKey);
+  if (block_arg_index < 0) {
+    this->command_partition_by_keys(c, cmd, arg_index, 2, false,
+        CollectionType::CollectMultiResponsesByKey);
+    return;
+  }
+
+  // a blocking read goes to every backend that has one of the streams, and
+  // the client gets the first response with any entries. each backend's
+  // command has the streams on that backend followed by their ids
+  int64_t num_streams = (num_args - arg_index) / 2;
+  unordered_map<size_t, vector<int64_t>> backend_index_to_stream_indexes;
+  for (int64_t x = 0; x < num_streams; x++) {
+    backend_index_to_stream_indexes[this->backend_index_for_key(
+        cmd->args[arg_index + x])].emplace_back(arg_index + x);
+  }
+  unordered_map<size_t, ReferenceCommand> backend_index_to_command;
+  for (const auto& it : backend_index_to_stream_indexes) {
+    auto& backend_cmd = backend_index_to_command[it.first];
+    for (int64_t x = 0; x < arg_index; x++) {
+      backend_cmd.args.emplace_back(cmd->args[x]);
+    }
+    for (int64_t stream_index : it.second) {
+      backend_cmd.args.emplace_back(cmd->args[stream_index]);
+    }
+    for (int64_t stream_index : it.second) {
+      backend_cmd.args.emplace_back(cmd->args[stream_index + num_streams]);
+    }
+  }
+  this->send_blocking_commands(c, backend_index_to_command);
+}
+
+void Proxy::command_blocking_pop(Client* c, shared_ptr<DataCommand> cmd) {
+  // BLPOP, BRPOP, BZPOPMIN and BZPOPMAX all take keys followed by a timeout
+  int64_t num_args = cmd->args.size();
+  if (num_args < 3) {
+    this->send_client_string_response(c, "ERR not enough arguments",
+        Response::Type::Error);
+    return;
+  }
+  if (!this->blocking_pool_size) {
+    this->command_unimplemented(c, cmd);
+    return;
+  }
+
+  // the keys on each backend are waited on together. the proxy sends the
+  // command to all of the backends at once and forwards the first response
+  // that isn't null, then cancels the rest
+  unordered_map<size_t, ReferenceCommand> backend_index_to_command;
+  for (int64_t x = 1; x < num_args - 1; x++) {
+    if (this->replication_factor_for_key(cmd->args[x]) > 1) {
+      this->send_client_string_response(c,
+          "PROXYERROR blocking commands on replicated keys are not supported",
+          Response::Type::Error);
+      return;
+    }
+    auto& backend_cmd = backend_index_to_command[
+        this->backend_index_for_key(cmd->args[x])];
+    if (backend_cmd.args.empty()) {
+      backend_cmd.args.emplace_back(cmd->args[0]);
+    }
+    backend_cmd.args.emplace_back(cmd->args[x]);
+  }
+  for (auto& it : backend_index_to_command) {
+    it.second.args.emplace_back(cmd->args[num_args - 1]);
+  }
+  this->send_blocking_commands(c, backend_index_to_command);
+}
+
+void Proxy::command_BRPOPLPUSH(Client* c, shared_ptr<DataCommand> cmd) {
+  if (cmd->args.size() != 4) {
+    this->send_client_string_response(c, "ERR incorrect number of arguments",
+        Response::Type::Error);
+    return;
+  }
+  if (!this->blocking_pool_size) {
+    this->command_unimplemented(c, cmd);
+    return;
+  }
+  if ((this->replication_factor_for_key(cmd->args[1]) > 1) ||
+      (this->replication_factor_for_key(cmd->args[2]) > 1)) {
+    this->send_client_string_response(c,
+        "PROXYERROR blocking commands on replicated keys are not supported",
+        Response::Type::Error);
+    return;
+  }
+  int64_t backend_index = this->backend_index_for_key(cmd->args[1]);
+  if (this->backend_index_for_key(cmd->args[2]) != backend_index) {
+    this->send_client_string_response(c,
+        "PROXYERROR keys are on different backends", Response::Type::Error);
+    return;
+  }
+
+  unordered_map<size_t, ReferenceCommand> backend_index_to_command;
+  auto& backend_cmd = backend_index_to_command[backend_index];
+  for (const auto& arg : cmd->args) {
+    backend_cmd.args.emplace_back(arg);
+  }
+  this->send_blocking_commands(c, backend_index_to_command);
 }
 
 void Proxy::command_ZACTIONSTORE(Client* c, shared_ptr<DataCommand> cmd) {
@@ -2419,9 +7120,19 @@ void Proxy::command_ZACTIONSTORE(Client* c, shared_ptr<DataCommand> cmd) {
     return;
   }
 
-  // check that the keys all hash to the same server
+  // check that the keys all hash to the same server. a write to a replicated
+  // key would only reach one of its copies, so they aren't supported
   int64_t backend_index = this->backend_index_for_key(cmd->args[1]);
-  for (int64_t x = 0; x < num_keys; x++) {
+  for (int64_t x = -2; x < num_keys; x++) {
+    if (x == -1) {
+      continue; // args[2] is the key count
+    }
+    if (this->replication_factor_for_key(cmd->args[3 + x]) > 1) {
+      this->send_client_string_response(c,
+          "PROXYERROR multi-key writes to replicated keys are not supported",
+          Response::Type::Error);
+      return;
+    }
     if (this->backend_index_for_key(cmd->args[3 + x]) != backend_index) {
       this->send_client_string_response(c,
           "PROXYERROR keys are on different backends", Response::Type::Error);
@@ -2436,6 +7147,80 @@ void Proxy::command_ZACTIONSTORE(Client* c, shared_ptr<DataCommand> cmd) {
 
 
 
+bool Proxy::is_blocking_command(const DataCommand* cmd) {
+  const string& command_name = cmd->args[0];
+  if ((command_name == "BLPOP") || (command_name == "BRPOP") ||
+      (command_name == "BRPOPLPUSH") || (command_name == "BZPOPMAX") ||
+      (command_name == "BZPOPMIN")) {
+    return true;
+  }
+  if ((command_name == "XREAD") || (command_name == "XREADGROUP")) {
+    for (size_t x = 1; x < cmd->args.size(); x++) {
+      if (!strcasecmp(cmd->args[x].c_str(), "BLOCK")) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static shared_ptr<Response> subscription_response(const char* kind,
+    const string* name, size_t num_subscriptions) {
+  shared_ptr<Response> r(new Response(Response::Type::Multi, 3));
+  r->fields.emplace_back(new Response(Response::Type::Data, kind));
+  if (name) {
+    r->fields.emplace_back(new Response(Response::Type::Data, *name));
+  } else {
+    r->fields.emplace_back(new Response(Response::Type::Data, -1));
+  }
+  r->fields.emplace_back(new Response(Response::Type::Integer));
+  r->fields.back()->int_value = num_subscriptions;
+  return r;
+}
+
+void Proxy::command_subscribe(Client* c, shared_ptr<DataCommand> cmd,
+    bool pattern) {
+  if (cmd->args.size() < 2) {
+    this->send_client_string_response(c, "ERR not enough arguments",
+        Response::Type::Error);
+    return;
+  }
+
+  // like redis, send one confirmation per channel or pattern, with the
+  // client's total number of subscriptions after each one
+  const char* kind = pattern ? "psubscribe" : "subscribe";
+  for (size_t x = 1; x < cmd->args.size(); x++) {
+    this->subscribe_client(c, cmd->args[x], pattern);
+    this->send_client_push(c, subscription_response(kind, &cmd->args[x],
+        c->subscribed_channels.size() + c->subscribed_patterns.size()));
+  }
+}
+
+void Proxy::command_unsubscribe(Client* c, shared_ptr<DataCommand> cmd,
+    bool pattern) {
+  // with no arguments, unsubscribe from all channels (or patterns)
+  vector<string> names;
+  if (cmd->args.size() > 1) {
+    names.assign(cmd->args.begin() + 1, cmd->args.end());
+  } else if (pattern) {
+    names.assign(c->subscribed_patterns.begin(), c->subscribed_patterns.end());
+  } else {
+    names.assign(c->subscribed_channels.begin(), c->subscribed_channels.end());
+  }
+
+  const char* kind = pattern ? "punsubscribe" : "unsubscribe";
+  if (names.empty()) {
+    this->send_client_push(c, subscription_response(kind, NULL,
+        c->subscribed_channels.size() + c->subscribed_patterns.size()));
+    return;
+  }
+  for (const string& name : names) {
+    this->unsubscribe_client(c, name, pattern);
+    this->send_client_push(c, subscription_response(kind, &name,
+        c->subscribed_channels.size() + c->subscribed_patterns.size()));
+  }
+}
+
 uint8_t Proxy::scan_cursor_backend_index_bits() const {
   size_t backend_count = this->backends.size();
 
@@ -2452,32 +7237,16 @@ uint8_t Proxy::scan_cursor_backend_index_bits() const {
 
 const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"AUTH",              &Proxy::command_unimplemented},
-  {"BLPOP",             &Proxy::command_unimplemented},
-  {"BRPOP",             &Proxy::command_unimplemented},
-  {"BRPOPLPUSH",        &Proxy::command_unimplemented},
-  {"BZPOPMAX",          &Proxy::command_unimplemented},
-  {"BZPOPMIN",          &Proxy::command_unimplemented},
   {"CLUSTER",           &Proxy::command_unimplemented},
-  {"DISCARD",           &Proxy::command_unimplemented},
-  {"EXEC",              &Proxy::command_unimplemented},
   {"MONITOR",           &Proxy::command_unimplemented},
   {"MOVE",              &Proxy::command_unimplemented},
-  {"MULTI",             &Proxy::command_unimplemented},
-  {"PSUBSCRIBE",        &Proxy::command_unimplemented},
-  {"PUBLISH",           &Proxy::command_unimplemented},
-  {"PUBSUB",            &Proxy::command_unimplemented},
-  {"PUNSUBSCRIBE",      &Proxy::command_unimplemented},
   {"READONLY",          &Proxy::command_unimplemented},
   {"READWRITE",         &Proxy::command_unimplemented},
   {"SELECT",            &Proxy::command_unimplemented},
   {"SLAVEOF",           &Proxy::command_unimplemented},
-  {"SUBSCRIBE",         &Proxy::command_unimplemented},
   {"SWAPDB",            &Proxy::command_unimplemented},
   {"SYNC",              &Proxy::command_unimplemented},
-  {"UNSUBSCRIBE",       &Proxy::command_unimplemented},
-  {"UNWATCH",           &Proxy::command_unimplemented},
   {"WAIT",              &Proxy::command_unimplemented},
-  {"WATCH",             &Proxy::command_unimplemented},
 
   {"ACL",               &Proxy::command_ACL},
   {"APPEND",            &Proxy::command_forward_by_key_1},
@@ -2487,6 +7256,11 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"BITFIELD",          &Proxy::command_forward_by_key_1},
   {"BITOP",             &Proxy::command_forward_by_keys_2_all},
   {"BITPOS",            &Proxy::command_forward_by_key_1},
+  {"BLPOP",             &Proxy::command_blocking_pop},
+  {"BRPOP",             &Proxy::command_blocking_pop},
+  {"BRPOPLPUSH",        &Proxy::command_BRPOPLPUSH},
+  {"BZPOPMAX",          &Proxy::command_blocking_pop},
+  {"BZPOPMIN",          &Proxy::command_blocking_pop},
   {"CLIENT",            &Proxy::command_CLIENT},
   {"COMMAND",           &Proxy::command_forward_random},
   {"CONFIG",            &Proxy::command_all_collect_responses},
@@ -2495,10 +7269,12 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"DECR",              &Proxy::command_forward_by_key_1},
   {"DECRBY",            &Proxy::command_forward_by_key_1},
   {"DEL",               &Proxy::command_partition_by_keys_1_integer},
+  {"DISCARD",           &Proxy::command_DISCARD},
   {"DUMP",              &Proxy::command_forward_by_key_1},
   {"ECHO",              &Proxy::command_ECHO},
   {"EVAL",              &Proxy::command_EVAL},
   {"EVALSHA",           &Proxy::command_EVAL},
+  {"EXEC",              &Proxy::command_EXEC},
   {"EXISTS",            &Proxy::command_partition_by_keys_1_integer},
   {"EXPIRE",            &Proxy::command_forward_by_key_1},
   {"EXPIREAT",          &Proxy::command_forward_by_key_1},
@@ -2510,7 +7286,7 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"GEODIST",           &Proxy::command_forward_by_key_1},
   {"GEORADIUS",         &Proxy::command_GEORADIUS},
   {"GEORADIUSBYMEMBER", &Proxy::command_GEORADIUS},
-  {"GET",               &Proxy::command_forward_by_key_1},
+  {"GET",               &Proxy::command_GET},
   {"GETBIT",            &Proxy::command_forward_by_key_1},
   {"GETRANGE",          &Proxy::command_forward_by_key_1},
   {"GETSET",            &Proxy::command_forward_by_key_1},
@@ -2553,6 +7329,7 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"MODULE",            &Proxy::command_MODULE},
   {"MSET",              &Proxy::command_partition_by_keys_2_status},
   {"MSETNX",            &Proxy::command_MSETNX},
+  {"MULTI",             &Proxy::command_MULTI},
   {"OBJECT",            &Proxy::command_OBJECT},
   {"PERSIST",           &Proxy::command_forward_by_key_1},
   {"PEXPIRE",           &Proxy::command_forward_by_key_1},
@@ -2562,7 +7339,11 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"PFMERGE",           &Proxy::command_forward_by_keys_1_all},
   {"PING",              &Proxy::command_PING},
   {"PSETEX",            &Proxy::command_forward_by_key_1},
+  {"PSUBSCRIBE",        &Proxy::command_PSUBSCRIBE},
   {"PTTL",              &Proxy::command_forward_by_key_1},
+  {"PUBLISH",           &Proxy::command_PUBLISH},
+  {"PUBSUB",            &Proxy::command_PUBSUB},
+  {"PUNSUBSCRIBE",      &Proxy::command_PUNSUBSCRIBE},
   {"QUIT",              &Proxy::command_QUIT},
   {"RANDOMKEY",         &Proxy::command_forward_random},
   {"RENAME",            &Proxy::command_forward_by_keys_1_all},
@@ -2598,6 +7379,7 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"SREM",              &Proxy::command_forward_by_key_1},
   {"SSCAN",             &Proxy::command_forward_by_key_1},
   {"STRLEN",            &Proxy::command_forward_by_key_1},
+  {"SUBSCRIBE",         &Proxy::command_SUBSCRIBE},
   {"SUNION",            &Proxy::command_forward_by_keys_1_all},
   {"SUNIONSTORE",       &Proxy::command_forward_by_keys_1_all},
   {"TIME",              &Proxy::command_all_collect_responses},
@@ -2605,6 +7387,9 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"TTL",               &Proxy::command_forward_by_key_1},
   {"TYPE",              &Proxy::command_forward_by_key_1},
   {"UNLINK",            &Proxy::command_partition_by_keys_1_integer},
+  {"UNSUBSCRIBE",       &Proxy::command_UNSUBSCRIBE},
+  {"UNWATCH",           &Proxy::command_UNWATCH},
+  {"WATCH",             &Proxy::command_WATCH},
   {"XACK",              &Proxy::command_forward_by_key_1},
   {"XADD",              &Proxy::command_forward_by_key_1},
   {"XCLAIM",            &Proxy::command_forward_by_key_1},
@@ -2648,4 +7433,49 @@ const unordered_map<string, Proxy::command_handler> Proxy::default_handlers({
   {"BACKENDS",          &Proxy::command_BACKENDS},
   {"FORWARD",           &Proxy::command_FORWARD},
   {"PRINTSTATE",        &Proxy::command_PRINTSTATE},
+  {"ROUTE",             &Proxy::command_ROUTE},
+});
+
+const unordered_set<string> Proxy::read_only_commands({
+  "BITCOUNT", "BITPOS", "DBSIZE", "DUMP", "EXISTS", "GEODIST", "GEOHASH",
+  "GEOPOS", "GET", "GETBIT", "GETRANGE", "HEXISTS", "HGET", "HGETALL", "HKEYS",
+  "HLEN", "HMGET", "HSCAN", "HSTRLEN", "HVALS", "KEYS", "LINDEX", "LLEN",
+  "LRANGE", "MGET", "PFCOUNT", "PTTL", "RANDOMKEY", "SCAN", "SCARD", "SDIFF",
+  "SINTER", "SISMEMBER", "SMEMBERS", "SRANDMEMBER", "SSCAN", "STRLEN", "SUNION",
+  "TTL", "TYPE", "XLEN", "XPENDING", "XRANGE", "XREAD", "XREVRANGE", "ZCARD",
+  "ZCOUNT", "ZLEXCOUNT", "ZRANGE", "ZRANGEBYLEX", "ZRANGEBYSCORE", "ZRANK",
+  "ZREVRANGE", "ZREVRANGEBYLEX", "ZREVRANGEBYSCORE", "ZREVRANK", "ZSCAN",
+  "ZSCORE",
+});
+
+const unordered_set<string> Proxy::read_cache_commands({
+  "GET", "GETRANGE", "HEXISTS", "HGET", "HGETALL", "HMGET", "LRANGE",
+  "SISMEMBER", "SMEMBERS", "STRLEN", "ZRANGE", "ZSCORE",
+});
+
+const unordered_set<string> Proxy::read_cache_clearing_commands({
+  "FLUSHALL", "FLUSHDB", "FORWARD", "MIGRATE", "SWAPDB",
+});
+
+const unordered_set<string> Proxy::unspillable_commands({
+  "BLPOP", "BRPOP", "BRPOPLPUSH", "BZPOPMAX", "BZPOPMIN", "PUBLISH",
+  "XREADGROUP",
+});
+
+const unordered_set<string> Proxy::status_response_commands({
+  "HMSET", "LSET", "LTRIM", "PSETEX", "RENAME", "RESTORE", "SET", "SETEX",
+});
+
+const unordered_set<string> Proxy::priority_commands({
+  "BACKEND", "BACKENDNUM", "BACKENDS", "CLIENT", "ECHO", "INFO", "PING",
+  "PRINTSTATE", "PSUBSCRIBE", "PUNSUBSCRIBE", "QUIT", "ROLE", "ROUTE",
+  "SUBSCRIBE", "UNSUBSCRIBE",
+});
+
+const unordered_set<string> Proxy::subscribe_mode_commands({
+  "PING", "PSUBSCRIBE", "PUNSUBSCRIBE", "QUIT", "SUBSCRIBE", "UNSUBSCRIBE",
+});
+
+const unordered_set<string> Proxy::transaction_control_commands({
+  "DISCARD", "EXEC", "MULTI", "QUIT", "UNWATCH", "WATCH",
 });
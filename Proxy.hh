@@ -5,18 +5,32 @@
 
 #include <atomic>
 #include <deque>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <phosg/ConsistentHashRing.hh>
+#include <random>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "AutoEjectHashRing.hh"
+#include "ConcurrencyLimiter.hh"
+#include "HotKeySketch.hh"
+#include "LatencyHistogram.hh"
 #include "Protocol.hh"
+#include "ReadCache.hh"
+#include "RoutingOverrides.hh"
+#include "ScriptCache.hh"
+#include "SpillQueue.hh"
+#include "TimerWheel.hh"
 
 
 struct ResponseLink;
 struct Backend;
+struct Client;
 
 
 struct BackendConnection {
@@ -24,6 +38,8 @@ struct BackendConnection {
   int64_t index;
 
   std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev;
+  bool connected;
+  bool draining;
   ResponseParser parser;
 
   struct sockaddr_storage local_addr;
@@ -35,6 +51,22 @@ struct BackendConnection {
   ResponseLink* head_link;
   ResponseLink* tail_link;
 
+  // clients that aren't being read from until this connection drains
+  std::unordered_set<Client*> paused_clients;
+
+  // commands over the backend's concurrency limit, which haven't been sent
+  // yet. queued_command_sizes has the size of each command in queued_output.
+  // send_times has the time each sent (but unanswered) command was sent; it's
+  // only used if the backend has a concurrency limiter
+  std::unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> queued_output;
+  std::deque<size_t> queued_command_sizes;
+  size_t queued_bytes;
+  std::deque<uint64_t> send_times;
+
+  // true if CLIENT TRACKING has been sent on this connection, redirecting
+  // invalidations to the backend's subscriber connection
+  bool tracking;
+
   BackendConnection(Backend* backend, int64_t index,
       std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>&& bev);
   BackendConnection(const BackendConnection&) = delete;
@@ -48,6 +80,83 @@ struct BackendConnection {
   void print(FILE* stream, int indent_level = 0) const;
 };
 
+// a backend connection in subscribe mode. each thread has at most one per
+// backend, which carries all the channels and patterns that any of the
+// thread's clients are subscribed to on that backend. the backend's
+// confirmations are discarded; messages are delivered to the local subscribers
+struct SubscriberConnection {
+  Backend* backend;
+
+  std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev;
+  bool connected;
+  ResponseParser parser;
+
+  // channels and patterns that have been subscribed to on this connection
+  std::unordered_set<std::string> channels;
+  std::unordered_set<std::string> patterns;
+
+  size_t num_messages_received;
+
+  // the backend's id for this connection, which the backend's other
+  // connections redirect their invalidations to when backend tracking is
+  // enabled. it's requested when the connection is opened; -1 if it's unknown
+  int64_t client_id;
+  bool awaiting_client_id;
+
+  SubscriberConnection(Backend* backend,
+      std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>&& bev);
+  SubscriberConnection(const SubscriberConnection&) = delete;
+  SubscriberConnection(SubscriberConnection&&) = delete;
+  SubscriberConnection& operator=(const SubscriberConnection&) = delete;
+  SubscriberConnection& operator=(SubscriberConnection&&) = delete;
+  ~SubscriberConnection() = default;
+
+  void send_command(const char* command, const std::string& name);
+};
+
+// a backend connection that's leased to one blocking command at a time, so
+// blocking commands don't hold up the commands pipelined on the backend's
+// shared connections. when the command is answered, the connection goes back
+// to the backend's pool of idle connections. connections from the same pool
+// are also pinned to clients for transactions, since WATCH and MULTI state
+// belongs to the connection
+struct BlockingConnection {
+  Backend* backend;
+  int64_t index;
+
+  std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev;
+  bool connected;
+  ResponseParser parser;
+
+  // the backend's id for this connection, which CLIENT UNBLOCK needs. it's
+  // requested when the connection is opened; -1 if it's unknown
+  int64_t client_id;
+  bool awaiting_client_id;
+
+  // the link waiting for this connection's response, and the name of the
+  // command it's waiting for. a leased connection with no link has been
+  // cancelled, and is waiting for the backend to unblock it
+  bool leased;
+  ResponseLink* link;
+  std::string command_name;
+  uint64_t cancel_time;
+
+  // when the connection is pinned to a client, responses are matched to
+  // pinned_links in order (NULL entries are for commands whose responses
+  // aren't sent to the client). the connection goes back to the pool after the
+  // client unpins it and the remaining responses arrive
+  Client* pinned_client;
+  std::deque<ResponseLink*> pinned_links;
+
+  BlockingConnection(Backend* backend, int64_t index,
+      std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>&& bev);
+  BlockingConnection(const BlockingConnection&) = delete;
+  BlockingConnection(BlockingConnection&&) = delete;
+  BlockingConnection& operator=(const BlockingConnection&) = delete;
+  BlockingConnection& operator=(BlockingConnection&&) = delete;
+  ~BlockingConnection() = default;
+};
+
 struct Backend {
   size_t index;
 
@@ -62,6 +171,49 @@ struct Backend {
 
   size_t num_responses_received;
   size_t num_commands_sent;
+  size_t num_timeouts;
+  size_t num_retries;
+
+  // writes held while this backend is down. spilled_links has one entry per
+  // record in spill_queue; entries are NULL for commands that were already
+  // acknowledged (or were recovered from a previous run)
+  bool is_down;
+  std::unique_ptr<SpillQueue> spill_queue;
+  std::deque<ResponseLink*> spilled_links;
+
+  // replicas of this backend, which read-only commands can be sent to. a
+  // replica has the same index as its master and isn't in the hash ring
+  Backend* master;
+  std::vector<Backend*> replicas;
+  size_t next_replica_index;
+
+  // latencies of reads sent to this backend or its replicas, which determine
+  // when reads are hedged. only used on masters
+  LatencyHistogram read_latency;
+
+  // adaptive limit on the number of commands sent to this backend that
+  // haven't been answered yet (NULL = no limit)
+  std::unique_ptr<ConcurrencyLimiter> concurrency_limiter;
+  size_t num_concurrency_limit_rejects;
+
+  // number of times this backend was chosen for a command with no keys
+  size_t num_keyless_selections;
+
+  // this thread's subscribe-mode connection (NULL if no channels or patterns
+  // are subscribed to on this backend, or if it disconnected)
+  std::unique_ptr<SubscriberConnection> subscriber_conn;
+
+  // connections for blocking commands. idle_blocking_conns are the ones that
+  // aren't leased to a command
+  std::unordered_map<int64_t, BlockingConnection> index_to_blocking_connection;
+  int64_t next_blocking_connection_index;
+  std::vector<BlockingConnection*> idle_blocking_conns;
+  size_t num_blocking_leases;
+  size_t num_blocking_pool_exhausted;
+
+  // scripts that should be in this backend's script cache, because this
+  // thread loaded them or ran them with EVAL since it connected
+  std::unordered_set<std::string> loaded_script_shas;
 
   Backend(size_t index, const std::string& host, int port, const std::string& name);
   Backend(const Backend&) = delete;
@@ -71,6 +223,9 @@ struct Backend {
   ~Backend() = default;
 
   BackendConnection& get_default_connection();
+  BackendConnection* get_active_connection();
+  BackendConnection* get_connected_connection();
+  size_t num_pending_commands() const;
 
   void print(FILE* stream, int indent_level = 0) const;
 };
@@ -81,7 +236,12 @@ struct Client {
   std::string debug_name;
   bool should_disconnect;
 
+  // in idle mode, bev is NULL and idle_event waits for the client to send
+  // something, at which point a new bufferevent is created
+  int fd;
   std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev;
+  std::unique_ptr<struct event, void(*)(struct event*)> idle_event;
+  uint64_t last_active_time;
   CommandParser parser;
 
   struct sockaddr_storage local_addr;
@@ -93,6 +253,68 @@ struct Client {
   ResponseLink* head_link;
   ResponseLink* tail_link;
 
+  // backend connections that this client is waiting on to drain before we
+  // read more commands from it
+  std::unordered_set<BackendConnection*> paused_by_backend_conns;
+  uint64_t pause_start_time;
+
+  // when the output buffer went over the soft limit (0 if it's under)
+  uint64_t output_soft_limit_start_time;
+
+  // fair queuing state. num_pending_responses is the length of the ResponseLink
+  // chain (the number of responses the client is waiting for)
+  std::list<std::shared_ptr<DataCommand>> queued_commands;
+  int64_t deficit;
+  bool scheduled;
+  std::list<Client*>::iterator scheduled_it;
+  size_t num_pending_responses;
+
+  // when this client last sent a write to each backend that has replicas.
+  // only used if read-your-writes stickiness is enabled
+  std::unordered_map<size_t, uint64_t> backend_index_to_last_write_time;
+
+  // channels and patterns this client is subscribed to. a client with any
+  // subscriptions is in subscribe mode, and can only send (un)subscribe
+  // commands, PING and QUIT
+  std::unordered_set<std::string> subscribed_channels;
+  std::unordered_set<std::string> subscribed_patterns;
+
+  // transaction state. commands between MULTI and EXEC are checked and queued
+  // here, then sent all at once on the connection pinned to this client.
+  // WATCH pins the connection earlier. all of the keys in the transaction must
+  // be on transaction_backend_index (-1 until the first key is seen). if the
+  // pinned connection is lost while watching keys, the transaction fails as if
+  // a watched key had changed
+  bool in_transaction;
+  bool transaction_aborted;
+  bool transaction_watch_failed;
+  int64_t transaction_backend_index;
+  std::vector<std::shared_ptr<DataCommand>> transaction_commands;
+  BlockingConnection* pinned_conn;
+  uint64_t pin_start_time;
+
+  // CLIENT REPLY state. if reply_off or reply_skip is set, commands still run
+  // but their responses are discarded. replies_suppressed is only set while
+  // such a command is being handled; responses to earlier commands are still
+  // sent
+  bool reply_off;
+  bool reply_skip;
+  bool replies_suppressed;
+
+  // the id returned by CLIENT ID. the low bits are the index of the proxy
+  // thread the client is connected to
+  int64_t id;
+
+  // CLIENT TRACKING state. tracked_keys are the keys this client has read
+  // since they were last invalidated; invalidations are sent to the client
+  // with id tracking_redirect_id (which may be on another thread) as
+  // __redis__:invalidate messages. with tracking_noloop, the client's own
+  // writes don't cause invalidations
+  bool tracking;
+  bool tracking_noloop;
+  int64_t tracking_redirect_id;
+  std::unordered_set<std::string> tracked_keys;
+
   Client(std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)> bev);
   Client(const Client&) = delete;
   Client(Client&&) = delete;
@@ -101,6 +323,9 @@ struct Client {
   ~Client();
 
   struct evbuffer* get_output_buffer();
+  bool is_idle() const;
+  bool in_subscribe_mode() const;
+  size_t memory_usage() const;
 
   void print(FILE* stream, int indent_level = 0) const;
 };
@@ -143,6 +368,14 @@ struct Client {
 // linked to receive an error response, and they're unlinked from the
 // BackendConnection immediately. any ready ResponseLinks are processed (sent
 // to the client, if possible) at this time also.
+//
+// if a ResponseLink's deadline passes before it's ready, the client gets a new
+// ResponseLink containing a timeout error in its place, and the original
+// ResponseLink is unlinked from the client as if the client had disconnected.
+// it stays in the BackendConnection chains so the late responses are discarded
+// in the correct order, and those BackendConnections are marked as draining:
+// no new commands are sent on them, and they're closed as soon as they have no
+// more useful responses to receive.
 
 struct ResponseLink {
   enum class CollectionType {
@@ -156,6 +389,7 @@ struct ResponseLink {
     ModifyScanResponse,
     ModifyScriptExistsResponse,
     ModifyMigrateResponse,
+    CollectQuorumResponses,
   };
   CollectionType type;
 
@@ -163,8 +397,56 @@ struct ResponseLink {
 
   Client* client;
   ResponseLink* next_client;
+  uint64_t start_time;
+  TimerWheel::Timer deadline_timer;
   std::unordered_map<BackendConnection*, ResponseLink*> backend_conn_to_next_link;
 
+  // serialized commands that can be resent if the backend connection is lost
+  // before it responds. only read-only commands are kept here, and only until
+  // they've been retried once
+  std::unordered_map<BackendConnection*, std::string> backend_conn_to_retry_command;
+  bool retried;
+
+  // true if the command is in a backend's spill queue and hasn't been sent yet
+  bool spilled;
+
+  // true if the link was created by a command run with CLIENT REPLY OFF or
+  // SKIP, so its response is discarded instead of being sent
+  bool replies_suppressed;
+
+  // hedged reads. if hedge_command is set, the command can be sent to another
+  // replica when hedge_timer expires. hedge_conn is the connection it was sent
+  // to; while it's set, the first response from either connection is used
+  TimerWheel::Timer hedge_timer;
+  std::shared_ptr<const DataCommand> hedge_command;
+  BackendConnection* hedge_conn;
+
+  // EVALSHA for a script the proxy has the body of. if the backend returns
+  // NOSCRIPT, the script is loaded there and the command is sent again (once)
+  std::shared_ptr<const DataCommand> script_command;
+  bool script_reloaded;
+
+  // a cacheable read that missed the read cache. its response is added to the
+  // cache unless the key was written after read_cache_generation
+  std::shared_ptr<const DataCommand> read_cache_command;
+  uint64_t read_cache_generation;
+
+  // request coalescing. a read that's in flight can be joined by identical
+  // reads from other clients (coalesced_links), which get the same response
+  // instead of sending the command again. coalesced_command is set on the
+  // link that was sent to the backend; coalescing_leader is set on the links
+  // that are waiting for it
+  std::shared_ptr<const DataCommand> coalesced_command;
+  std::vector<ResponseLink*> coalesced_links;
+  ResponseLink* coalescing_leader;
+
+  // GET batching. GETs from any clients for the same backend are sent as one
+  // MGET, whose link (which has no client) has the GETs' links in
+  // batched_links, in the same order as the MGET's keys. batch_link is set on
+  // the GETs' links until the MGET's response is split between them
+  std::vector<ResponseLink*> batched_links;
+  ResponseLink* batch_link;
+
   std::shared_ptr<Response> error_response;
 
   // type-specific fields
@@ -181,6 +463,14 @@ struct ResponseLink {
 
   int64_t scan_backend_index;
 
+  // for CollectQuorumResponses, the number of successful responses needed
+  size_t quorum_size;
+
+  // for blocking commands, the leased connections that haven't responded yet.
+  // the first non-null response is sent to the client and the other
+  // connections are cancelled
+  std::unordered_set<BlockingConnection*> blocking_conns;
+
   ResponseLink(CollectionType type, Client* c);
   ResponseLink(const ResponseLink&) = delete;
   ResponseLink(ResponseLink&&) = delete;
@@ -203,8 +493,71 @@ public:
     std::atomic<size_t> num_responses_sent;
     std::atomic<size_t> num_connections_received;
     std::atomic<size_t> num_clients;
+    std::atomic<size_t> num_timeouts;
+    std::atomic<size_t> num_retries;
+    std::atomic<size_t> num_retry_failures;
+    std::atomic<size_t> num_spilled_commands;
+    std::atomic<size_t> num_replayed_commands;
+    std::atomic<size_t> num_spill_queue_full_errors;
+    std::atomic<size_t> num_replica_reads;
+    std::atomic<size_t> num_hedges_sent;
+    std::atomic<size_t> num_hedge_wins;
+    std::atomic<size_t> num_hedges_over_budget;
+    std::atomic<size_t> num_concurrency_limit_rejects;
+    std::atomic<size_t> num_replicated_reads;
+    std::atomic<size_t> num_replicated_writes;
+    std::atomic<size_t> num_pubsub_channels;
+    std::atomic<size_t> num_pubsub_patterns;
+    std::atomic<size_t> num_pubsub_messages_received;
+    std::atomic<size_t> num_pubsub_messages_sent;
+    std::atomic<size_t> num_blocking_commands;
+    std::atomic<size_t> num_blocking_leases;
+    std::atomic<size_t> num_blocking_conns_leased;
+    std::atomic<size_t> num_blocking_pool_exhausted;
+    std::atomic<size_t> num_blocking_cancels;
+    std::atomic<size_t> num_blocking_requeues;
+    std::atomic<size_t> num_transactions;
+    std::atomic<size_t> num_transactions_aborted;
+    std::atomic<size_t> num_transactions_discarded;
+    std::atomic<size_t> num_transaction_pins;
+    std::atomic<uint64_t> transaction_pin_usecs;
+    std::atomic<size_t> num_watch_timeouts;
+    std::atomic<size_t> num_suppressed_replies;
+    std::atomic<size_t> num_script_loads;
+    std::atomic<size_t> num_noscript_retries;
+    std::atomic<size_t> num_read_cache_hits;
+    std::atomic<size_t> num_read_cache_misses;
+    std::atomic<size_t> num_coalesced_commands;
+    std::atomic<size_t> num_batched_gets;
+    std::atomic<size_t> num_get_batches;
+    std::atomic<size_t> num_tracking_invalidations;
+    std::atomic<size_t> num_tracking_flushes;
+    std::atomic<size_t> num_tracking_messages_sent;
+    std::atomic<size_t> num_tracking_evictions;
+    std::atomic<size_t> num_paused_clients;
+    std::atomic<size_t> num_client_pauses;
+    std::atomic<uint64_t> client_pause_usecs;
+    std::atomic<size_t> num_disconnects_multibulk_length;
+    std::atomic<size_t> num_disconnects_bulk_length;
+    std::atomic<size_t> num_disconnects_output_hard_limit;
+    std::atomic<size_t> num_disconnects_output_soft_limit;
+    std::atomic<size_t> num_disconnects_idle_timeout;
+    std::atomic<size_t> num_rejected_connections;
+    std::atomic<size_t> num_idle_clients;
+    LatencyHistogram response_latency;
+    LatencyHistogram tracking_invalidation_lag;
     uint64_t start_time;
 
+    // the most frequently sampled keys from all threads. each thread merges
+    // its own sketch into hot_keys every second; when hot_keys covers the hot
+    // key interval, it replaces last_hot_keys (which INFO HOTKEYS shows)
+    static const size_t HOT_KEY_SKETCH_CAPACITY = 256;
+    std::mutex hot_keys_lock;
+    HotKeySketch hot_keys;
+    HotKeySketch last_hot_keys;
+    uint64_t hot_keys_start_time;
+    uint64_t last_hot_keys_usecs;
+
     Stats();
   };
 
@@ -214,6 +567,17 @@ public:
     int port;
   };
 
+  enum class ReplicaReadPolicy {
+    LeastOutstanding = 0,
+    RoundRobin,
+  };
+
+  enum class WriteAckPolicy {
+    First = 0,
+    Majority,
+    All,
+  };
+
   Proxy(int listen_fd, std::shared_ptr<const ConsistentHashRing> ring,
       int hash_begin_delimiter = -1, int hash_end_delimiter = -1,
       std::shared_ptr<Stats> stats = NULL, size_t proxy_index = 0);
@@ -224,6 +588,43 @@ public:
   ~Proxy() = default;
 
   bool disable_command(const std::string& command_name);
+  void set_auto_eject_ring(std::shared_ptr<AutoEjectHashRing> ring);
+  void set_routing_overrides(std::shared_ptr<RoutingOverrides> overrides);
+  void set_preconnect_backends(bool enabled, double ready_fraction = 0,
+      uint64_t ready_timeout_usecs = 0);
+  void set_timeouts(uint64_t read_timeout_usecs, uint64_t write_timeout_usecs,
+      uint64_t fanout_timeout_usecs);
+  void set_retry_reads(bool enabled);
+  void set_spill_queues(const std::string& filename_prefix, size_t max_size,
+      bool ack_immediately, size_t replay_rate);
+  void set_replicas(const std::unordered_map<std::string,
+        std::vector<ConsistentHashRing::Host>>& backend_name_to_replicas,
+      ReplicaReadPolicy policy, uint64_t read_your_writes_usecs);
+  void set_hedging(double percentile, double budget_percent);
+  void set_replicated_keyspace(size_t replication_factor,
+      const std::unordered_map<std::string, size_t>& key_prefix_to_replication_factor,
+      WriteAckPolicy write_ack_policy);
+  void set_concurrency_limits(size_t initial_limit, size_t min_limit,
+      size_t max_limit, double latency_tolerance, size_t max_queued_commands);
+  void set_blocking_pool_size(size_t max_connections_per_backend,
+      uint64_t watch_timeout_usecs);
+  void set_script_cache(std::shared_ptr<ScriptCache> script_cache);
+  void set_read_cache(size_t max_bytes, uint64_t ttl_usecs,
+      const std::vector<std::string>& key_prefixes);
+  void set_backend_tracking(bool enabled, size_t table_max_keys);
+  void set_coalesced_commands(const std::vector<std::string>& commands);
+  void set_get_batching(size_t max_keys, uint64_t window_usecs);
+  void set_hot_key_sampling(size_t sample_rate, uint64_t interval_usecs,
+      double alarm_rate,
+      const std::unordered_map<std::string, double>& backend_name_to_alarm_rate);
+  void set_backpressure_watermarks(size_t output_high, size_t output_low,
+      size_t pending_high, size_t pending_low);
+  void set_client_limits(int64_t max_multibulk_length, int64_t max_bulk_length,
+      size_t output_hard_limit, size_t output_soft_limit,
+      uint64_t output_soft_limit_usecs);
+  void set_fair_queuing(size_t quantum, size_t max_inflight_commands);
+  void set_idle_clients(uint64_t idle_mode_usecs, uint64_t idle_timeout_usecs,
+      size_t max_clients);
 
   void serve();
   void stop();
@@ -237,12 +638,186 @@ private:
   std::unique_ptr<struct evconnlistener, void(*)(struct evconnlistener*)> listener;
   bool should_exit;
 
+  // startup state
+  bool accepting_clients;
+  bool preconnect_backends;
+  double ready_fraction;
+  uint64_t ready_timeout_usecs;
+  uint64_t serve_start_time;
+  bool all_backends_connected;
+
+  // response deadlines (0 = no deadline)
+  uint64_t read_timeout_usecs;
+  uint64_t write_timeout_usecs;
+  uint64_t fanout_timeout_usecs;
+  TimerWheel deadlines;
+  std::unique_ptr<struct event, void(*)(struct event*)> deadline_event;
+
+  // if true, read-only commands are resent once on a new connection if their
+  // backend connection is lost before they're answered
+  bool retry_reads;
+
+  // spill queues. if enabled, writes to backends that are down are appended
+  // to per-backend spill files (and either acknowledged immediately or held
+  // until they're sent), then replayed at up to spill_replay_rate commands per
+  // second (0 = no limit) when the backend reconnects
+  bool spill_ack_immediately;
+  size_t spill_replay_rate;
+  std::unique_ptr<struct event, void(*)(struct event*)> spill_replay_event;
+
+  // replica routing. read-only commands for backends with replicas are sent to
+  // one of the replicas, unless the client wrote to the backend within the
+  // last read_your_writes_usecs (0 = never)
+  ReplicaReadPolicy replica_read_policy;
+  uint64_t read_your_writes_usecs;
+
+  // replicated keyspace. keys are stored on replication_factor consecutive
+  // backends on the ring (1 = only the usual one), or on the number given by
+  // the longest matching prefix in key_prefix_to_replication_factor. reads go
+  // to one of them; writes go to all of them, and are acknowledged according
+  // to write_ack_policy
+  size_t replication_factor;
+  std::vector<std::pair<std::string, size_t>> key_prefix_to_replication_factor;
+  WriteAckPolicy write_ack_policy;
+
+  // hedged reads. a read that hasn't been answered after the hedge_percentile
+  // latency of recent reads on its backend is sent to another replica too.
+  // each read adds hedge_budget tokens and each hedge uses one, which limits
+  // the hedges to about hedge_budget of all reads (0 = no hedging)
+  double hedge_percentile;
+  double hedge_budget;
+  double hedge_tokens;
+  uint64_t read_latency_decay_time;
+
+  // adaptive concurrency limits. each backend learns a limit on its pending
+  // commands from their round-trip times; commands over the limit wait in the
+  // proxy until earlier ones are answered, and are rejected if more than
+  // concurrency_limit_max_queued_commands are already waiting
+  size_t concurrency_limit_max_queued_commands;
+
+  // blocking commands are sent on dedicated connections, leased from a pool of
+  // up to this many per backend (0 = blocking commands aren't supported).
+  // WATCH can keep one pinned for at most watch_timeout_usecs (0 = no limit)
+  size_t blocking_pool_size;
+  uint64_t watch_timeout_usecs;
+
+  // script bodies seen in SCRIPT LOAD and EVAL, by SHA-1. they're loaded on
+  // backends that don't have them before EVALSHA is sent there, and on every
+  // backend connection when it connects. the cache is shared by all threads
+  // (its max size is 0 if scripts aren't cached)
+  std::shared_ptr<ScriptCache> script_cache;
+
+  // responses to reads of hot keys, answered without going to a backend.
+  // only keys that begin with one of read_cache_key_prefixes are cached (all
+  // keys if there are none). responses expire after read_cache_ttl_usecs, and
+  // are invalidated when this thread sees a write to their key
+  ReadCache read_cache;
+  uint64_t read_cache_ttl_usecs;
+  std::vector<std::string> read_cache_key_prefixes;
+
+  // backend tracking. if enabled, every backend connection has CLIENT
+  // TRACKING on, redirected to the backend's subscriber connection, so writes
+  // from anywhere invalidate the read cache and clients' tracked keys.
+  // invalidations for clients on other threads are published on the target
+  // thread's tracking_forward_channel. tracked_key_to_clients holds at most
+  // tracking_table_max_keys keys (0 = no limit); when it's full, keys are
+  // invalidated to make room, like redis-server's tracking-table-max-keys.
+  // local_write_times has the times of recent writes to cached keys, to
+  // measure how long their invalidations take to come back from the backend
+  bool backend_tracking;
+  size_t tracking_table_max_keys;
+  std::string tracking_forward_channel;
+  int64_t next_client_id;
+  std::unordered_map<int64_t, Client*> id_to_client;
+  std::unordered_map<std::string, std::unordered_set<Client*>> tracked_key_to_clients;
+  std::unordered_map<std::string, uint64_t> local_write_times;
+
+  // request coalescing. reads with commands in coalesced_commands join an
+  // identical read that's already in flight, if there is one. inflight_reads
+  // is keyed by the read's key, then by read_cache_variant; a write to the
+  // key removes its entries, so later reads aren't answered from before it
+  std::unordered_set<std::string> coalesced_commands;
+  std::unordered_map<std::string,
+      std::unordered_map<std::string, ResponseLink*>> inflight_reads;
+
+  // GET batching (0 = disabled). GETs are collected per backend for
+  // get_batch_window_usecs (0 = until the end of the current event loop
+  // iteration), or until there are get_batch_max_keys of them, and then sent
+  // as one MGET. pending batches are sent before any write, so the backend
+  // sees a client's reads and writes in the order they were sent
+  struct GetBatch {
+    ResponseLink* link;
+    std::shared_ptr<DataCommand> cmd;
+  };
+  size_t get_batch_max_keys;
+  uint64_t get_batch_window_usecs;
+  std::unordered_map<int64_t, GetBatch> backend_index_to_get_batch;
+  bool get_batch_flush_pending;
+  std::unique_ptr<struct event, void(*)(struct event*)> get_batch_event;
+
+  // hot key detection (0 = disabled). the routed parts of the keys of one in
+  // every hot_key_sample_rate commands are counted in hot_keys, which is merged
+  // into the shared stats every second. at the end of each interval, keys
+  // whose estimated rate (commands/sec) is at least their backend's alarm rate
+  // (0 = never) are logged
+  size_t hot_key_sample_rate;
+  size_t hot_key_sample_countdown;
+  uint64_t hot_key_interval_usecs;
+  std::vector<double> backend_index_to_hot_key_alarm_rate;
+  HotKeySketch hot_keys;
+
+  // backpressure watermarks (0 = no limit). output is the number of bytes in
+  // a backend connection's output buffer; pending is the number of commands
+  // that haven't received responses yet
+  size_t backend_output_high_watermark;
+  size_t backend_output_low_watermark;
+  size_t backend_pending_high_watermark;
+  size_t backend_pending_low_watermark;
+
+  // client limits (0 = no limit for the output buffer limits)
+  int64_t client_max_multibulk_length;
+  int64_t client_max_bulk_length;
+  size_t client_output_hard_limit;
+  size_t client_output_soft_limit;
+  uint64_t client_output_soft_limit_usecs;
+
+  // fair queuing. if the quantum is nonzero, commands are queued per client
+  // and dispatched to the backends in deficit round-robin order
+  size_t fair_queue_quantum;
+  size_t client_max_inflight_commands;
+  std::list<Client*> scheduled_clients;
+  bool fair_queue_run_pending;
+  std::unique_ptr<struct event, void(*)(struct event*)> fair_queue_event;
+
+  // idle clients (0 = disabled). max_clients applies to all threads in this
+  // proxy instance; when it's reached, each thread stops accepting
+  // connections until a client disconnects
+  uint64_t client_idle_mode_usecs;
+  uint64_t client_idle_timeout_usecs;
+  size_t max_clients;
+  bool accepts_throttled;
+
   // connection indexing and lookup
   std::shared_ptr<const ConsistentHashRing> ring;
+  std::shared_ptr<AutoEjectHashRing> auto_eject_ring;
+  // keys pinned to specific backends. the table is shared by all threads;
+  // each thread keeps its own copy (with names resolved to indexes) and only
+  // refreshes it when the shared version changes, so lookups don't lock
+  std::shared_ptr<RoutingOverrides> routing_overrides;
+  mutable std::unordered_map<std::string, int64_t> key_to_backend_override;
+  mutable uint64_t routing_overrides_version;
   std::vector<Backend*> backends;
   std::unordered_map<std::string, Backend*> name_to_backend;
   std::unordered_map<struct bufferevent*, BackendConnection*> bev_to_backend_conn;
-  std::unordered_map<struct bufferevent*, Client> bev_to_client;
+  std::unordered_map<int, Client> fd_to_client;
+
+  // pub/sub. each channel with local subscribers is subscribed to on the
+  // backend the ring maps it to (which is where PUBLISH sends it), and each
+  // pattern is subscribed to on all backends
+  std::unordered_map<std::string, std::unordered_set<Client*>> channel_to_clients;
+  std::unordered_map<std::string, std::unordered_set<Client*>> pattern_to_clients;
+  std::unordered_map<struct bufferevent*, SubscriberConnection*> bev_to_subscriber_conn;
+  std::unordered_map<struct bufferevent*, BlockingConnection*> bev_to_blocking_conn;
 
   // stats
   size_t proxy_index;
@@ -252,23 +827,177 @@ private:
   int hash_begin_delimiter;
   int hash_end_delimiter;
 
+  // commands with no keys go to the less-loaded of two random backends. each
+  // thread has its own generator, so choosing one doesn't take a lock
+  std::minstd_rand rng;
+
   // backend lookups
+  const char* hashed_part_of_key(const std::string& s, size_t* size) const;
+  int64_t backend_override_for_key(const std::string& s, const char* data,
+      size_t size) const;
   int64_t backend_index_for_key(const std::string& s) const;
+  std::vector<uint64_t> backend_indexes_for_key(const std::string& s,
+      size_t count) const;
+  size_t replication_factor_for_key(const std::string& s) const;
   int64_t backend_index_for_argument(const std::string& arg) const;
   Backend& backend_for_index(size_t index);
+  size_t backend_index_for_keyless_command();
   Backend& backend_for_key(const std::string& s);
   BackendConnection& backend_conn_for_index(size_t index);
   BackendConnection& backend_conn_for_key(const std::string& s);
 
   // connection management
+  BackendConnection& connect_backend(Backend& b);
+  void connect_all_backends();
+  size_t num_connected_backends() const;
+  void check_ready_to_accept(bool timed_out);
+  std::unique_ptr<struct bufferevent, void(*)(struct bufferevent*)>
+      create_client_bev(int fd);
   void disconnect_client(Client* c);
+  void disconnect_client_later(Client* c);
+  void check_client_output_limits(Client* c);
   void disconnect_backend(BackendConnection* b);
+  void count_backend_response(BackendConnection* conn, const ResponseLink* l);
+
+  // backpressure
+  bool backend_conn_above_high_watermark(BackendConnection* conn);
+  bool backend_conn_below_low_watermark(BackendConnection* conn);
+  void pause_client(Client* c, BackendConnection* conn);
+  void resume_paused_clients(BackendConnection* conn);
+  void unpause_client(Client* c);
+
+  // concurrency limits
+  size_t backend_conn_in_flight(const BackendConnection* conn) const;
+  struct evbuffer* backend_conn_command_buffer(BackendConnection* conn);
+  void send_queued_commands(BackendConnection* conn);
+
+  // pub/sub
+  SubscriberConnection* subscriber_conn_for_backend(Backend& b);
+  void disconnect_subscriber(SubscriberConnection* conn);
+  void subscribe_upstream(Backend& b, const std::string& name, bool pattern);
+  void unsubscribe_upstream(Backend& b, const std::string& name, bool pattern);
+  bool subscribe_client(Client* c, const std::string& name, bool pattern);
+  bool unsubscribe_client(Client* c, const std::string& name, bool pattern);
+  void sync_subscriptions();
+  void sync_channel_subscription(const std::string& channel);
+  void send_client_push(Client* c, std::shared_ptr<Response> r);
+  void handle_subscriber_message(SubscriberConnection* conn,
+      std::shared_ptr<Response> r);
+
+  // blocking commands
+  BlockingConnection* lease_blocking_conn(Backend& b);
+  void release_blocking_conn(BlockingConnection* conn);
+  void disconnect_blocking_conn(BlockingConnection* conn);
+  void send_blocking_commands(Client* c,
+      std::unordered_map<size_t, ReferenceCommand>& backend_index_to_command);
+  void cancel_blocking_conn(BlockingConnection* conn);
+  void cancel_blocking_link(ResponseLink* l);
+  void requeue_blocking_response(Backend* b, const std::string& command_name,
+      std::shared_ptr<Response> r);
+  void send_background_command(Backend& b, const ReferenceCommand* cmd);
+  void send_background_command(BackendConnection* conn,
+      const ReferenceCommand* cmd);
+  void handle_blocking_response(BlockingConnection* conn,
+      std::shared_ptr<Response> r);
+  void handle_pinned_response(BlockingConnection* conn,
+      std::shared_ptr<Response> r);
+
+  // script cache
+  void load_script(BackendConnection* conn, const std::string& sha,
+      const std::string& body);
+  void preload_scripts(BackendConnection* conn);
+  bool retry_script_command(BackendConnection* conn, ResponseLink* l,
+      const std::shared_ptr<Response>& r);
+
+  // hot keys
+  void sample_hot_keys(const DataCommand* cmd);
+  void merge_hot_keys();
+  double hot_key_rate(uint64_t count, uint64_t interval_usecs) const;
+
+  // read cache
+  bool is_read_cacheable(const DataCommand* cmd) const;
+  bool send_cached_response(Client* c, const DataCommand* cmd);
+  void invalidate_read_cache(Client* c, const DataCommand* cmd);
+  void fill_read_cache(ResponseLink* l, const std::shared_ptr<Response>& r);
+
+  // request coalescing
+  bool is_coalescable(const DataCommand* cmd) const;
+  bool join_inflight_read(Client* c, const DataCommand* cmd);
+  void start_coalescing(ResponseLink* l, std::shared_ptr<const DataCommand> cmd);
+  void end_coalescing(ResponseLink* l);
+  void send_coalesced_responses(ResponseLink* l,
+      const std::shared_ptr<Response>& r);
+
+  // GET batching
+  bool batch_get(Client* c, const DataCommand* cmd);
+  void send_get_batch(int64_t backend_index);
+  void send_get_batches();
+  void send_batched_responses(ResponseLink* l,
+      const std::shared_ptr<Response>& r);
+
+  // backend tracking and CLIENT TRACKING
+  void enable_backend_tracking(BackendConnection* conn);
+  void handle_tracking_invalidation(const std::shared_ptr<Response>& keys);
+  void handle_forwarded_invalidation(const std::string& data);
+  void invalidate_key(Client* writer, const std::string& key);
+  void invalidate_tracked_key(Client* writer, const std::string& key);
+  void flush_tracking();
+  void track_client_keys(Client* c, const DataCommand* cmd);
+  void stop_client_tracking(Client* c);
+  void send_tracking_invalidation(Client* c, const std::string* key);
+  void deliver_tracking_invalidation(int64_t target_id, const std::string* key);
+
+  // transactions
+  std::vector<size_t> key_arg_indexes(const DataCommand* cmd) const;
+  BlockingConnection* pin_transaction_conn(Client* c, int64_t backend_index);
+  void unpin_transaction_conn(Client* c, bool unwatch);
+  void send_pinned_command(BlockingConnection* conn, ResponseLink* l,
+      const DataCommand* cmd);
+  void queue_transaction_command(Client* c, std::shared_ptr<DataCommand> cmd);
+  void reset_transaction(Client* c);
+
+  // fair queuing
+  size_t client_max_queued_commands() const;
+  bool can_read_commands(const Client* c) const;
+  void resume_reading(Client* c);
+  void enqueue_client_command(Client* c, std::shared_ptr<DataCommand> cmd);
+  void schedule_client(Client* c);
+
+  // idle clients
+  bool can_enter_idle_mode(const Client* c) const;
+  void enter_idle_mode(Client* c);
+  void leave_idle_mode(Client* c);
+  void update_accept_throttling();
 
   // response linking
   ResponseLink* create_link(ResponseLink::CollectionType type, Client* c);
   ResponseLink* create_error_link(Client* c, std::shared_ptr<Response> r);
   struct evbuffer* can_send_command(BackendConnection* conn, ResponseLink* l);
   void link_connection(BackendConnection* conn, ResponseLink* l);
+  void save_retry_command(BackendConnection* conn, ResponseLink* l,
+      struct evbuffer* out, size_t start_offset);
+  bool is_retryable_link(BackendConnection* conn, const ResponseLink* l) const;
+  void retry_read_only_links(BackendConnection* conn);
+  bool should_spill_command(Backend* b, ResponseLink* l,
+      const DataCommand* cmd);
+  void spill_command(Backend* b, ResponseLink* l, const DataCommand* cmd);
+  bool can_ack_spilled_command(const DataCommand* cmd) const;
+  BackendConnection* route_command(BackendConnection* conn, ResponseLink* l,
+      bool read_only);
+  bool should_read_from_master(Client* c, size_t backend_index);
+  void unlink_backend_conn(BackendConnection* conn, ResponseLink* prev_l,
+      ResponseLink* l);
+  void replace_backend_conn_link(BackendConnection* conn, ResponseLink* l,
+      ResponseLink* new_l);
+  void start_hedge_timer(ResponseLink* l, const std::shared_ptr<DataCommand>& cmd);
+  void send_hedge(ResponseLink* l);
+  void finish_hedged_link(ResponseLink* l, BackendConnection* conn);
+  void abandon_backend_conns(ResponseLink* l);
+  void send_replicated_command(Client* c, std::shared_ptr<DataCommand> cmd,
+      const std::vector<uint64_t>& backend_indexes);
+  void check_quorum(ResponseLink* l);
+  void start_deadline(ResponseLink* l, const DataCommand* cmd);
+  void expire_link(ResponseLink* l);
   void send_command_and_link(BackendConnection* conn, ResponseLink* l,
       const DataCommand* cmd);
   void send_command_and_link(BackendConnection* conn, ResponseLink* l,
@@ -295,6 +1024,8 @@ private:
   void handle_backend_response(BackendConnection* conn,
       std::shared_ptr<Response> r);
   void handle_client_command(Client* c, std::shared_ptr<DataCommand> cmd);
+  void run_client_command(Client* c, std::shared_ptr<DataCommand> cmd);
+  void detach_client_links(Client* c, ResponseLink* after_l);
 
   // low-level input handlers
   static void dispatch_on_client_input(struct bufferevent *bev, void* ctx);
@@ -302,11 +1033,26 @@ private:
   static void dispatch_on_client_error(struct bufferevent *bev, short events,
       void* ctx);
   void on_client_error(struct bufferevent *bev, short events);
+  static void dispatch_on_idle_client_input(evutil_socket_t fd, short what,
+      void* ctx);
+  void on_idle_client_input(evutil_socket_t fd, short what);
   static void dispatch_on_backend_input(struct bufferevent *bev, void* ctx);
   void on_backend_input(struct bufferevent *bev);
+  static void dispatch_on_backend_output(struct bufferevent *bev, void* ctx);
+  void on_backend_output(struct bufferevent *bev);
   static void dispatch_on_backend_error(struct bufferevent *bev, short events,
       void* ctx);
   void on_backend_error(struct bufferevent *bev, short events);
+  static void dispatch_on_subscriber_input(struct bufferevent *bev, void* ctx);
+  void on_subscriber_input(struct bufferevent *bev);
+  static void dispatch_on_subscriber_error(struct bufferevent *bev,
+      short events, void* ctx);
+  void on_subscriber_error(struct bufferevent *bev, short events);
+  static void dispatch_on_blocking_input(struct bufferevent *bev, void* ctx);
+  void on_blocking_input(struct bufferevent *bev);
+  static void dispatch_on_blocking_error(struct bufferevent *bev,
+      short events, void* ctx);
+  void on_blocking_error(struct bufferevent *bev, short events);
   static void dispatch_on_listen_error(struct evconnlistener *listener,
       void* ctx);
   void on_listen_error(struct evconnlistener *listener);
@@ -319,6 +1065,23 @@ private:
   static void dispatch_check_for_thread_exit(evutil_socket_t fd, short what,
       void* ctx);
   void check_for_thread_exit(evutil_socket_t fd, short what);
+  static void dispatch_check_backends(evutil_socket_t fd, short what,
+      void* ctx);
+  void check_backends(evutil_socket_t fd, short what);
+  static void dispatch_check_deadlines(evutil_socket_t fd, short what,
+      void* ctx);
+  void check_deadlines(evutil_socket_t fd, short what);
+  static void dispatch_check_clients(evutil_socket_t fd, short what,
+      void* ctx);
+  void check_clients(evutil_socket_t fd, short what);
+  static void dispatch_run_fair_queue(evutil_socket_t fd, short what,
+      void* ctx);
+  void run_fair_queue(evutil_socket_t fd, short what);
+  static void dispatch_replay_spilled_commands(evutil_socket_t fd, short what,
+      void* ctx);
+  void replay_spilled_commands(evutil_socket_t fd, short what);
+  static void dispatch_send_get_batches(evutil_socket_t fd, short what,
+      void* ctx);
 
   // generic command implementations
   void command_all_collect_responses(Client* c,
@@ -357,12 +1120,16 @@ private:
   void command_BACKEND(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_BACKENDNUM(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_BACKENDS(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_BRPOPLPUSH(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_CLIENT(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_DBSIZE(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_DEBUG(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_DISCARD(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_ECHO(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_EVAL(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_EXEC(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_FORWARD(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_GET(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_GEORADIUS(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_INFO(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_KEYS(Client* c, std::shared_ptr<DataCommand> cmd);
@@ -371,13 +1138,23 @@ private:
   void command_MIGRATE(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_MODULE(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_MSETNX(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_MULTI(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_OBJECT(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_PING(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_PRINTSTATE(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_PSUBSCRIBE(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_PUBLISH(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_PUBSUB(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_PUNSUBSCRIBE(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_QUIT(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_ROLE(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_ROUTE(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_SCAN(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_SCRIPT(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_SUBSCRIBE(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_UNSUBSCRIBE(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_UNWATCH(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_WATCH(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_XGROUP(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_XINFO(Client* c, std::shared_ptr<DataCommand> cmd);
   void command_XREAD(Client* c, std::shared_ptr<DataCommand> cmd);
@@ -385,6 +1162,12 @@ private:
 
   // helpers for command implementations
   uint8_t scan_cursor_backend_index_bits() const;
+  static bool is_blocking_command(const DataCommand* cmd);
+  void command_blocking_pop(Client* c, std::shared_ptr<DataCommand> cmd);
+  void command_subscribe(Client* c, std::shared_ptr<DataCommand> cmd,
+      bool pattern);
+  void command_unsubscribe(Client* c, std::shared_ptr<DataCommand> cmd,
+      bool pattern);
 
   // handler index
   typedef void (Proxy::*command_handler)(Client* c,
@@ -392,4 +1175,33 @@ private:
   std::unordered_map<std::string, command_handler> handlers;
   static const std::unordered_map<std::string, command_handler>
       default_handlers;
+
+  // commands that never modify the keyspace
+  static const std::unordered_set<std::string> read_only_commands;
+
+  // reads whose responses can be kept in the read cache. they all have a
+  // single key in arg 1
+  static const std::unordered_set<std::string> read_cache_commands;
+
+  // writes that can affect any key, which clear the read cache
+  static const std::unordered_set<std::string> read_cache_clearing_commands;
+
+  // write commands that are never spilled, since their responses can't be
+  // faked or delayed
+  static const std::unordered_set<std::string> unspillable_commands;
+
+  // write commands whose response is always +OK if they succeed. with
+  // spill_ack_immediately, only these are acknowledged before being replayed
+  static const std::unordered_set<std::string> status_response_commands;
+
+  // commands that are answered by the proxy (or are cheap administrative
+  // commands) and skip the fair queue
+  static const std::unordered_set<std::string> priority_commands;
+
+  // commands that clients in subscribe mode are allowed to send
+  static const std::unordered_set<std::string> subscribe_mode_commands;
+
+  // commands that are run immediately between MULTI and EXEC instead of being
+  // queued
+  static const std::unordered_set<std::string> transaction_control_commands;
 };
@@ -0,0 +1,242 @@
+#include "ReadCache.hh"
+
+#include <functional>
+
+using namespace std;
+
+
+
+ReadCache::ReadCache(size_t max_bytes) : max_total_bytes(max_bytes),
+    total_bytes(0), small_queue_bytes(0), entries(), small_queue(),
+    main_queue(), ghost_queue(), ghost_keys(),
+    generations(NUM_GENERATION_SLOTS, 0), evictions(0), expirations(0),
+    invalidations(0) { }
+
+shared_ptr<Response> ReadCache::get(const string& key, const string& variant,
+    uint64_t now) {
+  auto entry_it = this->entries.find(key);
+  if (entry_it == this->entries.end()) {
+    return NULL;
+  }
+  Entry* e = &entry_it->second;
+  auto variant_it = e->variants.find(variant);
+  if (variant_it == e->variants.end()) {
+    return NULL;
+  }
+
+  if (variant_it->second.expire_time <= now) {
+    size_t size = variant_it->second.size + variant.size() + VARIANT_OVERHEAD;
+    e->variants.erase(variant_it);
+    e->size -= size;
+    this->total_bytes -= size;
+    if (!e->in_main_queue) {
+      this->small_queue_bytes -= size;
+    }
+    if (e->variants.empty()) {
+      this->erase(e);
+    }
+    this->expirations++;
+    return NULL;
+  }
+
+  if (e->frequency < MAX_FREQUENCY) {
+    e->frequency++;
+  }
+  return variant_it->second.value;
+}
+
+uint64_t ReadCache::generation(const string& key) const {
+  return this->generations[this->generation_slot(key)];
+}
+
+bool ReadCache::put(const string& key, const string& variant,
+    shared_ptr<Response> value, size_t size, uint64_t expire_time,
+    uint64_t generation) {
+  if (generation != this->generation(key)) {
+    return false;
+  }
+  size_t variant_size = size + variant.size() + VARIANT_OVERHEAD;
+  if (key.size() + ENTRY_OVERHEAD + variant_size > this->max_total_bytes) {
+    return false;
+  }
+
+  auto entry_it = this->entries.find(key);
+  Entry* e;
+  if (entry_it == this->entries.end()) {
+    // keys that were evicted recently go directly to the main queue
+    auto emplace_ret = this->entries.emplace(key, Entry());
+    e = &emplace_ret.first->second;
+    e->key = &emplace_ret.first->first;
+    e->size = key.size() + ENTRY_OVERHEAD;
+    e->frequency = 0;
+    auto ghost_it = this->ghost_keys.find(key);
+    if (ghost_it != this->ghost_keys.end()) {
+      this->ghost_queue.erase(ghost_it->second);
+      this->ghost_keys.erase(ghost_it);
+      e->in_main_queue = true;
+      e->queue_it = this->main_queue.emplace(this->main_queue.begin(), e);
+    } else {
+      e->in_main_queue = false;
+      e->queue_it = this->small_queue.emplace(this->small_queue.begin(), e);
+      this->small_queue_bytes += e->size;
+    }
+    this->total_bytes += e->size;
+
+  } else {
+    e = &entry_it->second;
+    auto variant_it = e->variants.find(variant);
+    if (variant_it != e->variants.end()) {
+      size_t old_size = variant_it->second.size + variant.size() +
+          VARIANT_OVERHEAD;
+      e->variants.erase(variant_it);
+      e->size -= old_size;
+      this->total_bytes -= old_size;
+      if (!e->in_main_queue) {
+        this->small_queue_bytes -= old_size;
+      }
+    }
+  }
+
+  Variant& v = e->variants[variant];
+  v.value = value;
+  v.size = size;
+  v.expire_time = expire_time;
+  e->size += variant_size;
+  this->total_bytes += variant_size;
+  if (!e->in_main_queue) {
+    this->small_queue_bytes += variant_size;
+  }
+
+  while (this->total_bytes > this->max_total_bytes) {
+    this->evict_one();
+  }
+  return true;
+}
+
+bool ReadCache::invalidate(const string& key) {
+  this->generations[this->generation_slot(key)]++;
+  auto entry_it = this->entries.find(key);
+  if (entry_it == this->entries.end()) {
+    return false;
+  }
+  this->erase(&entry_it->second);
+  this->invalidations++;
+  return true;
+}
+
+void ReadCache::clear() {
+  for (auto& generation : this->generations) {
+    generation++;
+  }
+  this->invalidations += this->entries.size();
+  this->small_queue.clear();
+  this->main_queue.clear();
+  this->ghost_queue.clear();
+  this->ghost_keys.clear();
+  this->entries.clear();
+  this->total_bytes = 0;
+  this->small_queue_bytes = 0;
+}
+
+void ReadCache::set_max_bytes(size_t max_bytes) {
+  this->max_total_bytes = max_bytes;
+  while (this->total_bytes > this->max_total_bytes) {
+    this->evict_one();
+  }
+}
+
+size_t ReadCache::max_bytes() const {
+  return this->max_total_bytes;
+}
+
+size_t ReadCache::bytes() const {
+  return this->total_bytes;
+}
+
+size_t ReadCache::size() const {
+  return this->entries.size();
+}
+
+size_t ReadCache::num_evictions() const {
+  return this->evictions;
+}
+
+size_t ReadCache::num_expirations() const {
+  return this->expirations;
+}
+
+size_t ReadCache::num_invalidations() const {
+  return this->invalidations;
+}
+
+size_t ReadCache::generation_slot(const string& key) const {
+  return hash<string>()(key) % NUM_GENERATION_SLOTS;
+}
+
+void ReadCache::erase(Entry* e) {
+  if (e->in_main_queue) {
+    this->main_queue.erase(e->queue_it);
+  } else {
+    this->small_queue.erase(e->queue_it);
+    this->small_queue_bytes -= e->size;
+  }
+  this->total_bytes -= e->size;
+  this->entries.erase(*e->key);
+}
+
+void ReadCache::add_ghost(const string& key) {
+  // the ghost queue remembers about as many keys as the cache holds
+  auto emplace_ret = this->ghost_keys.emplace(key, this->ghost_queue.end());
+  if (!emplace_ret.second) {
+    return;
+  }
+  emplace_ret.first->second = this->ghost_queue.emplace(
+      this->ghost_queue.begin(), key);
+  while (this->ghost_keys.size() > this->entries.size() + 1) {
+    this->ghost_keys.erase(this->ghost_queue.back());
+    this->ghost_queue.pop_back();
+  }
+}
+
+void ReadCache::evict_one() {
+  // evict from the small queue if it's over its share of the cache (or if
+  // there's nothing else to evict)
+  if (!this->small_queue.empty() &&
+      ((this->small_queue_bytes > this->max_total_bytes / 10) ||
+       this->main_queue.empty())) {
+    Entry* e = this->small_queue.back();
+    this->small_queue.pop_back();
+    this->small_queue_bytes -= e->size;
+
+    // keys that were read more than once in the small queue are promoted
+    if (e->frequency > 1) {
+      e->frequency = 0;
+      e->in_main_queue = true;
+      e->queue_it = this->main_queue.emplace(this->main_queue.begin(), e);
+      return;
+    }
+
+    string key = *e->key;
+    this->total_bytes -= e->size;
+    this->entries.erase(key);
+    this->add_ghost(key);
+    this->evictions++;
+    return;
+  }
+
+  // keys in the main queue that were read since they were last at the end of
+  // the queue get another pass through it
+  for (;;) {
+    Entry* e = this->main_queue.back();
+    this->main_queue.pop_back();
+    if (e->frequency > 0) {
+      e->frequency--;
+      e->queue_it = this->main_queue.emplace(this->main_queue.begin(), e);
+      continue;
+    }
+    this->total_bytes -= e->size;
+    this->entries.erase(*e->key);
+    this->evictions++;
+    return;
+  }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Protocol.hh"
+
+
+// a memory-bounded cache of read responses, keyed by redis key. each key can
+// have several cached responses ("variants"), one for each distinct read of
+// that key (e.g. HGET with different fields), so that a write to the key can
+// invalidate all of them at once. each variant has its own expiration time.
+//
+// eviction follows S3-FIFO: new keys go into a small FIFO queue that holds
+// about 10% of the cache's bytes. keys that are read more than once while in
+// the small queue are moved to the main queue when they reach its end; the
+// others are evicted, but are remembered in a ghost queue (without their
+// responses) so they go directly to the main queue if they're inserted again
+// soon. keys at the end of the main queue are reinserted at its beginning if
+// they've been read since the last time they were there, and evicted
+// otherwise.
+//
+// responses that were requested from a backend before a write to the same key
+// was seen must not be inserted after it; callers get a generation number
+// before sending the read and pass it to put(), which ignores the response if
+// the key may have been invalidated since then.
+//
+// the cache isn't thread-safe; each proxy thread has its own.
+
+class ReadCache {
+public:
+  explicit ReadCache(size_t max_bytes = 0);
+  ReadCache(const ReadCache&) = delete;
+  ReadCache(ReadCache&&) = delete;
+  ReadCache& operator=(const ReadCache&) = delete;
+  ReadCache& operator=(ReadCache&&) = delete;
+  ~ReadCache() = default;
+
+  // returns the cached response, or NULL if there isn't one or it expired
+  std::shared_ptr<Response> get(const std::string& key,
+      const std::string& variant, uint64_t now);
+
+  // returns the current generation number for the given key
+  uint64_t generation(const std::string& key) const;
+
+  // adds a response to the cache. size is the response's approximate memory
+  // usage. returns false if the response wasn't added because the key was
+  // invalidated after the given generation or the response is too large.
+  bool put(const std::string& key, const std::string& variant,
+      std::shared_ptr<Response> value, size_t size, uint64_t expire_time,
+      uint64_t generation);
+
+  // removes all responses for the given key and prevents responses requested
+  // before now from being added for it. returns true if any were removed
+  bool invalidate(const std::string& key);
+  void clear();
+
+  void set_max_bytes(size_t max_bytes);
+  size_t max_bytes() const;
+  size_t bytes() const;
+  size_t size() const;
+
+  size_t num_evictions() const;
+  size_t num_expirations() const;
+  size_t num_invalidations() const;
+
+private:
+  // rough per-object overhead of the containers, so caches of many small
+  // responses don't use much more memory than max_bytes
+  static const size_t ENTRY_OVERHEAD = 128;
+  static const size_t VARIANT_OVERHEAD = 64;
+  static const size_t NUM_GENERATION_SLOTS = 1024;
+  static const uint8_t MAX_FREQUENCY = 3;
+
+  struct Variant {
+    std::shared_ptr<Response> value;
+    size_t size;
+    uint64_t expire_time;
+  };
+
+  struct Entry {
+    const std::string* key;
+    std::unordered_map<std::string, Variant> variants;
+    size_t size;
+    uint8_t frequency;
+    bool in_main_queue;
+    std::list<Entry*>::iterator queue_it;
+  };
+
+  size_t max_total_bytes;
+  size_t total_bytes;
+  size_t small_queue_bytes;
+
+  std::unordered_map<std::string, Entry> entries;
+  std::list<Entry*> small_queue; // newest at front
+  std::list<Entry*> main_queue; // newest at front
+  std::list<std::string> ghost_queue; // newest at front
+  std::unordered_map<std::string, std::list<std::string>::iterator> ghost_keys;
+
+  // generations are tracked per hash slot rather than per key, so they don't
+  // take any memory for keys that aren't cached. a write to a different key in
+  // the same slot only prevents a response from being cached, which is safe
+  std::vector<uint64_t> generations;
+
+  size_t evictions;
+  size_t expirations;
+  size_t invalidations;
+
+  size_t generation_slot(const std::string& key) const;
+  void erase(Entry* e);
+  void add_ghost(const std::string& key);
+  void evict_one();
+};
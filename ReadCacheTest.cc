@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <memory>
+#include <phosg/Strings.hh>
+#include <phosg/UnitTest.hh>
+#include <string>
+
+#include "Protocol.hh"
+#include "ReadCache.hh"
+
+using namespace std;
+
+
+static shared_ptr<Response> data_response(const string& data) {
+  return shared_ptr<Response>(new Response(Response::Type::Data, data));
+}
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- responses are returned until they expire\n");
+
+    ReadCache cache(100000);
+    expect(!cache.get("k", "GET", 1000).get());
+    expect(cache.put("k", "GET", data_response("v"), 100, 2000,
+        cache.generation("k")));
+    expect_eq(cache.size(), 1);
+    auto r = cache.get("k", "GET", 1000);
+    expect(r.get());
+    expect_eq(r->data, "v");
+    expect(!cache.get("k", "STRLEN", 1000).get());
+
+    expect(!cache.get("k", "GET", 2000).get());
+    expect_eq(cache.num_expirations(), 1);
+    expect_eq(cache.size(), 0);
+    expect_eq(cache.bytes(), 0);
+  }
+
+  {
+    printf("-- invalidation removes all variants of a key\n");
+
+    ReadCache cache(100000);
+    expect(cache.put("h", "HGET f1", data_response("1"), 100, 2000,
+        cache.generation("h")));
+    expect(cache.put("h", "HGET f2", data_response("2"), 100, 2000,
+        cache.generation("h")));
+    expect(cache.put("other", "GET", data_response("3"), 100, 2000,
+        cache.generation("other")));
+    expect_eq(cache.get("h", "HGET f2", 1000)->data, "2");
+
+    expect(cache.invalidate("h"));
+    expect(!cache.invalidate("h"));
+    expect(!cache.get("h", "HGET f1", 1000).get());
+    expect(!cache.get("h", "HGET f2", 1000).get());
+    expect_eq(cache.get("other", "GET", 1000)->data, "3");
+    expect_eq(cache.num_invalidations(), 1);
+
+    cache.clear();
+    expect_eq(cache.size(), 0);
+    expect_eq(cache.bytes(), 0);
+  }
+
+  {
+    printf("-- responses requested before an invalidation aren\'t cached\n");
+
+    ReadCache cache(100000);
+    uint64_t generation = cache.generation("k");
+    cache.invalidate("k");
+    expect(!cache.put("k", "GET", data_response("old"), 100, 2000,
+        generation));
+    expect(!cache.get("k", "GET", 1000).get());
+
+    generation = cache.generation("k");
+    cache.clear();
+    expect(!cache.put("k", "GET", data_response("old"), 100, 2000,
+        generation));
+
+    // responses that are larger than the whole cache aren't cached either
+    expect(!cache.put("k", "GET", data_response("big"), 200000, 2000,
+        cache.generation("k")));
+  }
+
+  {
+    printf("-- memory usage is bounded, and frequently-read keys survive scans\n");
+
+    ReadCache cache(3000);
+    expect(cache.put("hot", "GET", data_response("h"), 100, 1000000,
+        cache.generation("hot")));
+    expect(cache.get("hot", "GET", 1000).get());
+    expect(cache.get("hot", "GET", 1000).get());
+
+    for (size_t x = 0; x < 100; x++) {
+      string key = string_printf("cold%zu", x);
+      expect(cache.put(key, "GET", data_response(key), 100, 1000000,
+          cache.generation(key)));
+      expect_le(cache.bytes(), 3000);
+    }
+    expect(cache.get("hot", "GET", 1000).get());
+    expect(!cache.get("cold0", "GET", 1000).get());
+    expect(cache.get("cold99", "GET", 1000).get());
+    expect_gt(cache.num_evictions(), 0);
+
+    cache.set_max_bytes(500);
+    expect_le(cache.bytes(), 500);
+    cache.set_max_bytes(0);
+    expect_eq(cache.size(), 0);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
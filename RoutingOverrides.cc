@@ -0,0 +1,42 @@
+#include "RoutingOverrides.hh"
+
+using namespace std;
+
+
+
+RoutingOverrides::RoutingOverrides() : lock(), key_to_backend_name(),
+    current_version(0) { }
+
+void RoutingOverrides::set(const string& key, const string& backend_name) {
+  lock_guard<mutex> g(this->lock);
+  this->key_to_backend_name[key] = backend_name;
+  this->current_version++;
+}
+
+bool RoutingOverrides::erase(const string& key) {
+  lock_guard<mutex> g(this->lock);
+  if (!this->key_to_backend_name.erase(key)) {
+    return false;
+  }
+  this->current_version++;
+  return true;
+}
+
+void RoutingOverrides::clear() {
+  lock_guard<mutex> g(this->lock);
+  this->key_to_backend_name.clear();
+  this->current_version++;
+}
+
+unordered_map<string, string> RoutingOverrides::get_all(
+    uint64_t* version) const {
+  lock_guard<mutex> g(this->lock);
+  if (version) {
+    *version = this->current_version;
+  }
+  return this->key_to_backend_name;
+}
+
+uint64_t RoutingOverrides::version() const {
+  return this->current_version.load(memory_order_acquire);
+}
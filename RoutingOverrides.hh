@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+// a table of keys (or hashed parts of keys) that are pinned to specific
+// backends, overriding the hash ring. it's shared by all proxy threads and
+// can be changed at any time; each change increments the version, so threads
+// can cheaply check whether their own copy of the table is current.
+
+class RoutingOverrides {
+public:
+  RoutingOverrides();
+  RoutingOverrides(const RoutingOverrides&) = delete;
+  RoutingOverrides(RoutingOverrides&&) = delete;
+  RoutingOverrides& operator=(const RoutingOverrides&) = delete;
+  RoutingOverrides& operator=(RoutingOverrides&&) = delete;
+  ~RoutingOverrides() = default;
+
+  void set(const std::string& key, const std::string& backend_name);
+  // returns true if the key was in the table
+  bool erase(const std::string& key);
+  void clear();
+
+  // returns a copy of the table. if version isn't NULL, it's set to the
+  // version that the copy corresponds to
+  std::unordered_map<std::string, std::string> get_all(
+      uint64_t* version = NULL) const;
+
+  uint64_t version() const;
+
+private:
+  mutable std::mutex lock;
+  std::unordered_map<std::string, std::string> key_to_backend_name;
+  std::atomic<uint64_t> current_version;
+};
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/UnitTest.hh>
+#include <string>
+
+#include "RoutingOverrides.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- changes are visible and increment the version\n");
+
+    RoutingOverrides overrides;
+    uint64_t version;
+    expect_eq(overrides.get_all(&version).size(), 0);
+    expect_eq(version, overrides.version());
+
+    overrides.set("hot", "big-backend");
+    overrides.set("{user:1000}", "other-backend");
+    expect_gt(overrides.version(), version);
+    auto table = overrides.get_all(&version);
+    expect_eq(version, overrides.version());
+    expect_eq(table.size(), 2);
+    expect_eq(table.at("hot"), "big-backend");
+
+    overrides.set("hot", "other-backend");
+    expect_eq(overrides.get_all().at("hot"), "other-backend");
+  }
+
+  {
+    printf("-- erasing missing keys doesn\'t change the version\n");
+
+    RoutingOverrides overrides;
+    overrides.set("hot", "big-backend");
+    uint64_t version = overrides.version();
+    expect(!overrides.erase("cold"));
+    expect_eq(overrides.version(), version);
+    expect(overrides.erase("hot"));
+    expect_gt(overrides.version(), version);
+    expect_eq(overrides.get_all().size(), 0);
+
+    overrides.set("a", "b");
+    overrides.clear();
+    expect_eq(overrides.get_all().size(), 0);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
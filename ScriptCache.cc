@@ -0,0 +1,63 @@
+#include "ScriptCache.hh"
+
+#include "Sha1.hh"
+
+using namespace std;
+
+
+
+ScriptCache::ScriptCache(size_t max_size) : lock(), max_scripts(max_size),
+    lru(), sha_to_entry() { }
+
+string ScriptCache::add(const string& body) {
+  string sha = sha1_hex(body);
+  if (!this->max_scripts) {
+    return sha;
+  }
+
+  lock_guard<mutex> g(this->lock);
+  auto it = this->sha_to_entry.find(sha);
+  if (it != this->sha_to_entry.end()) {
+    this->lru.splice(this->lru.begin(), this->lru, it->second);
+    return sha;
+  }
+
+  while (this->lru.size() >= this->max_scripts) {
+    this->sha_to_entry.erase(this->lru.back().first);
+    this->lru.pop_back();
+  }
+  this->lru.emplace_front(sha, body);
+  this->sha_to_entry.emplace(sha, this->lru.begin());
+  return sha;
+}
+
+bool ScriptCache::get(const string& sha, string* body) {
+  lock_guard<mutex> g(this->lock);
+  auto it = this->sha_to_entry.find(sha);
+  if (it == this->sha_to_entry.end()) {
+    return false;
+  }
+  this->lru.splice(this->lru.begin(), this->lru, it->second);
+  *body = it->second->second;
+  return true;
+}
+
+vector<pair<string, string>> ScriptCache::get_all() const {
+  lock_guard<mutex> g(this->lock);
+  return vector<pair<string, string>>(this->lru.begin(), this->lru.end());
+}
+
+void ScriptCache::clear() {
+  lock_guard<mutex> g(this->lock);
+  this->sha_to_entry.clear();
+  this->lru.clear();
+}
+
+size_t ScriptCache::size() const {
+  lock_guard<mutex> g(this->lock);
+  return this->lru.size();
+}
+
+size_t ScriptCache::max_size() const {
+  return this->max_scripts;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// script bodies by SHA-1, shared by all proxy threads so that a script seen in
+// EVAL or SCRIPT LOAD on one thread can be loaded on a backend by another. at
+// most max_size scripts are kept; when the cache is full, adding a script
+// evicts the one that was least recently added or looked up. scripts are
+// added rarely (usually once each), so a single lock is enough.
+
+class ScriptCache {
+public:
+  explicit ScriptCache(size_t max_size);
+  ScriptCache(const ScriptCache&) = delete;
+  ScriptCache(ScriptCache&&) = delete;
+  ScriptCache& operator=(const ScriptCache&) = delete;
+  ScriptCache& operator=(ScriptCache&&) = delete;
+  ~ScriptCache() = default;
+
+  // adds a script (or marks it as recently used if it's already cached) and
+  // returns its SHA-1. if max_size is 0, nothing is cached
+  std::string add(const std::string& body);
+
+  // looks up a script by its (lowercase) SHA-1. returns false if it isn't
+  // cached
+  bool get(const std::string& sha, std::string* body);
+
+  // returns all cached scripts as (sha, body) pairs, most recently used first
+  std::vector<std::pair<std::string, std::string>> get_all() const;
+
+  void clear();
+
+  size_t size() const;
+  size_t max_size() const;
+
+private:
+  mutable std::mutex lock;
+  size_t max_scripts;
+
+  // most recently used first
+  std::list<std::pair<std::string, std::string>> lru;
+  std::unordered_map<std::string,
+      std::list<std::pair<std::string, std::string>>::iterator> sha_to_entry;
+};
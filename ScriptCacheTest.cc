@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/UnitTest.hh>
+#include <string>
+
+#include "ScriptCache.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- scripts are found by their SHA-1\n");
+
+    ScriptCache cache(4);
+    string sha = cache.add("return 1");
+    expect_eq(sha, "e0e1f9fabfc9d4800c877a703b823ac0578ff8db");
+    expect_eq(cache.add("return 1"), sha);
+    expect_eq(cache.size(), 1);
+
+    string body;
+    expect(cache.get(sha, &body));
+    expect_eq(body, "return 1");
+    expect(!cache.get("0000000000000000000000000000000000000000", &body));
+
+    cache.clear();
+    expect_eq(cache.size(), 0);
+    expect(!cache.get(sha, &body));
+  }
+
+  {
+    printf("-- the least recently used script is evicted\n");
+
+    ScriptCache cache(2);
+    string sha1 = cache.add("return 1");
+    string sha2 = cache.add("return 2");
+    string body;
+    expect(cache.get(sha1, &body));
+    string sha3 = cache.add("return 3");
+    expect_eq(cache.size(), 2);
+    expect(cache.get(sha1, &body));
+    expect(!cache.get(sha2, &body));
+    expect(cache.get(sha3, &body));
+
+    auto all = cache.get_all();
+    expect_eq(all.size(), 2);
+    expect_eq(all[0].first, sha3);
+    expect_eq(all[1].first, sha1);
+    expect_eq(all[1].second, "return 1");
+
+    // a cache with no capacity keeps nothing
+    ScriptCache empty(0);
+    empty.add("return 1");
+    expect_eq(empty.size(), 0);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
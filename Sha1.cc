@@ -0,0 +1,97 @@
+#include "Sha1.hh"
+
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+
+
+static inline uint32_t rotate_left(uint32_t x, uint8_t bits) {
+  return (x << bits) | (x >> (32 - bits));
+}
+
+static void sha1_process_block(uint32_t* state, const uint8_t* block) {
+  uint32_t w[80];
+  for (size_t x = 0; x < 16; x++) {
+    w[x] = (static_cast<uint32_t>(block[x * 4]) << 24) |
+        (static_cast<uint32_t>(block[x * 4 + 1]) << 16) |
+        (static_cast<uint32_t>(block[x * 4 + 2]) << 8) |
+        static_cast<uint32_t>(block[x * 4 + 3]);
+  }
+  for (size_t x = 16; x < 80; x++) {
+    w[x] = rotate_left(w[x - 3] ^ w[x - 8] ^ w[x - 14] ^ w[x - 16], 1);
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+      e = state[4];
+  for (size_t x = 0; x < 80; x++) {
+    uint32_t f, k;
+    if (x < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (x < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (x < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    uint32_t temp = rotate_left(a, 5) + f + e + k + w[x];
+    e = d;
+    d = c;
+    c = rotate_left(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+string sha1_hex(const void* data, size_t size) {
+  uint32_t state[5] = {
+      0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  size_t offset = 0;
+  for (; offset + 64 <= size; offset += 64) {
+    sha1_process_block(state, bytes + offset);
+  }
+
+  // the last block(s) contain the remaining data, a 1 bit, zeroes, and the
+  // length of the data in bits
+  uint8_t tail[128];
+  size_t tail_size = size - offset;
+  memcpy(tail, bytes + offset, tail_size);
+  tail[tail_size] = 0x80;
+  size_t padded_size = (tail_size + 9 <= 64) ? 64 : 128;
+  memset(tail + tail_size + 1, 0, padded_size - tail_size - 1);
+  uint64_t bit_size = static_cast<uint64_t>(size) * 8;
+  for (size_t x = 0; x < 8; x++) {
+    tail[padded_size - 1 - x] = (bit_size >> (x * 8)) & 0xFF;
+  }
+  for (size_t x = 0; x < padded_size; x += 64) {
+    sha1_process_block(state, tail + x);
+  }
+
+  static const char* hex_digits = "0123456789abcdef";
+  string ret;
+  ret.reserve(40);
+  for (size_t x = 0; x < 5; x++) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      ret.push_back(hex_digits[(state[x] >> shift) & 0x0F]);
+    }
+  }
+  return ret;
+}
+
+string sha1_hex(const string& data) {
+  return sha1_hex(data.data(), data.size());
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+
+
+// computes the SHA-1 digest of the given data and returns it as 40 lowercase
+// hex characters. this is how redis-server names scripts in its script cache,
+// so the proxy uses it to match EVALSHA commands to script bodies it has seen.
+
+std::string sha1_hex(const void* data, size_t size);
+std::string sha1_hex(const std::string& data);
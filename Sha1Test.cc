@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/UnitTest.hh>
+#include <string>
+
+#include "Sha1.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- known digests\n");
+
+    expect_eq(sha1_hex(""), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    expect_eq(sha1_hex("abc"), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    expect_eq(sha1_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+        "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+
+    // redis-server's name for this script (as returned by SCRIPT LOAD)
+    expect_eq(sha1_hex("return 1"), "e0e1f9fabfc9d4800c877a703b823ac0578ff8db");
+  }
+
+  {
+    printf("-- data lengths around the block boundaries\n");
+
+    // 55 bytes fits in one padded block; 56 bytes needs two
+    expect_eq(sha1_hex(string(55, 'a')),
+        "c1c8bbdc22796e28c0e15163d20899b65621d65a");
+    expect_eq(sha1_hex(string(56, 'a')),
+        "c2db330f6083854c99d4b5bfb6e8f29f201be699");
+    expect_eq(sha1_hex(string(64, 'a')),
+        "0098ba824b5c16427bd7a1122a5a442a25ec644d");
+    expect_eq(sha1_hex(string(1000000, 'a')),
+        "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}
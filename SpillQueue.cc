@@ -0,0 +1,175 @@
+#include "SpillQueue.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <phosg/Strings.hh>
+#include <stdexcept>
+
+using namespace std;
+
+
+static const uint64_t SPILL_QUEUE_MAGIC = 0x5350494C4C510001; // 'SPILLQ' v1
+
+
+
+SpillQueue::SpillQueue(const string& filename, size_t max_size) :
+    filename(filename), fd(-1), file_size(max_size + sizeof(Header)),
+    data(NULL), header(NULL) {
+  this->fd = open(this->filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (this->fd < 0) {
+    throw runtime_error(string_printf("can\'t open spill file %s (%s)",
+        this->filename.c_str(), string_for_error(errno).c_str()));
+  }
+
+  // if the file already contains a queue, recover its records. they're moved
+  // to the beginning of the file first, since the file may be getting smaller
+  struct stat st;
+  if (fstat(this->fd, &st)) {
+    int error = errno;
+    close(this->fd);
+    throw runtime_error(string_printf("can\'t stat spill file %s (%s)",
+        this->filename.c_str(), string_for_error(error).c_str()));
+  }
+  size_t existing_size = st.st_size;
+
+  Header existing;
+  bool recover = (existing_size >= sizeof(Header)) &&
+      (pread(this->fd, &existing, sizeof(Header), 0) == sizeof(Header)) &&
+      (existing.magic == SPILL_QUEUE_MAGIC) &&
+      (existing.read_offset >= sizeof(Header)) &&
+      (existing.read_offset <= existing.write_offset) &&
+      (existing.write_offset <= existing_size);
+  if (recover && (existing.write_offset - existing.read_offset > max_size)) {
+    close(this->fd);
+    throw runtime_error(string_printf(
+        "spill file %s contains more data than its maximum size allows",
+        this->filename.c_str()));
+  }
+
+  size_t map_size = (recover && (existing_size > this->file_size)) ?
+      existing_size : this->file_size;
+  for (;;) {
+    if (ftruncate(this->fd, map_size)) {
+      int error = errno;
+      close(this->fd);
+      throw runtime_error(string_printf("can\'t resize spill file %s (%s)",
+          this->filename.c_str(), string_for_error(error).c_str()));
+    }
+    void* data = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        this->fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      close(this->fd);
+      throw runtime_error(string_printf("can\'t map spill file %s (%s)",
+          this->filename.c_str(), string_for_error(error).c_str()));
+    }
+    this->data = reinterpret_cast<uint8_t*>(data);
+    this->header = reinterpret_cast<Header*>(data);
+
+    if (!recover) {
+      this->header->magic = SPILL_QUEUE_MAGIC;
+      this->header->read_offset = sizeof(Header);
+      this->header->write_offset = sizeof(Header);
+      this->header->num_records = 0;
+    } else if (this->header->read_offset > sizeof(Header)) {
+      size_t bytes = this->bytes();
+      memmove(this->data + sizeof(Header),
+          this->data + this->header->read_offset, bytes);
+      this->header->read_offset = sizeof(Header);
+      this->header->write_offset = sizeof(Header) + bytes;
+    }
+
+    if (map_size == this->file_size) {
+      break;
+    }
+
+    // the old file was larger; now that the records are at the beginning,
+    // shrink it and map it again
+    munmap(this->data, map_size);
+    map_size = this->file_size;
+    recover = true;
+  }
+}
+
+SpillQueue::~SpillQueue() {
+  munmap(this->data, this->file_size);
+  close(this->fd);
+}
+
+bool SpillQueue::push(const void* data, size_t size) {
+  if (size > UINT32_MAX) {
+    return false;
+  }
+  size_t record_size = sizeof(uint32_t) + size;
+
+  // if the record doesn't fit after the last record, move the records to the
+  // beginning of the file to reclaim the space used by consumed records
+  if (this->header->write_offset + record_size > this->file_size) {
+    size_t bytes = this->bytes();
+    if (sizeof(Header) + bytes + record_size > this->file_size) {
+      return false;
+    }
+    memmove(this->data + sizeof(Header),
+        this->data + this->header->read_offset, bytes);
+    this->header->read_offset = sizeof(Header);
+    this->header->write_offset = sizeof(Header) + bytes;
+  }
+
+  // write the record before updating the header, so a partially-written
+  // record is never visible if the process crashes
+  uint32_t size32 = size;
+  uint8_t* record = this->data + this->header->write_offset;
+  memcpy(record, &size32, sizeof(uint32_t));
+  memcpy(record + sizeof(uint32_t), data, size);
+  this->header->write_offset += record_size;
+  this->header->num_records++;
+  return true;
+}
+
+const void* SpillQueue::front(size_t* size) const {
+  if (!this->header->num_records) {
+    throw out_of_range("spill queue is empty");
+  }
+  const uint8_t* record = this->data + this->header->read_offset;
+  uint32_t size32;
+  memcpy(&size32, record, sizeof(uint32_t));
+  *size = size32;
+  return record + sizeof(uint32_t);
+}
+
+void SpillQueue::pop() {
+  size_t size;
+  this->front(&size);
+  this->header->num_records--;
+  if (!this->header->num_records) {
+    this->header->read_offset = sizeof(Header);
+    this->header->write_offset = sizeof(Header);
+  } else {
+    this->header->read_offset += sizeof(uint32_t) + size;
+  }
+}
+
+bool SpillQueue::empty() const {
+  return !this->header->num_records;
+}
+
+size_t SpillQueue::size() const {
+  return this->header->num_records;
+}
+
+size_t SpillQueue::bytes() const {
+  return this->header->write_offset - this->header->read_offset;
+}
+
+size_t SpillQueue::max_bytes() const {
+  return this->file_size - sizeof(Header);
+}
+
+const string& SpillQueue::get_filename() const {
+  return this->filename;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+
+// a bounded FIFO queue of byte strings stored in a memory-mapped file. records
+// are appended after the last record and consumed from the front; the file's
+// header says where the unconsumed records are, so if the process exits while
+// the queue isn't empty, the records are recovered when the file is opened
+// again. the file is allocated at its maximum size when it's opened. space
+// freed by consumed records is reused when the queue becomes empty, or when
+// a record doesn't fit at the end of the file.
+//
+// the file is never explicitly synced, so records survive the process exiting
+// or crashing, but not necessarily the machine crashing.
+
+class SpillQueue {
+public:
+  SpillQueue(const std::string& filename, size_t max_size);
+  SpillQueue(const SpillQueue&) = delete;
+  SpillQueue(SpillQueue&&) = delete;
+  SpillQueue& operator=(const SpillQueue&) = delete;
+  SpillQueue& operator=(SpillQueue&&) = delete;
+  ~SpillQueue();
+
+  // appends a record to the end of the queue. returns false (and doesn't
+  // change the queue) if there isn't enough space in the file.
+  bool push(const void* data, size_t size);
+
+  // returns the record at the front of the queue. the queue must not be empty.
+  // the returned pointer is valid until the next call to push() or pop().
+  const void* front(size_t* size) const;
+  void pop();
+
+  bool empty() const;
+  size_t size() const;
+  size_t bytes() const;
+  size_t max_bytes() const;
+  const std::string& get_filename() const;
+
+private:
+  struct Header {
+    uint64_t magic;
+    uint64_t read_offset;
+    uint64_t write_offset;
+    uint64_t num_records;
+  };
+
+  std::string filename;
+  int fd;
+  size_t file_size;
+  uint8_t* data;
+  Header* header;
+};
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <phosg/Strings.hh>
+#include <phosg/UnitTest.hh>
+#include <stdexcept>
+#include <string>
+
+#include "SpillQueue.hh"
+
+using namespace std;
+
+
+static string front_str(const SpillQueue& q) {
+  size_t size;
+  const void* data = q.front(&size);
+  return string(reinterpret_cast<const char*>(data), size);
+}
+
+
+int main(int argc, char* argv[]) {
+  string filename = string_printf("SpillQueueTest-%d.spill", getpid());
+
+  {
+    printf("-- records come out in the order they went in\n");
+
+    SpillQueue q(filename, 1024);
+    expect(q.empty());
+    expect(q.push("SET x 1", 7));
+    expect(q.push("", 0));
+    expect(q.push("INCR y", 6));
+    expect_eq(q.size(), 3);
+    expect_eq(q.bytes(), 7 + 0 + 6 + 3 * sizeof(uint32_t));
+
+    expect_eq(front_str(q), "SET x 1");
+    q.pop();
+    expect_eq(front_str(q), "");
+    q.pop();
+    expect_eq(front_str(q), "INCR y");
+    q.pop();
+    expect(q.empty());
+    expect_eq(q.bytes(), 0);
+    try {
+      q.pop();
+      expect(false);
+    } catch (const out_of_range& e) { }
+  }
+
+  {
+    printf("-- the queue is bounded, and consumed space is reused\n");
+
+    SpillQueue q(filename, 100);
+    string record(46, 'x'); // 50 bytes with the size field
+    expect(q.push(record.data(), record.size()));
+    expect(q.push(record.data(), record.size()));
+    expect(!q.push("y", 1));
+    expect_eq(q.size(), 2);
+
+    // after the first record is consumed, there's room at the beginning of the
+    // file for another one
+    q.pop();
+    expect(q.push("z", 1));
+    expect_eq(q.size(), 2);
+    expect_eq(front_str(q), record);
+    q.pop();
+    expect_eq(front_str(q), "z");
+    q.pop();
+    expect(q.empty());
+  }
+
+  {
+    printf("-- records are recovered when the file is opened again\n");
+
+    {
+      SpillQueue q(filename, 1024);
+      expect(q.push("first", 5));
+      expect(q.push("second", 6));
+      expect(q.push("third", 5));
+      q.pop();
+    }
+    {
+      // the file can shrink if the remaining records still fit
+      SpillQueue q(filename, 32);
+      expect_eq(q.size(), 2);
+      expect_eq(front_str(q), "second");
+      q.pop();
+      expect_eq(front_str(q), "third");
+    }
+    try {
+      SpillQueue q(filename, 4);
+      expect(false);
+    } catch (const runtime_error& e) { }
+  }
+
+  unlink(filename.c_str());
+
+  printf("all tests passed\n");
+  return 0;
+}
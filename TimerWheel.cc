@@ -0,0 +1,168 @@
+#include "TimerWheel.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+
+
+TimerWheel::Timer::Timer() : ctx(NULL), wheel(NULL), prev(NULL), next(NULL),
+    expire_tick(0) { }
+
+TimerWheel::Timer::~Timer() {
+  this->cancel();
+}
+
+bool TimerWheel::Timer::is_scheduled() const {
+  return this->wheel;
+}
+
+void TimerWheel::Timer::cancel() {
+  if (this->wheel) {
+    this->wheel->num_timers--;
+    TimerWheel::unlink(this);
+  }
+}
+
+
+
+TimerWheel::TimerWheel(uint64_t tick_usecs, uint64_t start_time) :
+    tick_usecs(tick_usecs), start_time(start_time), current_tick(0),
+    num_timers(0) {
+  if (this->tick_usecs == 0) {
+    throw invalid_argument("tick length must be nonzero");
+  }
+  for (size_t level = 0; level < NUM_LEVELS; level++) {
+    for (size_t x = 0; x < LEVEL_SLOTS; x++) {
+      Timer* sentinel = &this->slots[level][x];
+      sentinel->prev = sentinel;
+      sentinel->next = sentinel;
+    }
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  // unschedule all remaining timers so they don't point to a deleted wheel
+  for (size_t level = 0; level < NUM_LEVELS; level++) {
+    for (size_t x = 0; x < LEVEL_SLOTS; x++) {
+      Timer* sentinel = &this->slots[level][x];
+      while (sentinel->next != sentinel) {
+        unlink(sentinel->next);
+      }
+      sentinel->prev = NULL;
+      sentinel->next = NULL;
+    }
+  }
+}
+
+void TimerWheel::schedule(Timer* t, uint64_t expire_time) {
+  t->cancel();
+
+  uint64_t expire_tick = (expire_time > this->start_time) ?
+      ((expire_time - this->start_time + this->tick_usecs - 1) / this->tick_usecs) : 0;
+  // timers that are already expired fire on the next tick
+  t->expire_tick = (expire_tick < this->current_tick) ?
+      this->current_tick : expire_tick;
+  t->wheel = this;
+  this->num_timers++;
+  this->link(t);
+}
+
+size_t TimerWheel::advance(uint64_t time, function<void(Timer*)> fn) {
+  if (time < this->start_time) {
+    return 0;
+  }
+  uint64_t target_tick = (time - this->start_time) / this->tick_usecs;
+
+  size_t num_expired = 0;
+  while (this->current_tick <= target_tick) {
+    // if there are no timers, there's nothing to cascade or expire
+    if (!this->num_timers) {
+      this->current_tick = target_tick + 1;
+      break;
+    }
+
+    // if we've wrapped around level 0, move the timers from the next slot of
+    // level 1 down; if that also wrapped around, do the same for level 2, etc.
+    size_t index = this->current_tick & LEVEL_MASK;
+    for (size_t level = 1; (index == 0) && (level < NUM_LEVELS); level++) {
+      index = (this->current_tick >> (level * LEVEL_BITS)) & LEVEL_MASK;
+      this->cascade(level);
+    }
+
+    Timer* sentinel = &this->slots[0][this->current_tick & LEVEL_MASK];
+    this->current_tick++;
+
+    // fn may cancel any timer, including other timers in this slot, so take
+    // them off the list one at a time
+    while (sentinel->next != sentinel) {
+      Timer* t = sentinel->next;
+      this->num_timers--;
+      unlink(t);
+      num_expired++;
+      fn(t);
+    }
+  }
+
+  return num_expired;
+}
+
+size_t TimerWheel::size() const {
+  return this->num_timers;
+}
+
+uint64_t TimerWheel::get_tick_usecs() const {
+  return this->tick_usecs;
+}
+
+void TimerWheel::link(Timer* t) {
+  uint64_t delta = t->expire_tick - this->current_tick;
+
+  Timer* sentinel;
+  if (delta < (1ULL << LEVEL_BITS)) {
+    sentinel = &this->slots[0][t->expire_tick & LEVEL_MASK];
+  } else if (delta < (1ULL << (2 * LEVEL_BITS))) {
+    sentinel = &this->slots[1][(t->expire_tick >> LEVEL_BITS) & LEVEL_MASK];
+  } else if (delta < (1ULL << (3 * LEVEL_BITS))) {
+    sentinel = &this->slots[2][(t->expire_tick >> (2 * LEVEL_BITS)) & LEVEL_MASK];
+  } else {
+    // clamp timers that are too far in the future to the end of the wheel
+    if (delta >= (1ULL << (4 * LEVEL_BITS))) {
+      t->expire_tick = this->current_tick + (1ULL << (4 * LEVEL_BITS)) - 1;
+    }
+    sentinel = &this->slots[3][(t->expire_tick >> (3 * LEVEL_BITS)) & LEVEL_MASK];
+  }
+
+  t->prev = sentinel->prev;
+  t->next = sentinel;
+  sentinel->prev->next = t;
+  sentinel->prev = t;
+}
+
+void TimerWheel::unlink(Timer* t) {
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->prev = NULL;
+  t->next = NULL;
+  t->wheel = NULL;
+}
+
+void TimerWheel::cascade(size_t level) {
+  size_t index = (this->current_tick >> (level * LEVEL_BITS)) & LEVEL_MASK;
+  Timer* sentinel = &this->slots[level][index];
+  if (sentinel->next == sentinel) {
+    return;
+  }
+
+  // detach the whole list first, since link() may put timers back into this
+  // same slot (if they're still far enough away)
+  Timer* t = sentinel->next;
+  sentinel->prev->next = NULL;
+  sentinel->next = sentinel;
+  sentinel->prev = sentinel;
+  while (t) {
+    Timer* next = t->next;
+    this->link(t);
+    t = next;
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+
+// a hierarchical timer wheel, similar to the one in older Linux kernels. timers
+// are intrusive (they're embedded in the objects they belong to), so
+// scheduling and canceling a timer are O(1) and don't allocate memory. the
+// wheel doesn't have its own clock; the owner calls advance() periodically
+// (usually from a libevent timer) and the wheel calls the expiration callback
+// for all timers that have expired since the last call.
+//
+// the wheel has four levels of 64 slots each. level 0 has one slot per tick;
+// each higher level has one slot per 64 slots of the level below it. timers in
+// higher levels are moved ("cascaded") to lower levels as their expiration
+// time approaches. timers farther in the future than the wheel can represent
+// (2^24 ticks) expire at the end of the last level instead.
+
+class TimerWheel {
+public:
+  class Timer {
+  public:
+    Timer();
+    Timer(const Timer&) = delete;
+    Timer(Timer&&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    Timer& operator=(Timer&&) = delete;
+    ~Timer();
+
+    bool is_scheduled() const;
+    void cancel();
+
+    void* ctx;
+
+  private:
+    friend class TimerWheel;
+
+    TimerWheel* wheel;
+    Timer* prev;
+    Timer* next;
+    uint64_t expire_tick;
+  };
+
+  TimerWheel(uint64_t tick_usecs, uint64_t start_time);
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel(TimerWheel&&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+  TimerWheel& operator=(TimerWheel&&) = delete;
+  ~TimerWheel();
+
+  // schedules (or reschedules) t to expire at the given time. the time is in
+  // the same units as start_time (usually usecs).
+  void schedule(Timer* t, uint64_t expire_time);
+
+  // calls fn for every timer that has expired as of the given time. expired
+  // timers are unscheduled before fn is called, so fn may reschedule them or
+  // cancel any other timer. returns the number of expired timers.
+  size_t advance(uint64_t time, std::function<void(Timer*)> fn);
+
+  size_t size() const;
+  uint64_t get_tick_usecs() const;
+
+private:
+  static const uint8_t LEVEL_BITS = 6;
+  static const size_t LEVEL_SLOTS = (1 << LEVEL_BITS);
+  static const uint64_t LEVEL_MASK = LEVEL_SLOTS - 1;
+  static const size_t NUM_LEVELS = 4;
+
+  uint64_t tick_usecs;
+  uint64_t start_time;
+  uint64_t current_tick;
+  size_t num_timers;
+
+  // each slot is the sentinel of a circular doubly-linked list
+  Timer slots[NUM_LEVELS][LEVEL_SLOTS];
+
+  void link(Timer* t);
+  static void unlink(Timer* t);
+  void cascade(size_t level);
+};
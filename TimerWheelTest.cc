@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <phosg/UnitTest.hh>
+#include <vector>
+
+#include "TimerWheel.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+  {
+    printf("-- timers expire in order at the right times\n");
+
+    TimerWheel w(1000, 0); // 1ms ticks
+    vector<TimerWheel::Timer> timers(5);
+    vector<uint64_t> expire_times = {500, 63000, 64000, 5000000, 300000000};
+    for (size_t x = 0; x < timers.size(); x++) {
+      timers[x].ctx = reinterpret_cast<void*>(x);
+      w.schedule(&timers[x], expire_times[x]);
+    }
+    expect_eq(w.size(), 5);
+
+    vector<size_t> expired;
+    auto fn = [&](TimerWheel::Timer* t) {
+      expired.emplace_back(reinterpret_cast<size_t>(t->ctx));
+    };
+
+    expect_eq(w.advance(0, fn), 0);
+    expect_eq(w.advance(1000, fn), 1);
+    expect_eq(w.advance(62000, fn), 0);
+    expect_eq(w.advance(63000, fn), 1);
+    expect_eq(w.advance(64000, fn), 1);
+    expect_eq(w.advance(4999000, fn), 0);
+    expect_eq(w.advance(5000000, fn), 1);
+    expect_eq(w.advance(299999000, fn), 0);
+    expect_eq(w.advance(300000000, fn), 1);
+    expect_eq(w.size(), 0);
+
+    expect_eq(expired.size(), 5);
+    for (size_t x = 0; x < expired.size(); x++) {
+      expect_eq(expired[x], x);
+      expect(!timers[x].is_scheduled());
+    }
+  }
+
+  {
+    printf("-- canceled and destroyed timers don\'t expire\n");
+
+    TimerWheel w(1000, 0);
+    TimerWheel::Timer t1, t2;
+    w.schedule(&t1, 10000);
+    w.schedule(&t2, 10000);
+    {
+      TimerWheel::Timer t3;
+      w.schedule(&t3, 10000);
+      expect_eq(w.size(), 3);
+    }
+    expect_eq(w.size(), 2);
+    t1.cancel();
+    expect_eq(w.size(), 1);
+
+    size_t num_expired = 0;
+    expect_eq(w.advance(20000, [&](TimerWheel::Timer* t) {
+      expect_eq(t, &t2);
+      num_expired++;
+    }), 1);
+    expect_eq(num_expired, 1);
+  }
+
+  {
+    printf("-- expiration callback can cancel and reschedule timers\n");
+
+    TimerWheel w(1000, 0);
+    TimerWheel::Timer t1, t2;
+    w.schedule(&t1, 5000);
+    w.schedule(&t2, 5000);
+
+    size_t num_expired = 0;
+    w.advance(5000, [&](TimerWheel::Timer* t) {
+      num_expired++;
+      (t == &t1) ? t2.cancel() : t1.cancel();
+      w.schedule(t, 7000);
+    });
+    expect_eq(num_expired, 1);
+    expect_eq(w.size(), 1);
+    expect_eq(w.advance(7000, [&](TimerWheel::Timer* t) { }), 1);
+  }
+
+  printf("all tests passed\n");
+  return 0;
+}